@@ -13,7 +13,7 @@ public:
 protected:
     void handleClient(windgent::Socket::ptr client) {
         LOG_INFO(g_logger) << "Welcome client: " << *client;
-        windgent::ByteArray::ptr ba(new windgent::ByteArray);
+        windgent::ByteArray::ptr ba = windgent::ByteArray::Create();
         while(true) {
             ba->clear();
             std::vector<iovec> iovs;
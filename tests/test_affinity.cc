@@ -0,0 +1,67 @@
+#include "../windgent/windgent.h"
+#include "../windgent/iomanager.h"
+
+#include <sched.h>
+#include <atomic>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+void test_cpu_list() {
+    std::vector<int> v = windgent::Thread::ParseCpuList("0-3,8, 10-11");
+    ASSERT(v.size() == 7 && v[0] == 0 && v[3] == 3 && v[4] == 8 && v[6] == 11);
+    ASSERT(windgent::Thread::FormatCpuList(v) == "0-3,8,10-11");
+    ASSERT(windgent::Thread::ParseCpuList("3-1").empty());
+    ASSERT(windgent::Thread::ParseCpuList("a").empty());
+    ASSERT(!windgent::Thread::GetOnlineCpus().empty());
+    const std::vector<std::vector<int> >& nodes = windgent::Thread::GetNumaNodes();
+    for(size_t i = 0; i < nodes.size(); ++i) {
+        LOG_INFO(g_logger) << "node" << i << ": cpu" << windgent::Thread::FormatCpuList(nodes[i]);
+    }
+    LOG_INFO(g_logger) << "online: cpu" << windgent::Thread::FormatCpuList(windgent::Thread::GetOnlineCpus());
+}
+
+//在每个调度线程上检查实际的亲和性是否与配置一致
+void check(const std::string& policy, size_t expect_cpus) {
+    windgent::ConfigMgr::Lookup<std::string>("scheduler.affinity")->setVal(policy);
+    const int threads = 2;
+    windgent::IOManager iom(threads, false, "affinity");
+    std::atomic<int> checked = {0};
+    for(int i = 0; i < threads * 8; ++i) {
+        iom.schedule([&checked, expect_cpus]() {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            ASSERT(sched_getaffinity(0, sizeof(set), &set) == 0);
+            if(expect_cpus) {
+                ASSERT((size_t)CPU_COUNT(&set) == expect_cpus);
+                ASSERT(windgent::Thread::GetNumaNode() >= 0);
+            } else {
+                ASSERT(windgent::Thread::GetNumaNode() == -1);
+            }
+            ++checked;
+        });
+    }
+    while(checked != threads * 8) {
+        usleep(1000);
+    }
+    std::stringstream ss;
+    iom.dump(ss);
+    LOG_INFO(g_logger) << "policy=\"" << policy << "\" " << ss.str();
+}
+
+int main(int argc, char** argv) {
+    test_cpu_list();
+    check("", 0);
+    check("core", 1);
+    //没有cpu的节点不参与绑定
+    size_t node_cpus = 0;
+    for(auto& i : windgent::Thread::GetNumaNodes()) {
+        if(!i.empty()) {
+            node_cpus = i.size();
+            break;
+        }
+    }
+    check("numa", node_cpus);
+    check(std::to_string(windgent::Thread::GetOnlineCpus().back()), 1);
+    windgent::ConfigMgr::Lookup<std::string>("scheduler.affinity")->setVal("");
+    return 0;
+}
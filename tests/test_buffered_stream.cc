@@ -0,0 +1,244 @@
+#include "../windgent/windgent.h"
+#include "../windgent/iomanager.h"
+#include "../windgent/socket.h"
+#include "../windgent/socket_stream.h"
+#include "../windgent/buffered_stream.h"
+#include "../windgent/address.h"
+
+#include <dlfcn.h>
+#include <unistd.h>
+#include <atomic>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+//统计recv/recvmsg的次数（SocketStream读缓冲区用recv，读iovec用recvmsg）
+static std::atomic<uint64_t> s_recvs = {0};
+
+extern "C" {
+ssize_t recv(int sockfd, void* buf, size_t len, int flags) {
+    static auto real = (ssize_t (*)(int, void*, size_t, int))dlsym(RTLD_NEXT, "recv");
+    ++s_recvs;
+    return real(sockfd, buf, len, flags);
+}
+ssize_t recvmsg(int sockfd, struct msghdr* msg, int flags) {
+    static auto real = (ssize_t (*)(int, struct msghdr*, int))dlsym(RTLD_NEXT, "recvmsg");
+    ++s_recvs;
+    return real(sockfd, msg, flags);
+}
+}
+
+//内存中的流，每次读取最多交出chunk字节，用来构造任意的分包
+class ChunkStream : public windgent::Stream {
+public:
+    ChunkStream(const std::string& data, size_t chunk) :m_data(data), m_chunk(chunk) { }
+
+    virtual int read(void* buffer, size_t length) override {
+        size_t n = std::min(std::min(length, m_chunk), m_data.size() - m_pos);
+        memcpy(buffer, &m_data[m_pos], n);
+        m_pos += n;
+        ++reads;
+        return n;
+    }
+    virtual int read(windgent::ByteArray::ptr ba, size_t length) override {
+        std::string tmp(std::min(length, m_chunk), 0);
+        int n = read(&tmp[0], tmp.size());
+        ba->write(tmp.c_str(), n);
+        return n;
+    }
+    virtual int readv(struct iovec* buffers, size_t count) override {
+        size_t total = 0;
+        for(size_t i = 0; i < count && total < m_chunk; ++i) {
+            size_t n = std::min(std::min(buffers[i].iov_len, m_chunk - total), m_data.size() - m_pos);
+            memcpy(buffers[i].iov_base, &m_data[m_pos], n);
+            m_pos += n;
+            total += n;
+        }
+        ++reads;
+        return total;
+    }
+    virtual int write(const void* buffer, size_t length) override { return length; }
+    virtual int write(windgent::ByteArray::ptr ba, size_t length) override { return length; }
+    virtual void close() override { }
+
+    int reads = 0;
+private:
+    std::string m_data;
+    size_t m_chunk;
+    size_t m_pos = 0;
+};
+
+//容量很小的缓冲区让数据频繁绕回，分包大小从1到容量以上
+void test_basic() {
+    std::string text = "GET / HTTP/1.1\r\nHost: a\r\n\r\nline one\nline two\r\n\r\nlast";
+    for(size_t chunk = 1; chunk <= 40; ++chunk) {
+        windgent::BufferedStream bs(std::make_shared<ChunkStream>(text, chunk), 32);
+        const char* data = nullptr;
+        int n = bs.readUntil("\r\n\r\n", &data);
+        ASSERT(n == 27 && std::string(data, n) == "GET / HTTP/1.1\r\nHost: a\r\n\r\n");
+        size_t len = 0;
+        ASSERT(bs.readLine(&data, &len) == 9 && std::string(data, len) == "line one");
+        ASSERT(bs.readLine(&data, &len) == 10 && std::string(data, len) == "line two");
+        ASSERT(bs.readLine(&data, &len) == 2 && len == 0);
+        const char* p = bs.peek(3);
+        ASSERT(p && std::string(p, 3) == "las");
+        ASSERT(bs.peek(5) == nullptr);
+        bs.consume(1);
+        char buf[8];
+        ASSERT(bs.read(buf, sizeof(buf)) == 3 && std::string(buf, 3) == "ast");
+        ASSERT(bs.read(buf, sizeof(buf)) == 0);
+        ASSERT(bs.readLine(&data, &len) == 0);
+    }
+    //一行超过缓冲区
+    windgent::BufferedStream bs(std::make_shared<ChunkStream>(std::string(40, 'x') + "\n", 7), 16);
+    const char* data = nullptr;
+    size_t len = 0;
+    ASSERT(bs.readLine(&data, &len) == -2 && bs.size() == 16);
+    //大块读取绕过缓冲区直接从底层读
+    std::shared_ptr<ChunkStream> cs = std::make_shared<ChunkStream>(std::string(1000, 'y'), 1000);
+    windgent::BufferedStream big(cs, 64);
+    char buf[1000];
+    ASSERT(big.read(buf, sizeof(buf)) == 1000 && cs->reads == 1 && big.size() == 0);
+    //ByteArray
+    windgent::ByteArray::ptr ba(new windgent::ByteArray);
+    ba->writeFuint32(0x01020304);
+    ba->writeStringF16("hello");
+    ba->setPosition(0);
+    std::string frame = ba->toString();
+    windgent::BufferedStream fs(std::make_shared<ChunkStream>(frame + frame, 3), 8);
+    for(int i = 0; i < 2; ++i) {
+        windgent::ByteArray::ptr out(new windgent::ByteArray);
+        ASSERT(fs.readFixedSize(out, frame.size()) == (int)frame.size());
+        out->setPosition(0);
+        ASSERT(out->readFuint32() == 0x01020304 && out->readStringF16() == "hello");
+    }
+    LOG_INFO(g_logger) << "basic ok";
+}
+
+//客户端写入data后关闭，服务端在协程中用cb读取
+static void serve(windgent::IOManager& iom, const std::string& data
+                  , std::function<void(windgent::SocketStream::ptr)> cb) {
+    std::atomic<int> done = {0};
+    iom.schedule([&]() {
+        windgent::Socket::ptr listener = windgent::Socket::createTCPSocket();
+        ASSERT(listener->bind(windgent::IPv4Address::Create("127.0.0.1", 0)));
+        ASSERT(listener->listen());
+        windgent::Address::ptr addr = listener->getLocalAddress();
+        iom.schedule([&, addr]() {
+            windgent::Socket::ptr client = windgent::Socket::createTCPSocket();
+            ASSERT(client->connect(addr));
+            windgent::SocketStream ss(client);
+            ASSERT(ss.writeFixedSize(data.c_str(), data.size()) == (int)data.size());
+            ++done;
+        });
+        windgent::Socket::ptr conn = listener->accept();
+        cb(windgent::SocketStream::ptr(new windgent::SocketStream(conn)));
+        ++done;
+    });
+    while(done < 2) {
+        usleep(1000);
+    }
+}
+
+//按行的文本协议：逐字节recv找换行 vs BufferedStream::readLine
+void bench_lines(windgent::IOManager& iom) {
+    const int lines = 20000;
+    std::string data;
+    for(int i = 0; i < lines; ++i) {
+        data += "key" + std::to_string(i) + ": value-" + std::to_string(i * 7) + "\r\n";
+    }
+    for(int buffered = 0; buffered < 2; ++buffered) {
+        uint64_t recvs = s_recvs;
+        uint64_t start = windgent::GetCurrentUS();
+        int got = 0;
+        serve(iom, data, [&](windgent::SocketStream::ptr ss) {
+            if(buffered) {
+                windgent::BufferedStream bs(ss);
+                const char* line = nullptr;
+                size_t len = 0;
+                while(bs.readLine(&line, &len) > 0) {
+                    ASSERT(len > 0 && line[len - 1] != '\r');
+                    ++got;
+                }
+            } else {
+                std::string line;
+                char c;
+                while(ss->read(&c, 1) == 1) {
+                    line += c;
+                    if(c == '\n') {
+                        ++got;
+                        line.clear();
+                    }
+                }
+            }
+        });
+        ASSERT(got == lines);
+        uint64_t used = windgent::GetCurrentUS() - start;
+        std::cout << (buffered ? "readLine   " : "byte recv  ") << lines << " lines: " << used / 1000.0 << "ms, recv calls="
+                  << s_recvs - recvs << " (" << (double)(s_recvs - recvs) / lines << "/line)" << std::endl;
+    }
+}
+
+//长度前缀的二进制帧：readFixedSize读长度再读负载 vs BufferedStream::peek直接在缓冲区中解析
+void bench_frames(windgent::IOManager& iom) {
+    const int frames = 20000;
+    windgent::ByteArray::ptr ba(new windgent::ByteArray);
+    uint64_t expect = 0;
+    for(int i = 0; i < frames; ++i) {
+        std::string payload(20 + i % 200, (char)i);
+        ba->writeFuint32(payload.size());
+        ba->writeStringWithoutLen(payload);
+        expect += payload.size() * (unsigned char)(char)i;
+    }
+    ba->setPosition(0);
+    std::string data = ba->toString();
+    for(int buffered = 0; buffered < 2; ++buffered) {
+        uint64_t recvs = s_recvs;
+        uint64_t start = windgent::GetCurrentUS();
+        uint64_t sum = 0;
+        serve(iom, data, [&](windgent::SocketStream::ptr ss) {
+            if(buffered) {
+                windgent::BufferedStream bs(ss);
+                const char* p = nullptr;
+                while((p = bs.peek(4))) {
+                    windgent::ByteArray::ptr head(new windgent::ByteArray);
+                    head->write(p, 4);
+                    head->setPosition(0);
+                    uint32_t len = head->readFuint32();
+                    p = bs.peek(4 + len);
+                    ASSERT(p);
+                    for(uint32_t i = 0; i < len; ++i) {
+                        sum += (unsigned char)p[4 + i];
+                    }
+                    bs.consume(4 + len);
+                }
+            } else {
+                std::string payload;
+                while(true) {
+                    windgent::ByteArray::ptr head(new windgent::ByteArray);
+                    if(ss->readFixedSize(head, 4) <= 0) {
+                        break;
+                    }
+                    head->setPosition(0);
+                    payload.resize(head->readFuint32());
+                    ASSERT(ss->readFixedSize(&payload[0], payload.size()) > 0);
+                    for(auto c : payload) {
+                        sum += (unsigned char)c;
+                    }
+                }
+            }
+        });
+        ASSERT(sum == expect);
+        uint64_t used = windgent::GetCurrentUS() - start;
+        std::cout << (buffered ? "peek       " : "readFixed  ") << frames << " frames: " << used / 1000.0 << "ms, recv calls="
+                  << s_recvs - recvs << " (" << (double)(s_recvs - recvs) / frames << "/frame)" << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    LOG_NAME("system")->setLevel(windgent::LogLevel::WARN);
+    test_basic();
+    windgent::IOManager iom(2, false, "buffered");
+    bench_lines(iom);
+    bench_frames(iom);
+    return 0;
+}
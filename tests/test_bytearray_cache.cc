@@ -0,0 +1,150 @@
+#include "../windgent/windgent.h"
+#include "../windgent/bytearray.h"
+
+#include <atomic>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+//统计堆分配次数，替换glibc的malloc系列函数
+static std::atomic<bool> s_counting = {false};
+static std::atomic<uint64_t> s_mallocs = {0};
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+    if(s_counting) {
+        ++s_mallocs;
+    }
+    return __libc_malloc(size);
+}
+void* calloc(size_t n, size_t size) {
+    if(s_counting) {
+        ++s_mallocs;
+    }
+    return __libc_calloc(n, size);
+}
+void* realloc(void* ptr, size_t size) {
+    if(s_counting) {
+        ++s_mallocs;
+    }
+    return __libc_realloc(ptr, size);
+}
+}
+
+static windgent::ConfigVar<uint64_t>::ptr g_cache_size = windgent::ConfigMgr::Lookup<uint64_t>("bytearray.block_cache_size");
+static windgent::ConfigVar<uint32_t>::ptr g_pool_size = windgent::ConfigMgr::Lookup<uint32_t>("bytearray.pool_size");
+
+//一条约6KB的消息，占2个4KB的内存块
+static void serialize(windgent::ByteArray::ptr ba, int i) {
+    ba->writeFuint32(i);
+    for(int j = 0; j < 1000; ++j) {
+        ba->writeUint64(i * 1000ull + j);
+        ba->writeFuint16(j);
+    }
+}
+
+static void deserialize(windgent::ByteArray::ptr ba, int i) {
+    ba->setPosition(0);
+    ASSERT(ba->readFuint32() == (uint32_t)i);
+    for(int j = 0; j < 1000; ++j) {
+        ASSERT(ba->readUint64() == i * 1000ull + j);
+        ASSERT(ba->readFuint16() == j);
+    }
+}
+
+//缓存上限：超出的内存块归还系统；Create放回池中的ByteArray被清空并恢复为大端
+void test_limits() {
+    g_cache_size->setVal(8 * 1024);
+    windgent::ByteArray::BlockCacheStats before = windgent::ByteArray::GetBlockCacheStats();
+    {
+        windgent::ByteArray::ptr ba(new windgent::ByteArray(1024));
+        ba->addCapacity(10 * 1024);
+    }
+    windgent::ByteArray::BlockCacheStats after = windgent::ByteArray::GetBlockCacheStats();
+    ASSERT(after.cached_bytes - before.cached_bytes == 8 * 1024);
+    ASSERT(after.frees - before.frees == 2);
+    ASSERT(after.peak_cached_bytes >= 8 * 1024);
+    g_cache_size->setVal(4 * 1024 * 1024);
+
+    windgent::ByteArray* raw = nullptr;
+    {
+        windgent::ByteArray::ptr ba = windgent::ByteArray::Create();
+        ba->setIsLittleEndian(true);
+        ba->writeFuint64(1);
+        raw = ba.get();
+    }
+    windgent::ByteArray::ptr ba = windgent::ByteArray::Create();
+    ASSERT(ba.get() == raw && ba->getSize() == 0 && ba->getPosition() == 0 && !ba->isLittleEndian());
+
+    //线程退出时归还它缓存的所有内存块
+    before = windgent::ByteArray::GetBlockCacheStats();
+    windgent::Thread t([]() {
+        windgent::ByteArray::ptr ba = windgent::ByteArray::Create();
+        ba->addCapacity(64 * 1024);
+    }, "cache_exit");
+    t.join();
+    after = windgent::ByteArray::GetBlockCacheStats();
+    ASSERT(after.cached_bytes == before.cached_bytes);
+    LOG_INFO(g_logger) << "limits ok";
+}
+
+enum Mode {
+    NEW_EACH,       //每条消息new一个ByteArray
+    CREATE_EACH,    //每条消息ByteArray::Create
+    CLEAR_REUSE     //像echo_server那样复用一个ByteArray，每条消息前clear
+};
+static const char* s_mode_names[] = {"new ByteArray", "ByteArray::Create", "reuse + clear()"};
+
+static void bench(Mode mode, bool cache) {
+    g_cache_size->setVal(cache ? 4 * 1024 * 1024 : 0);
+    g_pool_size->setVal(cache ? 64 : 0);
+    const int warmup = 100;
+    const int msgs = 20000;
+    windgent::ByteArray::ptr reused(new windgent::ByteArray);
+    uint64_t start = 0;
+    windgent::ByteArray::BlockCacheStats before;
+    for(int i = 0; i < warmup + msgs; ++i) {
+        if(i == warmup) {
+            before = windgent::ByteArray::GetBlockCacheStats();
+            s_mallocs = 0;
+            s_counting = true;
+            start = windgent::GetCurrentUS();
+        }
+        windgent::ByteArray::ptr ba;
+        if(mode == NEW_EACH) {
+            ba.reset(new windgent::ByteArray);
+        } else if(mode == CREATE_EACH) {
+            ba = windgent::ByteArray::Create();
+        } else {
+            ba = reused;
+            ba->clear();
+        }
+        serialize(ba, i);
+        deserialize(ba, i);
+    }
+    s_counting = false;
+    uint64_t used = windgent::GetCurrentUS() - start;
+    windgent::ByteArray::BlockCacheStats after = windgent::ByteArray::GetBlockCacheStats();
+    std::cout << (cache ? "cache on  " : "cache off ") << s_mode_names[mode] << ": " << msgs << " msgs "
+              << used / 1000.0 << "ms, mallocs/msg=" << (double)s_mallocs / msgs
+              << ", block allocs=" << after.allocs - before.allocs << " hits=" << after.hits - before.hits
+              << " pool hits=" << after.pool_hits - before.pool_hits << std::endl;
+    //new出来的ByteArray对象和它的shared_ptr控制块仍然是两次分配，内存块都来自缓存
+    if(cache) {
+        ASSERT(mode == NEW_EACH ? s_mallocs == 2ull * msgs : s_mallocs < 10);
+    }
+}
+
+int main(int argc, char** argv) {
+    test_limits();
+    for(int m = NEW_EACH; m <= CLEAR_REUSE; ++m) {
+        bench((Mode)m, false);
+        bench((Mode)m, true);
+    }
+    windgent::ByteArray::BlockCacheStats stats = windgent::ByteArray::GetBlockCacheStats();
+    LOG_INFO(g_logger) << "cached_bytes=" << stats.cached_bytes << " peak_cached_bytes=" << stats.peak_cached_bytes;
+    return 0;
+}
@@ -0,0 +1,175 @@
+#include "../windgent/windgent.h"
+#include "../windgent/bytearray.h"
+
+#include <random>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+//原来的实现：写入时先编码到临时数组再write，读取时每字节一次readFuint8
+static void legacy_write(windgent::ByteArray::ptr ba, uint64_t value) {
+    uint8_t tmp[10];
+    uint8_t i = 0;
+    while(value >= 0x80) {
+        tmp[i++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    tmp[i++] = value;
+    ba->write(tmp, i);
+}
+
+static uint64_t legacy_read(windgent::ByteArray::ptr ba, int bits) {
+    uint64_t result = 0;
+    for(int i = 0; i < bits; i += 7) {
+        uint8_t b = ba->readFuint8();
+        result |= (((uint64_t)(b & 0x7F)) << i);
+        if(b < 0x80) {
+            break;
+        }
+    }
+    return result;
+}
+
+//位数均匀分布的随机数，各种编码长度都会出现
+static std::vector<uint64_t> make_values(size_t count, int max_bits, uint32_t seed) {
+    std::mt19937_64 rng(seed);
+    std::vector<uint64_t> values(count);
+    for(auto& v : values) {
+        int bits = rng() % max_bits + 1;
+        v = bits == 64 ? rng() : rng() & ((1ull << bits) - 1);
+    }
+    return values;
+}
+
+//不同的块大小让编码落在内存块边界上，结果与原来的实现逐字节一致
+void test_compat() {
+    const size_t block_sizes[] = {1, 7, 10, 16, 23, 4096};
+    std::vector<uint64_t> v64 = make_values(5000, 64, 1);
+    std::vector<uint64_t> v32 = make_values(5000, 32, 2);
+    for(auto bs : block_sizes) {
+        windgent::ByteArray::ptr fast(new windgent::ByteArray(bs));
+        windgent::ByteArray::ptr legacy(new windgent::ByteArray(bs));
+        for(size_t i = 0; i < v64.size(); ++i) {
+            fast->writeUint64(v64[i]);
+            fast->writeUint32(v32[i]);
+            legacy_write(legacy, v64[i]);
+            legacy_write(legacy, v32[i]);
+        }
+        ASSERT(fast->getSize() == legacy->getSize());
+        fast->setPosition(0);
+        legacy->setPosition(0);
+        ASSERT(fast->toString() == legacy->toString());
+        for(size_t i = 0; i < v64.size(); ++i) {
+            ASSERT(fast->readUint64() == v64[i]);
+            ASSERT(fast->readUint32() == v32[i]);
+        }
+        ASSERT(fast->getReadSize() == 0);
+
+        //数组与单个读写互通，数量不是16的倍数
+        std::vector<uint32_t> arr(v32.begin(), v32.end() - 3);
+        for(size_t i = 0; i < arr.size(); i += 97) {
+            std::fill(arr.begin() + i, arr.begin() + std::min(arr.size(), i + 40), i % 128);
+        }
+        windgent::ByteArray::ptr ba(new windgent::ByteArray(bs));
+        ba->writeUint32Array(&arr[0], arr.size());
+        ba->writeUint32(12345);
+        ba->setPosition(0);
+        for(auto v : arr) {
+            ASSERT(ba->readUint32() == v);
+        }
+        ba->clear();
+        for(auto v : arr) {
+            ba->writeUint32(v);
+        }
+        ba->writeUint32(12345);
+        ba->setPosition(0);
+        std::vector<uint32_t> out(arr.size());
+        ba->readUint32Array(&out[0], out.size());
+        ASSERT(out == arr && ba->readUint32() == 12345 && ba->getReadSize() == 0);
+    }
+    //在已有数据中间改写时不会踩到后面的数据
+    windgent::ByteArray::ptr over(new windgent::ByteArray);
+    over->writeFuint64(0x1122334455667788ull);
+    over->writeFuint64(0x99AABBCCDDEEFF00ull);
+    over->setPosition(0);
+    over->writeUint32(1);
+    uint32_t two[] = {2, 300};
+    over->writeUint32Array(two, 2);
+    over->setPosition(0);
+    ASSERT(over->readUint32() == 1 && over->readUint32() == 2 && over->readUint32() == 300);
+    ASSERT(over->readFuint32() == 0x55667788 && over->readFuint64() == 0x99AABBCCDDEEFF00ull);
+    //超长的编码与原来的实现读取相同的字节数
+    windgent::ByteArray::ptr ba(new windgent::ByteArray);
+    for(int i = 0; i < 12; ++i) {
+        ba->writeFuint8(0xFF);
+    }
+    ba->writeFuint32(0);
+    ba->setPosition(0);
+    ba->readUint32();
+    ASSERT(ba->getPosition() == 5);
+    ba->setPosition(0);
+    ba->readUint64();
+    ASSERT(ba->getPosition() == 10);
+    LOG_INFO(g_logger) << "compat ok";
+}
+
+enum Mode {
+    LEGACY,
+    SINGLE,     //新的writeUint32/readUint32
+    ARRAY       //writeUint32Array/readUint32Array
+};
+static const char* s_mode_names[] = {"legacy", "single", "array"};
+
+static void bench(const char* name, const std::vector<uint32_t>& values) {
+    const int rounds = 20;
+    for(int m = LEGACY; m <= ARRAY; ++m) {
+        windgent::ByteArray::ptr ba(new windgent::ByteArray);
+        std::vector<uint32_t> out(values.size());
+        uint64_t write_us = 0;
+        uint64_t read_us = 0;
+        for(int r = 0; r < rounds; ++r) {
+            ba->clear();
+            uint64_t start = windgent::GetCurrentUS();
+            if(m == ARRAY) {
+                ba->writeUint32Array(&values[0], values.size());
+            } else {
+                for(auto v : values) {
+                    m == LEGACY ? legacy_write(ba, v) : ba->writeUint32(v);
+                }
+            }
+            write_us += windgent::GetCurrentUS() - start;
+            ba->setPosition(0);
+            start = windgent::GetCurrentUS();
+            if(m == ARRAY) {
+                ba->readUint32Array(&out[0], out.size());
+            } else {
+                for(auto& v : out) {
+                    v = m == LEGACY ? legacy_read(ba, 32) : ba->readUint32();
+                }
+            }
+            read_us += windgent::GetCurrentUS() - start;
+            ASSERT(out == values);
+        }
+        double mb = (double)ba->getSize() * rounds / (1 << 20);
+        std::cout << name << " " << s_mode_names[m] << ": encode " << (uint64_t)(mb / (write_us / 1000000.0))
+                  << " MB/s, decode " << (uint64_t)(mb / (read_us / 1000000.0)) << " MB/s" << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    test_compat();
+    const size_t count = 1 << 20;
+    std::vector<uint32_t> small(count);
+    std::vector<uint32_t> mixed(count);
+    std::vector<uint32_t> large(count);
+    std::mt19937 rng(3);
+    std::vector<uint64_t> m = make_values(count, 32, 4);
+    for(size_t i = 0; i < count; ++i) {
+        small[i] = rng() % 128;
+        mixed[i] = m[i];
+        large[i] = rng() | 0x80000000u;
+    }
+    bench("1 byte  ", small);
+    bench("mixed   ", mixed);
+    bench("5 bytes ", large);
+    return 0;
+}
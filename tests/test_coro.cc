@@ -0,0 +1,190 @@
+#include "../windgent/windgent.h"
+#include "../windgent/iomanager.h"
+#include "../windgent/fd_manager.h"
+#include "../windgent/future.h"
+#include "../windgent/coro.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <fstream>
+#include <stdexcept>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+namespace coro = windgent::coro;
+
+static void wait_for(std::atomic<int>& count, int n) {
+    while(count < n) {
+        usleep(1000);
+    }
+}
+
+static windgent::coro::Task<int> add_later(int a, int b) {
+    co_await coro::sleep(10);
+    co_return a + b;
+}
+
+static windgent::coro::Task<int> fail_later() {
+    co_await coro::sleep(1);
+    throw std::runtime_error("coroutine failed");
+}
+
+//Task可以嵌套等待，异常从co_await重新抛出；spawn返回的Future可以在Fiber或线程中等待
+void test_task(windgent::IOManager& iom) {
+    windgent::Future<int> sum = coro::spawn([]() -> windgent::coro::Task<int> {
+        uint64_t start = windgent::GetCurrentMS();
+        int v = co_await add_later(1, 2);
+        v += co_await add_later(v, 4);
+        bool thrown = false;
+        try {
+            co_await fail_later();
+        } catch(std::runtime_error& e) {
+            thrown = true;
+        }
+        ASSERT(thrown);
+        //等待Fiber代码产生的结果
+        windgent::Future<int> f = windgent::Async([]() { usleep(5000); return 100; });
+        v += co_await coro::wait(f);
+        ASSERT(windgent::GetCurrentMS() - start >= 20);
+        co_return v;
+    }(), &iom);
+    ASSERT(sum.get() == 110);
+    LOG_INFO(g_logger) << "task ok";
+}
+
+//读写、超时和connect
+void test_io(windgent::IOManager& iom) {
+    int fds[2];
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == 0);
+    windgent::Future<int> f = coro::spawn([](int fd) -> windgent::coro::Task<int> {
+        //没有数据时超时
+        uint64_t start = windgent::GetCurrentMS();
+        ASSERT(!co_await coro::readable(fd, 20));
+        ASSERT(windgent::GetCurrentMS() - start >= 15);
+        char buf[16];
+        ssize_t n = co_await coro::read(fd, buf, sizeof(buf));
+        ASSERT(n == 5);
+        ASSERT(co_await coro::write(fd, buf, n) == n);
+
+        //连接本地监听端口，以及一个没有监听的端口
+        int listener = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        ASSERT(bind(listener, (sockaddr*)&addr, sizeof(addr)) == 0 && listen(listener, 16) == 0);
+        socklen_t len = sizeof(addr);
+        getsockname(listener, (sockaddr*)&addr, &len);
+        int client = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        ASSERT(co_await coro::connect(client, (sockaddr*)&addr, sizeof(addr), 1000) == 0);
+        close(client);
+        close(listener);
+        client = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        int ret = co_await coro::connect(client, (sockaddr*)&addr, sizeof(addr), 1000);
+        close(client);
+        co_return ret;
+    }(fds[0]), &iom);
+    usleep(50 * 1000);
+    ASSERT(write(fds[1], "hello", 5) == 5);
+    char buf[16];
+    int n = 0;
+    while((n = read(fds[1], buf, sizeof(buf))) < 0 && errno == EAGAIN) {
+        usleep(1000);
+    }
+    ASSERT(n == 5 && memcmp(buf, "hello", 5) == 0);
+    ASSERT(f.get() == -ECONNREFUSED);
+    close(fds[0]);
+    close(fds[1]);
+    LOG_INFO(g_logger) << "io ok";
+}
+
+//常驻内存和虚拟内存，单位KB
+static void memory_kb(uint64_t& rss, uint64_t& vsz) {
+    std::ifstream ifs("/proc/self/statm");
+    ifs >> vsz >> rss;
+    uint64_t page = sysconf(_SC_PAGESIZE) / 1024;
+    vsz *= page;
+    rss *= page;
+}
+
+//conns个空闲连接，每个连接一个处理者等待一个字节并回写。stackless为true时处理者是C++20协程，否则是Fiber
+void bench_idle(windgent::IOManager& iom, int conns, bool stackless) {
+    std::vector<int> servers, clients;
+    for(int i = 0; i < conns; ++i) {
+        int fds[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds)) {
+            LOG_ERROR(g_logger) << "socketpair failed after " << i << " pairs, errno=" << errno;
+            break;
+        }
+        servers.push_back(fds[0]);
+        clients.push_back(fds[1]);
+    }
+    conns = servers.size();
+    std::atomic<int> waiting = {0};
+    std::atomic<int> done = {0};
+    uint64_t rss0, vsz0, rss1, vsz1;
+    memory_kb(rss0, vsz0);
+    for(int i = 0; i < conns; ++i) {
+        int fd = servers[i];
+        if(stackless) {
+            coro::spawn([](int fd, std::atomic<int>& waiting, std::atomic<int>& done) -> windgent::coro::Task<void> {
+                char c;
+                ++waiting;
+                if(co_await coro::read(fd, &c, 1) == 1) {
+                    co_await coro::write(fd, &c, 1);
+                }
+                ++done;
+            }(fd, waiting, done), &iom);
+        } else {
+            iom.schedule([fd, &waiting, &done]() {
+                //socketpair没有被hook，手动登记后recv在EAGAIN时挂起Fiber
+                windgent::FdMgr::GetInstance()->get(fd, true);
+                char c;
+                ++waiting;
+                if(recv(fd, &c, 1, 0) == 1) {
+                    send(fd, &c, 1, 0);
+                }
+                ++done;
+            });
+        }
+    }
+    wait_for(waiting, conns);
+    usleep(50 * 1000);
+    memory_kb(rss1, vsz1);
+
+    for(auto fd : clients) {
+        ASSERT(write(fd, "x", 1) == 1);
+    }
+    wait_for(done, conns);
+    for(auto fd : clients) {
+        char c = 0;
+        ASSERT(read(fd, &c, 1) == 1 && c == 'x');
+        close(fd);
+    }
+    for(auto fd : servers) {
+        windgent::FdMgr::GetInstance()->del(fd);
+        close(fd);
+    }
+    double rss = (double)(rss1 - rss0) * 1024 / conns;
+    double vsz = (double)(vsz1 - vsz0) * 1024 / conns;
+    std::cout << (stackless ? "coroutine" : "fiber    ") << " conns=" << conns
+              << " rss/conn=" << (uint64_t)rss << "B vsz/conn=" << (uint64_t)vsz << "B"
+              << " 1M conns: rss=" << (uint64_t)(rss * 1000000 / (1 << 20)) << "MB"
+              << " vsz=" << (uint64_t)(vsz * 1000000 / (1 << 20)) << "MB" << std::endl;
+}
+
+//用法：test_coro [连接数]，受ulimit -n限制（每个连接两个fd）
+int main(int argc, char** argv) {
+    int conns = argc > 1 ? atoi(argv[1]) : 5000;
+    LOG_NAME("system")->setLevel(windgent::LogLevel::WARN);
+    windgent::IOManager iom(2, false, "coro");
+    test_task(iom);
+    test_io(iom);
+    bench_idle(iom, conns, true);
+    bench_idle(iom, conns, false);
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "../windgent/windgent.h"
+#include "../windgent/fd_manager.h"
+#include "../windgent/fd_table.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <atomic>
+#include <vector>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+//FdTable的基本行为：未分配的块返回nullptr，新块按fd初始化，槽位地址不变
+void test_table() {
+    windgent::FdTable<int> table([](int& slot, int fd) {
+        slot = fd;
+    });
+    ASSERT(table.get(-1, true) == nullptr);
+    ASSERT(table.get(windgent::FdTable<int>::MAX_FDS, true) == nullptr);
+    ASSERT(table.get(5000) == nullptr);
+    int* p = table.get(5000, true);
+    ASSERT(p && *p == 5000);
+    ASSERT(table.get(5000) == p);
+    //同一块中的其他fd也已经初始化
+    ASSERT(*table.get(5001) == 5001);
+    ASSERT(table.get(100) == nullptr);
+    LOG_INFO(g_logger) << "table ok";
+}
+
+//多个线程反复查找已有的fd，同时另一个线程不断在更大的fd上创建和删除FdCtx，查找不应受影响
+void test_concurrent() {
+    const int n = 16;
+    std::vector<int> fds;
+    for(int i = 0; i < n; ++i) {
+        int fd = open("/dev/null", O_RDONLY);
+        ASSERT(fd >= 0);
+        ASSERT(windgent::FdMgr::GetInstance()->get(fd, true));
+        fds.push_back(fd);
+    }
+
+    std::atomic<bool> stop = {false};
+    std::atomic<uint64_t> lookups = {0};
+    std::vector<windgent::Thread::ptr> thrs;
+    for(int t = 0; t < 3; ++t) {
+        thrs.push_back(windgent::Thread::ptr(new windgent::Thread([&]() {
+            uint64_t count = 0;
+            while(!stop) {
+                for(auto fd : fds) {
+                    ASSERT(windgent::FdMgr::GetInstance()->get(fd));
+                    ++count;
+                }
+            }
+            lookups += count;
+        }, "lookup_" + std::to_string(t))));
+    }
+
+    //dup2到越来越大的fd上，迫使表分配新的块
+    int src = fds[0];
+    uint64_t start = windgent::GetCurrentMS();
+    int high = 1024;
+    for(int round = 0; round < 2000; ++round) {
+        int fd = high + (round % 64) * 97;
+        ASSERT(dup2(src, fd) == fd);
+        windgent::FdCtx::ptr ctx = windgent::FdMgr::GetInstance()->get(fd, true);
+        ASSERT(ctx && windgent::FdMgr::GetInstance()->get(fd) == ctx);
+        windgent::FdMgr::GetInstance()->del(fd);
+        ASSERT(!windgent::FdMgr::GetInstance()->get(fd));
+        close(fd);
+    }
+    stop = true;
+    for(auto& i : thrs) {
+        i->join();
+    }
+    uint64_t used = windgent::GetCurrentMS() - start;
+    for(auto fd : fds) {
+        windgent::FdMgr::GetInstance()->del(fd);
+        close(fd);
+    }
+    LOG_INFO(g_logger) << "concurrent ok, lookups=" << lookups << " used=" << used << "ms";
+}
+
+int main(int argc, char** argv) {
+    test_table();
+    test_concurrent();
+    return 0;
+}
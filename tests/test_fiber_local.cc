@@ -0,0 +1,143 @@
+#include "../windgent/windgent.h"
+#include "../windgent/iomanager.h"
+#include "../windgent/fd_manager.h"
+
+#include <sys/socket.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <atomic>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+//统计Fiber::GetThis的调用次数，每次调用都是一次引用计数的原子加和一次原子减
+static std::atomic<uint64_t> s_get_this = {0};
+
+namespace windgent {
+Fiber::ptr Fiber::GetThis() {
+    static auto real = (Fiber::ptr (*)())dlsym(RTLD_NEXT, "_ZN8windgent5Fiber7GetThisEv");
+    ++s_get_this;
+    return real();
+}
+}
+
+//记录构造和析构次数的请求上下文
+static std::atomic<int> s_alive = {0};
+struct RequestCtx {
+    RequestCtx() { ++s_alive; }
+    ~RequestCtx() { --s_alive; }
+    std::string traceId;
+    uint64_t fiberId = 0;
+};
+
+static windgent::FiberLocal<RequestCtx> s_request;
+static windgent::FiberLocal<int> s_counter;
+
+//每个协程看到自己的值，让出、换线程之后不变；任务结束后析构，复用的协程看不到上一个任务的值
+void test_local(windgent::IOManager& iom) {
+    const int fibers = 200;
+    std::atomic<int> done = {0};
+    for(int i = 0; i < fibers; ++i) {
+        iom.schedule([i, &done]() {
+            ASSERT(s_request.peek() == nullptr);
+            ASSERT(s_counter.get() == 0);
+            s_request->traceId = "trace-" + std::to_string(i);
+            s_request->fiberId = windgent::Fiber::GetFiberId();
+            for(int j = 0; j < 10; ++j) {
+                ++*s_counter;
+                windgent::Fiber::YieldToReady();
+                ASSERT(s_request->traceId == "trace-" + std::to_string(i));
+                ASSERT(s_request->fiberId == windgent::Fiber::GetFiberId());
+            }
+            ASSERT(s_counter.get() == 10);
+            if(i % 2) {
+                s_request.reset();
+                ASSERT(s_request.peek() == nullptr);
+            }
+            ++done;
+        });
+    }
+    while(done != fibers) {
+        usleep(1000);
+    }
+    //非协程中使用时属于线程的主协程
+    s_counter.set(42);
+    ASSERT(*s_counter == 42);
+    //idle中的调度线程还可能持有最后一个复用的协程，它的值已经在任务结束时析构
+    ASSERT(s_alive == 0);
+    LOG_INFO(g_logger) << "fiber local ok";
+}
+
+//一次请求：客户端协程send一个字节，服务端协程recv（EAGAIN时挂起等待）后send回去，客户端recv
+void count_per_request() {
+    int fds[2];
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    const int n = 10000;
+    std::atomic<int> done = {0};
+    uint64_t before = 0;
+    {
+        windgent::IOManager iom(1, false, "request");
+        iom.schedule([&]() {
+            //socketpair没有被hook，手动登记
+            windgent::FdMgr::GetInstance()->get(fds[0], true);
+            windgent::FdMgr::GetInstance()->get(fds[1], true);
+            iom.schedule([&]() {
+                char c;
+                for(int i = 0; i < n; ++i) {
+                    ASSERT(recv(fds[1], &c, 1, 0) == 1);
+                    ASSERT(send(fds[1], &c, 1, 0) == 1);
+                }
+                ++done;
+            });
+            iom.schedule([&]() {
+                char c = 'x';
+                before = s_get_this;
+                for(int i = 0; i < n; ++i) {
+                    ASSERT(send(fds[0], &c, 1, 0) == 1);
+                    ASSERT(recv(fds[0], &c, 1, 0) == 1);
+                    s_request->fiberId = i;
+                }
+                ++done;
+            });
+        });
+        while(done != 2) {
+            usleep(1000);
+        }
+    }
+    close(fds[0]);
+    close(fds[1]);
+    //剩下的是addEvent保存等待协程时必须持有的引用
+    LOG_INFO(g_logger) << "GetThis per request=" << (double)(s_get_this - before) / n
+                       << " (atomic refcount ops x2)";
+}
+
+//GetThis和GetCurrent的单次开销
+void bench_accessor() {
+    const int n = 10000000;
+    //绕过上面的计数
+    auto get_this = (windgent::Fiber::ptr (*)())dlsym(RTLD_NEXT, "_ZN8windgent5Fiber7GetThisEv");
+    windgent::Fiber::GetCurrent();
+    uint64_t start = windgent::GetCurrentUS();
+    uint64_t sum = 0;
+    for(int i = 0; i < n; ++i) {
+        sum += (uint64_t)get_this().get();
+    }
+    uint64_t shared = windgent::GetCurrentUS() - start;
+    start = windgent::GetCurrentUS();
+    for(int i = 0; i < n; ++i) {
+        sum += (uint64_t)windgent::Fiber::GetCurrent();
+    }
+    uint64_t raw = windgent::GetCurrentUS() - start;
+    LOG_INFO(g_logger) << "GetThis " << shared * 1000.0 / n << "ns/call, GetCurrent " << raw * 1000.0 / n
+                       << "ns/call (" << (sum & 1) << ")";
+}
+
+int main(int argc, char** argv) {
+    LOG_NAME("system")->setLevel(windgent::LogLevel::WARN);
+    {
+        windgent::IOManager iom(4, false, "local");
+        test_local(iom);
+    }
+    count_per_request();
+    bench_accessor();
+    return 0;
+}
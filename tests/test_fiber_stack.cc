@@ -0,0 +1,130 @@
+#include "../windgent/windgent.h"
+
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <alloca.h>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+//当前进程的常驻内存，单位KB
+static uint64_t get_rss_kb() {
+    std::ifstream ifs("/proc/self/statm");
+    uint64_t size = 0, rss = 0;
+    ifs >> size >> rss;
+    return rss * sysconf(_SC_PAGESIZE) / 1024;
+}
+
+//反复创建、销毁大量协程，每一轮的耗时和RSS都应该保持平稳
+void test_create() {
+    const int fibers = 100000;
+    windgent::Fiber::GetThis();
+    for(int round = 0; round < 5; ++round) {
+        uint64_t start = windgent::GetCurrentUS();
+        for(int i = 0; i < fibers; ++i) {
+            windgent::Fiber::ptr fiber(new windgent::Fiber([]() {
+                char buf[1024];
+                memset(buf, 0, sizeof(buf));
+            }, 0, true));
+            fiber->call();
+        }
+        uint64_t used = windgent::GetCurrentUS() - start;
+        LOG_INFO(g_logger) << "round=" << round << " fibers=" << fibers << " used=" << used / 1000 << "ms"
+                           << " ns/fiber=" << used * 1000 / fibers << " rss=" << get_rss_kb() << "KB";
+    }
+
+    //同时存活大量协程，释放后超出缓存上限的栈归还系统
+    std::vector<windgent::Fiber::ptr> alive;
+    for(int i = 0; i < 10000; ++i) {
+        alive.push_back(windgent::Fiber::ptr(new windgent::Fiber([]() {
+            char buf[1024];
+            memset(buf, 0, sizeof(buf));
+        }, 0, true)));
+        alive.back()->call();
+    }
+    LOG_INFO(g_logger) << "10000 fibers alive, rss=" << get_rss_kb() << "KB";
+    alive.clear();
+    LOG_INFO(g_logger) << "10000 fibers released, rss=" << get_rss_kb() << "KB";
+}
+
+//在栈上用掉n字节
+static void __attribute__((noinline)) touch_stack(size_t n) {
+    volatile char* buf = (volatile char*)alloca(n);
+    for(size_t i = 0; i < n; i += 64) {
+        buf[i] = 1;
+    }
+    buf[0] = buf[n - 1] = 1;
+}
+
+//不同的栈大小等级，水位线应该反映协程实际用到的栈
+void test_stack_class() {
+    windgent::Fiber::GetThis();
+    size_t sizes[] = {windgent::Fiber::STACK_SMALL, windgent::Fiber::STACK_MEDIUM, windgent::Fiber::STACK_LARGE};
+    for(auto size : sizes) {
+        size_t touch = size / 2;
+        windgent::Fiber::ptr fiber(new windgent::Fiber([touch]() {
+            touch_stack(touch);
+            windgent::Fiber::GetThis()->back();
+        }, size, true));
+        fiber->call();
+        size_t used = fiber->getStackUsage();
+        LOG_INFO(g_logger) << "stacksize=" << fiber->getStackSize() << " touched=" << touch << " usage=" << used;
+        ASSERT(used >= touch && used < touch + 4096);
+        fiber->call();
+    }
+
+    //通过调度器按等级指定栈大小，并采样栈的使用峰值
+    windgent::ConfigMgr::Lookup<uint32_t>("fiber.stack_sample_rate")->setVal(1);
+    windgent::Scheduler sc(1, false, "stack_class");
+    sc.start();
+    for(int i = 0; i < 100; ++i) {
+        sc.schedule([]() {
+            touch_stack(2048);
+        }, -1, windgent::Fiber::STACK_SMALL);
+        sc.schedule([]() {
+            touch_stack(100 * 1024);
+        }, -1, windgent::Fiber::STACK_LARGE);
+    }
+    sc.stop();
+    ASSERT(windgent::Fiber::GetPeakStackUsage(windgent::Fiber::STACK_SMALL) >= 2048);
+    ASSERT(windgent::Fiber::GetPeakStackUsage(windgent::Fiber::STACK_SMALL) < windgent::Fiber::STACK_SMALL);
+    ASSERT(windgent::Fiber::GetPeakStackUsage(windgent::Fiber::STACK_LARGE) >= 100 * 1024);
+    std::stringstream ss;
+    windgent::Fiber::DumpStackUsage(ss);
+    LOG_INFO(g_logger) << ss.str();
+}
+
+static int recurse(int n) {
+    volatile char buf[1024];
+    buf[0] = n;
+    return n ? recurse(n - 1) + buf[0] : 0;
+}
+
+//栈溢出时应该落在保护页上触发SIGSEGV
+void test_guard_page() {
+    pid_t pid = fork();
+    if(pid == 0) {
+        windgent::Fiber::GetThis();
+        windgent::Fiber::ptr fiber(new windgent::Fiber([]() {
+            recurse(1024 * 1024);
+        }, 0, true));
+        fiber->call();
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    ASSERT(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+    LOG_INFO(g_logger) << "stack overflow hit guard page";
+}
+
+int main(int argc, char** argv) {
+    LOG_NAME("system")->setLevel(windgent::LogLevel::INFO);
+    test_guard_page();
+    windgent::Thread thr(&test_create, "stack");
+    thr.join();
+    windgent::Thread thr2(&test_stack_class, "stack_class");
+    thr2.join();
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "../windgent/windgent.h"
+#include "../windgent/fcontext.h"
+
+#include <ucontext.h>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+static const uint64_t s_rounds = 2000000;      //来回切换的次数，每轮两次切换
+static const size_t s_stacksize = 128 * 1024;
+
+static void report(const std::string& name, uint64_t used_us) {
+    LOG_INFO(g_logger) << name << " switches=" << s_rounds * 2 << " used=" << used_us / 1000 << "ms"
+                       << " ns/switch=" << used_us * 1000.0 / (s_rounds * 2);
+}
+
+//裸的swapcontext来回切换
+static ucontext_t s_uc_main;
+static ucontext_t s_uc_co;
+
+static void uc_func() {
+    while(true) {
+        swapcontext(&s_uc_co, &s_uc_main);
+    }
+}
+
+void bench_ucontext() {
+    std::vector<char> stack(s_stacksize);
+    getcontext(&s_uc_co);
+    s_uc_co.uc_link = nullptr;
+    s_uc_co.uc_stack.ss_sp = &stack[0];
+    s_uc_co.uc_stack.ss_size = stack.size();
+    makecontext(&s_uc_co, &uc_func, 0);
+
+    uint64_t start = windgent::GetCurrentUS();
+    for(uint64_t i = 0; i < s_rounds; ++i) {
+        swapcontext(&s_uc_main, &s_uc_co);
+    }
+    report("ucontext", windgent::GetCurrentUS() - start);
+}
+
+#ifdef WINDGENT_FIBER_ASM
+//裸的汇编上下文来回切换
+static windgent::fcontext_t s_fc_main;
+static windgent::fcontext_t s_fc_co;
+
+static void fc_func() {
+    while(true) {
+        windgent_jump_fcontext(&s_fc_co, s_fc_main);
+    }
+}
+
+void bench_fcontext() {
+    std::vector<char> stack(s_stacksize);
+    s_fc_co = windgent_make_fcontext(&stack[0], stack.size(), &fc_func);
+
+    uint64_t start = windgent::GetCurrentUS();
+    for(uint64_t i = 0; i < s_rounds; ++i) {
+        windgent_jump_fcontext(&s_fc_main, s_fc_co);
+    }
+    report("fcontext", windgent::GetCurrentUS() - start);
+}
+#endif
+
+//Fiber::call/back来回切换，使用编译时选择的后端
+void bench_fiber() {
+    windgent::Fiber::GetThis();
+    uint64_t count = 0;
+    windgent::Fiber::ptr fiber(new windgent::Fiber([&count]() {
+        while(true) {
+            ++count;
+            windgent::Fiber::GetThis()->back();
+        }
+    }, 0, true));
+
+    uint64_t start = windgent::GetCurrentUS();
+    for(uint64_t i = 0; i < s_rounds; ++i) {
+        fiber->call();
+    }
+    uint64_t used = windgent::GetCurrentUS() - start;
+    ASSERT(count == s_rounds);
+#ifdef WINDGENT_FIBER_ASM
+    report("Fiber(fcontext)", used);
+#else
+    report("Fiber(ucontext)", used);
+#endif
+}
+
+//浮点运算与异常穿过协程切换
+void test_fiber_state() {
+    windgent::Fiber::GetThis();
+    double sum = 0;
+    windgent::Fiber::ptr fiber(new windgent::Fiber([&sum]() {
+        for(int i = 1; i <= 10; ++i) {
+            try {
+                sum += 1.0 / i;
+                windgent::Fiber::GetThis()->back();
+                throw std::runtime_error("in fiber");
+            } catch(std::exception& e) {
+                sum += 1.0 / i;
+            }
+        }
+    }, 0, true));
+    for(int i = 0; i < 10; ++i) {
+        fiber->call();
+        sum *= 1.0;
+    }
+    fiber->call();
+    ASSERT(fiber->getState() == windgent::Fiber::TERM);
+    LOG_INFO(g_logger) << "fiber state ok, sum=" << sum;
+}
+
+int main(int argc, char** argv) {
+    g_logger->setLevel(windgent::LogLevel::INFO);
+    windgent::ConfigMgr::Lookup<std::string>("nonexist", "")->getVal();
+    windgent::LoggerMgr::GetInstance()->getLogger("system")->setLevel(windgent::LogLevel::INFO);
+
+    windgent::Thread thr([]() {
+        test_fiber_state();
+        bench_ucontext();
+#ifdef WINDGENT_FIBER_ASM
+        bench_fcontext();
+#endif
+        bench_fiber();
+    }, "switch");
+    thr.join();
+    return 0;
+}
@@ -0,0 +1,244 @@
+#include "../windgent/windgent.h"
+#include "../windgent/iomanager.h"
+#include "../windgent/fiber_sync.h"
+
+#include <unistd.h>
+#include <atomic>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+static void wait_for(std::atomic<int>& count, int n) {
+    while(count != n) {
+        usleep(1000);
+    }
+}
+
+//临界区中让出协程，持有锁的协程挂起时其他协程不会进入，线程也不会被阻塞
+void test_mutex(windgent::IOManager& iom) {
+    windgent::FiberMutex mutex;
+    std::atomic<int> done = {0};
+    int inside = 0;
+    int64_t value = 0;
+    const int fibers = 200;
+    const int loops = 50;
+    for(int i = 0; i < fibers; ++i) {
+        iom.schedule([&]() {
+            for(int j = 0; j < loops; ++j) {
+                windgent::FiberMutex::Lock lock(mutex);
+                ASSERT(++inside == 1);
+                ++value;
+                if(j % 10 == 0) {
+                    windgent::Fiber::YieldToReady();
+                }
+                --inside;
+            }
+            ++done;
+        });
+    }
+    wait_for(done, fibers);
+    ASSERT(value == fibers * loops);
+    ASSERT(mutex.tryLock());
+    mutex.unlock();
+    LOG_INFO(g_logger) << "mutex ok";
+}
+
+//信号量限制同时执行的协程数，等待时协程用hook的usleep让出
+void test_semaphore(windgent::IOManager& iom) {
+    windgent::FiberSemaphore sem(3);
+    std::atomic<int> running = {0};
+    std::atomic<int> peak = {0};
+    std::atomic<int> done = {0};
+    const int fibers = 30;
+    for(int i = 0; i < fibers; ++i) {
+        iom.schedule([&]() {
+            sem.wait();
+            int cur = ++running;
+            int old = peak;
+            while(cur > old && !peak.compare_exchange_weak(old, cur)) {
+            }
+            usleep(1000);
+            --running;
+            sem.notify();
+            ++done;
+        });
+    }
+    wait_for(done, fibers);
+    ASSERT(peak <= 3);
+    ASSERT(sem.tryWait() && sem.tryWait() && sem.tryWait() && !sem.tryWait());
+    LOG_INFO(g_logger) << "semaphore ok, peak=" << peak;
+}
+
+//条件变量：消费者协程等待，非调度线程（main）修改条件后通知
+void test_condition(windgent::IOManager& iom) {
+    windgent::FiberMutex mutex;
+    windgent::FiberCondition cond;
+    int ready = 0;
+    std::atomic<int> done = {0};
+    const int fibers = 50;
+    for(int i = 0; i < fibers; ++i) {
+        iom.schedule([&, i]() {
+            windgent::FiberMutex::Lock lock(mutex);
+            cond.wait(mutex, [&]() { return ready > i; });
+            ++done;
+        });
+    }
+    for(int i = 1; i <= fibers; ++i) {
+        usleep(100);
+        windgent::FiberMutex::Lock lock(mutex);
+        ready = i;
+        cond.notifyAll();
+    }
+    wait_for(done, fibers);
+    LOG_INFO(g_logger) << "condition ok";
+}
+
+//通道：不同调度器之间传递数据，main线程也可以阻塞地收发；关闭后等待者全部返回
+void test_channel(windgent::IOManager& a, windgent::IOManager& b) {
+    for(size_t capacity : {0, 1, 16}) {
+        windgent::Channel<int> chan(capacity);
+        std::atomic<int> done = {0};
+        std::atomic<int64_t> sum = {0};
+        const int producers = 8;
+        const int per_producer = 500;
+        for(int i = 0; i < producers; ++i) {
+            a.schedule([&, i]() {
+                for(int j = 0; j < per_producer; ++j) {
+                    ASSERT(chan.send(i * per_producer + j));
+                }
+                ++done;
+            });
+        }
+        for(int i = 0; i < 4; ++i) {
+            b.schedule([&]() {
+                int v = 0;
+                while(chan.recv(v)) {
+                    sum += v;
+                }
+                ++done;
+            });
+        }
+        //main线程也参与接收
+        int v = 0;
+        int64_t main_sum = 0;
+        for(int i = 0; i < 100; ++i) {
+            ASSERT(chan.recv(v));
+            main_sum += v;
+        }
+        wait_for(done, producers);
+        chan.close();
+        ASSERT(!chan.send(0));
+        wait_for(done, producers + 4);
+        const int64_t n = producers * per_producer;
+        ASSERT(sum + main_sum == n * (n - 1) / 2);
+    }
+
+    //close时缓冲区中的数据仍然可以取出
+    windgent::Channel<std::string> chan(4);
+    ASSERT(chan.send("a") && chan.send("b"));
+    chan.close();
+    std::string s;
+    ASSERT(chan.recv(s) && s == "a" && chan.recv(s) && s == "b" && !chan.recv(s));
+    LOG_INFO(g_logger) << "channel ok";
+}
+
+//生产者/消费者流水线：producers个协程把消息发到第一个通道，relays个协程转发到第二个通道，consumers个协程接收
+void bench_pipeline(int threads, size_t capacity, int fibers, int messages) {
+    windgent::IOManager iom(threads, false, "pipeline");
+    windgent::Channel<int> first(capacity);
+    windgent::Channel<int> second(capacity);
+    int producers = fibers / 2;
+    int relays = fibers / 4;
+    int consumers = fibers - producers - relays;
+    int per_producer = messages / producers;
+    std::atomic<int> producers_done = {0};
+    std::atomic<int> relays_done = {0};
+    std::atomic<int> consumers_done = {0};
+    std::atomic<int64_t> received = {0};
+
+    uint64_t start = windgent::GetCurrentUS();
+    for(int i = 0; i < consumers; ++i) {
+        iom.schedule([&]() {
+            int v = 0;
+            int64_t count = 0;
+            while(second.recv(v)) {
+                ++count;
+            }
+            received += count;
+            ++consumers_done;
+        });
+    }
+    for(int i = 0; i < relays; ++i) {
+        iom.schedule([&]() {
+            int v = 0;
+            while(first.recv(v)) {
+                second.send(v);
+            }
+            if(++relays_done == relays) {
+                second.close();
+            }
+        });
+    }
+    for(int i = 0; i < producers; ++i) {
+        iom.schedule([&, i]() {
+            for(int j = 0; j < per_producer; ++j) {
+                first.send(i);
+            }
+            if(++producers_done == producers) {
+                first.close();
+            }
+        });
+    }
+    wait_for(consumers_done, consumers);
+    uint64_t used = windgent::GetCurrentUS() - start;
+    ASSERT(received == (int64_t)per_producer * producers);
+    std::cout << "pipeline threads=" << threads << " fibers=" << fibers << " capacity=" << capacity
+              << " messages=" << received << " used=" << used / 1000 << "ms"
+              << " msg/s=" << received * 1000000 / (used ? used : 1) << std::endl;
+}
+
+//fibers个协程争抢同一把FiberMutex
+void bench_mutex(int threads, int fibers, int loops) {
+    windgent::IOManager iom(threads, false, "contend");
+    windgent::FiberMutex mutex;
+    int64_t value = 0;
+    std::atomic<int> done = {0};
+    uint64_t start = windgent::GetCurrentUS();
+    for(int i = 0; i < fibers; ++i) {
+        iom.schedule([&]() {
+            for(int j = 0; j < loops; ++j) {
+                windgent::FiberMutex::Lock lock(mutex);
+                ++value;
+            }
+            ++done;
+        });
+    }
+    wait_for(done, fibers);
+    uint64_t used = windgent::GetCurrentUS() - start;
+    ASSERT(value == (int64_t)fibers * loops);
+    std::cout << "mutex threads=" << threads << " fibers=" << fibers << " locks=" << value
+              << " used=" << used / 1000 << "ms" << " lock/s=" << value * 1000000 / (used ? used : 1) << std::endl;
+}
+
+//用法：test_fiber_sync [协程数] [消息数]
+int main(int argc, char** argv) {
+    int fibers = argc > 1 ? atoi(argv[1]) : 10000;
+    int messages = argc > 2 ? atoi(argv[2]) : 1000000;
+    {
+        windgent::IOManager a(4, false, "sync_a");
+        windgent::IOManager b(2, false, "sync_b");
+        test_mutex(a);
+        test_semaphore(a);
+        test_condition(a);
+        test_channel(a, b);
+    }
+
+    g_logger->setLevel(windgent::LogLevel::WARN);
+    LOG_NAME("system")->setLevel(windgent::LogLevel::WARN);
+    for(int threads : {1, 4}) {
+        for(size_t capacity : {0, 64, 1024}) {
+            bench_pipeline(threads, capacity, fibers, messages);
+        }
+        bench_mutex(threads, fibers, messages / fibers);
+    }
+    return 0;
+}
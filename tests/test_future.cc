@@ -0,0 +1,164 @@
+#include "../windgent/windgent.h"
+#include "../windgent/iomanager.h"
+#include "../windgent/future.h"
+
+#include <unistd.h>
+#include <atomic>
+#include <stdexcept>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+//模拟一次后端调用：协程中的usleep被hook，只挂起协程
+static std::string call_backend(const std::string& name, int delay_ms) {
+    usleep(delay_ms * 1000);
+    return name + ":" + std::to_string(delay_ms);
+}
+
+static void run_in(windgent::IOManager& iom, std::function<void()> cb) {
+    std::atomic<bool> done = {false};
+    iom.schedule([cb, &done]() {
+        cb();
+        done = true;
+    });
+    while(!done) {
+        usleep(1000);
+    }
+}
+
+void test_promise() {
+    windgent::Promise<int> p;
+    windgent::Future<int> f = p.getFuture();
+    ASSERT(f.valid() && !f.isReady());
+    ASSERT(!f.wait(10));
+    ASSERT(p.setValue(42));
+    ASSERT(!p.setValue(43));
+    ASSERT(f.isReady() && f.get() == 42 && !f.hasException());
+
+    windgent::Promise<std::string> pe;
+    windgent::Future<std::string> fe = pe.getFuture();
+    pe.setException(std::make_exception_ptr(std::runtime_error("backend down")));
+    bool thrown = false;
+    try {
+        fe.get();
+    } catch(std::runtime_error& e) {
+        thrown = std::string(e.what()) == "backend down";
+    }
+    ASSERT(thrown && fe.hasException());
+    LOG_INFO(g_logger) << "promise ok";
+}
+
+//3个后端调用：依次调用耗时是总和，Async并发后WhenAll只需要最慢的那个
+void test_fan_out(windgent::IOManager& iom) {
+    const int delays[] = {50, 80, 100};
+    run_in(iom, [&]() {
+        uint64_t start = windgent::GetCurrentMS();
+        std::string seq;
+        for(auto d : delays) {
+            seq += call_backend("b" + std::to_string(d), d);
+        }
+        uint64_t sequential = windgent::GetCurrentMS() - start;
+
+        start = windgent::GetCurrentMS();
+        std::vector<windgent::Future<std::string> > futures;
+        for(auto d : delays) {
+            futures.push_back(windgent::Async([d]() {
+                return call_backend("b" + std::to_string(d), d);
+            }));
+        }
+        ASSERT(windgent::WhenAll(std::vector<windgent::FutureBase>(futures.begin(), futures.end())));
+        std::string par;
+        for(auto& i : futures) {
+            par += i.get();
+        }
+        uint64_t parallel = windgent::GetCurrentMS() - start;
+        ASSERT(par == seq);
+        ASSERT(parallel < sequential * 2 / 3);
+        LOG_INFO(g_logger) << "fan out: sequential=" << sequential << "ms parallel=" << parallel << "ms";
+    });
+}
+
+//WhenAny返回最先完成的；超时的WhenAll在超时时返回，任务继续执行
+void test_any_and_timeout(windgent::IOManager& iom) {
+    run_in(iom, []() {
+        windgent::Future<std::string> slow = windgent::Async([]() { return call_backend("slow", 200); });
+        windgent::Future<int> fast = windgent::Async([]() { usleep(20 * 1000); return 7; });
+        ASSERT(windgent::WhenAny({slow, fast}) == 1);
+        ASSERT(fast.get() == 7 && !slow.isReady());
+
+        uint64_t start = windgent::GetCurrentMS();
+        ASSERT(!windgent::WhenAll({slow, fast}, 30));
+        uint64_t used = windgent::GetCurrentMS() - start;
+        ASSERT(used >= 25 && used < 150);
+        ASSERT(windgent::WhenAny({slow}, 10) == -1);
+        ASSERT(slow.get() == "slow:200");
+        LOG_INFO(g_logger) << "when_any/timeout ok, timeout used=" << used << "ms";
+    });
+
+    //非协程线程等待，超时用带超时的信号量
+    windgent::Future<int> f = windgent::Async([]() { usleep(50 * 1000); return 1; }, &iom);
+    ASSERT(!f.wait(5));
+    ASSERT(f.wait(1000) && f.get() == 1);
+    //异常从Async传到get
+    windgent::Future<int> fe = windgent::Async([]() -> int { throw std::logic_error("bad"); }, &iom);
+    ASSERT(windgent::WhenAll({fe}) && fe.hasException());
+    LOG_INFO(g_logger) << "thread wait ok";
+}
+
+//join：协程和线程都可以等待一个协程结束
+void test_join(windgent::IOManager& iom) {
+    std::atomic<int> steps = {0};
+    windgent::Fiber::ptr child(new windgent::Fiber([&steps]() {
+        for(int i = 0; i < 5; ++i) {
+            usleep(10 * 1000);
+            ++steps;
+        }
+    }));
+    iom.schedule(child);
+    run_in(iom, [&]() {
+        ASSERT(!child->join(5));
+        ASSERT(child->join());
+        ASSERT(steps == 5);
+    });
+    ASSERT(child->join());
+
+    windgent::Fiber::ptr sleeper(new windgent::Fiber([]() {
+        usleep(50 * 1000);
+    }));
+    iom.schedule(sleeper);
+    ASSERT(!sleeper->join(5));
+    ASSERT(sleeper->join());
+    ASSERT(sleeper->getState() == windgent::Fiber::TERM);
+
+    //没有调度过的协程被reset或销毁，等待者被唤醒而不是一直等下去
+    for(int destroy = 0; destroy < 2; ++destroy) {
+        windgent::Fiber::ptr never(new windgent::Fiber([]() {}));
+        windgent::Fiber* raw = never.get();
+        std::atomic<int> joined = {0};
+        iom.schedule([raw, &joined]() {
+            joined = raw->join(2000) ? 1 : -1;
+        });
+        usleep(20 * 1000);
+        ASSERT(joined == 0);
+        if(destroy) {
+            never.reset();
+        } else {
+            never->reset([]() {});
+        }
+        uint64_t start = windgent::GetCurrentMS();
+        while(!joined) {
+            usleep(1000);
+        }
+        ASSERT(joined == 1 && windgent::GetCurrentMS() - start < 1000);
+    }
+    LOG_INFO(g_logger) << "join ok";
+}
+
+int main(int argc, char** argv) {
+    LOG_NAME("system")->setLevel(windgent::LogLevel::WARN);
+    test_promise();
+    windgent::IOManager iom(2, false, "future");
+    test_fan_out(iom);
+    test_any_and_timeout(iom);
+    test_join(iom);
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include "../windgent/windgent.h"
+#include "../windgent/iomanager.h"
+#include "../windgent/fd_manager.h"
+
+#include <sys/socket.h>
+#include <atomic>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+//统计堆分配次数，替换glibc的malloc系列函数
+static std::atomic<bool> s_counting = {false};
+static std::atomic<uint64_t> s_mallocs = {0};
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+    if(s_counting) {
+        ++s_mallocs;
+    }
+    return __libc_malloc(size);
+}
+void* calloc(size_t n, size_t size) {
+    if(s_counting) {
+        ++s_mallocs;
+    }
+    return __libc_calloc(n, size);
+}
+void* realloc(void* ptr, size_t size) {
+    if(s_counting) {
+        ++s_mallocs;
+    }
+    return __libc_realloc(ptr, size);
+}
+}
+
+//socketpair没有被hook，需要手动创建FdCtx，fd才会被设置为非阻塞，由IOManager等待
+static void make_pair(int fds[2]) {
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    windgent::FdMgr::GetInstance()->get(fds[0], true);
+    windgent::FdMgr::GetInstance()->get(fds[1], true);
+}
+
+static void set_timeout(int fd, int ms) {
+    struct timeval tv = {ms / 1000, (ms % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+//两个协程通过socketpair来回收发，每次recv都会EAGAIN -> 挂起 -> 被唤醒，统计稳定后的堆分配次数
+void test_ping_pong() {
+    int fds[2];
+    make_pair(fds);
+    const int warmup = 1000;
+    const int rounds = 100000;
+    windgent::IOManager* iom = windgent::IOManager::GetThis();
+    iom->schedule([fds]() {
+        set_timeout(fds[1], 5000);
+        char c;
+        for(int i = 0; i < warmup + rounds; ++i) {
+            ASSERT(recv(fds[1], &c, 1, 0) == 1);
+            ASSERT(send(fds[1], &c, 1, 0) == 1);
+        }
+        //等统计结束后再退出，协程的销毁不计入
+        ASSERT(recv(fds[1], &c, 1, 0) == 1);
+        close(fds[0]);
+        close(fds[1]);
+    });
+    set_timeout(fds[0], 5000);
+    char c = 'x';
+    uint64_t start = 0;
+    for(int i = 0; i < warmup + rounds; ++i) {
+        if(i == warmup) {
+            start = windgent::GetCurrentUS();
+            s_mallocs = 0;
+            s_counting = true;
+        }
+        ASSERT(send(fds[0], &c, 1, 0) == 1);
+        ASSERT(recv(fds[0], &c, 1, 0) == 1);
+    }
+    s_counting = false;
+    uint64_t used = windgent::GetCurrentUS() - start;
+    ASSERT(send(fds[0], &c, 1, 0) == 1);
+    LOG_INFO(g_logger) << "ping-pong rounds=" << rounds << " mallocs=" << s_mallocs
+                       << " ns/round=" << used * 1000 / rounds;
+    ASSERT(s_mallocs == 0);
+}
+
+//超时后复用的定时器应该能再次超时，也能在数据到来时被正常取消
+void test_timeout() {
+    int fds[2];
+    make_pair(fds);
+    set_timeout(fds[0], 50);
+    char c = 'x';
+    for(int i = 0; i < 3; ++i) {
+        uint64_t start = windgent::GetCurrentMS();
+        ASSERT(recv(fds[0], &c, 1, 0) == -1 && errno == ETIMEDOUT);
+        uint64_t used = windgent::GetCurrentMS() - start;
+        ASSERT(used >= 50 && used < 500);
+    }
+    windgent::IOManager::GetThis()->addTimer(20, [fds]() {
+        send(fds[1], "y", 1, 0);
+    });
+    ASSERT(recv(fds[0], &c, 1, 0) == 1 && c == 'y');
+    //上一次等待的定时器已取消，之后的等待按新的截止时刻超时
+    uint64_t start = windgent::GetCurrentMS();
+    ASSERT(recv(fds[0], &c, 1, 0) == -1 && errno == ETIMEDOUT);
+    ASSERT(windgent::GetCurrentMS() - start >= 50);
+    LOG_INFO(g_logger) << "timeout ok";
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main(int argc, char** argv) {
+    windgent::IOManager iom(1, false, "alloc");
+    iom.schedule([]() {
+        test_timeout();
+        test_ping_pong();
+    });
+    return 0;
+}
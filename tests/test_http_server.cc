@@ -24,6 +24,8 @@ void test() {
         rsp->setBody("Glob:\r\n" + req->toString());
         return 0;
     });
+    //当前目录下的文件：/static/a.txt -> ./a.txt
+    sd->addGlobServlet("/static/*", windgent::http::StaticFileServlet::ptr(new windgent::http::StaticFileServlet(".", "/static")));
     http_server->start();
 }
 
@@ -0,0 +1,381 @@
+#include "../windgent/windgent.h"
+#include "../windgent/iomanager.h"
+#include "../windgent/fd_manager.h"
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <dlfcn.h>
+#include <atomic>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <string.h>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+//统计epoll相关的系统调用次数，替换libc的epoll_ctl/epoll_wait（环境里没有strace时也能对比）
+static std::atomic<uint64_t> s_epoll_ctl = {0};
+static std::atomic<uint64_t> s_epoll_wait = {0};
+
+extern "C" {
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event) {
+    static auto real = (int (*)(int, int, int, struct epoll_event*))dlsym(RTLD_NEXT, "epoll_ctl");
+    ++s_epoll_ctl;
+    return real(epfd, op, fd, event);
+}
+int epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout) {
+    static auto real = (int (*)(int, struct epoll_event*, int, int))dlsym(RTLD_NEXT, "epoll_wait");
+    ++s_epoll_wait;
+    return real(epfd, events, maxevents, timeout);
+}
+}
+
+//socketpair没有被hook，需要手动创建FdCtx，fd才会被设置为非阻塞，由IOManager等待
+static void make_pair(int fds[2]) {
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    windgent::FdMgr::GetInstance()->get(fds[0], true);
+    windgent::FdMgr::GetInstance()->get(fds[1], true);
+}
+
+static void set_timeout(int fd, int type, int ms) {
+    struct timeval tv = {ms / 1000, (ms % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, type, &tv, sizeof(tv));
+}
+
+//读超时：io_uring后端由链接的超时请求取消recv
+void test_timeout() {
+    int fds[2];
+    make_pair(fds);
+    set_timeout(fds[0], SO_RCVTIMEO, 50);
+    char c = 'x';
+    uint64_t start = windgent::GetCurrentMS();
+    ASSERT(recv(fds[0], &c, 1, 0) == -1 && errno == ETIMEDOUT);
+    uint64_t used = windgent::GetCurrentMS() - start;
+    ASSERT(used >= 45 && used < 500);
+    //超时之后fd仍然可以正常读写
+    ASSERT(send(fds[1], "y", 1, 0) == 1);
+    ASSERT(recv(fds[0], &c, 1, 0) == 1 && c == 'y');
+    close(fds[0]);
+    close(fds[1]);
+    LOG_INFO(g_logger) << "timeout ok, used=" << used << "ms";
+}
+
+//等待中的fd被其他协程关闭，等待的协程应该被唤醒并返回错误
+void test_close() {
+    int fds[2];
+    make_pair(fds);
+    int fd = fds[0];
+    windgent::IOManager::GetThis()->addTimer(20, [fd]() {
+        close(fd);
+    });
+    char c;
+    ASSERT(recv(fds[0], &c, 1, 0) == -1);
+    LOG_INFO(g_logger) << "close ok, errno=" << errno << " " << strerror(errno);
+    close(fds[1]);
+}
+
+//等待中的fd对端关闭，EPOLLHUP只唤醒添加过的读事件
+void test_peer_close() {
+    int fds[2];
+    make_pair(fds);
+    int fd = fds[1];
+    windgent::IOManager::GetThis()->addTimer(20, [fd]() {
+        close(fd);
+    });
+    char c;
+    ASSERT(recv(fds[0], &c, 1, 0) == 0);
+    close(fds[0]);
+    LOG_INFO(g_logger) << "peer close ok";
+}
+
+//回环地址上的accept/connect/send/recv
+void test_tcp() {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT(listen_fd >= 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = 0;
+    ASSERT(bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+    ASSERT(listen(listen_fd, 16) == 0);
+    socklen_t len = sizeof(addr);
+    ASSERT(getsockname(listen_fd, (sockaddr*)&addr, &len) == 0);
+
+    windgent::IOManager::GetThis()->schedule([addr]() {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT(connect(fd, (const sockaddr*)&addr, sizeof(addr)) == 0);
+        ASSERT(send(fd, "hello", 5, 0) == 5);
+        close(fd);
+    });
+
+    int fd = accept(listen_fd, nullptr, nullptr);
+    ASSERT(fd >= 0);
+    char buf[8] = {0};
+    ASSERT(recv(fd, buf, sizeof(buf), 0) == 5);
+    ASSERT(memcmp(buf, "hello", 5) == 0);
+    close(fd);
+    close(listen_fd);
+    LOG_INFO(g_logger) << "tcp ok";
+}
+
+//持久注册过的fd绕过hook直接关闭，fd号被新的socket复用后，在它上面的等待仍然能被唤醒
+void test_reused_fd() {
+    int fds[2];
+    make_pair(fds);
+    int old_fd = fds[0];
+    int peer = fds[1];
+    windgent::IOManager::GetThis()->addTimer(10, [peer]() {
+        send(peer, "x", 1, 0);
+    });
+    char c;
+    ASSERT(recv(old_fd, &c, 1, 0) == 1);
+    syscall(SYS_close, old_fd);
+    close(peer);
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT(listen_fd == old_fd);
+    set_timeout(listen_fd, SO_RCVTIMEO, 2000);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    ASSERT(bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+    ASSERT(listen(listen_fd, 16) == 0);
+    socklen_t len = sizeof(addr);
+    ASSERT(getsockname(listen_fd, (sockaddr*)&addr, &len) == 0);
+    windgent::IOManager::GetThis()->addTimer(20, [addr]() {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT(connect(fd, (const sockaddr*)&addr, sizeof(addr)) == 0);
+        close(fd);
+    });
+    int fd = accept(listen_fd, nullptr, nullptr);
+    ASSERT(fd >= 0);
+    close(fd);
+    close(listen_fd);
+
+    //fd号被没有单独hook等待的socketpair复用
+    int pair[2];
+    make_pair(pair);
+    windgent::IOManager::GetThis()->addTimer(10, [pair]() {
+        send(pair[1], "x", 1, 0);
+    });
+    ASSERT(recv(pair[0], &c, 1, 0) == 1);
+    old_fd = pair[0];
+    syscall(SYS_close, pair[0]);
+    syscall(SYS_close, pair[1]);
+    make_pair(pair);
+    ASSERT(pair[0] == old_fd);
+    set_timeout(pair[0], SO_RCVTIMEO, 2000);
+    peer = pair[1];
+    windgent::IOManager::GetThis()->addTimer(10, [peer]() {
+        send(peer, "y", 1, 0);
+    });
+    ASSERT(recv(pair[0], &c, 1, 0) == 1 && c == 'y');
+    close(pair[0]);
+    close(pair[1]);
+    LOG_INFO(g_logger) << "reused fd ok";
+}
+
+//两个协程通过socketpair来回收发，每次recv都要等待对端
+void test_ping_pong(const std::string& backend) {
+    int fds[2];
+    make_pair(fds);
+    const int rounds = 100000;
+    windgent::IOManager::GetThis()->schedule([fds]() {
+        char c;
+        for(int i = 0; i < rounds; ++i) {
+            ASSERT(recv(fds[1], &c, 1, 0) == 1);
+            ASSERT(send(fds[1], &c, 1, 0) == 1);
+        }
+    });
+    char c = 'x';
+    //先来回一次，让两端都完成第一次等待
+    ASSERT(send(fds[0], &c, 1, 0) == 1);
+    ASSERT(recv(fds[0], &c, 1, 0) == 1);
+    uint64_t ctl = s_epoll_ctl;
+    uint64_t wait = s_epoll_wait;
+    uint64_t start = windgent::GetCurrentUS();
+    for(int i = 1; i < rounds; ++i) {
+        ASSERT(send(fds[0], &c, 1, 0) == 1);
+        ASSERT(recv(fds[0], &c, 1, 0) == 1);
+    }
+    uint64_t used = windgent::GetCurrentUS() - start;
+    ctl = s_epoll_ctl - ctl;
+    wait = s_epoll_wait - wait;
+    close(fds[0]);
+    close(fds[1]);
+    LOG_INFO(g_logger) << backend << " ping-pong rounds=" << rounds << " used=" << used / 1000
+                       << "ms rounds/s=" << rounds * 1000000ull / used
+                       << " epoll_ctl=" << ctl << " epoll_wait=" << wait;
+    //持久注册之后收发不再需要epoll_ctl
+    if(backend == "epoll") {
+        ASSERT(ctl == 0);
+    }
+}
+
+//大量fd同时就绪：一次唤醒取到的事件超过初始的事件数组大小，就绪的协程批量放入调度队列
+void test_many_ready(const std::string& backend) {
+    const int n = 300;
+    std::vector<int> fds(n * 2);
+    std::shared_ptr<std::atomic<int> > started(new std::atomic<int>(0));
+    std::shared_ptr<std::atomic<int> > done(new std::atomic<int>(0));
+    for(int i = 0; i < n; ++i) {
+        make_pair(&fds[i * 2]);
+        int fd = fds[i * 2];
+        windgent::IOManager::GetThis()->schedule([fd, started, done]() {
+            char c;
+            ++*started;
+            ASSERT(recv(fd, &c, 1, 0) == 1);
+            ++*done;
+        });
+    }
+    //只有一个调度线程，所有协程都开始执行之后一定已经挂起在recv上
+    while(*started != n) {
+        windgent::Fiber::YieldToReady();
+    }
+    uint64_t wait = s_epoll_wait;
+    for(int i = 0; i < n; ++i) {
+        ASSERT(send(fds[i * 2 + 1], "x", 1, 0) == 1);
+    }
+    while(*done != n) {
+        usleep(1000);
+    }
+    wait = s_epoll_wait - wait;
+    for(auto fd : fds) {
+        close(fd);
+    }
+    LOG_INFO(g_logger) << backend << " many ready fds=" << n << " epoll_wait=" << wait;
+}
+
+//epoll_oneshot：每次等待都用epoll_ctl添加/删除事件；epoll：持久注册
+void run(const std::string& backend) {
+    windgent::ConfigMgr::Lookup<std::string>("iomanager.backend")->setVal(backend == "io_uring" ? "io_uring" : "epoll");
+    windgent::ConfigMgr::Lookup<bool>("iomanager.epoll_persistent")->setVal(backend == "epoll");
+    windgent::IOManager iom(1, false, backend);
+    LOG_INFO(g_logger) << "backend=" << backend << " isUring=" << iom.isUring();
+    iom.schedule([backend]() {
+        test_timeout();
+        test_close();
+        test_peer_close();
+        test_tcp();
+        test_reused_fd();
+        test_ping_pong(backend);
+        test_many_ready(backend);
+    });
+}
+
+//fd在IOManager b上持久注册之后，在另一个IOManager a的线程上关闭，fd号又被a上新建的socket复用（TcpServer在accept_worker上
+//accept、在worker上处理连接就是这种情况）。b上的等待要发现fd已经换了，重新注册，而不是一直等下去
+void test_two_iomanagers() {
+    windgent::ConfigMgr::Lookup<std::string>("iomanager.backend")->setVal("epoll");
+    windgent::ConfigMgr::Lookup<bool>("iomanager.epoll_persistent")->setVal(true);
+    windgent::IOManager b(1, false, "iom_b");
+    windgent::IOManager a(1, false, "iom_a");
+    std::atomic<int> step = {0};
+    std::atomic<int> old_fd = {-1};
+    std::atomic<int> peer = {-1};
+    std::atomic<int> listen_fd = {-1};
+    b.schedule([&]() {
+        int fds[2];
+        make_pair(fds);
+        int p = fds[1];
+        windgent::IOManager::GetThis()->addTimer(10, [p]() {
+            send(p, "x", 1, 0);
+        });
+        char c;
+        ASSERT(recv(fds[0], &c, 1, 0) == 1);
+        old_fd = fds[0];
+        peer = fds[1];
+        step = 1;
+    });
+    while(step != 1) {
+        usleep(1000);
+    }
+    a.schedule([&]() {
+        close(old_fd);
+        close(peer);
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT(fd == old_fd);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        ASSERT(bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+        ASSERT(listen(fd, 16) == 0);
+        socklen_t len = sizeof(addr);
+        ASSERT(getsockname(fd, (sockaddr*)&addr, &len) == 0);
+        set_timeout(fd, SO_RCVTIMEO, 2000);
+        listen_fd = fd;
+        windgent::IOManager::GetThis()->addTimer(20, [addr]() {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            ASSERT(connect(fd, (const sockaddr*)&addr, sizeof(addr)) == 0);
+            close(fd);
+        });
+        step = 2;
+    });
+    while(step != 2) {
+        usleep(1000);
+    }
+    b.schedule([&]() {
+        uint64_t start = windgent::GetCurrentMS();
+        int fd = accept(listen_fd, nullptr, nullptr);
+        uint64_t used = windgent::GetCurrentMS() - start;
+        LOG_INFO(g_logger) << "two iomanagers accept fd=" << fd << " used=" << used << "ms";
+        ASSERT(fd >= 0 && used < 1000);
+        close(fd);
+        close(listen_fd);
+        step = 3;
+    });
+    while(step != 3) {
+        usleep(1000);
+    }
+    LOG_INFO(g_logger) << "two iomanagers ok";
+}
+
+//use_caller的线程在调度器开始运行前不是调度线程，io_uring不会替它提交请求，connect要自己发起。
+//Unix域socket的非阻塞connect立即完成，不需要等待
+void test_non_worker_connect() {
+    windgent::ConfigMgr::Lookup<std::string>("iomanager.backend")->setVal("io_uring");
+    windgent::IOManager iom(1, true, "uring_caller");
+    if(!iom.isUring()) {
+        return;
+    }
+    windgent::set_hook_enable(true);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    //抽象命名空间
+    snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "windgent_uring_%d", getpid());
+    socklen_t len = offsetof(sockaddr_un, sun_path) + 1 + strlen(addr.sun_path + 1);
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT(bind(listen_fd, (sockaddr*)&addr, len) == 0);
+    ASSERT(listen(listen_fd, 16) == 0);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT(connect(fd, (sockaddr*)&addr, len) == 0);
+    sockaddr_un peer;
+    socklen_t peer_len = sizeof(peer);
+    ASSERT(getpeername(fd, (sockaddr*)&peer, &peer_len) == 0);
+    int conn = accept(listen_fd, nullptr, nullptr);
+    ASSERT(conn >= 0);
+    close(conn);
+    close(fd);
+    close(listen_fd);
+    windgent::set_hook_enable(false);
+    LOG_INFO(g_logger) << "non-worker connect ok";
+}
+
+//可以指定只运行一个后端，便于用strace -c -f统计系统调用
+int main(int argc, char** argv) {
+    if(argc > 1) {
+        run(argv[1]);
+        return 0;
+    }
+    run("epoll_oneshot");
+    run("epoll");
+    run("io_uring");
+    test_two_iomanagers();
+    test_non_worker_connect();
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include "../windgent/mpsc_queue.h"
+#include "../windgent/mutex.h"
+#include "../windgent/thread.h"
+#include "../windgent/log.h"
+#include "../windgent/macro.h"
+#include "../windgent/util.h"
+
+#include <list>
+#include <functional>
+#include <sched.h>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+//模拟调度器中的一个任务
+struct Task {
+    std::function<void()> cb;
+    int threadId = -1;
+};
+
+static const size_t s_total = 2000000;         //每轮测试的任务总数
+
+//原来的实现：std::list + 互斥锁，每次入队申请一个链表结点，消费者每次加锁取一个
+class ListQueue {
+public:
+    void push(Task& t) {
+        windgent::Mutex::Lock lock(m_mutex);
+        m_tasks.push_back(std::move(t));
+    }
+    size_t consume(std::atomic<size_t>& sum) {
+        windgent::Mutex::Lock lock(m_mutex);
+        if(m_tasks.empty()) {
+            return 0;
+        }
+        Task t = std::move(m_tasks.front());
+        m_tasks.pop_front();
+        lock.unlock();
+        t.cb();
+        return 1;
+    }
+private:
+    windgent::Mutex m_mutex;
+    std::list<Task> m_tasks;
+};
+
+//无锁队列：生产者无锁入队，消费者取得消费权后批量出队
+class InboxQueue {
+public:
+    InboxQueue() :m_queue(4096) { }
+    void push(Task& t) {
+        while(!m_queue.push(t)) {
+            sched_yield();
+        }
+    }
+    size_t consume(std::atomic<size_t>& sum) {
+        if(m_queue.empty() || !m_queue.tryLockConsumer()) {
+            return 0;
+        }
+        size_t n = m_queue.popBatch([](Task& t) {
+            t.cb();
+        }, 256);
+        m_queue.unlockConsumer();
+        return n;
+    }
+private:
+    windgent::MPSCQueue<Task> m_queue;
+};
+
+template<class Queue>
+void bench(const std::string& name, int producers, int consumers) {
+    Queue q;
+    size_t total = s_total / producers * producers;
+    std::atomic<size_t> sum = {0};
+    std::atomic<size_t> consumed = {0};
+    std::vector<windgent::Thread::ptr> thrs;
+
+    uint64_t start = windgent::GetCurrentUS();
+    for(int i = 0; i < consumers; ++i) {
+        thrs.push_back(windgent::Thread::ptr(new windgent::Thread([&q, &sum, &consumed, total]() {
+            while(consumed < total) {
+                size_t n = q.consume(sum);
+                if(n) {
+                    consumed += n;
+                } else {
+                    sched_yield();
+                }
+            }
+        }, "consumer_" + std::to_string(i))));
+    }
+    for(int i = 0; i < producers; ++i) {
+        thrs.push_back(windgent::Thread::ptr(new windgent::Thread([&q, &sum, producers]() {
+            for(size_t j = 0; j < s_total / producers; ++j) {
+                Task t;
+                t.cb = [&sum]() { ++sum; };
+                q.push(t);
+            }
+        }, "producer_" + std::to_string(i))));
+    }
+    for(auto& i : thrs) {
+        i->join();
+    }
+    uint64_t used = windgent::GetCurrentUS() - start;
+    ASSERT(sum == total);
+    LOG_INFO(g_logger) << name << " producers=" << producers << " consumers=" << consumers
+                       << " tasks=" << sum << " used=" << used / 1000 << "ms"
+                       << " ops/s=" << (uint64_t)(sum * 1000000.0 / used);
+}
+
+int main(int argc, char** argv) {
+    int cases[][2] = {{1, 1}, {4, 1}, {4, 4}, {8, 2}, {16, 4}};
+    for(auto& c : cases) {
+        bench<ListQueue>("list+mutex", c[0], c[1]);
+        bench<InboxQueue>("mpsc_queue", c[0], c[1]);
+    }
+    return 0;
+}
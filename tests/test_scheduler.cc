@@ -1,4 +1,5 @@
 #include "../windgent/windgent.h"
+#include <map>
 
 static windgent::Logger::ptr g_logger = LOG_ROOT();
 
@@ -14,15 +15,36 @@ void test_fiber() {
     }
 }
 
+//在调度线程中一次调度大量任务，任务都进入该线程的本地队列，其他空闲线程会从中窃取
+void test_steal() {
+    static std::atomic<int> s_done = {0};
+    static windgent::Mutex s_mutex;
+    static std::map<int, int> s_counts;     //线程id -> 执行的任务数
+    for(int i = 0; i < 1000; ++i) {
+        windgent::Scheduler::GetThis()->schedule([](){
+            windgent::set_hook_enable(false);
+            usleep(100);
+            windgent::Mutex::Lock lock(s_mutex);
+            ++s_counts[windgent::GetThreadId()];
+            if(++s_done == 1000) {
+                for(auto& i : s_counts) {
+                    LOG_INFO(g_logger) << "thread " << i.first << " ran " << i.second << " tasks";
+                }
+            }
+        });
+    }
+}
+
 int main(int argc, char** argv) {
     g_logger->setLevel(windgent::LogLevel::INFO);
     windgent::Thread::SetName("main");
     LOG_INFO(g_logger) << "main start";
-    windgent::Scheduler sc(2, false, "test");
+    windgent::Scheduler sc(3, false, "test");
     sc.start();
     sleep(2);
     LOG_INFO(g_logger) << "schedule";
     sc.schedule(&test_fiber);
+    sc.schedule(&test_steal);
     sc.stop();
     LOG_INFO(g_logger) << "main over";
 
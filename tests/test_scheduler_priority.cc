@@ -0,0 +1,135 @@
+#include "../windgent/windgent.h"
+#include "../windgent/iomanager.h"
+
+#include <unistd.h>
+#include <atomic>
+#include <algorithm>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+static windgent::ConfigVar<uint32_t>::ptr g_interval = windgent::ConfigMgr::Lookup<uint32_t>("scheduler.starvation_interval");
+
+//不让出CPU地执行us微秒，模拟解析请求体等计算
+static void spin_us(uint64_t us) {
+    uint64_t end = windgent::GetCurrentUS() + us;
+    while(windgent::GetCurrentUS() < end);
+}
+
+//占住单线程调度器的唯一线程，直到open为true，期间提交的任务都在队列中排队
+static void block_worker(windgent::IOManager& iom, std::atomic<bool>& open) {
+    std::atomic<bool> started = {false};
+    iom.schedule([&open, &started]() {
+        started = true;
+        while(!open);
+    });
+    while(!started) {
+        usleep(100);
+    }
+}
+
+//同时排队的任务按高、普通、低的顺序执行；挂起后重新调度的函数任务保持提交时的优先级
+void test_order(windgent::IOManager& iom) {
+    g_interval->setVal(0);
+    std::atomic<bool> open = {false};
+    block_worker(iom, open);
+    std::vector<int> order;
+    std::atomic<int> done = {0};
+    const int prios[] = {windgent::Fiber::PRIORITY_LOW, windgent::Fiber::PRIORITY_NORMAL, windgent::Fiber::PRIORITY_HIGH, -1};
+    for(int i = 0; i < 3; ++i) {
+        for(auto p : prios) {
+            iom.schedule([&order, &done, p]() {
+                order.push_back(p < 0 ? windgent::Fiber::PRIORITY_NORMAL : p);
+                ++done;
+            }, -1, 0, p);
+        }
+    }
+    iom.schedule([&done]() {
+        usleep(1000);
+        ASSERT(windgent::Fiber::GetCurrent()->getPriority() == windgent::Fiber::PRIORITY_LOW);
+        ++done;
+    }, -1, 0, windgent::Fiber::PRIORITY_LOW);
+    open = true;
+    while(done < 13) {
+        usleep(1000);
+    }
+    ASSERT(std::is_sorted(order.begin(), order.end()));
+    LOG_INFO(g_logger) << "order ok";
+}
+
+//高优先级任务持续排队时，低优先级任务最迟在第starvation_interval个任务时得到执行
+void test_starvation(windgent::IOManager& iom) {
+    for(uint32_t interval : {0u, 16u}) {
+        g_interval->setVal(interval);
+        std::atomic<bool> open = {false};
+        block_worker(iom, open);
+        std::atomic<int> seq = {0};
+        std::atomic<int> low_pos = {-1};
+        std::atomic<int> normal_pos = {-1};
+        iom.schedule([&]() { low_pos = seq++; }, -1, 0, windgent::Fiber::PRIORITY_LOW);
+        iom.schedule([&]() { normal_pos = seq++; }, -1, 0, windgent::Fiber::PRIORITY_NORMAL);
+        const int highs = 64;
+        for(int i = 0; i < highs; ++i) {
+            iom.schedule([&]() { ++seq; }, -1, 0, windgent::Fiber::PRIORITY_HIGH);
+        }
+        windgent::Scheduler::QueueStats before = iom.getQueueStats();
+        open = true;
+        while(seq < highs + 2) {
+            usleep(1000);
+        }
+        windgent::Scheduler::QueueStats after = iom.getQueueStats();
+        if(interval == 0) {
+            ASSERT(normal_pos == highs && low_pos == highs + 1);
+        } else {
+            ASSERT(low_pos < (int)interval * 2 && normal_pos < (int)interval * 2);
+            ASSERT(after.rescued - before.rescued >= 2);
+        }
+        ASSERT(after.dequeued[windgent::Fiber::PRIORITY_HIGH] - before.dequeued[windgent::Fiber::PRIORITY_HIGH] == highs);
+        LOG_INFO(g_logger) << "starvation_interval=" << interval << ": normal ran at " << normal_pos
+                           << ", low ran at " << low_pos << " of " << highs + 2;
+    }
+    g_interval->setVal(16);
+}
+
+//大请求（每个bulk_us微秒的计算）排满队列时，每隔1ms到来一个小请求，统计小请求从提交到开始执行的排队时间
+void bench_latency(windgent::IOManager& iom, bool use_priority) {
+    const int bulks = 300;
+    const int bulk_us = 2000;
+    const int smalls = 200;
+    std::atomic<int> done = {0};
+    std::vector<uint64_t> latency(smalls);
+    for(int i = 0; i < bulks; ++i) {
+        iom.schedule([&done]() {
+            spin_us(bulk_us);
+            ++done;
+        }, -1, 0, use_priority ? windgent::Fiber::PRIORITY_LOW : -1);
+    }
+    for(int i = 0; i < smalls; ++i) {
+        uint64_t submit = windgent::GetCurrentUS();
+        iom.schedule([&done, &latency, i, submit]() {
+            latency[i] = windgent::GetCurrentUS() - submit;
+            ++done;
+        }, -1, 0, use_priority ? windgent::Fiber::PRIORITY_HIGH : -1);
+        usleep(1000);
+    }
+    while(done < bulks + smalls) {
+        usleep(1000);
+    }
+    std::sort(latency.begin(), latency.end());
+    std::cout << (use_priority ? "priority " : "fifo     ") << " small request queueing: p50="
+              << latency[smalls / 2] / 1000.0 << "ms p99=" << latency[smalls * 99 / 100] / 1000.0
+              << "ms max=" << latency.back() / 1000.0 << "ms" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    LOG_NAME("system")->setLevel(windgent::LogLevel::WARN);
+    {
+        windgent::IOManager iom(1, false, "prio1");
+        test_order(iom);
+        test_starvation(iom);
+    }
+    windgent::IOManager iom(2, false, "prio2");
+    bench_latency(iom, false);
+    bench_latency(iom, true);
+    iom.dump(std::cout) << std::endl;
+    return 0;
+}
@@ -0,0 +1,257 @@
+#include "../windgent/windgent.h"
+#include "../windgent/iomanager.h"
+#include "../windgent/fd_manager.h"
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <atomic>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+//统计epoll_wait的次数，每次返回都是一次线程唤醒（或超时）。s_epoll_block只统计会阻塞的调用，不包括从共享IO epoll取事件
+static std::atomic<uint64_t> s_epoll_wait = {0};
+static std::atomic<uint64_t> s_epoll_block = {0};
+
+extern "C" {
+int epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout) {
+    static auto real = (int (*)(int, struct epoll_event*, int, int))dlsym(RTLD_NEXT, "epoll_wait");
+    ++s_epoll_wait;
+    if(timeout) {
+        ++s_epoll_block;
+    }
+    return real(epfd, events, maxevents, timeout);
+}
+}
+
+static std::atomic<int> s_done = {0};
+
+static void report(const char* name, windgent::IOManager& iom
+                   , const windgent::Scheduler::WakeupStats& before, uint64_t waits) {
+    windgent::Scheduler::WakeupStats after = iom.getWakeupStats();
+    uint64_t wakeups = after.wakeups - before.wakeups;
+    uint64_t useful = after.useful - before.useful;
+    LOG_INFO(g_logger) << name << ": tickles=" << after.tickles - before.tickles
+                       << " suppressed=" << after.suppressed - before.suppressed
+                       << " wakeups=" << wakeups << " useful=" << useful
+                       << " useful%=" << (wakeups ? useful * 100 / wakeups : 0)
+                       << " epoll_wait=" << s_epoll_wait - waits;
+}
+
+//非调度线程分批提交短任务，每批之间所有线程都会睡着
+void test_burst(windgent::IOManager& iom) {
+    const int batches = 200;
+    const int per_batch = 50;
+    s_done = 0;
+    windgent::Scheduler::WakeupStats before = iom.getWakeupStats();
+    uint64_t waits = s_epoll_wait;
+    for(int i = 0; i < batches; ++i) {
+        for(int j = 0; j < per_batch; ++j) {
+            iom.schedule([]() {
+                ++s_done;
+            });
+        }
+        usleep(1000);
+    }
+    while(s_done != batches * per_batch) {
+        usleep(1000);
+    }
+    report("burst", iom, before, waits);
+}
+
+//指定线程的任务只唤醒那个线程
+void test_pinned(windgent::IOManager& iom) {
+    std::atomic<int> tid = {0};
+    iom.schedule([&tid]() {
+        tid = windgent::GetThreadId();
+    });
+    while(!tid) {
+        usleep(1000);
+    }
+    const int n = 2000;
+    s_done = 0;
+    std::atomic<int> wrong = {0};
+    windgent::Scheduler::WakeupStats before = iom.getWakeupStats();
+    uint64_t waits = s_epoll_wait;
+    for(int i = 0; i < n; ++i) {
+        iom.schedule([&tid, &wrong]() {
+            if(windgent::GetThreadId() != tid) {
+                ++wrong;
+            }
+            ++s_done;
+        }, tid);
+        if(i % 10 == 0) {
+            usleep(500);
+        }
+    }
+    while(s_done != n) {
+        usleep(1000);
+    }
+    ASSERT(wrong == 0);
+    report("pinned", iom, before, waits);
+}
+
+//调度线程上的协程不断产生新任务，只在有睡眠线程时才唤醒，且同一时刻最多一个线程在找任务
+void test_fanout(windgent::IOManager& iom) {
+    const int n = 20000;
+    s_done = 0;
+    windgent::Scheduler::WakeupStats before = iom.getWakeupStats();
+    uint64_t waits = s_epoll_wait;
+    iom.schedule([&iom]() {
+        for(int i = 0; i < n; ++i) {
+            iom.schedule([]() {
+                ++s_done;
+            });
+            if(i % 100 == 0) {
+                usleep(200);
+            }
+        }
+    });
+    while(s_done != n) {
+        usleep(1000);
+    }
+    report("fanout", iom, before, waits);
+}
+
+//等待fd的协程所在的线程被一个长任务占住，fd就绪后由其他空闲线程取到事件并恢复协程
+void test_busy_owner(windgent::IOManager& iom) {
+    int fds[2];
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    windgent::FdMgr::GetInstance()->get(fds[0], true);
+    std::atomic<int> tid = {0};
+    std::atomic<uint64_t> woke = {0};
+    iom.schedule([&tid, &woke, fds]() {
+        tid = windgent::GetThreadId();
+        char c;
+        ASSERT(recv(fds[0], &c, 1, 0) == 1);
+        close(fds[0]);
+        woke = windgent::GetCurrentMS();
+    });
+    while(!tid) {
+        usleep(1000);
+    }
+    usleep(10000);
+    std::atomic<bool> spin = {true};
+    std::atomic<bool> spun = {false};
+    iom.schedule([&spin, &spun]() {
+        while(spin) {
+        }
+        spun = true;
+    }, tid);
+    usleep(10000);
+    uint64_t start = windgent::GetCurrentMS();
+    ASSERT(write(fds[1], "x", 1) == 1);
+    while(!woke && windgent::GetCurrentMS() - start < 2000) {
+        usleep(1000);
+    }
+    spin = false;
+    while(!spun) {
+        usleep(1000);
+    }
+    ASSERT(woke);
+    LOG_INFO(g_logger) << "busy owner: resumed after " << woke - start << "ms";
+    ASSERT(woke - start < 1000);
+    close(fds[1]);
+}
+
+//所有线程都在睡眠时fd逐个变为可读：每次只有一个线程被唤醒，它自己执行就绪的协程，不会再为这个协程唤醒其他线程
+void test_io_ready(windgent::IOManager& iom, const char* name) {
+    const int pairs = 8;
+    const int rounds = 200;
+    int fds[pairs][2];
+    s_done = 0;
+    for(int i = 0; i < pairs; ++i) {
+        ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]) == 0);
+        windgent::FdMgr::GetInstance()->get(fds[i][0], true);
+        int fd = fds[i][0];
+        iom.schedule([fd]() {
+            char c;
+            while(recv(fd, &c, 1, 0) == 1) {
+                ++s_done;
+            }
+            close(fd);
+            ++s_done;
+        });
+    }
+    usleep(20000);
+    windgent::Scheduler::WakeupStats before = iom.getWakeupStats();
+    uint64_t waits = s_epoll_wait;
+    uint64_t blocks = s_epoll_block;
+    for(int r = 0; r < rounds; ++r) {
+        ASSERT(write(fds[r % pairs][1], "x", 1) == 1);
+        while(s_done != r + 1) {
+            usleep(100);
+        }
+        usleep(1000);
+    }
+    report(name, iom, before, waits);
+    windgent::Scheduler::WakeupStats after = iom.getWakeupStats();
+    uint64_t wakeups = after.wakeups - before.wakeups;
+    uint64_t useful = after.useful - before.useful;
+    blocks = s_epoll_block - blocks;
+    LOG_INFO(g_logger) << name << ": blocking epoll_wait=" << blocks;
+    ASSERT(wakeups <= useful + rounds / 10);
+    ASSERT(blocks <= rounds + rounds / 10);
+    for(int i = 0; i < pairs; ++i) {
+        close(fds[i][1]);
+    }
+    while(s_done != rounds + pairs) {
+        usleep(1000);
+    }
+}
+
+//inbox很小，指定线程的任务大部分溢出到目标线程的本地队列，每一轮都应该很快执行完，不会等到epoll_wait超时
+void test_pinned_overflow() {
+    windgent::ConfigVar<uint32_t>::ptr inbox_size = windgent::ConfigMgr::Lookup<uint32_t>("scheduler.inbox_size");
+    uint32_t old_size = inbox_size->getVal();
+    inbox_size->setVal(2);
+    {
+        windgent::IOManager iom(2, false, "overflow");
+        std::atomic<int> tid = {0};
+        iom.schedule([&tid]() {
+            tid = windgent::GetThreadId();
+        });
+        while(!tid) {
+            usleep(1000);
+        }
+        const int rounds = 300;
+        const int per_round = 16;
+        uint64_t max_used = 0;
+        for(int r = 0; r < rounds; ++r) {
+            s_done = 0;
+            uint64_t start = windgent::GetCurrentMS();
+            for(int i = 0; i < per_round; ++i) {
+                iom.schedule([]() {
+                    ++s_done;
+                }, tid);
+            }
+            while(s_done != per_round) {
+                usleep(100);
+            }
+            max_used = std::max(max_used, windgent::GetCurrentMS() - start);
+            usleep(r % 7 * 100);
+        }
+        LOG_INFO(g_logger) << "pinned overflow: max round " << max_used << "ms";
+        ASSERT(max_used < 1000);
+    }
+    inbox_size->setVal(old_size);
+}
+
+int main(int argc, char** argv) {
+    test_pinned_overflow();
+    windgent::IOManager iom(4, false, "wakeup");
+    test_burst(iom);
+    test_pinned(iom);
+    test_fanout(iom);
+    test_busy_owner(iom);
+    test_io_ready(iom, "io ready");
+    {
+        windgent::IOManager iom16(16, false, "wakeup16");
+        test_io_ready(iom16, "io ready 16");
+    }
+    std::stringstream ss;
+    iom.dump(ss);
+    LOG_INFO(g_logger) << ss.str();
+    return 0;
+}
@@ -0,0 +1,290 @@
+#include "../windgent/windgent.h"
+#include "../windgent/iomanager.h"
+#include "../windgent/socket.h"
+#include "../windgent/socket_stream.h"
+#include "../windgent/address.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <atomic>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+enum Mode {
+    READ_WRITE,     //读进用户缓冲区再写到socket
+    SENDFILE,
+    SPLICE
+};
+static const char* s_mode_names[] = {"read+write", "sendfile", "splice"};
+
+static unsigned char pattern(uint64_t i) {
+    return (i * 31 + i / 4096) % 251;
+}
+
+//生成size字节的测试文件
+static std::string make_file(uint64_t size) {
+    std::string path = "/tmp/windgent_sendfile_" + std::to_string(size);
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT(fd >= 0);
+    std::vector<unsigned char> buf(1024 * 1024);
+    for(uint64_t off = 0; off < size; off += buf.size()) {
+        size_t n = std::min<uint64_t>(buf.size(), size - off);
+        for(size_t i = 0; i < n; ++i) {
+            buf[i] = pattern(off + i);
+        }
+        ASSERT(write(fd, &buf[0], n) == (ssize_t)n);
+    }
+    close(fd);
+    return path;
+}
+
+static int64_t send_file(windgent::SocketStream& ss, Mode mode, int fd, uint64_t offset, uint64_t length) {
+    if(mode == SENDFILE) {
+        return ss.sendFile(fd, offset, length);
+    }
+    if(mode == SPLICE) {
+        return ss.spliceFrom(fd, offset, length);
+    }
+    //协程醒来后可能换了线程，不能用thread_local的缓冲区
+    std::vector<char> buf(128 * 1024);
+    uint64_t sent = 0;
+    while(sent < length) {
+        ssize_t n = pread(fd, &buf[0], std::min<uint64_t>(buf.size(), length - sent), offset + sent);
+        if(n <= 0) {
+            break;
+        }
+        if(ss.writeFixedSize(&buf[0], n) <= 0) {
+            return -1;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+//进程消耗的CPU时间（用户态+内核态），单位微秒
+static uint64_t cpu_us() {
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ull + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+//服务端把文件发送reps次，客户端接收并（verify为true时）校验内容，返回MB/s。
+//cpu_ms_per_gb为每发送1GB整个进程（包括接收方）消耗的CPU时间，接收方的开销在各种方式下相同
+static double transfer(windgent::IOManager& iom, Mode mode, const std::string& path, uint64_t offset
+                       , uint64_t length, int reps, bool verify, double* cpu_ms_per_gb = nullptr) {
+    std::atomic<int> done = {0};
+    uint64_t cpu_start = cpu_us();
+    std::atomic<uint64_t> used_us = {0};
+    iom.schedule([&]() {
+        windgent::Socket::ptr listener = windgent::Socket::createTCPSocket();
+        ASSERT(listener->bind(windgent::IPv4Address::Create("127.0.0.1", 0)));
+        ASSERT(listener->listen());
+        windgent::Address::ptr addr = listener->getLocalAddress();
+
+        iom.schedule([&, addr]() {
+            windgent::Socket::ptr client = windgent::Socket::createTCPSocket();
+            ASSERT(client->connect(addr));
+            std::vector<unsigned char> buf(256 * 1024);
+            uint64_t total = length * reps;
+            uint64_t received = 0;
+            while(received < total) {
+                int n = client->recv(&buf[0], std::min<uint64_t>(buf.size(), total - received));
+                ASSERT(n > 0);
+                if(verify) {
+                    for(int i = 0; i < n; ++i) {
+                        ASSERT(buf[i] == pattern(offset + (received + i) % length));
+                    }
+                }
+                received += n;
+            }
+            ++done;
+        });
+
+        windgent::Socket::ptr conn = listener->accept();
+        ASSERT(conn);
+        windgent::SocketStream ss(conn);
+        int fd = open(path.c_str(), O_RDONLY);
+        ASSERT(fd >= 0);
+        uint64_t start = windgent::GetCurrentUS();
+        for(int i = 0; i < reps; ++i) {
+            ASSERT(send_file(ss, mode, fd, offset, length) == (int64_t)length);
+        }
+        used_us = windgent::GetCurrentUS() - start;
+        close(fd);
+        ++done;
+    });
+    while(done < 2) {
+        usleep(1000);
+    }
+    if(cpu_ms_per_gb) {
+        *cpu_ms_per_gb = (cpu_us() - cpu_start) / 1000.0 / ((double)length * reps / (1 << 30));
+    }
+    return (double)length * reps / (1 << 20) / (used_us / 1000000.0);
+}
+
+//管道作为输入时sendfile不可用，sendFile自动改用splice
+void test_pipe(windgent::IOManager& iom, const std::string& path) {
+    int fds[2];
+    ASSERT(pipe(fds) == 0);
+    std::atomic<bool> done = {false};
+    const uint64_t length = 300 * 1000;
+    iom.schedule([&]() {
+        windgent::Socket::ptr listener = windgent::Socket::createTCPSocket();
+        ASSERT(listener->bind(windgent::IPv4Address::Create("127.0.0.1", 0)));
+        ASSERT(listener->listen());
+        windgent::Address::ptr addr = listener->getLocalAddress();
+        iom.schedule([&, addr]() {
+            windgent::Socket::ptr client = windgent::Socket::createTCPSocket();
+            ASSERT(client->connect(addr));
+            std::vector<unsigned char> buf(length);
+            uint64_t received = 0;
+            while(received < length) {
+                int n = client->recv(&buf[received], length - received);
+                ASSERT(n > 0);
+                received += n;
+            }
+            for(uint64_t i = 0; i < length; ++i) {
+                ASSERT(buf[i] == pattern(i));
+            }
+            done = true;
+        });
+        windgent::Socket::ptr conn = listener->accept();
+        windgent::SocketStream ss(conn);
+        ASSERT(ss.sendFile(fds[0], 0, length) == (int64_t)length);
+    });
+    //另一个线程从文件写入管道
+    windgent::Thread writer([&]() {
+        int fd = open(path.c_str(), O_RDONLY);
+        std::vector<char> buf(length);
+        ASSERT(read(fd, &buf[0], length) == (ssize_t)length);
+        ASSERT(write(fds[1], &buf[0], length) == (ssize_t)length);
+        close(fd);
+    }, "pipe_writer");
+    writer.join();
+    while(!done) {
+        usleep(1000);
+    }
+    close(fds[0]);
+    close(fds[1]);
+    LOG_INFO(g_logger) << "pipe fallback ok";
+}
+
+//小文件：最后一段数据不能带MSG_MORE，否则连接不关闭时对端要等到内核超时才能收到
+void test_tail_latency(windgent::IOManager& iom, const std::string& path) {
+    for(int m = SENDFILE; m <= SPLICE; ++m) {
+        std::atomic<uint64_t> used = {0};
+        std::atomic<bool> done = {false};
+        iom.schedule([&]() {
+            windgent::Socket::ptr listener = windgent::Socket::createTCPSocket();
+            ASSERT(listener->bind(windgent::IPv4Address::Create("127.0.0.1", 0)));
+            ASSERT(listener->listen());
+            windgent::Address::ptr addr = listener->getLocalAddress();
+            uint64_t start = windgent::GetCurrentUS();
+            iom.schedule([&, addr, start]() {
+                windgent::Socket::ptr client = windgent::Socket::createTCPSocket();
+                ASSERT(client->connect(addr));
+                char buf[100];
+                int received = 0;
+                while(received < (int)sizeof(buf)) {
+                    int n = client->recv(buf + received, sizeof(buf) - received);
+                    ASSERT(n > 0);
+                    received += n;
+                }
+                used = windgent::GetCurrentUS() - start;
+            });
+            windgent::Socket::ptr conn = listener->accept();
+            windgent::SocketStream ss(conn);
+            int fd = open(path.c_str(), O_RDONLY);
+            ASSERT(send_file(ss, (Mode)m, fd, 0, 100) == 100);
+            close(fd);
+            //对端收完之前不关闭连接
+            while(!used) {
+                usleep(1000);
+            }
+            done = true;
+        });
+        while(!done) {
+            usleep(1000);
+        }
+        LOG_INFO(g_logger) << s_mode_names[m] << " 100 bytes: " << used / 1000.0 << "ms";
+        ASSERT(used < 100 * 1000);
+    }
+}
+
+//首部带MSG_MORE发出后文件没有发出任何数据（空文件），pushPending让首部立即发出，不等内核超时
+void test_head_flush(windgent::IOManager& iom, const std::string& path) {
+    std::atomic<uint64_t> used = {0};
+    std::atomic<bool> done = {false};
+    iom.schedule([&]() {
+        windgent::Socket::ptr listener = windgent::Socket::createTCPSocket();
+        ASSERT(listener->bind(windgent::IPv4Address::Create("127.0.0.1", 0)));
+        ASSERT(listener->listen());
+        windgent::Address::ptr addr = listener->getLocalAddress();
+        static const std::string head = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+        uint64_t start = windgent::GetCurrentUS();
+        iom.schedule([&, addr, start]() {
+            windgent::Socket::ptr client = windgent::Socket::createTCPSocket();
+            ASSERT(client->connect(addr));
+            char buf[64];
+            int received = 0;
+            while(received < (int)head.size()) {
+                int n = client->recv(buf + received, sizeof(buf) - received);
+                ASSERT(n > 0);
+                received += n;
+            }
+            used = windgent::GetCurrentUS() - start;
+        });
+        windgent::Socket::ptr conn = listener->accept();
+        windgent::SocketStream ss(conn);
+        iovec iov = {(void*)head.c_str(), head.size()};
+        ASSERT(ss.writevFixedSize(&iov, 1, false, MSG_MORE) == (int64_t)head.size());
+        int fd = open(path.c_str(), O_RDONLY);
+        ASSERT(ss.sendFile(fd, 0, 0) == 0);
+        close(fd);
+        ASSERT(ss.pushPending());
+        while(!used) {
+            usleep(1000);
+        }
+        done = true;
+    });
+    while(!done) {
+        usleep(1000);
+    }
+    LOG_INFO(g_logger) << "corked head flushed after " << used / 1000.0 << "ms";
+    ASSERT(used < 100 * 1000);
+}
+
+int main(int argc, char** argv) {
+    LOG_NAME("system")->setLevel(windgent::LogLevel::WARN);
+    std::string small = make_file(1 << 20);
+    std::string large = make_file(100 << 20);
+    windgent::IOManager iom(2, false, "sendfile");
+
+    //带偏移的部分发送，校验内容
+    for(int m = READ_WRITE; m <= SPLICE; ++m) {
+        transfer(iom, (Mode)m, small, 12345, 500000, 3, true);
+    }
+    LOG_INFO(g_logger) << "offset transfer ok";
+    test_pipe(iom, small);
+    test_tail_latency(iom, small);
+    test_head_flush(iom, small);
+
+    struct {
+        const char* name;
+        std::string path;
+        uint64_t size;
+        int reps;
+    } cases[] = {{"1MB   x500", small, 1 << 20, 500}, {"100MB x5  ", large, 100 << 20, 5}};
+    for(auto& c : cases) {
+        for(int m = READ_WRITE; m <= SPLICE; ++m) {
+            double cpu = 0;
+            double mbs = transfer(iom, (Mode)m, c.path, 0, c.size, c.reps, false, &cpu);
+            std::cout << c.name << " " << s_mode_names[m] << ": " << (uint64_t)mbs << " MB/s, cpu "
+                      << (uint64_t)cpu << " ms/GB" << std::endl;
+        }
+    }
+    unlink(small.c_str());
+    unlink(large.c_str());
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include "../windgent/windgent.h"
+#include "../windgent/http/http_server.h"
+#include "../windgent/http/servlet.h"
+
+#include <unistd.h>
+#include <atomic>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+static std::atomic<uint32_t> s_stacksize = {0};
+
+//只记录连接协程的栈大小，不处理请求
+class StackProbeServer : public windgent::http::HttpServer {
+public:
+    typedef std::shared_ptr<StackProbeServer> ptr;
+    StackProbeServer() :HttpServer(false) { }
+protected:
+    void handleClient(windgent::Socket::ptr client) override {
+        s_stacksize = windgent::Fiber::GetCurrent()->getStackSize();
+        client->close();
+    }
+};
+
+static windgent::http::Servlet::ptr make_servlet(size_t stacksize) {
+    windgent::http::Servlet::ptr slt(new windgent::http::FunctionServlet([](windgent::http::HttpRequest::ptr req
+                                           ,windgent::http::HttpResponse::ptr rsp
+                                           ,windgent::http::HttpSession::ptr session) {
+        return 0;
+    }));
+    slt->setStackSize(stacksize);
+    return slt;
+}
+
+void test() {
+    const size_t small = windgent::Fiber::STACK_SMALL;
+    StackProbeServer::ptr server(new StackProbeServer);
+    auto sd = server->getDispatcher();
+    //只有内置的默认servlet：使用fiber.stacksize
+    ASSERT(server->getStackSize() == windgent::Fiber::GetDefaultStackSize());
+
+    //所有servlet都指定STACK_SMALL，内置的默认servlet和TcpServer上的0不再把栈抬到fiber.stacksize
+    sd->addServlet("/a", make_servlet(small));
+    sd->addGlobServlet("/b/*", make_servlet(small));
+    ASSERT(server->getStackSize() == small);
+
+    windgent::Address::ptr addr = windgent::IPv4Address::Create("127.0.0.1", 8031);
+    while(!server->bind(addr)) {
+        sleep(1);
+    }
+    server->start();
+    windgent::Socket::ptr sock = windgent::Socket::createTCP(addr);
+    ASSERT(sock->connect(addr));
+    char c;
+    sock->recv(&c, 1);
+    LOG_INFO(g_logger) << "connection fiber stacksize=" << s_stacksize;
+    ASSERT(s_stacksize == small);
+
+    //栈大小为0的servlet对栈没有要求
+    sd->addServlet("/c", make_servlet(0));
+    ASSERT(server->getStackSize() == small);
+    //TcpServer上显式设置的栈大小与servlet取最大值
+    server->setStackSize(windgent::Fiber::STACK_MEDIUM);
+    ASSERT(server->getStackSize() == windgent::Fiber::STACK_MEDIUM);
+    //删除之后所有servlet都没有要求，回到fiber.stacksize
+    server->setStackSize(0);
+    sd->delServlet("/a");
+    sd->delGlobServlet("/b/*");
+    ASSERT(server->getStackSize() == windgent::Fiber::GetDefaultStackSize());
+    server->stop();
+    LOG_INFO(g_logger) << "servlet stack ok";
+}
+
+int main() {
+    windgent::IOManager iom(1);
+    iom.schedule(test);
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include "../windgent/windgent.h"
+#include "../windgent/iomanager.h"
+#include "../windgent/tcp_server.h"
+#include "../windgent/socket.h"
+#include "../windgent/address.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <atomic>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+static const size_t MSG_SIZE = 64;
+
+//把收到的数据原样发回，一个请求就是一次收发
+class EchoServer : public windgent::TcpServer {
+public:
+    typedef std::shared_ptr<EchoServer> ptr;
+    EchoServer(windgent::IOManager* worker) :TcpServer(worker, worker) { }
+    EchoServer(const std::vector<windgent::IOManager*>& workers) :TcpServer(workers) { }
+protected:
+    void handleClient(windgent::Socket::ptr client) override {
+        char buf[MSG_SIZE];
+        while(true) {
+            int ret = client->recv(buf, sizeof(buf));
+            if(ret <= 0) {
+                break;
+            }
+            if(client->send(buf, ret) != ret) {
+                break;
+            }
+        }
+    }
+};
+
+//把IOManager唯一的线程绑定到cpu上
+static void pin(windgent::IOManager* iom, int cpu) {
+    std::atomic<bool> done = {false};
+    iom->schedule([cpu, &done]() {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        done = true;
+    });
+    while(!done) {
+        usleep(100);
+    }
+}
+
+//conns个连接各自不停地请求，直到duration毫秒后，返回每秒完成的请求数
+static uint64_t run_clients(windgent::Address::ptr addr, int conns, uint64_t duration) {
+    std::atomic<uint64_t> requests = {0};
+    std::atomic<int> failed = {0};
+    {
+        windgent::IOManager client(2, false, "client");
+        uint64_t deadline = windgent::GetCurrentMS() + duration;
+        for(int i = 0; i < conns; ++i) {
+            client.schedule([addr, deadline, &requests, &failed]() {
+                windgent::Socket::ptr sock = windgent::Socket::createTCP(addr);
+                if(!sock->connect(addr)) {
+                    ++failed;
+                    return;
+                }
+                char buf[MSG_SIZE] = {0};
+                uint64_t count = 0;
+                while(windgent::GetCurrentMS() < deadline) {
+                    if(sock->send(buf, sizeof(buf)) != (int)sizeof(buf)) {
+                        ++failed;
+                        break;
+                    }
+                    size_t got = 0;
+                    while(got < sizeof(buf)) {
+                        int ret = sock->recv(buf + got, sizeof(buf) - got);
+                        if(ret <= 0) {
+                            break;
+                        }
+                        got += ret;
+                    }
+                    if(got != sizeof(buf)) {
+                        ++failed;
+                        break;
+                    }
+                    ++count;
+                }
+                requests += count;
+                sock->close();
+            });
+        }
+    }
+    ASSERT(failed == 0);
+    return requests * 1000 / duration;
+}
+
+//shared：一个cores个线程的IOManager，连接由任意线程处理；reuseport：cores个单线程的IOManager，各自accept并处理自己的连接
+static uint64_t run(bool reuseport, int cores, int port, int conns, uint64_t duration) {
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    std::vector<windgent::IOManager*> ioms;
+    EchoServer::ptr server;
+    if(reuseport) {
+        for(int i = 0; i < cores; ++i) {
+            ioms.push_back(new windgent::IOManager(1, false, "core_" + std::to_string(i)));
+            pin(ioms.back(), i % cpus);
+        }
+        server.reset(new EchoServer(ioms));
+    } else {
+        ioms.push_back(new windgent::IOManager(cores, false, "shared"));
+        server.reset(new EchoServer(ioms[0]));
+    }
+    windgent::Address::ptr addr = windgent::IPv4Address::Create("127.0.0.1", port);
+    ASSERT(addr);
+    //监听socket要在hook的线程上创建，accept才会由IOManager等待
+    std::atomic<bool> started = {false};
+    ioms[0]->schedule([server, addr, &started]() {
+        ASSERT(server->bind(addr));
+        server->start();
+        started = true;
+    });
+    while(!started) {
+        usleep(100);
+    }
+
+    uint64_t qps = run_clients(addr, conns, duration);
+
+    server->stop();
+    server.reset();
+    for(auto i : ioms) {
+        delete i;
+    }
+    return qps;
+}
+
+//用法：test_tcp_server_scaling [每轮毫秒数] [连接数] [最大线程数]。本机cpu数少于线程数时，多出的线程共享cpu，数字只能说明开销
+int main(int argc, char** argv) {
+    uint64_t duration = argc > 1 ? atoi(argv[1]) : 1000;
+    int conns = argc > 2 ? atoi(argv[2]) : 64;
+    int max_cores = argc > 3 ? atoi(argv[3]) : 16;
+    g_logger->setLevel(windgent::LogLevel::WARN);
+    //停止时accept失败的日志是预期的
+    LOG_NAME("system")->setLevel(windgent::LogLevel::FATAL);
+
+    int port = 18400;
+    const int cores[] = {1, 2, 4, 8, 16};
+    for(auto n : cores) {
+        if(n > max_cores) {
+            break;
+        }
+        uint64_t shared = run(false, n, port++, conns, duration);
+        uint64_t reuseport = run(true, n, port++, conns, duration);
+        std::cout << "cores=" << n << " shared req/s=" << shared << " reuseport req/s=" << reuseport
+                  << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,282 @@
+#include "../windgent/windgent.h"
+#include "../windgent/timer.h"
+#include "../windgent/iomanager.h"
+
+#include <stdlib.h>
+#include <sys/time.h>
+#include <random>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+//虚拟时钟：不为0时替换库里的windgent::GetCurrentMS，定时器的到期时刻和时间轮的推进都按它计算
+static std::atomic<uint64_t> s_fake_ms = {0};
+
+namespace windgent {
+uint64_t GetCurrentMS() {
+    if(s_fake_ms) {
+        return s_fake_ms;
+    }
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000ul + tv.tv_usec / 1000;
+}
+}
+
+class TestTimerManager : public windgent::TimerManager {
+protected:
+    virtual void onTimerInsertedAtFront() override { }
+};
+
+static void set_backend(const std::string& backend) {
+    windgent::ConfigMgr::Lookup<std::string>("timer.backend")->setVal(backend);
+}
+
+//模拟idle循环：等到下一个定时器，取出到期回调执行
+static void run_until_empty(TestTimerManager& mgr) {
+    while(mgr.hasTimer()) {
+        uint64_t next = mgr.getTimeOfNextTimer();
+        if(next) {
+            usleep(std::min(next, (uint64_t)10) * 1000);
+        }
+        std::vector<std::function<void()> > cbs;
+        mgr.listExpiredCbs(cbs);
+        for(auto& cb : cbs) {
+            cb();
+        }
+    }
+}
+
+//随机的定时器，部分取消、部分refresh/reset，检查触发时刻
+void test_correctness(const std::string& backend) {
+    set_backend(backend);
+    TestTimerManager mgr;
+    const int count = 2000;
+    std::vector<int> fired(count, 0);
+    std::vector<uint64_t> expect(count, 0);
+    std::vector<windgent::Timer::ptr> timers(count);
+    uint64_t max_late = 0;
+
+    uint64_t start = windgent::GetCurrentMS();
+    for(int i = 0; i < count; ++i) {
+        uint64_t ms = rand() % 700;
+        expect[i] = start + ms;
+        timers[i] = mgr.addTimer(ms, [i, &fired, &expect, &max_late]() {
+            uint64_t now = windgent::GetCurrentMS();
+            ASSERT(now >= expect[i]);
+            max_late = std::max(max_late, now - expect[i]);
+            ++fired[i];
+        });
+    }
+    for(int i = 0; i < count; i += 4) {
+        ASSERT(timers[i]->cancel());
+        ASSERT(!timers[i]->cancel());
+    }
+    for(int i = 1; i < count; i += 4) {
+        expect[i] = windgent::GetCurrentMS() + 300;
+        ASSERT(timers[i]->reset(300, true));
+    }
+    //循环定时器执行3次后取消
+    int recur = 0;
+    windgent::Timer::ptr recur_timer;
+    recur_timer = mgr.addTimer(50, [&recur, &recur_timer]() {
+        if(++recur == 3) {
+            recur_timer->cancel();
+        }
+    }, true);
+    //超过时间轮一圈的定时器先refresh
+    uint64_t long_expect = 0;
+    int long_fired = 0;
+    windgent::Timer::ptr long_timer = mgr.addTimer(1000, [&long_fired, &long_expect]() {
+        ASSERT(windgent::GetCurrentMS() >= long_expect);
+        ++long_fired;
+    });
+    usleep(100 * 1000);
+    long_expect = windgent::GetCurrentMS() + 1000;
+    ASSERT(long_timer->refresh());
+
+    run_until_empty(mgr);
+    for(int i = 0; i < count; ++i) {
+        ASSERT(fired[i] == (i % 4 == 0 ? 0 : 1));
+    }
+    ASSERT(recur == 3);
+    ASSERT(long_fired == 1);
+    ASSERT(!long_timer->cancel());
+    LOG_INFO(g_logger) << backend << " correctness ok, max_late=" << max_late << "ms"
+                       << " used=" << windgent::GetCurrentMS() - start << "ms";
+}
+
+//虚拟时钟下的定时器分布在时间轮的各层，时钟按大小不一的步长推进，每个定时器都应该在到期后的第一次检查时触发
+void test_cascade(const std::string& backend) {
+    set_backend(backend);
+    std::mt19937_64 rng(7);
+    s_fake_ms = 1000000007;
+    uint64_t start = s_fake_ms;
+    {
+        TestTimerManager mgr;
+        std::vector<uint64_t> delays = {1, 255, 256, 257, 300, 16383, 16384, 16385, 20000, 1 << 20, (1 << 20) + 5
+                                        , 1 << 26, (1 << 26) + 12345, (1ull << 32) - 1, 1ull << 33};
+        for(int i = 0; i < 3000; ++i) {
+            delays.push_back(1 + rng() % (1ull << (rng() % 33)));
+        }
+        std::vector<uint64_t> fired(delays.size(), 0);
+        for(size_t i = 0; i < delays.size(); ++i) {
+            mgr.addTimer(delays[i], [i, &fired]() {
+                ASSERT(!fired[i]);
+                fired[i] = s_fake_ms;
+            });
+        }
+        //超过2^32ms的定时器先放在最高层，到那里后重新分配
+        size_t count = 0;
+        uint64_t prev = start;
+        while(mgr.hasTimer()) {
+            uint64_t steps[] = {1, rng() % 300, rng() % 20000, rng() % (1 << 22), rng() % (1ull << 28)};
+            s_fake_ms += steps[rng() % 5];
+            std::vector<std::function<void()> > cbs;
+            mgr.listExpiredCbs(cbs);
+            for(auto& cb : cbs) {
+                cb();
+            }
+            for(size_t i = 0; i < delays.size(); ++i) {
+                if(fired[i] == s_fake_ms) {
+                    ASSERT(start + delays[i] <= s_fake_ms && start + delays[i] > prev);
+                    ++count;
+                }
+            }
+            prev = s_fake_ms;
+        }
+        ASSERT(count == delays.size());
+    }
+    LOG_INFO(g_logger) << backend << " cascade ok, virtual time " << (s_fake_ms - start) / 3600000 << "h";
+    s_fake_ms = 0;
+}
+
+//空闲很久之后一次推进很长的时间：时间轮跳过空档，不逐毫秒推进
+void test_long_jump() {
+    set_backend("wheel");
+    s_fake_ms = 5000000011;
+    {
+        TestTimerManager mgr;
+        int fired = 0;
+        mgr.addTimer(10 * 24 * 3600 * 1000ull, [&fired]() {
+            ++fired;
+        });
+        mgr.addTimer(3 * 3600 * 1000 + 17, [&fired]() {
+            ++fired;
+        });
+        uint64_t begin = windgent::GetCurrentUS();
+        std::vector<std::function<void()> > cbs;
+        s_fake_ms += 24 * 3600 * 1000;
+        mgr.listExpiredCbs(cbs);
+        ASSERT(cbs.size() == 1);
+        s_fake_ms += 9 * 24 * 3600 * 1000ull;
+        mgr.listExpiredCbs(cbs);
+        ASSERT(cbs.size() == 2 && !mgr.hasTimer());
+        uint64_t used = windgent::GetCurrentUS() - begin;
+        LOG_INFO(g_logger) << "wheel jumped 10 days in " << used << "us";
+        ASSERT(used < 50 * 1000);
+    }
+    s_fake_ms = 0;
+}
+
+//时钟往回调了不到rollover的阈值（1小时）：之后添加的短定时器仍然按时触发，不会等时钟追上原来的时刻
+void test_clock_step_back(const std::string& backend) {
+    set_backend(backend);
+    s_fake_ms = 7000000013;
+    {
+        TestTimerManager mgr;
+        int fired = 0;
+        mgr.addTimer(2 * 3600 * 1000, [&fired]() {
+            ++fired;
+        });
+        mgr.addTimer(1000, [&fired]() {
+            ++fired;
+        });
+        std::vector<std::function<void()> > cbs;
+        s_fake_ms += 1000;
+        mgr.listExpiredCbs(cbs);
+        ASSERT(cbs.size() == 1);
+        cbs.clear();
+        s_fake_ms -= 30 * 60 * 1000;
+        mgr.listExpiredCbs(cbs);
+        ASSERT(cbs.empty());
+        mgr.addTimer(50, [&fired]() {
+            ++fired;
+        });
+        mgr.addTimer(100, [&fired]() {
+            ++fired;
+        });
+        ASSERT(mgr.getTimeOfNextTimer() == 50);
+        s_fake_ms += 50;
+        mgr.listExpiredCbs(cbs);
+        ASSERT(cbs.size() == 1);
+        cbs.clear();
+        //第一个定时器触发之后，下一个定时器的时刻不能停在回调之前的时钟上
+        ASSERT(mgr.getTimeOfNextTimer() == 50);
+        s_fake_ms += 50;
+        mgr.listExpiredCbs(cbs);
+        ASSERT(cbs.size() == 1);
+        ASSERT(mgr.hasTimer());
+    }
+    LOG_INFO(g_logger) << backend << " clock step back ok";
+    s_fake_ms = 0;
+}
+
+//已有大量定时器时，模拟hook中每次IO的addTimer + cancel
+void bench_add_cancel(const std::string& backend) {
+    set_backend(backend);
+    TestTimerManager mgr;
+    std::vector<windgent::Timer::ptr> background;
+    for(int i = 0; i < 100000; ++i) {
+        background.push_back(mgr.addTimer(1000 + rand() % 60000, [](){}));
+    }
+    const int ops = 1000000;
+    uint64_t start = windgent::GetCurrentUS();
+    for(int i = 0; i < ops; ++i) {
+        windgent::Timer::ptr timer = mgr.addTimer(5000, [](){});
+        timer->cancel();
+    }
+    uint64_t used = windgent::GetCurrentUS() - start;
+    LOG_INFO(g_logger) << backend << " add+cancel ops=" << ops << " used=" << used / 1000 << "ms"
+                       << " ns/op=" << used * 1000 / ops;
+}
+
+//定时器在工作线程的分片上，由非工作线程取消、重置
+void test_cross_thread() {
+    windgent::IOManager iom(2, false, "timer");
+    std::atomic<int> fired1 = {0};
+    std::atomic<uint64_t> fired2 = {0};
+    windgent::Timer::ptr t1, t2;
+    windgent::Semaphore sem;
+    iom.schedule([&]() {
+        t1 = iom.addTimer(300, [&fired1]() { ++fired1; });
+        t2 = iom.addTimer(2000, [&fired2]() { fired2 = windgent::GetCurrentMS(); });
+        sem.notify();
+    });
+    sem.wait();
+    uint64_t start = windgent::GetCurrentMS();
+    ASSERT(t1->cancel());
+    ASSERT(!t1->cancel());
+    ASSERT(t2->reset(100, true));
+    while(!fired2 && windgent::GetCurrentMS() - start < 3000) {
+        usleep(10 * 1000);
+    }
+    usleep(400 * 1000);
+    ASSERT(fired1 == 0);
+    ASSERT(fired2 && fired2 - start < 1000);
+    LOG_INFO(g_logger) << "cross thread cancel ok, reset timer fired after " << fired2 - start << "ms";
+}
+
+int main(int argc, char** argv) {
+    LOG_NAME("system")->setLevel(windgent::LogLevel::WARN);
+    test_cross_thread();
+    test_correctness("set");
+    test_correctness("wheel");
+    test_cascade("set");
+    test_cascade("wheel");
+    test_long_jump();
+    test_clock_step_back("set");
+    test_clock_step_back("wheel");
+    bench_add_cancel("set");
+    bench_add_cancel("wheel");
+    return 0;
+}
@@ -0,0 +1,197 @@
+#include "../windgent/windgent.h"
+#include "../windgent/iomanager.h"
+#include "../windgent/socket.h"
+#include "../windgent/socket_stream.h"
+#include "../windgent/address.h"
+
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <sstream>
+
+windgent::Logger::ptr g_logger = LOG_ROOT();
+
+//统计调度线程上的usleep次数，等待完成通知时不应该靠睡眠轮询
+static std::atomic<uint64_t> s_fiber_sleeps = {0};
+
+extern "C" {
+int usleep(useconds_t usec) {
+    static auto real = (int (*)(useconds_t))dlsym(RTLD_NEXT, "usleep");
+    if(windgent::Scheduler::GetThis()) {
+        ++s_fiber_sleeps;
+    }
+    return real(usec);
+}
+}
+
+enum Mode {
+    CONCAT,         //原来的做法：首部和消息体写进stringstream，再拷贝成std::string发送
+    WRITEV,         //首部和消息体集中写
+    ZEROCOPY        //集中写并带MSG_ZEROCOPY
+};
+static const char* s_mode_names[] = {"concat+write", "writev", "writev+zerocopy"};
+
+static uint64_t cpu_us() {
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ull + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static std::string make_head(size_t body_size) {
+    return "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nConnection: keep-alive\r\n"
+           "Content-Length: " + std::to_string(body_size) + "\r\n\r\n";
+}
+
+static bool send_response(windgent::SocketStream& ss, Mode mode, const std::string& body) {
+    std::string head = make_head(body.size());
+    if(mode == CONCAT) {
+        std::stringstream os;
+        os << head << body;
+        std::string data = os.str();
+        return ss.writeFixedSize(data.c_str(), data.size()) > 0;
+    }
+    iovec iovs[2] = {{(void*)head.c_str(), head.size()}, {(void*)body.c_str(), body.size()}};
+    return ss.writevFixedSize(iovs, 2, mode == ZEROCOPY) == (int64_t)(head.size() + body.size());
+}
+
+//服务端发送reps个响应，客户端接收并（verify为true时）校验。返回MB/s，cpu为每GB整个进程消耗的CPU毫秒数
+static double run(windgent::IOManager& iom, Mode mode, const std::string& body, int reps, bool verify
+                  , double& cpu, int sndbuf = 0) {
+    std::atomic<int> done = {0};
+    std::atomic<uint64_t> used_us = {0};
+    uint64_t zc_sends = 0;
+    uint64_t zc_copied = 0;
+    uint64_t cpu_start = cpu_us();
+    iom.schedule([&]() {
+        windgent::Socket::ptr listener = windgent::Socket::createTCPSocket();
+        ASSERT(listener->bind(windgent::IPv4Address::Create("127.0.0.1", 0)));
+        ASSERT(listener->listen());
+        windgent::Address::ptr addr = listener->getLocalAddress();
+        size_t total = (make_head(body.size()).size() + body.size()) * reps;
+
+        iom.schedule([&, addr, total]() {
+            windgent::Socket::ptr client = windgent::Socket::createTCPSocket();
+            ASSERT(client->connect(addr));
+            std::string expect = make_head(body.size()) + body;
+            std::vector<char> buf(256 * 1024);
+            size_t received = 0;
+            while(received < total) {
+                int n = client->recv(&buf[0], std::min(buf.size(), total - received));
+                ASSERT(n > 0);
+                if(verify) {
+                    for(int i = 0; i < n; ++i) {
+                        ASSERT(buf[i] == expect[(received + i) % expect.size()]);
+                    }
+                }
+                received += n;
+            }
+            ++done;
+        });
+
+        windgent::Socket::ptr conn = listener->accept();
+        ASSERT(conn);
+        if(sndbuf) {
+            conn->setSockOpt(SOL_SOCKET, SO_SNDBUF, sndbuf);
+        }
+        windgent::SocketStream ss(conn);
+        uint64_t start = windgent::GetCurrentUS();
+        for(int i = 0; i < reps; ++i) {
+            ASSERT(send_response(ss, mode, body));
+        }
+        used_us = windgent::GetCurrentUS() - start;
+        zc_sends = ss.getZeroCopySends();
+        zc_copied = ss.getZeroCopyCopied();
+        ++done;
+    });
+    while(done < 2) {
+        usleep(1000);
+    }
+    double bytes = (double)body.size() * reps;
+    cpu = (cpu_us() - cpu_start) / 1000.0 / (bytes / (1 << 30));
+    if(mode == ZEROCOPY) {
+        LOG_INFO(g_logger) << "zerocopy sends=" << zc_sends << " copied by kernel=" << zc_copied;
+    }
+    return bytes / (1 << 20) / (used_us / 1000000.0);
+}
+
+//流水线的客户端：下一个请求已经到达，对端暂时不读，完成通知要等它读走数据后才来。等待期间协程挂起，不轮询
+void test_pending_request(windgent::IOManager& iom) {
+    const size_t size = 1024 * 1024;
+    std::string body(size, 'z');
+    std::atomic<int> done = {0};
+    std::atomic<uint64_t> sleeps = {0};
+    iom.schedule([&]() {
+        windgent::Socket::ptr listener = windgent::Socket::createTCPSocket();
+        ASSERT(listener->bind(windgent::IPv4Address::Create("127.0.0.1", 0)));
+        ASSERT(listener->listen());
+        windgent::Address::ptr addr = listener->getLocalAddress();
+        iom.schedule([&, addr]() {
+            windgent::Socket::ptr client = windgent::Socket::createTCPSocket();
+            ASSERT(client->connect(addr));
+            ASSERT(client->send("GET / HTTP/1.1\r\n\r\n", 18) == 18);
+            //对端读走数据之前零拷贝的发送不会完成
+            windgent::IOManager::GetThis()->addTimer(100, [&done]() {
+                ++done;
+            });
+            while(done < 1) {
+                windgent::Fiber::YieldToReady();
+            }
+            std::vector<char> buf(256 * 1024);
+            size_t total = make_head(size).size() + size;
+            size_t received = 0;
+            while(received < total) {
+                int n = client->recv(&buf[0], buf.size());
+                ASSERT(n > 0);
+                received += n;
+            }
+            ++done;
+        });
+        windgent::Socket::ptr conn = listener->accept();
+        ASSERT(conn);
+        windgent::SocketStream ss(conn);
+        uint64_t before = s_fiber_sleeps;
+        ASSERT(send_response(ss, ZEROCOPY, body));
+        sleeps = s_fiber_sleeps - before;
+        //请求数据没有被消耗，仍然可以读到
+        char buf[18];
+        ASSERT(ss.readFixedSize(buf, sizeof(buf)) == sizeof(buf));
+        ++done;
+    });
+    while(done < 3) {
+        usleep(1000);
+    }
+    LOG_INFO(g_logger) << "pending request: sleeps while waiting for completion=" << sleeps;
+    ASSERT(sleeps == 0);
+}
+
+int main(int argc, char** argv) {
+    LOG_NAME("system")->setLevel(windgent::LogLevel::WARN);
+    windgent::IOManager iom(2, false, "zerocopy");
+
+    std::string body(3 * 1024 * 1024 + 17, 0);
+    for(size_t i = 0; i < body.size(); ++i) {
+        body[i] = (char)(i * 131 + i / 977);
+    }
+    //小的发送缓冲区让每次只发送一部分，检查iovec的调整
+    double cpu = 0;
+    for(int m = CONCAT; m <= ZEROCOPY; ++m) {
+        run(iom, (Mode)m, body, 3, true, cpu, 64 * 1024);
+    }
+    LOG_INFO(g_logger) << "partial writes ok";
+    test_pending_request(iom);
+
+    const size_t sizes[] = {256 * 1024, 4 * 1024 * 1024};
+    for(auto size : sizes) {
+        std::string b(body.begin(), body.begin() + std::min(size, body.size()));
+        b.resize(size, 'x');
+        int reps = (int)(2048ull * 1024 * 1024 / size);
+        for(int m = CONCAT; m <= ZEROCOPY; ++m) {
+            double mbs = run(iom, (Mode)m, b, reps, false, cpu);
+            std::cout << size / 1024 << "KB x" << reps << " " << s_mode_names[m] << ": " << (uint64_t)mbs
+                      << " MB/s, cpu " << (uint64_t)cpu << " ms/GB, user-space copies per response "
+                      << (m == CONCAT ? 2 : 0) << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include "./buffered_stream.h"
+#include <string.h>
+#include <algorithm>
+
+namespace windgent {
+
+BufferedStream::BufferedStream(Stream::ptr stream, size_t capacity)
+    :m_stream(stream), m_capacity(std::max<size_t>(capacity, 1)) {
+    m_buffer = new char[m_capacity];
+}
+
+BufferedStream::~BufferedStream() {
+    delete[] m_buffer;
+}
+
+int BufferedStream::read(void* buffer, size_t length) {
+    if(m_size == 0) {
+        //大块读取不经过缓冲区，少一次拷贝
+        if(length >= m_capacity) {
+            return m_stream->read(buffer, length);
+        }
+        int rt = fill();
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+    size_t n = std::min(length, m_size);
+    size_t first = std::min(n, m_capacity - m_head);
+    memcpy(buffer, m_buffer + m_head, first);
+    memcpy((char*)buffer + first, m_buffer, n - first);
+    consume(n);
+    return n;
+}
+
+int BufferedStream::read(ByteArray::ptr ba, size_t length) {
+    if(m_size == 0) {
+        if(length >= m_capacity) {
+            return m_stream->read(ba, length);
+        }
+        int rt = fill();
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+    size_t n = std::min(length, m_size);
+    size_t first = std::min(n, m_capacity - m_head);
+    ba->write(m_buffer + m_head, first);
+    ba->write(m_buffer, n - first);
+    consume(n);
+    return n;
+}
+
+int BufferedStream::write(const void* buffer, size_t length) {
+    return m_stream->write(buffer, length);
+}
+
+int BufferedStream::write(ByteArray::ptr ba, size_t length) {
+    return m_stream->write(ba, length);
+}
+
+void BufferedStream::close() {
+    m_stream->close();
+}
+
+int BufferedStream::fill() {
+    if(m_size == m_capacity) {
+        return -2;
+    }
+    if(m_size == 0) {
+        m_head = 0;
+        m_scanned = 0;
+    }
+    //空闲部分可能绕回缓冲区开头，分两块交给一次readv
+    size_t tail = (m_head + m_size) % m_capacity;
+    iovec iovs[2];
+    size_t count = 1;
+    if(tail >= m_head) {
+        iovs[0].iov_base = m_buffer + tail;
+        iovs[0].iov_len = m_capacity - tail;
+        if(m_head > 0) {
+            iovs[1].iov_base = m_buffer;
+            iovs[1].iov_len = m_head;
+            count = 2;
+        }
+    } else {
+        iovs[0].iov_base = m_buffer + tail;
+        iovs[0].iov_len = m_head - tail;
+    }
+    int rt = m_stream->readv(iovs, count);
+    if(rt > 0) {
+        m_size += rt;
+    }
+    return rt;
+}
+
+void BufferedStream::linearize() {
+    if(m_head + m_size <= m_capacity) {
+        return;
+    }
+    std::rotate(m_buffer, m_buffer + m_head, m_buffer + m_capacity);
+    m_head = 0;
+}
+
+const char* BufferedStream::peek(size_t n) {
+    if(n > m_capacity) {
+        return nullptr;
+    }
+    while(m_size < n) {
+        if(fill() <= 0) {
+            return nullptr;
+        }
+    }
+    if(m_head + n > m_capacity) {
+        linearize();
+    }
+    return m_buffer + m_head;
+}
+
+void BufferedStream::consume(size_t n) {
+    n = std::min(n, m_size);
+    m_size -= n;
+    m_head = m_size ? (m_head + n) % m_capacity : 0;
+    m_scanned = m_scanned > n ? m_scanned - n : 0;
+}
+
+int BufferedStream::readUntil(const std::string& delim, const char** data) {
+    if(delim.empty()) {
+        return -1;
+    }
+    while(true) {
+        if(m_size >= delim.size()) {
+            linearize();
+            const char* start = m_buffer + m_head;
+            const char* pos = (const char*)memmem(start + m_scanned, m_size - m_scanned, delim.data(), delim.size());
+            if(pos) {
+                size_t len = pos - start + delim.size();
+                *data = start;
+                consume(len);
+                m_scanned = 0;
+                return len;
+            }
+            //delim可能跨越已有数据的结尾，保留最后delim.size()-1个字节下次再查
+            m_scanned = m_size - delim.size() + 1;
+        }
+        int rt = fill();
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+}
+
+int BufferedStream::readLine(const char** data, size_t* len) {
+    int rt = readUntil("\n", data);
+    if(rt > 0) {
+        *len = rt - 1;
+        if(*len > 0 && (*data)[*len - 1] == '\r') {
+            --*len;
+        }
+    }
+    return rt;
+}
+
+}
@@ -0,0 +1,58 @@
+#ifndef __BUFFERED_STREAM_H__
+#define __BUFFERED_STREAM_H__
+
+#include <memory>
+#include <string>
+#include "./stream.h"
+
+namespace windgent {
+
+//带预读缓冲的流装饰器：底层流的数据先批量读进一个环形缓冲区，每次补充数据只调用一次底层的readv（比如一次recv），
+//再从缓冲区交出。peek/readUntil/readLine返回指向缓冲区内部的指针，不拷贝数据；指针在下一次读取或补充数据之前有效。
+//数据在环形缓冲区中绕回时，需要连续视图的操作会先把数据旋转到缓冲区开头，这是唯一的内部搬移。
+//写操作直接交给底层流。不是线程安全的，同一时刻只应由一个协程读取
+class BufferedStream : public Stream {
+public:
+    typedef std::shared_ptr<BufferedStream> ptr;
+    BufferedStream(Stream::ptr stream, size_t capacity = 64 * 1024);
+    ~BufferedStream();
+
+    //先交出缓冲区中的数据；缓冲区为空时，length不小于容量则直接从底层流读，否则补充一次再交出
+    virtual int read(void* buffer, size_t length) override;
+    virtual int read(ByteArray::ptr ba, size_t length) override;
+    virtual int write(const void* buffer, size_t length) override;
+    virtual int write(ByteArray::ptr ba, size_t length) override;
+    virtual void close() override;
+
+    //从底层流读取一次，填满缓冲区的空闲部分。返回读到的字节数，0表示流结束，-1表示出错，缓冲区已满时返回-2
+    int fill();
+    //返回缓冲区开头至少n字节的连续视图，不消耗数据。数据不足时从底层流补充，n不能超过容量。
+    //流结束或出错前凑不够n字节时返回nullptr
+    const char* peek(size_t n);
+    //丢弃缓冲区开头的n字节
+    void consume(size_t n);
+    //读到delim为止（包括delim），返回视图的长度，*data指向数据。数据已被消耗，视图在下一次读取前有效。
+    //流结束时返回0，出错返回-1，缓冲区满了还没有找到delim时返回-2（剩余数据仍可用read读出）
+    int readUntil(const std::string& delim, const char** data);
+    //读一行，*len为不包括结尾\n或\r\n的行长度，返回值同readUntil（包括行尾，空行也大于0）
+    int readLine(const char** data, size_t* len);
+
+    //缓冲区中未读的字节数
+    size_t size() const { return m_size; }
+    size_t capacity() const { return m_capacity; }
+    Stream::ptr getStream() const { return m_stream; }
+private:
+    //把数据旋转到缓冲区开头，使其连续
+    void linearize();
+private:
+    Stream::ptr m_stream;
+    char* m_buffer;
+    size_t m_capacity;
+    size_t m_head = 0;      //第一个未读字节的位置
+    size_t m_size = 0;      //未读字节数
+    size_t m_scanned = 0;   //readUntil已经查找过、不含delim开头的字节数，避免重复查找
+};
+
+}
+
+#endif
@@ -1,17 +1,202 @@
 #include "./bytearray.h"
 #include "./endian.h"
 #include "./log.h"
+#include "./config.h"
 
 #include <math.h>
 #include <fstream>
 #include <sstream>
 #include <string.h>
 #include <iomanip>
+#include <atomic>
+#include <unordered_map>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
 
 namespace windgent {
 
 static windgent::Logger::ptr g_logger = LOG_NAME("system");
 
+static windgent::ConfigVar<uint64_t>::ptr g_block_cache_size = windgent::ConfigMgr::Lookup<uint64_t>("bytearray.block_cache_size", 4 * 1024 * 1024, "max bytes of free ByteArray blocks cached per thread");
+static windgent::ConfigVar<uint32_t>::ptr g_pool_size = windgent::ConfigMgr::Lookup<uint32_t>("bytearray.pool_size", 64, "max free ByteArrays pooled per thread by ByteArray::Create, 0 to disable");
+
+static uint64_t s_block_cache_size = 0;
+static uint32_t s_pool_size = 0;
+struct _BlockCacheIniter {
+    _BlockCacheIniter() {
+        s_block_cache_size = g_block_cache_size->getVal();
+        g_block_cache_size->addListener([](const uint64_t& old_val, const uint64_t& new_val) {
+            LOG_INFO(g_logger) << "bytearray block cache size changed from " << old_val << " to " << new_val;
+            s_block_cache_size = new_val;
+        });
+        s_pool_size = g_pool_size->getVal();
+        g_pool_size->addListener([](const uint32_t& old_val, const uint32_t& new_val) {
+            LOG_INFO(g_logger) << "bytearray pool size changed from " << old_val << " to " << new_val;
+            s_pool_size = new_val;
+        });
+    }
+};
+static _BlockCacheIniter s_block_cache_initer;
+
+static std::atomic<uint64_t> s_block_allocs {0};
+static std::atomic<uint64_t> s_block_hits {0};
+static std::atomic<uint64_t> s_block_frees {0};
+static std::atomic<uint64_t> s_cached_bytes {0};
+static std::atomic<uint64_t> s_peak_cached_bytes {0};
+static std::atomic<uint64_t> s_pool_hits {0};
+static std::atomic<uint64_t> s_pool_misses {0};
+
+//线程私有的缓存：空闲的内存块（带着Node一起缓存）按块大小分组，空闲的ByteArray按块大小分组，
+//以及ByteArray::Create返回的shared_ptr的控制块。线程退出时全部归还系统
+struct BlockCache {
+    ~BlockCache();
+    std::unordered_map<size_t, std::vector<ByteArray::Node*> > nodes;
+    size_t bytes = 0;
+    std::unordered_map<size_t, std::vector<ByteArray*> > arrays;
+    size_t array_count = 0;
+    std::unordered_map<size_t, std::vector<void*> > ctrl_blocks;
+};
+static thread_local BlockCache t_block_cache;
+//线程退出时t_block_cache析构之后，释放的内存直接归还系统
+static thread_local bool t_block_cache_dead = false;
+
+static ByteArray::Node* AllocNode(size_t size) {
+    if(!t_block_cache_dead) {
+        auto it = t_block_cache.nodes.find(size);
+        if(it != t_block_cache.nodes.end() && !it->second.empty()) {
+            ByteArray::Node* node = it->second.back();
+            it->second.pop_back();
+            t_block_cache.bytes -= size;
+            s_cached_bytes.fetch_sub(size, std::memory_order_relaxed);
+            s_block_hits.fetch_add(1, std::memory_order_relaxed);
+            return node;
+        }
+    }
+    s_block_allocs.fetch_add(1, std::memory_order_relaxed);
+    return new ByteArray::Node(size);
+}
+
+static void FreeNode(ByteArray::Node* node) {
+    if(!t_block_cache_dead && t_block_cache.bytes + node->size <= s_block_cache_size) {
+        node->next = nullptr;
+        t_block_cache.nodes[node->size].push_back(node);
+        t_block_cache.bytes += node->size;
+        uint64_t cached = s_cached_bytes.fetch_add(node->size, std::memory_order_relaxed) + node->size;
+        uint64_t peak = s_peak_cached_bytes.load(std::memory_order_relaxed);
+        while(cached > peak && !s_peak_cached_bytes.compare_exchange_weak(peak, cached, std::memory_order_relaxed));
+        return;
+    }
+    s_block_frees.fetch_add(1, std::memory_order_relaxed);
+    delete node;
+}
+
+//Create的shared_ptr控制块大小固定，和ByteArray一样在线程私有的缓存中复用，数量同样受bytearray.pool_size限制
+template<class T>
+struct CtrlBlockAllocator {
+    typedef T value_type;
+    CtrlBlockAllocator() { }
+    template<class U>
+    CtrlBlockAllocator(const CtrlBlockAllocator<U>&) { }
+
+    T* allocate(size_t n) {
+        size_t size = n * sizeof(T);
+        if(!t_block_cache_dead) {
+            auto it = t_block_cache.ctrl_blocks.find(size);
+            if(it != t_block_cache.ctrl_blocks.end() && !it->second.empty()) {
+                void* ptr = it->second.back();
+                it->second.pop_back();
+                return (T*)ptr;
+            }
+        }
+        return (T*)::operator new(size);
+    }
+    void deallocate(T* ptr, size_t n) {
+        size_t size = n * sizeof(T);
+        if(!t_block_cache_dead) {
+            std::vector<void*>& blocks = t_block_cache.ctrl_blocks[size];
+            if(blocks.size() < s_pool_size) {
+                blocks.push_back(ptr);
+                return;
+            }
+        }
+        ::operator delete(ptr);
+    }
+};
+template<class T, class U>
+bool operator==(const CtrlBlockAllocator<T>&, const CtrlBlockAllocator<U>&) { return true; }
+template<class T, class U>
+bool operator!=(const CtrlBlockAllocator<T>&, const CtrlBlockAllocator<U>&) { return false; }
+
+//Create返回的ByteArray的删除器：清空后放回池中
+static void ReleaseToPool(ByteArray* ba) {
+    if(!t_block_cache_dead && t_block_cache.array_count < s_pool_size) {
+        ba->clear();
+        ba->setIsLittleEndian(false);
+        t_block_cache.arrays[ba->getBlockSize()].push_back(ba);
+        ++t_block_cache.array_count;
+        return;
+    }
+    delete ba;
+}
+
+BlockCache::~BlockCache() {
+    t_block_cache_dead = true;
+    for(auto& i : arrays) {
+        for(auto& ba : i.second) {
+            delete ba;
+        }
+    }
+    arrays.clear();
+    array_count = 0;
+    for(auto& i : nodes) {
+        for(auto& node : i.second) {
+            s_cached_bytes.fetch_sub(node->size, std::memory_order_relaxed);
+            s_block_frees.fetch_add(1, std::memory_order_relaxed);
+            delete node;
+        }
+    }
+    nodes.clear();
+    bytes = 0;
+    for(auto& i : ctrl_blocks) {
+        for(auto& ptr : i.second) {
+            ::operator delete(ptr);
+        }
+    }
+    ctrl_blocks.clear();
+}
+
+ByteArray::ptr ByteArray::Create(size_t block_size) {
+    if(!t_block_cache_dead) {
+        auto it = t_block_cache.arrays.find(block_size);
+        if(it != t_block_cache.arrays.end() && !it->second.empty()) {
+            ByteArray* ba = it->second.back();
+            it->second.pop_back();
+            --t_block_cache.array_count;
+            s_pool_hits.fetch_add(1, std::memory_order_relaxed);
+            return ByteArray::ptr(ba, ReleaseToPool, CtrlBlockAllocator<ByteArray>());
+        }
+    }
+    s_pool_misses.fetch_add(1, std::memory_order_relaxed);
+    return ByteArray::ptr(new ByteArray(block_size), ReleaseToPool, CtrlBlockAllocator<ByteArray>());
+}
+
+ByteArray::BlockCacheStats ByteArray::GetBlockCacheStats() {
+    BlockCacheStats stats;
+    stats.allocs = s_block_allocs.load(std::memory_order_relaxed);
+    stats.hits = s_block_hits.load(std::memory_order_relaxed);
+    stats.frees = s_block_frees.load(std::memory_order_relaxed);
+    stats.cached_bytes = s_cached_bytes.load(std::memory_order_relaxed);
+    stats.peak_cached_bytes = s_peak_cached_bytes.load(std::memory_order_relaxed);
+    stats.pool_hits = s_pool_hits.load(std::memory_order_relaxed);
+    stats.pool_misses = s_pool_misses.load(std::memory_order_relaxed);
+    return stats;
+}
+
 ByteArray::Node::Node():ptr(nullptr), size(0), next(nullptr) {
 }
 
@@ -26,7 +211,7 @@ ByteArray::Node::~Node() {
 
 ByteArray::ByteArray(size_t block_size)
     :m_blocksize(block_size), m_position(0), m_capacity(block_size), m_size(0)
-    ,m_endian(WINDGENT_BIG_ENDIAN), m_root(new Node(block_size)), m_cur(m_root) {
+    ,m_endian(WINDGENT_BIG_ENDIAN), m_root(AllocNode(block_size)), m_cur(m_root) {
 
 }
 
@@ -35,7 +220,7 @@ ByteArray::~ByteArray() {
     while(tmp) {
         m_cur = tmp;
         tmp = tmp->next;
-        delete m_cur;
+        FreeNode(m_cur);
     }
 }
 
@@ -133,14 +318,7 @@ void ByteArray::writeInt32(int32_t value) {
 //压缩算法：每7位保存一位，前面1位为符号位（非有符号的符号位，而是如果为0表示后面没有数据，1表示有数据
 void ByteArray::writeUint32(uint32_t value) {
     //最多压缩到5个字节
-    uint8_t tmp[5];
-    uint8_t i = 0;
-    while(value >= 0x80) {
-        tmp[i++] = (value & 0x7F) | 0x80;
-        value >>= 7; 
-    }
-    tmp[i++] = value;
-    write(tmp, i);
+    writeVarint(value);
 }
 
 void ByteArray::writeInt64(int64_t value) {
@@ -149,14 +327,199 @@ void ByteArray::writeInt64(int64_t value) {
 
 void ByteArray::writeUint64(uint64_t value) {
     //最多压缩到10个字节
-    uint8_t tmp[10];
-    uint8_t i = 0;
+    writeVarint(value);
+}
+
+//把value压缩写到p，p之后至少有10字节空间，返回写入的字节数。小端机器上不超过56位的值（编码最多8字节）
+//先用clz算出长度，再把每7位展开到一个字节（BMI2用pdep，否则三轮移位）并加上续位，一次存储。
+//wide为true时直接存8个字节，调用者保证p之后超出编码长度的部分是无用数据（追加写入时）
+static inline size_t EncodeVarint(uint64_t value, uint8_t* p, bool wide) {
+#if WINDGENT_BYTE_ORDER == WINDGENT_LITTLE_ENDIAN
+    if(value < (1ull << 56)) {
+        size_t n = value ? (63 - __builtin_clzll(value)) / 7 + 1 : 1;
+#ifdef __BMI2__
+        uint64_t word = _pdep_u64(value, 0x7F7F7F7F7F7F7F7Full);
+#else
+        uint64_t word = value;
+        word = (word & 0x000000000FFFFFFFull) | ((word & 0x00FFFFFFF0000000ull) << 4);
+        word = (word & 0x00003FFF00003FFFull) | ((word & 0x0FFFC0000FFFC000ull) << 2);
+        word = (word & 0x007F007F007F007Full) | ((word & 0x3F803F803F803F80ull) << 1);
+#endif
+        word |= 0x8080808080808080ull & ((1ull << (8 * (n - 1))) - 1);
+        memcpy(p, &word, wide ? sizeof(word) : n);
+        return n;
+    }
+#endif
+    size_t n = 0;
     while(value >= 0x80) {
-        tmp[i++] = (value & 0x7F) | 0x80;
+        p[n++] = (value & 0x7F) | 0x80;
         value >>= 7;
     }
-    tmp[i++] = value;
-    write(tmp, i);
+    p[n++] = value;
+    return n;
+}
+
+//从p解码一个压缩整数，p之后至少有10字节可读，最多读取max_bytes字节，返回读取的字节数。
+//小端机器上一次取8个字节，用结束字节（最高位为0）的位置确定长度，再把每字节的低7位拼起来：
+//编译时打开BMI2用一条pext指令，否则用三轮移位合并；超过8字节的编码逐字节解码
+static inline size_t DecodeVarint(const uint8_t* p, size_t max_bytes, uint64_t* value) {
+#if WINDGENT_BYTE_ORDER == WINDGENT_LITTLE_ENDIAN
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    uint64_t stops = ~word & 0x8080808080808080ull;
+    if(stops) {
+        size_t n = (__builtin_ctzll(stops) + 1) / 8;
+        if(n <= max_bytes) {
+            if(n < 8) {
+                word &= (1ull << (n * 8)) - 1;
+            }
+#ifdef __BMI2__
+            *value = _pext_u64(word, 0x7F7F7F7F7F7F7F7Full);
+#else
+            word &= 0x7F7F7F7F7F7F7F7Full;
+            word = (word & 0x007F007F007F007Full) | ((word & 0x7F007F007F007F00ull) >> 1);
+            word = (word & 0x00003FFF00003FFFull) | ((word & 0x3FFF00003FFF0000ull) >> 2);
+            word = (word & 0x000000000FFFFFFFull) | ((word & 0x0FFFFFFF00000000ull) >> 4);
+            *value = word;
+#endif
+            return n;
+        }
+    }
+#endif
+    uint64_t result = 0;
+    size_t i = 0;
+    while(i < max_bytes) {
+        uint8_t b = p[i];
+        result |= ((uint64_t)(b & 0x7F)) << (7 * i);
+        ++i;
+        if(b < 0x80) {
+            break;
+        }
+    }
+    *value = result;
+    return i;
+}
+
+void ByteArray::advanceWrite(size_t npos, size_t n) {
+    if(m_cur->size == npos + n) {
+        m_cur = m_cur->next;
+    }
+    m_position += n;
+    if(m_position > m_size) {
+        m_size = m_position;
+    }
+}
+
+void ByteArray::advanceRead(size_t npos, size_t n) {
+    if(m_cur->size == npos + n) {
+        m_cur = m_cur->next;
+    }
+    m_position += n;
+}
+
+void ByteArray::writeVarint(uint64_t value) {
+    size_t npos = m_position % m_blocksize;
+    if(m_cur && m_cur->size - npos >= 10) {
+        advanceWrite(npos, EncodeVarint(value, (uint8_t*)m_cur->ptr + npos, m_position >= m_size));
+        return;
+    }
+    uint8_t tmp[10];
+    write(tmp, EncodeVarint(value, tmp, true));
+}
+
+uint64_t ByteArray::readVarint(size_t max_bytes) {
+    size_t npos = m_position % m_blocksize;
+    if(m_cur && m_cur->size - npos >= 10 && getReadSize() >= 10) {
+        uint64_t value = 0;
+        advanceRead(npos, DecodeVarint((const uint8_t*)m_cur->ptr + npos, max_bytes, &value));
+        return value;
+    }
+    //靠近内存块或数据末尾时逐字节读取
+    uint64_t result = 0;
+    for(size_t i = 0; i < max_bytes; ++i) {
+        uint8_t b = readFuint8();
+        result |= (((uint64_t)(b & 0x7F)) << (7 * i));
+        if(b < 0x80) {
+            break;
+        }
+    }
+    return result;
+}
+
+//在当前内存块剩余的连续空间上批量编码，空间不足10字节时单个写入（跨越内存块）。
+//SSE2下连续16个值都小于0x80时，一次打包成16个字节
+void ByteArray::writeUint32Array(const uint32_t* values, size_t count) {
+    size_t i = 0;
+    while(i < count) {
+        size_t npos = m_position % m_blocksize;
+        if(m_cur && m_cur->size - npos >= 10) {
+            uint8_t* begin = (uint8_t*)m_cur->ptr + npos;
+            uint8_t* end = (uint8_t*)m_cur->ptr + m_cur->size;
+            uint8_t* p = begin;
+            bool wide = m_position >= m_size;
+            while(i < count && end - p >= 10) {
+#ifdef __SSE2__
+                if(count - i >= 16 && end - p >= 16) {
+                    __m128i a = _mm_loadu_si128((const __m128i*)(values + i));
+                    __m128i b = _mm_loadu_si128((const __m128i*)(values + i + 4));
+                    __m128i c = _mm_loadu_si128((const __m128i*)(values + i + 8));
+                    __m128i d = _mm_loadu_si128((const __m128i*)(values + i + 12));
+                    __m128i high = _mm_and_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), _mm_set1_epi32(~0x7F));
+                    if(_mm_movemask_epi8(_mm_cmpeq_epi32(high, _mm_setzero_si128())) == 0xFFFF) {
+                        _mm_storeu_si128((__m128i*)p, _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+                        p += 16;
+                        i += 16;
+                        continue;
+                    }
+                }
+#endif
+                p += EncodeVarint(values[i++], p, wide);
+            }
+            advanceWrite(npos, p - begin);
+        } else {
+            writeVarint(values[i++]);
+        }
+    }
+}
+
+//在当前内存块剩余的连续数据上批量解码，剩余不足16字节时单个读取（跨越内存块）。
+//SSE2下接下来16个字节都是单字节编码时，一次展开成16个值
+void ByteArray::readUint32Array(uint32_t* values, size_t count) {
+    size_t i = 0;
+    while(i < count) {
+        size_t npos = m_position % m_blocksize;
+        size_t avail = m_cur ? std::min(m_cur->size - npos, getReadSize()) : 0;
+        if(avail >= 16) {
+            const uint8_t* begin = (const uint8_t*)m_cur->ptr + npos;
+            const uint8_t* end = begin + avail;
+            const uint8_t* p = begin;
+            while(i < count && end - p >= 16) {
+#ifdef __SSE2__
+                if(count - i >= 16) {
+                    __m128i v = _mm_loadu_si128((const __m128i*)p);
+                    if(_mm_movemask_epi8(v) == 0) {
+                        __m128i zero = _mm_setzero_si128();
+                        __m128i lo = _mm_unpacklo_epi8(v, zero);
+                        __m128i hi = _mm_unpackhi_epi8(v, zero);
+                        _mm_storeu_si128((__m128i*)(values + i), _mm_unpacklo_epi16(lo, zero));
+                        _mm_storeu_si128((__m128i*)(values + i + 4), _mm_unpackhi_epi16(lo, zero));
+                        _mm_storeu_si128((__m128i*)(values + i + 8), _mm_unpacklo_epi16(hi, zero));
+                        _mm_storeu_si128((__m128i*)(values + i + 12), _mm_unpackhi_epi16(hi, zero));
+                        p += 16;
+                        i += 16;
+                        continue;
+                    }
+                }
+#endif
+                uint64_t value = 0;
+                p += DecodeVarint(p, 5, &value);
+                values[i++] = value;
+            }
+            advanceRead(npos, p - begin);
+        } else {
+            values[i++] = readVarint(5);
+        }
+    }
 }
 
 void ByteArray::writeStringF16(const std::string& str) {
@@ -280,17 +643,7 @@ int32_t ByteArray::readInt32() {
 }
 
 uint32_t ByteArray::readUint32() {
-    uint32_t result = 0;
-    for(int i = 0;i < 32; i += 7) {
-        uint8_t b = readFuint8();
-        if(b < 0x80) {
-            result |= (((uint32_t)b) << i);
-            break;
-        } else {
-            result |= (((uint32_t)(b & 0x7F)) << i);
-        }
-    }
-    return result;
+    return readVarint(5);
 }
 
 int64_t ByteArray::readInt64() {
@@ -298,17 +651,7 @@ int64_t ByteArray::readInt64() {
 }
 
 uint64_t ByteArray::readUint64() {
-    uint64_t result = 0;
-    for(int i = 0;i < 64; i += 7) {
-        uint8_t b = readFuint8();
-        if(b < 0x80) {
-            result |= (((uint64_t)b) << i);
-            break;
-        } else {
-            result |= (((uint64_t)(b & 0x7F)) << i);
-        }
-    }
-    return result;
+    return readVarint(10);
 }
 
 //最基本的写操作函数
@@ -469,7 +812,7 @@ void ByteArray::addCapacity(size_t size) {
     size_t block_cnt = ceil(1.0 * size / m_blocksize);
     Node* fst = nullptr;
     for(size_t i = 0;i < block_cnt; ++i) {
-        tmp->next = new Node(m_blocksize);
+        tmp->next = AllocNode(m_blocksize);
         if(!fst) {
             fst = tmp->next;
         }
@@ -489,7 +832,7 @@ void ByteArray::clear() {
     while(tmp){
         m_cur = tmp;
         tmp = tmp->next;
-        delete m_cur;
+        FreeNode(m_cur);
     }
     m_cur = m_root;
     m_root->next = nullptr;
@@ -16,6 +16,9 @@ public:
 
     ByteArray(size_t block_size = 4096);
     ~ByteArray();
+    //从线程私有的池中取一个空的ByteArray，最后一个引用释放时清空并放回池中，而不是析构。
+    //池的大小由bytearray.pool_size限制，0表示不复用
+    static ByteArray::ptr Create(size_t block_size = 4096);
 
     struct Node {
         Node();
@@ -26,6 +29,19 @@ public:
         size_t size;
         Node* next;
     };
+
+    //内存块缓存的统计，所有线程累计。内存块（连同Node）释放后先放入线程私有的缓存，
+    //每个线程缓存的字节数不超过bytearray.block_cache_size，超出部分直接归还系统
+    struct BlockCacheStats {
+        uint64_t allocs = 0;            //向系统申请的内存块数
+        uint64_t hits = 0;              //从缓存取得的内存块数
+        uint64_t frees = 0;             //归还系统的内存块数
+        uint64_t cached_bytes = 0;      //当前缓存的字节数
+        uint64_t peak_cached_bytes = 0; //缓存字节数的高水位
+        uint64_t pool_hits = 0;         //Create从池中取得的ByteArray数
+        uint64_t pool_misses = 0;       //Create新建的ByteArray数
+    };
+    static BlockCacheStats GetBlockCacheStats();
     //write，按照data类型长度来写，不压缩
     void writeFint8(int8_t value);
     void writeFuint8(uint8_t value);
@@ -49,6 +65,8 @@ public:
     void writeStringVint(const std::string& str);
     //不写入长度
     void writeStringWithoutLen(const std::string& str);
+    //批量压缩写入count个uint32（不写入数量），用于packed repeated字段
+    void writeUint32Array(const uint32_t* values, size_t count);
 
     //read，按照固定的data类型长度来读,string类型数据按照其写入的长度来读
     int8_t readFint8();
@@ -70,6 +88,8 @@ public:
     uint32_t readUint32();
     int64_t readInt64();
     uint64_t readUint64();
+    //批量读取writeUint32Array写入的count个uint32
+    void readUint32Array(uint32_t* values, size_t count);
 
     //往内存写入buf中size长度的数据
     void write(const void* buf, size_t size);
@@ -82,7 +102,7 @@ public:
     bool readFromFile(const std::string& filename);
 
     //other
-    void clear();                                                   //释放头结点之外的所有结点
+    void clear();                                                   //释放头结点之外的所有结点（放回内存块缓存）
     void addCapacity(size_t size);                                  //扩容
     size_t getPosition() const { return m_position; }
     void setPosition(size_t val);                                   //设置m_position和m_cur
@@ -98,6 +118,14 @@ public:
     uint64_t getReadBuffers(std::vector<iovec>& buffers, uint64_t len = ~0ull) const;
     uint64_t getReadBuffers(std::vector<iovec>& buffers, uint64_t len, uint64_t pos) const;
     uint64_t getWriteBuffers(std::vector<iovec>& buffers, uint64_t len);
+private:
+    //压缩写/读一个整数，当前内存块剩余的连续空间足够时直接在内存块上编解码，否则逐字节经过write/read。
+    //max_bytes为最多读取的字节数，uint32为5，uint64为10
+    void writeVarint(uint64_t value);
+    uint64_t readVarint(size_t max_bytes);
+    //直接在当前内存块的npos处写入/读取了n字节后，移动m_position和m_cur
+    void advanceWrite(size_t npos, size_t n);
+    void advanceRead(size_t npos, size_t n);
 private:
     size_t m_blocksize;     //内存块大小
     size_t m_position;      //当前操作位置
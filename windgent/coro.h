@@ -0,0 +1,361 @@
+#ifndef __CORO_H__
+#define __CORO_H__
+
+//C++20无栈协程前端，只有头文件。库本身仍按C++11编译，使用它的源文件需要-std=c++20（CMake选项CORO）。
+//挂起的协程只占用编译器分配的协程帧（通常几百字节），不需要独立的栈；等待fd和定时器仍由IOManager完成，
+//协程被唤醒时在调度器复用的协程（Fiber）上执行到下一次挂起，所以可以和现有的Fiber代码运行在同一个调度器上。
+//协程中不要调用会挂起Fiber的hook函数，读写用这里的read/write/connect，fd必须是非阻塞的（hook的socket已经是）
+#if __cplusplus < 202002L || !defined(__cpp_impl_coroutine)
+#error "windgent/coro.h requires C++20 coroutines (-std=c++20)"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <memory>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "./iomanager.h"
+#include "./hook.h"
+#include "./log.h"
+#include "./future.h"
+
+namespace windgent {
+namespace coro {
+
+template<class T = void>
+class Task;
+
+namespace detail {
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation;   //co_await本任务的协程，结束时切换回去
+    std::exception_ptr error;
+    bool detached = false;                  //由spawn启动，没有等待者，结束时自己释放
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template<class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            PromiseBase& p = h.promise();
+            if(p.continuation) {
+                return p.continuation;
+            }
+            if(p.detached) {
+                if(p.error) {
+                    try {
+                        std::rethrow_exception(p.error);
+                    } catch(std::exception& e) {
+                        LOG_ERROR(LOG_NAME("system")) << "detached coroutine exception: " << e.what();
+                    } catch(...) {
+                        LOG_ERROR(LOG_NAME("system")) << "detached coroutine exception";
+                    }
+                }
+                h.destroy();
+            }
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept { }
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template<class T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+    template<class V>
+    void return_value(V&& v) { value.emplace(std::forward<V>(v)); }
+};
+
+template<>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object();
+    void return_void() { }
+};
+
+}
+
+//惰性启动的协程任务：被co_await时才开始执行，执行完毕后直接切换回等待者（对称转移，不会加深调用栈）
+template<class T>
+class Task {
+public:
+    typedef detail::Promise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> handle_type;
+
+    explicit Task(handle_type h) :m_handle(h) { }
+    Task(Task&& rhs) noexcept :m_handle(std::exchange(rhs.m_handle, nullptr)) { }
+    Task& operator=(Task&& rhs) noexcept {
+        if(this != &rhs) {
+            if(m_handle) {
+                m_handle.destroy();
+            }
+            m_handle = std::exchange(rhs.m_handle, nullptr);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if(m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> cont) noexcept {
+        m_handle.promise().continuation = cont;
+        return m_handle;
+    }
+    T await_resume() {
+        promise_type& p = m_handle.promise();
+        if(p.error) {
+            std::rethrow_exception(p.error);
+        }
+        if constexpr(!std::is_void<T>::value) {
+            return std::move(*p.value);
+        }
+    }
+
+    //交出协程帧的所有权
+    handle_type release() { return std::exchange(m_handle, nullptr); }
+private:
+    handle_type m_handle;
+};
+
+namespace detail {
+
+template<class T>
+inline Task<T> Promise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<Promise<T> >::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<Promise<void> >::from_promise(*this));
+}
+
+template<class T>
+Task<void> Fulfill(Task<T> task, windgent::Promise<T> promise) {
+    try {
+        promise.setValue(co_await task);
+    } catch(...) {
+        promise.setException(std::current_exception());
+    }
+}
+
+}
+
+//在iom（默认为当前IOManager）上启动任务，不等待它结束，任务结束后释放协程帧
+inline void spawn(Task<void> task, IOManager* iom = nullptr) {
+    if(!iom) {
+        iom = IOManager::GetThis();
+    }
+    std::coroutine_handle<detail::Promise<void> > h = task.release();
+    h.promise().detached = true;
+    iom->schedule([h]() {
+        h.resume();
+    });
+}
+
+//启动有返回值的任务，Fiber代码可以通过Future等待结果
+template<class T>
+windgent::Future<T> spawn(Task<T> task, IOManager* iom = nullptr) {
+    windgent::Promise<T> promise;
+    windgent::Future<T> future = promise.getFuture();
+    spawn(detail::Fulfill(std::move(task), promise), iom);
+    return future;
+}
+
+//等待fd上的读/写事件。timeout_ms不为~0ull时超时后取消等待。
+//co_await的结果：事件就绪（或fd被关闭、事件被取消）返回true，超时或注册失败返回false
+class EventAwaiter {
+public:
+    EventAwaiter(int fd, IOManager::Event event, uint64_t timeout_ms)
+        :m_fd(fd), m_event(event), m_timeoutMs(timeout_ms) { }
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> h) {
+        IOManager* iom = IOManager::GetThis();
+        if(!iom) {
+            m_ok = false;
+            return false;
+        }
+        if(m_timeoutMs == ~0ull) {
+            //注册成功后回调随时可能在其他线程恢复协程，之后不能再访问this
+            if(iom->addEvent(m_fd, m_event, [h]() { h.resume(); })) {
+                m_ok = false;
+                return false;
+            }
+            return true;
+        }
+        //事件回调和超时定时器共享的状态。超时一方在锁内取消事件，事件回调在锁内标记完成，
+        //协程恢复后再到达的定时器不会误取消同一个fd上新的等待
+        std::shared_ptr<State> state = std::make_shared<State>();
+        m_state = state;
+        int fd = m_fd;
+        IOManager::Event event = m_event;
+        uint64_t timeout_ms = m_timeoutMs;
+        //持有锁直到定时器设置完毕，事件回调在这之前不会恢复协程
+        SpinLock::Lock lock(state->mutex);
+        if(iom->addEvent(fd, event, [h, state]() {
+            SpinLock::Lock lock(state->mutex);
+            state->done = true;
+            if(state->timer) {
+                state->timer->cancel();
+                state->timer = nullptr;
+            }
+            lock.unlock();
+            h.resume();
+        })) {
+            m_ok = false;
+            return false;
+        }
+        state->timer = iom->addTimer(timeout_ms, [iom, fd, event, state]() {
+            SpinLock::Lock lock(state->mutex);
+            state->timer = nullptr;
+            if(!state->done) {
+                //取消会触发事件回调，由它恢复协程
+                state->timedout = iom->cancelEvent(fd, event);
+            }
+        });
+        return true;
+    }
+    bool await_resume() const noexcept {
+        return m_ok && !(m_state && m_state->timedout);
+    }
+private:
+    struct State {
+        SpinLock mutex;
+        bool done = false;
+        bool timedout = false;
+        Timer::ptr timer;
+    };
+    int m_fd;
+    IOManager::Event m_event;
+    uint64_t m_timeoutMs;
+    bool m_ok = true;
+    std::shared_ptr<State> m_state;
+};
+
+inline EventAwaiter readable(int fd, uint64_t timeout_ms = ~0ull) {
+    return EventAwaiter(fd, IOManager::READ, timeout_ms);
+}
+
+inline EventAwaiter writable(int fd, uint64_t timeout_ms = ~0ull) {
+    return EventAwaiter(fd, IOManager::WRITE, timeout_ms);
+}
+
+//挂起ms毫秒，由当前IOManager的定时器恢复
+class SleepAwaiter {
+public:
+    SleepAwaiter(uint64_t ms) :m_ms(ms) { }
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> h) {
+        IOManager* iom = IOManager::GetThis();
+        if(!iom) {
+            return false;
+        }
+        iom->addTimer(m_ms, [h]() {
+            h.resume();
+        });
+        return true;
+    }
+    void await_resume() const noexcept { }
+private:
+    uint64_t m_ms;
+};
+
+inline SleepAwaiter sleep(uint64_t ms) {
+    return SleepAwaiter(ms);
+}
+
+//在协程中等待Fiber代码产生的Future，完成后回到当前IOManager上继续执行
+template<class T>
+class FutureAwaiter {
+public:
+    FutureAwaiter(windgent::Future<T> future) :m_future(future) { }
+    bool await_ready() const { return m_future.isReady(); }
+    void await_suspend(std::coroutine_handle<> h) {
+        IOManager* iom = IOManager::GetThis();
+        m_future.onReady([iom, h]() {
+            iom->schedule([h]() {
+                h.resume();
+            });
+        });
+    }
+    T& await_resume() { return m_future.get(); }
+private:
+    windgent::Future<T> m_future;
+};
+
+template<class T>
+FutureAwaiter<T> wait(windgent::Future<T> future) {
+    return FutureAwaiter<T>(future);
+}
+
+//读写到EAGAIN时co_await fd就绪。返回读写的字节数，失败返回-errno，超时返回-ETIMEDOUT
+inline Task<ssize_t> read(int fd, void* buf, size_t len, uint64_t timeout_ms = ~0ull) {
+    while(true) {
+        ssize_t n = read_f(fd, buf, len);
+        if(n >= 0) {
+            co_return n;
+        }
+        if(errno == EINTR) {
+            continue;
+        }
+        if(errno != EAGAIN) {
+            co_return -errno;
+        }
+        if(!co_await readable(fd, timeout_ms)) {
+            co_return -ETIMEDOUT;
+        }
+    }
+}
+
+inline Task<ssize_t> write(int fd, const void* buf, size_t len, uint64_t timeout_ms = ~0ull) {
+    while(true) {
+        ssize_t n = write_f(fd, buf, len);
+        if(n >= 0) {
+            co_return n;
+        }
+        if(errno == EINTR) {
+            continue;
+        }
+        if(errno != EAGAIN) {
+            co_return -errno;
+        }
+        if(!co_await writable(fd, timeout_ms)) {
+            co_return -ETIMEDOUT;
+        }
+    }
+}
+
+//非阻塞connect，等待连接完成。成功返回0，失败返回-errno，超时返回-ETIMEDOUT
+inline Task<int> connect(int fd, const sockaddr* addr, socklen_t addrlen, uint64_t timeout_ms = ~0ull) {
+    if(connect_f(fd, addr, addrlen) == 0) {
+        co_return 0;
+    }
+    if(errno != EINPROGRESS) {
+        co_return -errno;
+    }
+    if(!co_await writable(fd, timeout_ms)) {
+        co_return -ETIMEDOUT;
+    }
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if(getsockopt_f(fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1) {
+        co_return -errno;
+    }
+    co_return -error;
+}
+
+}
+}
+
+#endif
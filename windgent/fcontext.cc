@@ -0,0 +1,139 @@
+#include <stdint.h>
+#include "./fcontext.h"
+
+#ifdef WINDGENT_FIBER_ASM
+
+//新上下文第一次被切换到时，windgent_jump_fcontext的ret会跳到这里，由它调用入口函数。
+//入口函数通过callee-saved寄存器(rbx/x19)传入；.cfi_undefined让栈回溯在这里终止
+extern "C" void windgent_fcontext_entry() __attribute__((visibility("hidden")));
+
+#if defined(__CET__) && (__CET__ & 1)
+#define WINDGENT_ENDBR "endbr64\n"
+#else
+#define WINDGENT_ENDBR
+#endif
+
+#if defined(__x86_64__)
+
+//栈帧(低地址->高地址)：mxcsr/x87控制字(8字节)、对齐(8字节)、r15、r14、r13、r12、rbx、rbp、返回地址
+__asm__(
+    ".text\n"
+    ".globl windgent_jump_fcontext\n"
+    ".type windgent_jump_fcontext, @function\n"
+    ".align 16\n"
+"windgent_jump_fcontext:\n"
+    WINDGENT_ENDBR
+    "pushq %rbp\n"
+    "pushq %rbx\n"
+    "pushq %r12\n"
+    "pushq %r13\n"
+    "pushq %r14\n"
+    "pushq %r15\n"
+    "subq $16, %rsp\n"
+    "stmxcsr (%rsp)\n"
+    "fnstcw 4(%rsp)\n"
+    "movq %rsp, (%rdi)\n"
+    "movq %rsi, %rsp\n"
+    "ldmxcsr (%rsp)\n"
+    "fldcw 4(%rsp)\n"
+    "addq $16, %rsp\n"
+    "popq %r15\n"
+    "popq %r14\n"
+    "popq %r13\n"
+    "popq %r12\n"
+    "popq %rbx\n"
+    "popq %rbp\n"
+    "ret\n"
+    ".size windgent_jump_fcontext, .-windgent_jump_fcontext\n"
+
+    ".globl windgent_fcontext_entry\n"
+    ".hidden windgent_fcontext_entry\n"
+    ".type windgent_fcontext_entry, @function\n"
+    ".align 16\n"
+"windgent_fcontext_entry:\n"
+    ".cfi_startproc\n"
+    ".cfi_undefined rip\n"
+    "callq *%rbx\n"
+    "ud2\n"
+    ".cfi_endproc\n"
+    ".size windgent_fcontext_entry, .-windgent_fcontext_entry\n"
+);
+
+windgent::fcontext_t windgent_make_fcontext(void* stack, size_t size, void (*fn)()) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    //ret之后rsp == top，保证调用入口函数时栈按16字节对齐
+    uint64_t* sp = (uint64_t*)(top - 9 * sizeof(uint64_t));
+    ((uint32_t*)sp)[0] = 0x1F80;        //mxcsr默认值
+    ((uint32_t*)sp)[1] = 0x037F;        //x87控制字默认值
+    sp[1] = 0;
+    sp[2] = sp[3] = sp[4] = sp[5] = 0;  //r15 ~ r12
+    sp[6] = (uint64_t)fn;               //rbx
+    sp[7] = 0;                          //rbp
+    sp[8] = (uint64_t)&windgent_fcontext_entry;
+    return sp;
+}
+
+#elif defined(__aarch64__)
+
+//栈帧(低地址->高地址)：d8 ~ d15、x19 ~ x28、x29(fp)、x30(lr)，共0xa0字节
+__asm__(
+    ".text\n"
+    ".globl windgent_jump_fcontext\n"
+    ".type windgent_jump_fcontext, %function\n"
+    ".align 4\n"
+"windgent_jump_fcontext:\n"
+    "sub sp, sp, #0xa0\n"
+    "stp d8, d9, [sp, #0x00]\n"
+    "stp d10, d11, [sp, #0x10]\n"
+    "stp d12, d13, [sp, #0x20]\n"
+    "stp d14, d15, [sp, #0x30]\n"
+    "stp x19, x20, [sp, #0x40]\n"
+    "stp x21, x22, [sp, #0x50]\n"
+    "stp x23, x24, [sp, #0x60]\n"
+    "stp x25, x26, [sp, #0x70]\n"
+    "stp x27, x28, [sp, #0x80]\n"
+    "stp x29, x30, [sp, #0x90]\n"
+    "mov x2, sp\n"
+    "str x2, [x0]\n"
+    "mov sp, x1\n"
+    "ldp d8, d9, [sp, #0x00]\n"
+    "ldp d10, d11, [sp, #0x10]\n"
+    "ldp d12, d13, [sp, #0x20]\n"
+    "ldp d14, d15, [sp, #0x30]\n"
+    "ldp x19, x20, [sp, #0x40]\n"
+    "ldp x21, x22, [sp, #0x50]\n"
+    "ldp x23, x24, [sp, #0x60]\n"
+    "ldp x25, x26, [sp, #0x70]\n"
+    "ldp x27, x28, [sp, #0x80]\n"
+    "ldp x29, x30, [sp, #0x90]\n"
+    "add sp, sp, #0xa0\n"
+    "ret\n"
+    ".size windgent_jump_fcontext, .-windgent_jump_fcontext\n"
+
+    ".globl windgent_fcontext_entry\n"
+    ".hidden windgent_fcontext_entry\n"
+    ".type windgent_fcontext_entry, %function\n"
+    ".align 4\n"
+"windgent_fcontext_entry:\n"
+    ".cfi_startproc\n"
+    ".cfi_undefined x30\n"
+    "blr x19\n"
+    "brk #0\n"
+    ".cfi_endproc\n"
+    ".size windgent_fcontext_entry, .-windgent_fcontext_entry\n"
+);
+
+windgent::fcontext_t windgent_make_fcontext(void* stack, size_t size, void (*fn)()) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t* sp = (uint64_t*)(top - 20 * sizeof(uint64_t));
+    for(int i = 0; i < 20; ++i) {
+        sp[i] = 0;
+    }
+    sp[8] = (uint64_t)fn;                               //x19
+    sp[19] = (uint64_t)&windgent_fcontext_entry;        //x30
+    return sp;
+}
+
+#endif
+
+#endif
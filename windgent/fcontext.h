@@ -0,0 +1,31 @@
+#ifndef __FCONTEXT_H__
+#define __FCONTEXT_H__
+
+#include <stddef.h>
+
+//x86-64和aarch64上使用手写汇编切换协程上下文；其他平台或定义了WINDGENT_FIBER_UCONTEXT时回退到ucontext
+#if !defined(WINDGENT_FIBER_UCONTEXT) && (defined(__x86_64__) || defined(__aarch64__))
+#define WINDGENT_FIBER_ASM 1
+#endif
+
+namespace windgent {
+
+//协程上下文只是一个栈指针：切出时把callee-saved寄存器压到协程自己的栈上，再把栈顶记录下来。
+//与swapcontext相比不保存信号掩码，切换时不需要rt_sigprocmask系统调用
+typedef void* fcontext_t;
+
+}
+
+#ifdef WINDGENT_FIBER_ASM
+extern "C" {
+
+//保存当前上下文到*from，切换到to。切换回来时从这里返回
+void windgent_jump_fcontext(windgent::fcontext_t* from, windgent::fcontext_t to);
+
+//在[stack, stack + size)上构造一个初始上下文，第一次切换到它时执行fn。fn不能返回
+windgent::fcontext_t windgent_make_fcontext(void* stack, size_t size, void (*fn)());
+
+}
+#endif
+
+#endif
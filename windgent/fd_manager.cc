@@ -7,12 +7,22 @@
 
 namespace windgent {
 
+static std::atomic<uint64_t> s_fd_generation = {0};
+
 FdCtx::FdCtx(int fd):m_isInit(false), m_isSocket(false), m_sysNonblock(false), m_userNonblock(false)
-                    ,m_isClosed(false), m_fd(fd), m_recvTimeout(-1), m_sendTimeout(-1) {
+                    ,m_isClosed(false), m_fd(fd), m_generation(++s_fd_generation), m_recvTimeout(-1), m_sendTimeout(-1)
+                    ,m_recvDeadline(0), m_sendDeadline(0) {
     init();
 }
 
-FdCtx::~FdCtx() { }
+FdCtx::~FdCtx() {
+    if(m_recvTimer) {
+        m_recvTimer->cancel();
+    }
+    if(m_sendTimer) {
+        m_sendTimer->cancel();
+    }
+}
 
 bool FdCtx::init() {
     if(m_isInit) {
@@ -59,39 +69,82 @@ uint64_t FdCtx::getTimeout(int type) {
     }
 }
 
+Timer::ptr& FdCtx::getTimer(int type) {
+    return type == SO_RCVTIMEO ? m_recvTimer : m_sendTimer;
+}
+
+void FdCtx::beginWait(int type, uint64_t deadline) {
+    (type == SO_RCVTIMEO ? m_recvDeadline : m_sendDeadline) = deadline;
+}
+
+bool FdCtx::expireWait(int type, uint64_t now_ms) {
+    std::atomic<uint64_t>& deadline = type == SO_RCVTIMEO ? m_recvDeadline : m_sendDeadline;
+    uint64_t d = deadline;
+    if(d == 0 || d == ~0ull || d > now_ms) {
+        return false;
+    }
+    return deadline.compare_exchange_strong(d, ~0ull);
+}
+
+bool FdCtx::endWait(int type) {
+    return (type == SO_RCVTIMEO ? m_recvDeadline : m_sendDeadline).exchange(0) == ~0ull;
+}
+
 FdManager::FdManager() {
-    m_fds.resize(64);
 }
 
 FdCtx::ptr FdManager::get(int fd, bool auto_create) {
     if(fd == -1) {
         return nullptr;
     }
-    RWMutexType::RdLock lock(m_mutex);
-    if((int)m_fds.size() <= fd){
-        if(!auto_create) {
-            return nullptr;
+    Slot* slot = m_fds.get(fd, auto_create);
+    if(!slot) {
+        return nullptr;
+    }
+    {
+        MutexType::Lock lock(slot->mutex);
+        if(slot->ctx || !auto_create) {
+            return slot->ctx;
         }
-    } else if(m_fds[fd] || !auto_create) {
-        return m_fds[fd];
     }
-    lock.unlock();
 
-    RWMutexType::WrLock lock2(m_mutex);
+    //FdCtx的构造会调用fstat/fcntl，不在自旋锁内进行
     FdCtx::ptr ctx(new FdCtx(fd));
-    if(fd >= (int)m_fds.size()) {
-        m_fds.resize(fd * 1.5);
+    MutexType::Lock lock(slot->mutex);
+    //其他线程已经创建过，用它的
+    if(!slot->ctx) {
+        slot->ctx = ctx;
     }
-    m_fds[fd] = ctx;
+    return slot->ctx;
+}
+
+FdCtx::ptr FdManager::create(int fd) {
+    Slot* slot = m_fds.get(fd, true);
+    if(!slot) {
+        return nullptr;
+    }
+    FdCtx::ptr ctx(new FdCtx(fd));
+    FdCtx::ptr old;
+    {
+        MutexType::Lock lock(slot->mutex);
+        old.swap(slot->ctx);
+        slot->ctx = ctx;
+    }
+    //旧的上下文在锁外释放
     return ctx;
 }
 
 void FdManager::del(int fd) {
-    RWMutexType::WrLock lock(m_mutex);
-    if((int)m_fds.size() <= fd){
+    Slot* slot = m_fds.get(fd);
+    if(!slot) {
         return;
     }
-    m_fds[fd].reset();
+    FdCtx::ptr ctx;
+    {
+        MutexType::Lock lock(slot->mutex);
+        ctx.swap(slot->ctx);
+    }
+    //最后一个引用在锁外释放，~FdCtx可能要取消定时器
 }
 
 }
\ No newline at end of file
@@ -3,9 +3,12 @@
 
 #include "./mutex.h"
 #include "./singleton.h"
+#include "./timer.h"
+#include "./fd_table.h"
 
 #include <memory>
 #include <vector>
+#include <atomic>
 
 namespace windgent {
 
@@ -20,6 +23,8 @@ public:
     bool isInit() const { return m_isInit; }
     bool isSocket() const { return m_isSocket; }
     bool isClosed() const { return m_isClosed; }
+    //上下文的代数，每创建一个FdCtx加一。fd号被新的fd复用时上下文会被替换，IOManager据此发现持久注册已经失效
+    uint64_t getGeneration() const { return m_generation; }
 
     void setUserNonblock(bool v) { m_userNonblock = v; }
     bool getUserNonblock() const { return m_userNonblock; }
@@ -29,6 +34,17 @@ public:
 
     void setTimeout(int type, uint64_t v);
     uint64_t getTimeout(int type);
+
+    //阻塞IO等待超时，type为SO_RCVTIMEO或SO_SNDTIMEO，每个方向同时只有一个协程在等待
+    //该方向复用的超时定时器，避免每次等待都创建定时器
+    Timer::ptr& getTimer(int type);
+    //开始等待，deadline为截止时刻
+    void beginWait(int type, uint64_t deadline);
+    //定时器到期时调用，本次等待的截止时刻已过则标记为超时并返回true。
+    //旧的等待留下的定时器回调看到的是新的截止时刻，不会误判
+    bool expireWait(int type, uint64_t now_ms);
+    //结束等待，返回是否已超时
+    bool endWait(int type);
 private:
     bool m_isInit : 1;
     bool m_isSocket : 1;
@@ -37,21 +53,33 @@ private:
     bool m_isClosed : 1;
 
     int m_fd;
+    uint64_t m_generation;
     uint64_t m_recvTimeout;
     uint64_t m_sendTimeout;
+    Timer::ptr m_recvTimer;
+    Timer::ptr m_sendTimer;
+    std::atomic<uint64_t> m_recvDeadline;       //0表示没有在等待，~0ull表示已超时
+    std::atomic<uint64_t> m_sendDeadline;
 };
 
+//fd到FdCtx的映射，每次hook的系统调用都要查找。槽位放在FdTable中，查找不需要全局锁，扩容也不会阻塞其他线程；
+//每个槽位一把自旋锁，只保护对该fd的shared_ptr的读写
 class FdManager {
 public:
-    typedef RWMutex RWMutexType;
+    typedef SpinLock MutexType;
     FdManager();
     ~FdManager() { }
 
     FdCtx::ptr get(int fd, bool auto_create = false);
+    //为刚创建的fd（hook的socket/accept）建立新的上下文。原来的fd没有经过hook的close就关闭时，残留的旧上下文被替换掉
+    FdCtx::ptr create(int fd);
     void del(int fd);
 private:
-    RWMutexType m_mutex;
-    std::vector<FdCtx::ptr> m_fds;
+    struct Slot {
+        MutexType mutex;
+        FdCtx::ptr ctx;
+    };
+    FdTable<Slot> m_fds;
 };
 
 typedef Singleton<FdManager> FdMgr;
@@ -0,0 +1,73 @@
+#ifndef __FD_TABLE_H__
+#define __FD_TABLE_H__
+
+#include <stddef.h>
+#include <atomic>
+
+#include "./noncopyable.h"
+
+namespace windgent {
+
+//以fd为下标的两级表：第一级是固定大小的块指针数组，第二级是按需分配的块，每块CHUNK_SIZE个槽位。
+//块只会被添加，直到表析构才释放，所以槽位的地址一直有效。查找只有一次原子load，
+//添加新块用CAS发布，不会阻塞其他线程的查找。槽位内容的并发访问由T自己负责
+template<class T, size_t CHUNK_BITS = 10, size_t CHUNK_COUNT = 1024>
+class FdTable : NonCopyable {
+public:
+    static const size_t CHUNK_SIZE = (size_t)1 << CHUNK_BITS;
+    //能容纳的最大fd数，默认与Linux的fs.nr_open默认值（1048576）相同
+    static const size_t MAX_FDS = CHUNK_SIZE * CHUNK_COUNT;
+    //新块中每个槽位的初始化函数
+    typedef void (*InitFunc)(T& slot, int fd);
+
+    FdTable(InitFunc init = nullptr) :m_init(init) {
+        for(size_t i = 0; i < CHUNK_COUNT; ++i) {
+            m_chunks[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~FdTable() {
+        for(size_t i = 0; i < CHUNK_COUNT; ++i) {
+            delete m_chunks[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    //返回fd对应的槽位。所在的块还不存在时，create为true则分配，否则返回nullptr；fd超出范围返回nullptr
+    T* get(int fd, bool create = false) {
+        if(fd < 0 || (size_t)fd >= MAX_FDS) {
+            return nullptr;
+        }
+        std::atomic<Chunk*>& top = m_chunks[fd >> CHUNK_BITS];
+        Chunk* chunk = top.load(std::memory_order_acquire);
+        if(!chunk) {
+            if(!create) {
+                return nullptr;
+            }
+            chunk = new Chunk;
+            if(m_init) {
+                int base = fd & ~(int)(CHUNK_SIZE - 1);
+                for(size_t i = 0; i < CHUNK_SIZE; ++i) {
+                    m_init(chunk->slots[i], base + i);
+                }
+            }
+            //其他线程先发布了同一个块，用它的
+            Chunk* expected = nullptr;
+            if(!top.compare_exchange_strong(expected, chunk, std::memory_order_acq_rel)) {
+                delete chunk;
+                chunk = expected;
+            }
+        }
+        return &chunk->slots[fd & (CHUNK_SIZE - 1)];
+    }
+
+private:
+    struct Chunk {
+        T slots[CHUNK_SIZE];
+    };
+    InitFunc m_init;
+    std::atomic<Chunk*> m_chunks[CHUNK_COUNT];
+};
+
+}
+
+#endif
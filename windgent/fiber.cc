@@ -1,9 +1,18 @@
 #include <atomic>
+#include <vector>
+#include <unordered_map>
+#include <map>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "./fiber.h"
 #include "./macro.h"
 #include "./log.h"
 #include "./config.h"
 #include "./scheduler.h"
+#include "./thread.h"
+#include "./fiber_sync.h"
 
 namespace windgent {
 
@@ -11,6 +20,7 @@ static windgent::Logger::ptr g_logger = LOG_NAME("system");
 
 static std::atomic<uint64_t> s_fiber_id {0};    //协程id
 static std::atomic<uint64_t> s_fiber_count {0};    //协程数量
+static std::atomic<size_t> s_local_index {0};      //已分配的协程局部存储下标数
 
 static windgent::ConfigVar<uint32_t>::ptr g_fiber_config = windgent::ConfigMgr::Lookup<uint32_t>("fiber.stacksize", 128 * 1024, "fiber stack size");
 
@@ -19,26 +29,161 @@ static windgent::ConfigVar<uint32_t>::ptr g_fiber_config = windgent::ConfigMgr::
 static thread_local Fiber* t_fiber = nullptr;               //当前正在执行的协程
 static thread_local Fiber::ptr t_threadFiber = nullptr;     //线程的主协程
 
-class MallocStackAllocator {
+static windgent::ConfigVar<uint32_t>::ptr g_fiber_stack_sample = windgent::ConfigMgr::Lookup<uint32_t>("fiber.stack_sample_rate", 1024, "sample stack usage of one in every N finished fibers, 0 to disable");
+static windgent::ConfigVar<uint64_t>::ptr g_fiber_stack_cache = windgent::ConfigMgr::Lookup<uint64_t>("fiber.stack_cache_size", 32 * 1024 * 1024, "max bytes of free fiber stacks cached per thread");
+
+static uint64_t s_stack_cache_size = 0;
+static uint32_t s_stack_sample_rate = 0;
+struct _StackCacheIniter {
+    _StackCacheIniter() {
+        s_stack_cache_size = g_fiber_stack_cache->getVal();
+        g_fiber_stack_cache->addListener([](const uint64_t& old_val, const uint64_t& new_val) {
+            LOG_INFO(g_logger) << "fiber stack cache size changed from " << old_val << " to " << new_val;
+            s_stack_cache_size = new_val;
+        });
+        s_stack_sample_rate = g_fiber_stack_sample->getVal();
+        g_fiber_stack_sample->addListener([](const uint32_t& old_val, const uint32_t& new_val) {
+            LOG_INFO(g_logger) << "fiber stack sample rate changed from " << old_val << " to " << new_val;
+            s_stack_sample_rate = new_val;
+        });
+    }
+};
+static _StackCacheIniter s_stack_cache_initer;
+
+//线程私有的空闲栈缓存，按栈大小分组。线程退出时归还所有缓存的栈
+struct StackCache {
+    ~StackCache();
+    std::unordered_map<size_t, std::vector<void*> > stacks;
+    size_t bytes = 0;
+};
+static thread_local StackCache t_stack_cache;
+//线程退出时t_stack_cache先于其他对象析构，之后释放的栈直接归还系统
+static thread_local bool t_stack_cache_dead = false;
+
+//用mmap分配栈，低地址端放一个PROT_NONE的保护页，栈溢出时立即触发SIGSEGV而不是悄悄踩坏堆。
+//MAP_NORESERVE只保留地址空间，真正被写到的页才计入RSS，所以大栈的代价只在用到时才付出。
+//释放的栈放入当前线程的缓存，缓存总字节数超过fiber.stack_cache_size时直接munmap。
+//线程绑定了NUMA节点时，栈固定从该节点分配，协程被其他节点的线程执行时也不会分到远端内存
+class PooledStackAllocator {
 public:
     static void* Alloc(size_t size) {
-        return malloc(size);
+        size = RoundUp(size);
+        if(!t_stack_cache_dead) {
+            auto it = t_stack_cache.stacks.find(size);
+            if(it != t_stack_cache.stacks.end() && !it->second.empty()) {
+                void* ptr = it->second.back();
+                it->second.pop_back();
+                t_stack_cache.bytes -= size;
+                return ptr;
+            }
+        }
+        size_t page = PageSize();
+        void* base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if(base == MAP_FAILED) {
+            LOG_ERROR(g_logger) << "mmap fiber stack failed, size=" << size << " errno=" << errno << " errstr=" << strerror(errno);
+            throw std::bad_alloc();
+        }
+        if(mprotect(base, page, PROT_NONE)) {
+            LOG_ERROR(g_logger) << "mprotect guard page failed, errno=" << errno << " errstr=" << strerror(errno);
+        }
+        Thread::BindMemory((char*)base + page, size, Thread::GetNumaNode());
+        return (char*)base + page;
     }
     static void Dealloc(void* ptr, size_t size) {
         if(!ptr) {
-            free(ptr);
+            return;
+        }
+        size = RoundUp(size);
+        if(!t_stack_cache_dead && t_stack_cache.bytes + size <= s_stack_cache_size) {
+            t_stack_cache.stacks[size].push_back(ptr);
+            t_stack_cache.bytes += size;
+            return;
         }
+        Unmap(ptr, size);
     }
+    static void Unmap(void* ptr, size_t size) {
+        size_t page = PageSize();
+        munmap((char*)ptr - page, size + page);
+    }
+private:
+    static size_t PageSize() {
+        static size_t s_page_size = sysconf(_SC_PAGESIZE);
+        return s_page_size;
+    }
+    static size_t RoundUp(size_t size) {
+        size_t page = PageSize();
+        return (size + page - 1) / page * page;
+    }
+};
+using StackAllocator = PooledStackAllocator;
+
+//按栈大小统计的栈使用采样
+struct StackUsageStat {
+    uint64_t samples = 0;
+    size_t peak = 0;
 };
-using StackAllocator = MallocStackAllocator;
+static Mutex s_stack_usage_mutex;
+static std::map<size_t, StackUsageStat> s_stack_usage;
+static thread_local uint32_t t_stack_sample_count = 0;
+
+//协程结束时按采样频率记录栈的使用峰值
+static void SampleStackUsage(Fiber* f) {
+    uint32_t rate = s_stack_sample_rate;
+    if(!rate || ++t_stack_sample_count < rate) {
+        return;
+    }
+    t_stack_sample_count = 0;
+    size_t used = f->getStackUsage();
+    Mutex::Lock lock(s_stack_usage_mutex);
+    StackUsageStat& stat = s_stack_usage[f->getStackSize()];
+    ++stat.samples;
+    if(used > stat.peak) {
+        stat.peak = used;
+    }
+}
+
+StackCache::~StackCache() {
+    for(auto& i : stacks) {
+        for(auto& ptr : i.second) {
+            StackAllocator::Unmap(ptr, i.first);
+        }
+    }
+    stacks.clear();
+    bytes = 0;
+    t_stack_cache_dead = true;
+}
+
+#ifdef WINDGENT_FIBER_ASM
+//在栈上构造初始上下文，入口函数为fn
+static void MakeContext(fcontext_t& ctx, void* stack, size_t size, void (*fn)()) {
+    ctx = windgent_make_fcontext(stack, size, fn);
+}
+//保存当前上下文到from，切换到to
+static void SwapContext(fcontext_t& from, fcontext_t& to) {
+    windgent_jump_fcontext(&from, to);
+}
+#else
+static void MakeContext(ucontext_t& ctx, void* stack, size_t size, void (*fn)()) {
+    if(getcontext(&ctx)) {
+        ASSERT2(false, "getcontext");
+    }
+    ctx.uc_link = nullptr;                //uc_link为空时，执行完当前context后直接退出程序
+    ctx.uc_stack.ss_sp = stack;
+    ctx.uc_stack.ss_size = size;
+    makecontext(&ctx, fn, 0);
+}
+static void SwapContext(ucontext_t& from, ucontext_t& to) {
+    if(swapcontext(&from, &to)) {
+        ASSERT2(false, "swapcontext");
+    }
+}
+#endif
 
 //创建主协程，没有栈
 Fiber::Fiber() {
     m_state = EXEC;
     SetThis(this);
-    if(getcontext(&m_ctx)) {
-        ASSERT2(false, "getcontext");
-    }
+    //主协程的上下文在第一次切出时才会保存
     ++s_fiber_count;
     LOG_DEBUG(g_logger) << "Create main fiber";
 }
@@ -46,28 +191,25 @@ Fiber::Fiber() {
 //创建子协程
 Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller) 
     :m_id(++s_fiber_id), m_cb(cb) {
-    m_stacksize = stacksize ? stacksize : g_fiber_config->getVal();
+    m_stacksize = stacksize ? stacksize : GetDefaultStackSize();
     //分配栈空间
     m_stack = StackAllocator::Alloc(m_stacksize);
     ++s_fiber_count;
 
-    if(getcontext(&m_ctx)) {
-        ASSERT2(false, "getcontext");
-    }
-    m_ctx.uc_link = nullptr;                //uc_link为空时，执行完当前context后直接退出程序
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
     //指定上下文的入口函数
     if(!use_caller) {
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
+        MakeContext(m_ctx, m_stack, m_stacksize, &Fiber::MainFunc);
     } else {
-        makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+        MakeContext(m_ctx, m_stack, m_stacksize, &Fiber::CallerMainFunc);
     }
     LOG_DEBUG(g_logger) << "Create a subFiber, id= " << m_id;
 }
 
 Fiber::~Fiber() {
     --s_fiber_count;
+    //任务没有执行就被销毁，join的等待者不会再等到结束
+    notifyJoiners();
+    clearLocals();
     //子协程释放栈空间
     if(m_stack) {
         ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
@@ -91,14 +233,12 @@ void Fiber::reset(std::function<void()> cb) {
     ASSERT(m_stack);
     //只有处于TERM、INIT、EXCEPT状态的协程才能被重置
     ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
+    //INIT状态被重置时原来的任务不会再执行，唤醒等待它的join
+    notifyJoiners();
+    clearLocals();
     m_cb = cb;
-    if(getcontext(&m_ctx)) {
-        ASSERT2(false, "getcontext");
-    }
-    m_ctx.uc_link = nullptr;    //uc_link为空时，执行完当前context后直接退出程序
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
+    m_priority = PRIORITY_NORMAL;
+    MakeContext(m_ctx, m_stack, m_stacksize, &Fiber::MainFunc);
     m_state = INIT;
 }
 
@@ -107,9 +247,7 @@ void Fiber::reset(std::function<void()> cb) {
 void Fiber::call() {
     SetThis(this);
     m_state = EXEC;
-    if(swapcontext(&(t_threadFiber->m_ctx), &m_ctx)) {
-        ASSERT2(false, "swapcontext");
-    }
+    SwapContext(t_threadFiber->m_ctx, m_ctx);
 }
 
 //切换当前协程到后台执行，恢复主协程上下文。当前执⾏环境⼀定是位于⼦协程⾥，所以这⾥的swapcontext操作的结果是把⼦协程的上下⽂保存到协程⾃⼰的m_ctx中，同时从
@@ -117,9 +255,7 @@ void Fiber::call() {
 void Fiber::back() {
     SetThis(t_threadFiber.get());
     // m_state = TERM;
-    if(swapcontext(&m_ctx, &(t_threadFiber->m_ctx))) {
-        ASSERT2(false, "swapcontext");
-    }
+    SwapContext(m_ctx, t_threadFiber->m_ctx);
 }
 
 //从调度协程切换到当前协程执行
@@ -127,9 +263,7 @@ void Fiber::swapIn() {
     SetThis(this);
     ASSERT(m_state != EXEC);
     m_state = EXEC;
-    if(swapcontext(&(Scheduler::GetMainFiber()->m_ctx), &m_ctx)) {
-        ASSERT2(false, "swapcontext");
-    }
+    SwapContext(Scheduler::GetMainFiber()->m_ctx, m_ctx);
     // std::cout << "Fiber::swapIn()" << std::endl;
 }
 
@@ -137,9 +271,7 @@ void Fiber::swapIn() {
 void Fiber::swapOut() {
     SetThis(Scheduler::GetMainFiber());
     // m_state = TERM;
-    if(swapcontext(&m_ctx, &(Scheduler::GetMainFiber()->m_ctx))) {
-        ASSERT2(false, "swapcontext");
-    }
+    SwapContext(m_ctx, Scheduler::GetMainFiber()->m_ctx);
     // std::cout << "Fiber::swapOut()" << std::endl;
 }
 
@@ -159,20 +291,72 @@ Fiber::ptr Fiber::GetThis() {
     return t_fiber->shared_from_this();
 }
 
+Fiber* Fiber::GetCurrent() {
+    if(t_fiber) {
+        return t_fiber;
+    }
+    return GetThis().get();
+}
+
+bool Fiber::join(uint64_t timeout_ms) {
+    ASSERT2(t_fiber != this, "fiber can not join itself");
+    OnceWaiter::ptr waiter;
+    {
+        SpinLock::Lock lock(m_joinMutex);
+        if(m_state == TERM || m_state == EXCEPT) {
+            return true;
+        }
+        waiter.reset(new OnceWaiter);
+        m_joiners.push_back([waiter]() {
+            waiter->notify();
+        });
+    }
+    return waiter->wait(timeout_ms);
+}
+
+//m_state在此之前已经设为TERM或EXCEPT，join在同一把锁内检查状态，不会漏掉
+void Fiber::notifyJoiners() {
+    std::vector<std::function<void()> > joiners;
+    {
+        SpinLock::Lock lock(m_joinMutex);
+        joiners.swap(m_joiners);
+    }
+    for(auto& i : joiners) {
+        i();
+    }
+}
+
+size_t Fiber::AllocLocalIndex() {
+    return s_local_index++;
+}
+
+void Fiber::clearLocals() {
+    //析构函数中可能再访问FiberLocal，先把槽位数组换出来
+    while(!m_locals.empty()) {
+        std::vector<LocalSlot> locals;
+        locals.swap(m_locals);
+        for(auto& i : locals) {
+            if(i.ptr) {
+                i.destroy(i.ptr);
+            }
+        }
+    }
+}
+
 //切换协程到后台，并设为READY状态
 void Fiber::YieldToReady() {
-    Fiber::ptr cur = GetThis();
+    Fiber* cur = GetCurrent();
     ASSERT(cur->m_state == EXEC);
     cur->m_state = READY;
     cur->swapOut();
     
 }
 
-//切换协程到后台，并设为HOLD状态
+//切换协程到后台，并设为HOLD状态。
+//HOLD状态由调度器在swapIn返回、上下文已经保存完毕后设置，否则其他线程可能在切出完成前就把该协程取走执行
 void Fiber::YieldToHold() {
-    Fiber::ptr cur = GetThis();
+    Fiber* cur = GetCurrent();
     ASSERT(cur->m_state == EXEC);
-    cur->m_state = HOLD;
     cur->swapOut();
 }
 
@@ -188,6 +372,50 @@ uint64_t Fiber::GetFiberId() {
     return 0;
 }
 
+//新栈的页都是0，栈从高地址向低地址增长，所以从低地址端找到的第一个非0字就是水位线。
+//先用mincore跳过从未访问过的页，避免读这些页产生缺页
+size_t Fiber::getStackUsage() const {
+    if(!m_stack) {
+        return 0;
+    }
+    static size_t s_page_size = sysconf(_SC_PAGESIZE);
+    char* begin = (char*)m_stack;
+    char* end = begin + m_stacksize;
+    std::vector<unsigned char> vec((m_stacksize + s_page_size - 1) / s_page_size);
+    if(mincore(begin, m_stacksize, &vec[0]) == 0) {
+        size_t i = 0;
+        while(i < vec.size() && !(vec[i] & 1)) {
+            ++i;
+        }
+        begin += i * s_page_size;
+    }
+    const uint64_t* p = (const uint64_t*)begin;
+    const uint64_t* e = (const uint64_t*)end;
+    while(p < e && *p == 0) {
+        ++p;
+    }
+    return end - (char*)p;
+}
+
+void Fiber::DumpStackUsage(std::ostream& os) {
+    Mutex::Lock lock(s_stack_usage_mutex);
+    os << "[Fiber stack usage sample_rate=" << s_stack_sample_rate << "]" << std::endl;
+    for(auto& i : s_stack_usage) {
+        os << "    stacksize=" << i.first << " samples=" << i.second.samples
+           << " peak=" << i.second.peak << std::endl;
+    }
+}
+
+size_t Fiber::GetPeakStackUsage(size_t stacksize) {
+    Mutex::Lock lock(s_stack_usage_mutex);
+    auto it = s_stack_usage.find(stacksize);
+    return it == s_stack_usage.end() ? 0 : it->second.peak;
+}
+
+size_t Fiber::GetDefaultStackSize() {
+    return g_fiber_config->getVal();
+}
+
 //上下文入口函数
 void Fiber::MainFunc() {
     Fiber::ptr cur = GetThis();
@@ -204,6 +432,10 @@ void Fiber::MainFunc() {
         LOG_ERROR(g_logger) << "Fiber::MainFunc Exception" << ", fiber id= " << cur->getId() << std::endl << windgent::BacktraceToString();
     }
 
+    //请求级的协程局部数据随任务一起结束，协程被复用前不再占用内存
+    cur->clearLocals();
+    cur->notifyJoiners();
+    SampleStackUsage(cur.get());
     //减少一次this的引用计数，使得能够正确析构
     auto raw_ptr = cur.get();
     cur.reset();
@@ -228,6 +460,10 @@ void Fiber::CallerMainFunc() {
         LOG_ERROR(g_logger) << "Fiber::MainFunc Exception" << ", fiber id= " << cur->getId() << std::endl << windgent::BacktraceToString();
     }
 
+    //请求级的协程局部数据随任务一起结束，协程被复用前不再占用内存
+    cur->clearLocals();
+    cur->notifyJoiners();
+    SampleStackUsage(cur.get());
     //减少一次this的引用计数，使得能够正确析构
     auto raw_ptr = cur.get();
     cur.reset();
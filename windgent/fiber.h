@@ -3,7 +3,12 @@
 
 #include <memory>
 #include <functional>
+#include <ostream>
+#include <vector>
 #include <ucontext.h>
+#include "./fcontext.h"
+#include "./noncopyable.h"
+#include "./mutex.h"
 
 namespace windgent {
 
@@ -23,6 +28,19 @@ public:
         READY,
         EXCEPT
     };
+    //常用的栈大小等级，可在创建协程、schedule或servlet上指定
+    enum StackClass {
+        STACK_SMALL = 16 * 1024,
+        STACK_MEDIUM = 64 * 1024,
+        STACK_LARGE = 256 * 1024
+    };
+    //调度优先级，调度器按优先级从高到低取任务
+    enum Priority {
+        PRIORITY_HIGH = 0,      //定时器、健康检查、对延迟敏感的小请求
+        PRIORITY_NORMAL = 1,
+        PRIORITY_LOW = 2,       //大请求体、批量任务等
+        PRIORITY_COUNT = 3
+    };
 public:
     //构造子协程，参数use_caller表示是否将调用线程加入线程池
     Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false);
@@ -42,13 +60,25 @@ public:
     //当前协程执行此函数，切换到主协程执行
     void back();
 
+    //挂起当前协程（不在协程中时阻塞线程）直到本协程的任务执行完毕，超时返回false。
+    //任务还没执行协程就被reset或销毁时也返回true，表示任务已经不存在。不能join自己。协程被reset复用后，等待的是新的任务
+    bool join(uint64_t timeout_ms = ~0ull);
+
     uint64_t getId() const { return m_id; }
     State getState() const { return m_state; }
+    uint32_t getStackSize() const { return m_stacksize; }
+    Priority getPriority() const { return m_priority; }
+    //修改协程的调度优先级，在下一次被调度时生效。协程挂起后由IO事件、定时器等重新调度时仍使用这个优先级
+    void setPriority(Priority priority) { m_priority = priority; }
+    //扫描栈的水位线，返回栈使用的峰值字节数（栈被复用时包含之前协程留下的水位）
+    size_t getStackUsage() const;
 
     //设置当前运行的协程
     static void SetThis(Fiber* f);
     //返回当前执行的协程，如果当前线程还未创建协程，则创建线程的第⼀个协程，且该协程为当前线程的主协程，其他协程都通过这个协程来调度，也就是说，其他协程结束时,都要切回到主协程，由主协程重新选择新的协程进⾏resume
     static Fiber::ptr GetThis();
+    //与GetThis相同，但返回裸指针，不修改引用计数。只在需要持有协程（之后由别处唤醒）时才用GetThis
+    static Fiber* GetCurrent();
     //切换协程到后台，并设为READY状态
     static void YieldToReady();
     //切换协程到后台，并设为HOLD状态
@@ -56,13 +86,42 @@ public:
     //总协程数量
     static uint64_t TotalFibers();
     static uint64_t GetFiberId();
+    //按栈大小输出采样得到的栈使用峰值，采样频率由fiber.stack_sample_rate配置
+    static void DumpStackUsage(std::ostream& os);
+    //返回stacksize大小的栈上采样到的使用峰值，没有采样数据时返回0
+    static size_t GetPeakStackUsage(size_t stacksize);
+    //stacksize为0时使用的栈大小，即fiber.stacksize
+    static size_t GetDefaultStackSize();
 
     //上下文入口函数，在每个协程的独立栈空间上执行。
     //在用户传入的协程入口函数上进行了一次封装，这个封装类似于线程模块的对线程入口函数的封装。通过封装协程入口函数，可以实现协程在结束自动执行yield的操作
     static void MainFunc();
 
     static void CallerMainFunc();
+
+    //协程局部存储的槽位，ptr由destroy释放
+    struct LocalSlot {
+        void* ptr = nullptr;
+        void (*destroy)(void*) = nullptr;
+    };
+    //分配一个协程局部存储的下标，由FiberLocal在构造时调用，下标不会回收
+    static size_t AllocLocalIndex();
+    //返回下标为index的槽位，槽位数组按需扩展
+    LocalSlot& getLocal(size_t index) {
+        if(index >= m_locals.size()) {
+            m_locals.resize(index + 1);
+        }
+        return m_locals[index];
+    }
+    //返回下标为index的槽位，还没有分配时返回nullptr
+    LocalSlot* findLocal(size_t index) {
+        return index < m_locals.size() ? &m_locals[index] : nullptr;
+    }
+    //释放所有协程局部存储。协程任务结束、reset和析构时调用
+    void clearLocals();
 private:
+    //任务结束后唤醒所有join的等待者
+    void notifyJoiners();
     //只⽤于创建线程的第⼀个协程，也就是线程主函数对应的协程，这个协程只能由GetThis()⽅法调⽤，所以定义成私有⽅法
     Fiber();
 
@@ -70,11 +129,62 @@ private:
     uint64_t m_id = 0;              //协程id
     uint32_t m_stacksize = 0;       //所用栈大小
     State m_state = INIT;           //协程状态
+    Priority m_priority = PRIORITY_NORMAL;  //调度优先级
 
+#ifdef WINDGENT_FIBER_ASM
+    fcontext_t m_ctx = nullptr;     //上下文信息，保存切出时的栈顶
+#else
     ucontext_t m_ctx;               //上下文信息
+#endif
     void* m_stack = nullptr;        //栈空间
 
     std::function<void()> m_cb;     //执行函数
+    std::vector<LocalSlot> m_locals;    //协程局部存储，第一次使用时才分配
+    SpinLock m_joinMutex;
+    std::vector<std::function<void()> > m_joiners;  //等待任务结束的回调
+};
+
+//协程局部变量：每个协程各有一份T，第一次get时默认构造，协程任务结束时析构。
+//适合存放请求级的数据（trace id、内存池等），同一线程上先后执行的协程互不影响，协程换线程执行后仍能取到。
+//不在协程中使用时，属于线程的主协程，相当于thread_local。FiberLocal对象本身应当是全局或静态的
+template<class T>
+class FiberLocal : NonCopyable {
+public:
+    FiberLocal() :m_index(Fiber::AllocLocalIndex()) { }
+
+    T& get() {
+        Fiber::LocalSlot& slot = Fiber::GetCurrent()->getLocal(m_index);
+        if(!slot.ptr) {
+            slot.ptr = new T();
+            slot.destroy = &FiberLocal::Destroy;
+        }
+        return *(T*)slot.ptr;
+    }
+    //当前协程还没有值时返回nullptr，不会构造
+    T* peek() const {
+        Fiber::LocalSlot* slot = Fiber::GetCurrent()->findLocal(m_index);
+        return slot ? (T*)slot->ptr : nullptr;
+    }
+    void set(const T& v) {
+        get() = v;
+    }
+    //提前析构当前协程的值
+    void reset() {
+        Fiber::LocalSlot* slot = Fiber::GetCurrent()->findLocal(m_index);
+        if(slot && slot->ptr) {
+            void* ptr = slot->ptr;
+            slot->ptr = nullptr;
+            slot->destroy(ptr);
+        }
+    }
+    T& operator*() { return get(); }
+    T* operator->() { return &get(); }
+private:
+    static void Destroy(void* ptr) {
+        delete (T*)ptr;
+    }
+private:
+    size_t m_index;
 };
 
 }
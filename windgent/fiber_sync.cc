@@ -0,0 +1,194 @@
+#include "fiber_sync.h"
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+
+namespace windgent {
+
+FiberWaiter::FiberWaiter() {
+    //调度线程上正在执行的任务协程才能让出，调度协程和caller线程的主协程只能阻塞线程
+    Scheduler* scheduler = Scheduler::GetThis();
+    if(scheduler && Scheduler::GetWorkerIndex() >= 0) {
+        Fiber* cur = Fiber::GetCurrent();
+        if(cur != Scheduler::GetMainFiber()) {
+            m_scheduler = scheduler;
+            m_fiber = cur->shared_from_this();
+        }
+    }
+}
+
+void FiberWaiter::wait() {
+    if(m_scheduler) {
+        //wake先于切出发生时，调度器会等协程切出后才执行它
+        Fiber::YieldToHold();
+    } else {
+        m_sem.wait();
+    }
+}
+
+bool FiberWaiter::waitFor(uint64_t timeout_ms) {
+    ASSERT(!m_scheduler);
+    return m_sem.waitFor(timeout_ms);
+}
+
+void FiberWaiter::wake() {
+    if(m_scheduler) {
+        //先取出协程，schedule之后等待方随时可能返回并销毁本对象
+        Scheduler* scheduler = m_scheduler;
+        Fiber::ptr fiber;
+        fiber.swap(m_fiber);
+        scheduler->schedule(fiber);
+    } else {
+        m_sem.notify();
+    }
+}
+
+bool OnceWaiter::wait(uint64_t timeout_ms) {
+    if(timeout_ms == INFINITE) {
+        m_waiter.wait();
+        return true;
+    }
+    if(!m_waiter.isFiber()) {
+        if(m_waiter.waitFor(timeout_ms)) {
+            return true;
+        }
+        //超时的同时被通知了，通知方一定会notify信号量，等它完成
+        if(m_done.exchange(true)) {
+            m_waiter.wait();
+            return true;
+        }
+        return false;
+    }
+    IOManager* iom = IOManager::GetThis();
+    ASSERT2(iom, "OnceWaiter timeout needs an IOManager");
+    OnceWaiter::ptr self = shared_from_this();
+    Timer::ptr timer = iom->addTimer(timeout_ms, [self]() {
+        if(!self->m_done.exchange(true)) {
+            self->m_timedout = true;
+            self->m_waiter.wake();
+        }
+    });
+    m_waiter.wait();
+    if(!m_timedout) {
+        timer->cancel();
+    }
+    return !m_timedout;
+}
+
+bool OnceWaiter::notify() {
+    if(m_done.exchange(true)) {
+        return false;
+    }
+    m_waiter.wake();
+    return true;
+}
+
+void FiberMutex::lock() {
+    SpinLock::Lock lock(m_mutex);
+    if(!m_locked) {
+        m_locked = true;
+        return;
+    }
+    FiberWaiter self;
+    m_waiters.push_back(&self);
+    lock.unlock();
+    //被唤醒时锁已经交到自己手上
+    self.wait();
+}
+
+bool FiberMutex::tryLock() {
+    SpinLock::Lock lock(m_mutex);
+    if(m_locked) {
+        return false;
+    }
+    m_locked = true;
+    return true;
+}
+
+void FiberMutex::unlock() {
+    FiberWaiter* next = nullptr;
+    {
+        SpinLock::Lock lock(m_mutex);
+        ASSERT(m_locked);
+        if(m_waiters.empty()) {
+            m_locked = false;
+            return;
+        }
+        next = m_waiters.front();
+        m_waiters.pop_front();
+    }
+    next->wake();
+}
+
+void FiberCondition::wait(FiberMutex& mutex) {
+    FiberWaiter self;
+    {
+        SpinLock::Lock lock(m_mutex);
+        m_waiters.push_back(&self);
+    }
+    //先进入等待队列再释放mutex，释放之后的notify不会丢失
+    mutex.unlock();
+    self.wait();
+    mutex.lock();
+}
+
+void FiberCondition::notify() {
+    FiberWaiter* waiter = nullptr;
+    {
+        SpinLock::Lock lock(m_mutex);
+        if(m_waiters.empty()) {
+            return;
+        }
+        waiter = m_waiters.front();
+        m_waiters.pop_front();
+    }
+    waiter->wake();
+}
+
+void FiberCondition::notifyAll() {
+    std::deque<FiberWaiter*> waiters;
+    {
+        SpinLock::Lock lock(m_mutex);
+        waiters.swap(m_waiters);
+    }
+    for(auto i : waiters) {
+        i->wake();
+    }
+}
+
+void FiberSemaphore::wait() {
+    SpinLock::Lock lock(m_mutex);
+    if(m_count > 0) {
+        --m_count;
+        return;
+    }
+    FiberWaiter self;
+    m_waiters.push_back(&self);
+    lock.unlock();
+    self.wait();
+}
+
+bool FiberSemaphore::tryWait() {
+    SpinLock::Lock lock(m_mutex);
+    if(m_count > 0) {
+        --m_count;
+        return true;
+    }
+    return false;
+}
+
+void FiberSemaphore::notify() {
+    FiberWaiter* waiter = nullptr;
+    {
+        SpinLock::Lock lock(m_mutex);
+        if(m_waiters.empty()) {
+            ++m_count;
+            return;
+        }
+        waiter = m_waiters.front();
+        m_waiters.pop_front();
+    }
+    waiter->wake();
+}
+
+}
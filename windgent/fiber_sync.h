@@ -0,0 +1,227 @@
+#ifndef __FIBER_SYNC_H__
+#define __FIBER_SYNC_H__
+
+#include <stddef.h>
+#include <deque>
+#include <utility>
+#include <memory>
+#include <atomic>
+
+#include "./noncopyable.h"
+#include "./mutex.h"
+#include "./fiber.h"
+#include "./scheduler.h"
+
+namespace windgent {
+
+//协程同步原语的等待者。在调度器执行的协程中构造时，wait()让出协程，wake()把协程交回它所在的调度器；
+//在其他线程（没有调度器，或caller线程还未开始调度）中构造时，wait()用信号量阻塞线程。
+//等待者放在等待方的栈上，唤醒方在原语的锁内把它从等待队列中取出，解锁后再wake，wake之后不能再访问它
+class FiberWaiter : NonCopyable {
+public:
+    FiberWaiter();
+
+    //挂起直到被wake。调用前必须已经把自己放进等待队列，wake可能发生在wait之前
+    void wait();
+    //只用于线程等待者：最多阻塞timeout_ms毫秒，超时返回false
+    bool waitFor(uint64_t timeout_ms);
+    void wake();
+    //是否是协程等待者
+    bool isFiber() const { return m_scheduler != nullptr; }
+private:
+    Scheduler* m_scheduler = nullptr;
+    Fiber::ptr m_fiber;
+    Semaphore m_sem;
+};
+
+//可以超时的一次性等待：notify和超时只有先发生的一方唤醒等待者。
+//由等待方创建（构造时记录当前协程），用shared_ptr管理，通知方和超时定时器各持有一份，晚到的一方什么也不做。
+//协程中的超时由当前IOManager的定时器实现，线程中用带超时的信号量
+class OnceWaiter : public std::enable_shared_from_this<OnceWaiter>, NonCopyable {
+public:
+    typedef std::shared_ptr<OnceWaiter> ptr;
+    static const uint64_t INFINITE = ~0ull;
+
+    //挂起直到notify或超时，超时返回false。只能调用一次，且必须先把自己交给通知方
+    bool wait(uint64_t timeout_ms = INFINITE);
+    //唤醒等待者，已经被唤醒或已超时返回false
+    bool notify();
+private:
+    FiberWaiter m_waiter;
+    std::atomic<bool> m_done = {false};
+    bool m_timedout = false;
+};
+
+//协程互斥锁：拿不到锁时挂起协程而不是阻塞线程。解锁时直接把锁交给最早等待的协程，等待者按先后顺序获得锁
+class FiberMutex : NonCopyable {
+public:
+    typedef ScopedLockImpl<FiberMutex> Lock;
+
+    void lock();
+    bool tryLock();
+    void unlock();
+private:
+    SpinLock m_mutex;
+    bool m_locked = false;
+    std::deque<FiberWaiter*> m_waiters;
+};
+
+//协程条件变量，配合FiberMutex使用
+class FiberCondition : NonCopyable {
+public:
+    //调用前必须持有mutex，等待期间释放，返回前重新获得
+    void wait(FiberMutex& mutex);
+    template<class Predicate>
+    void wait(FiberMutex& mutex, Predicate pred) {
+        while(!pred()) {
+            wait(mutex);
+        }
+    }
+    void notify();
+    void notifyAll();
+private:
+    SpinLock m_mutex;
+    std::deque<FiberWaiter*> m_waiters;
+};
+
+//协程信号量。notify时有等待者则直接交给最早的等待者，计数不变
+class FiberSemaphore : NonCopyable {
+public:
+    FiberSemaphore(size_t count = 0) :m_count(count) { }
+
+    void wait();
+    bool tryWait();
+    void notify();
+private:
+    SpinLock m_mutex;
+    size_t m_count;
+    std::deque<FiberWaiter*> m_waiters;
+};
+
+//协程之间传递数据的有界通道，可以跨线程、跨调度器使用。
+//缓冲区满时send挂起，空时recv挂起；有接收者在等待时数据直接交给它，不经过缓冲区。
+//capacity为0时没有缓冲区，send要等到有接收者取走数据才返回。close之后send失败，recv取完缓冲区中的数据后失败
+template<class T>
+class Channel : NonCopyable {
+public:
+    typedef std::shared_ptr<Channel> ptr;
+
+    Channel(size_t capacity) :m_capacity(capacity) { }
+
+    //通道已关闭返回false
+    bool send(const T& v) {
+        T tmp(v);
+        return send(std::move(tmp));
+    }
+
+    bool send(T&& v) {
+        Waiter* receiver = nullptr;
+        {
+            SpinLock::Lock lock(m_mutex);
+            if(m_closed) {
+                return false;
+            }
+            if(!m_receivers.empty()) {
+                receiver = m_receivers.front();
+                m_receivers.pop_front();
+                *receiver->value = std::move(v);
+                receiver->ok = true;
+            } else if(m_buffer.size() < m_capacity) {
+                m_buffer.push_back(std::move(v));
+                return true;
+            } else {
+                Waiter self(&v);
+                m_senders.push_back(&self);
+                lock.unlock();
+                self.waiter.wait();
+                return self.ok;
+            }
+        }
+        receiver->waiter.wake();
+        return true;
+    }
+
+    //通道已关闭且没有剩余数据时返回false
+    bool recv(T& v) {
+        Waiter* sender = nullptr;
+        {
+            SpinLock::Lock lock(m_mutex);
+            if(!m_buffer.empty()) {
+                v = std::move(m_buffer.front());
+                m_buffer.pop_front();
+                //空出了一个位置，把最早等待的发送者的数据放进缓冲区
+                if(!m_senders.empty()) {
+                    sender = m_senders.front();
+                    m_senders.pop_front();
+                    m_buffer.push_back(std::move(*sender->value));
+                    sender->ok = true;
+                }
+            } else if(!m_senders.empty()) {
+                //没有缓冲区时发送者在这里等待
+                sender = m_senders.front();
+                m_senders.pop_front();
+                v = std::move(*sender->value);
+                sender->ok = true;
+            } else if(m_closed) {
+                return false;
+            } else {
+                Waiter self(&v);
+                m_receivers.push_back(&self);
+                lock.unlock();
+                self.waiter.wait();
+                return self.ok;
+            }
+        }
+        if(sender) {
+            sender->waiter.wake();
+        }
+        return true;
+    }
+
+    //关闭通道，唤醒所有等待者，它们的send/recv返回false
+    void close() {
+        std::deque<Waiter*> waiters;
+        {
+            SpinLock::Lock lock(m_mutex);
+            if(m_closed) {
+                return;
+            }
+            m_closed = true;
+            waiters.swap(m_senders);
+            waiters.insert(waiters.end(), m_receivers.begin(), m_receivers.end());
+            m_receivers.clear();
+        }
+        for(auto i : waiters) {
+            i->waiter.wake();
+        }
+    }
+
+    bool isClosed() {
+        SpinLock::Lock lock(m_mutex);
+        return m_closed;
+    }
+
+    size_t size() {
+        SpinLock::Lock lock(m_mutex);
+        return m_buffer.size();
+    }
+private:
+    //等待中的发送者或接收者，value指向发送的数据或接收的位置
+    struct Waiter {
+        Waiter(T* v) :value(v) { }
+        FiberWaiter waiter;
+        T* value;
+        bool ok = false;
+    };
+
+    SpinLock m_mutex;
+    size_t m_capacity;
+    bool m_closed = false;
+    std::deque<T> m_buffer;
+    std::deque<Waiter*> m_senders;
+    std::deque<Waiter*> m_receivers;
+};
+
+}
+
+#endif
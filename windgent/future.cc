@@ -0,0 +1,99 @@
+#include "future.h"
+
+namespace windgent {
+
+bool FutureStateBase::isReady() {
+    SpinLock::Lock lock(m_mutex);
+    return m_ready;
+}
+
+void FutureStateBase::onReady(std::function<void()> cb) {
+    {
+        SpinLock::Lock lock(m_mutex);
+        if(!m_ready) {
+            m_callbacks.push_back(std::move(cb));
+            return;
+        }
+    }
+    cb();
+}
+
+bool FutureStateBase::wait(uint64_t timeout_ms) {
+    OnceWaiter::ptr waiter;
+    {
+        SpinLock::Lock lock(m_mutex);
+        if(m_ready) {
+            return true;
+        }
+        waiter.reset(new OnceWaiter);
+        m_callbacks.push_back([waiter]() {
+            waiter->notify();
+        });
+    }
+    return waiter->wait(timeout_ms);
+}
+
+bool FutureStateBase::setException(std::exception_ptr error) {
+    SpinLock::Lock lock(m_mutex);
+    if(m_ready) {
+        return false;
+    }
+    m_error = error;
+    complete(lock);
+    return true;
+}
+
+std::exception_ptr FutureStateBase::getException() {
+    SpinLock::Lock lock(m_mutex);
+    return m_error;
+}
+
+void FutureStateBase::complete(SpinLock::Lock& lock) {
+    m_ready = true;
+    std::vector<std::function<void()> > callbacks;
+    callbacks.swap(m_callbacks);
+    lock.unlock();
+    for(auto& i : callbacks) {
+        i();
+    }
+}
+
+bool WhenAll(const std::vector<FutureBase>& futures, uint64_t timeout_ms) {
+    if(futures.empty()) {
+        return true;
+    }
+    //计数减到0的那个回调唤醒等待者，计数由回调共享，等待者超时返回后也不会失效
+    OnceWaiter::ptr waiter(new OnceWaiter);
+    std::shared_ptr<std::atomic<size_t> > remain = std::make_shared<std::atomic<size_t> >(futures.size());
+    for(auto& i : futures) {
+        i.onReady([waiter, remain]() {
+            if(--*remain == 0) {
+                waiter->notify();
+            }
+        });
+    }
+    return waiter->wait(timeout_ms);
+}
+
+int WhenAny(const std::vector<FutureBase>& futures, uint64_t timeout_ms) {
+    if(futures.empty()) {
+        return -1;
+    }
+    OnceWaiter::ptr waiter(new OnceWaiter);
+    std::shared_ptr<std::atomic<int> > first = std::make_shared<std::atomic<int> >(-1);
+    for(size_t i = 0; i < futures.size(); ++i) {
+        int idx = i;
+        futures[i].onReady([waiter, first, idx]() {
+            int expected = -1;
+            if(first->compare_exchange_strong(expected, idx)) {
+                waiter->notify();
+            }
+        });
+    }
+    if(!waiter->wait(timeout_ms)) {
+        return -1;
+    }
+    return *first;
+}
+
+}
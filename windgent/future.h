@@ -0,0 +1,145 @@
+#ifndef __FUTURE_H__
+#define __FUTURE_H__
+
+#include <memory>
+#include <vector>
+#include <functional>
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+#include "./mutex.h"
+#include "./scheduler.h"
+#include "./fiber_sync.h"
+
+namespace windgent {
+
+//Future的共享状态，与值的类型无关的部分：完成标志、异常和完成回调
+class FutureStateBase : NonCopyable {
+public:
+    typedef std::shared_ptr<FutureStateBase> ptr;
+    virtual ~FutureStateBase() { }
+
+    bool isReady();
+    //完成时在完成方的上下文中执行cb，已经完成则立即在当前上下文执行。cb应该很轻（比如唤醒等待者）
+    void onReady(std::function<void()> cb);
+    //挂起直到完成或超时，超时返回false
+    bool wait(uint64_t timeout_ms);
+    //设置异常，已经完成返回false
+    bool setException(std::exception_ptr error);
+    std::exception_ptr getException();
+protected:
+    //调用者持有m_mutex并已写入结果，标记完成后解锁并执行回调
+    void complete(SpinLock::Lock& lock);
+protected:
+    SpinLock m_mutex;
+    bool m_ready = false;
+    std::exception_ptr m_error;
+    std::vector<std::function<void()> > m_callbacks;
+};
+
+template<class T>
+class FutureState : public FutureStateBase {
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+
+    template<class V>
+    bool setValue(V&& v) {
+        SpinLock::Lock lock(m_mutex);
+        if(m_ready) {
+            return false;
+        }
+        m_value = std::forward<V>(v);
+        complete(lock);
+        return true;
+    }
+    //只在完成后调用
+    T& getValue() { return m_value; }
+private:
+    T m_value;
+};
+
+//与值的类型无关的Future，WhenAll/WhenAny用它接受不同类型的Future
+class FutureBase {
+public:
+    FutureBase() { }
+    FutureBase(FutureStateBase::ptr state) :m_state(state) { }
+
+    bool valid() const { return (bool)m_state; }
+    bool isReady() const { return m_state->isReady(); }
+    //挂起当前协程（不在协程中时阻塞线程）直到完成，超时返回false。协程中的超时依赖当前IOManager的定时器
+    bool wait(uint64_t timeout_ms = OnceWaiter::INFINITE) const { return m_state->wait(timeout_ms); }
+    //完成后是否带有异常
+    bool hasException() const { return (bool)m_state->getException(); }
+    void onReady(std::function<void()> cb) const { m_state->onReady(cb); }
+protected:
+    FutureStateBase::ptr m_state;
+};
+
+//异步结果，由对应的Promise设置。可以复制，所有副本共享同一个结果。T需要可默认构造
+template<class T>
+class Future : public FutureBase {
+public:
+    Future() { }
+    Future(typename FutureState<T>::ptr state) :FutureBase(state), m_value(state) { }
+
+    //等待完成并返回结果，Promise设置了异常时抛出该异常
+    T& get() const {
+        wait();
+        std::exception_ptr error = m_value->getException();
+        if(error) {
+            std::rethrow_exception(error);
+        }
+        return m_value->getValue();
+    }
+private:
+    typename FutureState<T>::ptr m_value;
+};
+
+//设置结果的一方。每个Promise只能设置一次结果，之后的设置返回false
+template<class T>
+class Promise {
+public:
+    Promise() :m_state(std::make_shared<FutureState<T> >()) { }
+
+    Future<T> getFuture() const { return Future<T>(m_state); }
+    bool setValue(const T& v) { return m_state->setValue(v); }
+    bool setValue(T&& v) { return m_state->setValue(std::move(v)); }
+    bool setException(std::exception_ptr error) { return m_state->setException(error); }
+private:
+    typename FutureState<T>::ptr m_state;
+};
+
+//在scheduler（默认为当前调度器）上新开一个协程执行cb，返回cb的结果。cb抛出的异常由Future::get重新抛出。
+//不在调度器中且没有指定scheduler时直接在当前线程执行。cb的返回值不能是void，不需要结果时用Fiber::join
+template<class F>
+Future<typename std::result_of<F()>::type> Async(F cb, Scheduler* scheduler = nullptr, size_t stacksize = 0) {
+    typedef typename std::result_of<F()>::type T;
+    Promise<T> promise;
+    Future<T> future = promise.getFuture();
+    std::function<void()> task = [promise, cb]() mutable {
+        try {
+            promise.setValue(cb());
+        } catch(...) {
+            promise.setException(std::current_exception());
+        }
+    };
+    if(!scheduler) {
+        scheduler = Scheduler::GetThis();
+    }
+    if(scheduler) {
+        scheduler->schedule(task, -1, stacksize);
+    } else {
+        task();
+    }
+    return future;
+}
+
+//等待所有futures完成，超时返回false。超时后未完成的任务仍会继续执行
+bool WhenAll(const std::vector<FutureBase>& futures, uint64_t timeout_ms = OnceWaiter::INFINITE);
+//等待任意一个完成，返回它的下标，超时返回-1
+int WhenAny(const std::vector<FutureBase>& futures, uint64_t timeout_ms = OnceWaiter::INFINITE);
+
+}
+
+#endif
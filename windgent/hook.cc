@@ -5,6 +5,7 @@
 #include "./log.h"
 #include "./fd_manager.h"
 #include "./config.h"
+#include "./uring.h"
 
 #include <dlfcn.h>
 #include <stdarg.h>
@@ -25,6 +26,8 @@ static thread_local bool t_hook_enable = false;
     XX(socket) \
     XX(connect) \
     XX(accept) \
+    XX(accept4) \
+    XX(socketpair) \
     XX(read) \
     XX(readv) \
     XX(recv) \
@@ -35,7 +38,14 @@ static thread_local bool t_hook_enable = false;
     XX(send) \
     XX(sendto) \
     XX(sendmsg) \
+    XX(sendfile) \
+    XX(splice) \
     XX(close) \
+    XX(pipe) \
+    XX(pipe2) \
+    XX(dup) \
+    XX(dup2) \
+    XX(dup3) \
     XX(fcntl) \
     XX(ioctl) \
     XX(getsockopt) \
@@ -81,10 +91,48 @@ struct timer_cond {
     int cancelled = 0;
 };
 
+//io_uring后端完成模式的请求，没有编译io_uring后端时opcode为-1
+#ifdef WINDGENT_IO_URING
+static windgent::IOManager::IoRequest make_req(int opcode, uint64_t addr, uint32_t len, uint64_t off, uint32_t flags) {
+    windgent::IOManager::IoRequest req;
+    req.opcode = opcode;
+    req.addr = addr;
+    req.len = len;
+    req.off = off;
+    req.opFlags = flags;
+    return req;
+}
+#define URING_REQ(op, addr, len, off, flags) make_req(IORING_OP_##op, (uint64_t)(addr), len, (uint64_t)(off), flags)
+#else
+#define URING_REQ(op, addr, len, off, flags) windgent::IOManager::IoRequest()
+#endif
+
+//阻塞IO超时的定时器回调：本次等待确实超时才取消事件，唤醒等待的协程
+static void on_io_timeout(windgent::IOManager* iom, int fd, uint32_t event) {
+    windgent::FdCtx::ptr ctx = windgent::FdMgr::GetInstance()->get(fd);
+    int type = event == windgent::IOManager::READ ? SO_RCVTIMEO : SO_SNDTIMEO;
+    if(ctx && ctx->expireWait(type, windgent::GetCurrentMS())) {
+        iom->cancelEvent(fd, (windgent::IOManager::Event)event);
+    }
+}
+
+//没有经过hook创建的fd：fd号原来的fd如果没有经过hook就被关闭，它的FdCtx还留着，丢弃它，
+//之后再为这个fd创建的FdCtx带有新的代数，IOManager据此重新注册
+static void drop_stale_ctx(int fd) {
+    if(fd < 0 || !windgent::FdMgr::GetInstance()->get(fd)) {
+        return;
+    }
+    windgent::IOManager* iom = windgent::IOManager::GetThis();
+    if(iom) {
+        iom->cancelAll(fd);
+    }
+    windgent::FdMgr::GetInstance()->del(fd);
+}
+
 //IO相关的API不仅需要添加定时器，还需要注册事件
 template<typename OriginFun, typename ... Args>
 static ssize_t do_io(int fd, OriginFun func, const char* hook_func_name, uint32_t event,
-                     int timeout_type, Args&&... args) {
+                     int timeout_type, const windgent::IOManager::IoRequest& req, Args&&... args) {
     if(!windgent::t_hook_enable) {
         return func(fd, std::forward<Args>(args)...);
     }
@@ -105,8 +153,7 @@ static ssize_t do_io(int fd, OriginFun func, const char* hook_func_name, uint32_
     }
 
     //获取socket的超时时间
-    uint64_t to = ctx->getTimeout(timeout_type);            
-    std::shared_ptr<timer_cond> tcond(new timer_cond);
+    uint64_t to = ctx->getTimeout(timeout_type);
 
 retry:
     //尝试执行func，若返回值 != -1，则成功直接返回n
@@ -123,47 +170,69 @@ retry:
     //从上可知，当返回值为-1且errno=EAGAIN，表示socket上还没有数据到来，需要添加定时器，转化为异步行为
     if(n == -1 && errno == EAGAIN) {
         windgent::IOManager* iom = windgent::IOManager::GetThis();  //当前线程所在的IOManager
-        windgent::Timer::ptr timer;
-        std::weak_ptr<timer_cond> wcond(tcond);     //条件
-        //有超时时间，添加条件定时器
+        //io_uring后端：直接提交完成模式的请求，醒来时数据已经读写完成，不需要再调用一次func
+        if(req.opcode >= 0 && iom->isUring()) {
+            int res = iom->submitIo(fd, req, to);
+            if(res >= 0) {
+                return res;
+            }
+            //被cancelAll取消时重试，由func给出fd关闭后的错误
+            if(res == -ECANCELED) {
+                goto retry;
+            }
+            //内核没有等待就绪就返回了EAGAIN，回到就绪模式
+            if(res != -EAGAIN) {
+                errno = -res;
+                return -1;
+            }
+        }
+        //有超时时间，启用该方向复用的定时器。回调只捕获指针和整数，整个过程不在堆上分配内存
         if(to != (uint64_t)-1) {
-            timer = iom->addCondTimer(to, [wcond, iom, fd, event](){
-                auto t = wcond.lock();
-                //若没有条件或者条件设置为错误，直接返回
-                if(!t || t->cancelled) {
-                    return;
+            ctx->beginWait(timeout_type, windgent::GetCurrentMS() + to);
+            windgent::Timer::ptr& timer = ctx->getTimer(timeout_type);
+            auto cb = [iom, fd, event]() {
+                on_io_timeout(iom, fd, event);
+            };
+            if(!timer || timer->getManager() != iom || !timer->rearm(to, cb)) {
+                if(timer) {
+                    timer->cancel();
                 }
-                t->cancelled = ETIMEDOUT;
-                //取消事件，若事件存在，则触发事件执行
-                iom->cancelEvent(fd, (windgent::IOManager::Event)event);
-            }, wcond);
+                timer = iom->addTimer(to, cb);
+            }
         }
 
-        //将fd及其事件纳入监听。因为cb为空，则会以当前协程为回调参数
-        int ret = iom->addEvent(fd, (windgent::IOManager::Event)event);
+        //将fd及其事件纳入监听，以当前协程为回调参数
+        int ret = iom->waitEvent(fd, (windgent::IOManager::Event)event, ctx->getGeneration());
         //添加事件失败
-        if(ret) {
+        if(ret < 0) {
             LOG_ERROR(g_logger) << hook_func_name << ", addEvent(" << fd << ", " << event << ")";
             //取消定时器
-            if(timer) {
-                timer->cancel();
+            if(to != (uint64_t)-1) {
+                ctx->getTimer(timeout_type)->cancel();
+                ctx->endWait(timeout_type);
             }
             return -1;
+        } else if(ret > 0) {
+            //持久注册的fd在EAGAIN之后已经就绪，不挂起直接重试
+            if(to != (uint64_t)-1) {
+                ctx->getTimer(timeout_type)->cancel();
+                ctx->endWait(timeout_type);
+            }
+            goto retry;
         } else {
             //添加事件成功，当前协程让出执行权。两种被唤醒情况：
-            //1.如果addEvent后在超时时间内，fd上有事件到来表示socket有数据可读写。那么取消定时器，若不取消，定时器任务cancelEvent会被执行（无意义了）。然后再次尝试读写socket上的数据；
-            //2.addCondTimer添加的定时器超时了，执行定时任务cancelEvent，也会唤醒YieldToHold。因为在定时器的回调函数中tcond->cancelled被设置为ETIMEDOUT，则if条件通过，返回-1表示IO操作发生超时错误。
+            //1.如果addEvent后在超时时间内，fd上有事件到来表示socket有数据可读写。那么取消定时器，然后再次尝试读写socket上的数据；
+            //2.定时器超时了，回调把本次等待标记为超时并执行cancelEvent，也会唤醒YieldToHold，返回-1表示IO操作发生超时错误。
             windgent::Fiber::YieldToHold();
-            //当从addEvent唤醒后，若定时器还存在，将其取消
-            if(timer) {
-                timer->cancel();
-            }
-            //若cancelled有值，说明是通过定时器任务cancelEvent唤醒的，说明已经超时且socket上还是没有数据可以读写
-            if(tcond->cancelled) {
-                errno = tcond->cancelled;
-                return -1;
+            if(to != (uint64_t)-1) {
+                //当从addEvent唤醒后，若定时器还存在，将其取消
+                ctx->getTimer(timeout_type)->cancel();
+                if(ctx->endWait(timeout_type)) {
+                    errno = ETIMEDOUT;
+                    return -1;
+                }
             }
-            //若tcond不成立，说明有IO事件到来，需要重新去读/写
+            //不是超时，说明有IO事件到来，需要重新去读/写
             goto retry;
         }
     }
@@ -188,7 +257,7 @@ unsigned int sleep(unsigned int seconds) {
     windgent::IOManager* iom = windgent::IOManager::GetThis();
     //模板方法bind的时候需要声明模板类型和方法参数
     iom->addTimer(seconds * 1000, std::bind((void(windgent::Scheduler::*)
-                 (windgent::Fiber::ptr, int thread))&windgent::IOManager::schedule, iom, fiber, -1));
+                 (windgent::Fiber::ptr, int thread, size_t stacksize, int priority))&windgent::IOManager::schedule, iom, fiber, -1, 0, -1));
     windgent::Fiber::YieldToHold();
     // fiber->YieldToHold();
     // std::cout << "------- after YieldToHold() ---------" << std::endl;
@@ -204,7 +273,7 @@ int usleep(useconds_t usec) {
     windgent::Fiber::ptr fiber = windgent::Fiber::GetThis();
     windgent::IOManager* iom = windgent::IOManager::GetThis();
     iom->addTimer(usec / 1000, std::bind((void(windgent::Scheduler::*)
-                 (windgent::Fiber::ptr, int thread))&windgent::IOManager::schedule, iom, fiber, -1));
+                 (windgent::Fiber::ptr, int thread, size_t stacksize, int priority))&windgent::IOManager::schedule, iom, fiber, -1, 0, -1));
     windgent::Fiber::YieldToHold();
     return 0;
 }
@@ -219,7 +288,7 @@ int nanosleep(const struct timespec *req, struct timespec *rem) {
     windgent::Fiber::ptr fiber = windgent::Fiber::GetThis();
     windgent::IOManager* iom = windgent::IOManager::GetThis();
     iom->addTimer(timeout_ms, std::bind((void(windgent::Scheduler::*)
-                 (windgent::Fiber::ptr, int thread))&windgent::IOManager::schedule, iom, fiber, -1));
+                 (windgent::Fiber::ptr, int thread, size_t stacksize, int priority))&windgent::IOManager::schedule, iom, fiber, -1, 0, -1));
     windgent::Fiber::YieldToHold();
     return 0;
 }
@@ -234,7 +303,7 @@ int socket(int domain, int type, int protocol) {
         return fd;
     }
     //为socket fd创建上下文
-    windgent::FdMgr::GetInstance()->get(fd, true);
+    windgent::FdMgr::GetInstance()->create(fd);
     // std::cout << "---------- use hook socket() ----------" << std::endl;
     return fd;
 }
@@ -256,15 +325,33 @@ int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addr
         return connect_f(sockfd, addr, addrlen);
     }
 
-    int n = connect_f(sockfd, addr, addrlen);
-    if(0 == n) {
-        return 0;   //connect成功
-    } else if(n != -1 || errno != EINPROGRESS) {
-        return n;
+    windgent::IOManager* iom = windgent::IOManager::GetThis();
+    bool submitted = false;
+    //io_uring后端：直接提交connect请求，由内核等待连接完成
+    if(iom->isUring()) {
+        int res = iom->submitIo(sockfd, URING_REQ(CONNECT, addr, 0, addrlen, 0), timerout_ms);
+        if(res == 0) {
+            return 0;
+        }
+        //内核没有等待就返回了，连接已经发起，回到等待可写的方式。
+        //-EAGAIN表示请求没有提交（不是本IOManager的调度线程，或者提交队列满），要自己调用connect
+        if(res == -EINPROGRESS || res == -EALREADY) {
+            submitted = true;
+        } else if(res != -EAGAIN) {
+            errno = -res;
+            return -1;
+        }
+    }
+    if(!submitted) {
+        int n = connect_f(sockfd, addr, addrlen);
+        if(0 == n) {
+            return 0;   //connect成功
+        } else if(n != -1 || errno != EINPROGRESS) {
+            return n;
+        }
     }
 
     //处理connect阻塞的情况：返回值为-1且errno = EINPROGRESS (sockfd被设置为O_NONBLOCK)
-    windgent::IOManager* iom = windgent::IOManager::GetThis();
     windgent::Timer::ptr timer;
     std::shared_ptr<timer_cond> tcond(new timer_cond);
     std::weak_ptr<timer_cond> wcond(tcond);
@@ -283,8 +370,13 @@ int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addr
     }
     //监听fd上的写事件，如果在超时时间内socket上可读写，则立即从YieldToHold出唤醒；如果超时时间到仍然socket没有数据可供读写，
     //则取消事件或者触发，也会从YieldToHold出唤醒，但此时t->cancelled被设为ETIMEDOUT，在if中条件通过会直接返回-1表示错误
-    int ret = iom->addEvent(sockfd, windgent::IOManager::WRITE);
-    if(0 == ret) {
+    int ret = iom->waitEvent(sockfd, windgent::IOManager::WRITE, ctx->getGeneration());
+    if(ret > 0) {
+        //持久注册的fd已经可写，不需要等待
+        if(timer) {
+            timer->cancel();
+        }
+    } else if(0 == ret) {
         //定时器超时后cancelEvent，或者connect连接成功(epoll监听到上面addEvent添加的事件)，都会将YieldToHold从此处唤醒
         windgent::Fiber::YieldToHold();
         //若唤醒后定时器还存在(fd可写)，已经没有意义，取消掉。 取消定时器会导致定时器回调被强制执⾏⼀次，但这并不会导致问题，因为只有当前协程结束后，定时器回调才会在接下来被调度，
@@ -325,58 +417,105 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 
 int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
     //accept会接受sockfd上等待的一个连接请求，并返回一个新的socket fd
-    int fd = do_io(sockfd, accept_f, "accept", windgent::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    int fd = do_io(sockfd, accept_f, "accept", windgent::IOManager::READ, SO_RCVTIMEO,
+                   URING_REQ(ACCEPT, addr, 0, addrlen, 0), addr, addrlen);
     if(fd >= 0) {
-        windgent::FdMgr::GetInstance()->get(fd, true);
+        windgent::FdMgr::GetInstance()->create(fd);
     }
     return fd;
 }
 
+//accept4/socketpair不会把fd设置为由IOManager等待，只丢弃fd号上残留的FdCtx
+int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags) {
+    int fd = accept4_f(sockfd, addr, addrlen, flags);
+    drop_stale_ctx(fd);
+    return fd;
+}
+
+int socketpair(int domain, int type, int protocol, int sv[2]) {
+    int ret = socketpair_f(domain, type, protocol, sv);
+    if(ret == 0) {
+        drop_stale_ctx(sv[0]);
+        drop_stale_ctx(sv[1]);
+    }
+    return ret;
+}
+
 //read
 ssize_t read(int fd, void *buf, size_t count) {
-    return do_io(fd, read_f, "read", windgent::IOManager::READ, SO_RCVTIMEO, buf, count);
+    return do_io(fd, read_f, "read", windgent::IOManager::READ, SO_RCVTIMEO,
+                 URING_REQ(READ, buf, count, -1, 0), buf, count);
 }
 
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt){
-    return do_io(fd, readv_f, "readv", windgent::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
+    return do_io(fd, readv_f, "readv", windgent::IOManager::READ, SO_RCVTIMEO,
+                 URING_REQ(READV, iov, iovcnt, -1, 0), iov, iovcnt);
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
     // std::cout << "---------- use hook recv() ----------" << std::endl;
-    return do_io(sockfd, recv_f, "recv", windgent::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+    return do_io(sockfd, recv_f, "recv", windgent::IOManager::READ, SO_RCVTIMEO,
+                 URING_REQ(RECV, buf, len, 0, flags), buf, len, flags);
 }
 
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen) {
     return do_io(sockfd, recvfrom_f, "recvfrom", windgent::IOManager::READ, 
-                 SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+                 SO_RCVTIMEO, windgent::IOManager::IoRequest(), buf, len, flags, src_addr, addrlen);
 }
 
 ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
-    return do_io(sockfd, recvmsg_f, "recvmsg", windgent::IOManager::READ, SO_RCVTIMEO, msg, flags);
+    return do_io(sockfd, recvmsg_f, "recvmsg", windgent::IOManager::READ, SO_RCVTIMEO,
+                 URING_REQ(RECVMSG, msg, 1, 0, flags), msg, flags);
 }
 
 //write
 ssize_t write(int fd, const void *buf, size_t count) {
-    return do_io(fd, write_f, "write", windgent::IOManager::WRITE, SO_SNDTIMEO, buf, count);
+    return do_io(fd, write_f, "write", windgent::IOManager::WRITE, SO_SNDTIMEO,
+                 URING_REQ(WRITE, buf, count, -1, 0), buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
-    return do_io(fd, writev_f, "writev", windgent::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
+    return do_io(fd, writev_f, "writev", windgent::IOManager::WRITE, SO_SNDTIMEO,
+                 URING_REQ(WRITEV, iov, iovcnt, -1, 0), iov, iovcnt);
 }
 
 ssize_t send(int sockfd, const void *buf, size_t len, int flags) {
     // std::cout << "---------- use hook send() ----------" << std::endl;
-    return do_io(sockfd, send_f, "send", windgent::IOManager::WRITE, SO_SNDTIMEO, buf, len, flags);
+    return do_io(sockfd, send_f, "send", windgent::IOManager::WRITE, SO_SNDTIMEO,
+                 URING_REQ(SEND, buf, len, 0, flags), buf, len, flags);
 }
 
 ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
                         const struct sockaddr *dest_addr, socklen_t addrlen) {
     return do_io(sockfd, sendto_f, "sendto", windgent::IOManager::WRITE, 
-                 SO_SNDTIMEO, buf, len, flags, dest_addr, addrlen);
+                 SO_SNDTIMEO, windgent::IOManager::IoRequest(), buf, len, flags, dest_addr, addrlen);
 }
 
 ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags) {
-    return do_io(sockfd, sendmsg_f, "sendmsg", windgent::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+    return do_io(sockfd, sendmsg_f, "sendmsg", windgent::IOManager::WRITE, SO_SNDTIMEO,
+                 URING_REQ(SENDMSG, msg, 1, 0, flags), msg, flags);
+}
+
+//sendfile按out_fd（socket）的写事件挂起
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    return do_io(out_fd, sendfile_f, "sendfile", windgent::IOManager::WRITE, SO_SNDTIMEO,
+                 windgent::IOManager::IoRequest(), in_fd, offset, count);
+}
+
+//splice的两端有一端是管道：写往socket时按socket的写事件挂起，否则按fd_in的读事件挂起（fd_in是socket时）
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags) {
+    if(!windgent::t_hook_enable) {
+        return splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+    }
+    windgent::FdCtx::ptr ctx = windgent::FdMgr::GetInstance()->get(fd_out);
+    if(ctx && ctx->isSocket()) {
+        return do_io(fd_out, [=](int fd) {
+            return splice_f(fd_in, off_in, fd, off_out, len, flags);
+        }, "splice", windgent::IOManager::WRITE, SO_SNDTIMEO, windgent::IOManager::IoRequest());
+    }
+    return do_io(fd_in, [=](int fd) {
+        return splice_f(fd, off_in, fd_out, off_out, len, flags);
+    }, "splice", windgent::IOManager::READ, SO_RCVTIMEO, windgent::IOManager::IoRequest());
 }
 
 int close(int fd) {
@@ -395,6 +534,45 @@ int close(int fd) {
     return close_f(fd);
 }
 
+int pipe(int pipefd[2]) {
+    int ret = pipe_f(pipefd);
+    if(ret == 0) {
+        drop_stale_ctx(pipefd[0]);
+        drop_stale_ctx(pipefd[1]);
+    }
+    return ret;
+}
+
+int pipe2(int pipefd[2], int flags) {
+    int ret = pipe2_f(pipefd, flags);
+    if(ret == 0) {
+        drop_stale_ctx(pipefd[0]);
+        drop_stale_ctx(pipefd[1]);
+    }
+    return ret;
+}
+
+int dup(int oldfd) {
+    int fd = dup_f(oldfd);
+    drop_stale_ctx(fd);
+    return fd;
+}
+
+//newfd原来打开的话被隐式关闭，同样丢弃它的FdCtx
+int dup2(int oldfd, int newfd) {
+    int fd = dup2_f(oldfd, newfd);
+    if(fd >= 0 && fd != oldfd) {
+        drop_stale_ctx(fd);
+    }
+    return fd;
+}
+
+int dup3(int oldfd, int newfd, int flags) {
+    int fd = dup3_f(oldfd, newfd, flags);
+    drop_stale_ctx(fd);
+    return fd;
+}
+
 //系统和呈现给用户的nonlock状态是不同的，fcntl函数是给用户调用的
 int fcntl(int fd, int cmd, ... /* arg */ ) {
     va_list va;
@@ -5,6 +5,7 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <stdint.h>
 #include <time.h>
 #include <unistd.h>
@@ -37,6 +38,12 @@ extern connect_fun connect_f;
 typedef int (*accept_fun)(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
 extern accept_fun accept_f;
 
+typedef int (*accept4_fun)(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
+extern accept4_fun accept4_f;
+
+typedef int (*socketpair_fun)(int domain, int type, int protocol, int sv[2]);
+extern socketpair_fun socketpair_f;
+
 extern int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addrlen, uint64_t timerout_ms);
 
 //read
@@ -72,10 +79,32 @@ extern sendto_fun sendto_f;
 typedef ssize_t (*sendmsg_fun)(int sockfd, const struct msghdr *msg, int flags);
 extern sendmsg_fun sendmsg_f;
 
+//零拷贝
+typedef ssize_t (*sendfile_fun)(int out_fd, int in_fd, off_t *offset, size_t count);
+extern sendfile_fun sendfile_f;
+
+typedef ssize_t (*splice_fun)(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags);
+extern splice_fun splice_f;
+
 //other
 typedef int (*close_fun)(int fd);
 extern close_fun close_f;
 
+typedef int (*pipe_fun)(int pipefd[2]);
+extern pipe_fun pipe_f;
+
+typedef int (*pipe2_fun)(int pipefd[2], int flags);
+extern pipe2_fun pipe2_f;
+
+typedef int (*dup_fun)(int oldfd);
+extern dup_fun dup_f;
+
+typedef int (*dup2_fun)(int oldfd, int newfd);
+extern dup2_fun dup2_f;
+
+typedef int (*dup3_fun)(int oldfd, int newfd, int flags);
+extern dup3_fun dup3_f;
+
 typedef int (*fcntl_fun)(int fd, int cmd, ... /* arg */ );
 extern fcntl_fun fcntl_f;
 
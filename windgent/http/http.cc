@@ -1,4 +1,5 @@
 #include "./http.h"
+#include <unistd.h>
 
 namespace windgent {
 namespace http {
@@ -168,6 +169,16 @@ HttpResponse::HttpResponse(uint8_t version, bool close)
     :m_status(HttpStatus::OK), m_version(version), m_close(close) {
 }
 
+void HttpResponse::setFile(int fd, uint64_t offset, uint64_t length) {
+    m_file.reset(new int(fd), [](int* p) {
+        close(*p);
+        delete p;
+    });
+    m_fileOffset = offset;
+    m_fileLength = length;
+    m_body.clear();
+}
+
 std::string HttpResponse::getHeader(const std::string& key, const std::string& def) const {
     auto it = m_headers.find(key);
     return it != m_headers.end() ? it->second : def;
@@ -187,7 +198,7 @@ std::string HttpResponse::toString() const {
     return ss.str();
 }
 
-std::ostream& HttpResponse::dump(std::ostream& os) const {
+std::ostream& HttpResponse::dumpHead(std::ostream& os) const {
     os << "HTTP/" << ((uint32_t)(m_version >> 4)) << "." << ((uint32_t)(m_version & 0x0F)) << " " 
        << (uint32_t)m_status << " " << (m_reason.empty() ? HttpStatus2String(m_status) : m_reason) << "\r\n";
     for(auto& i : m_headers) {
@@ -197,14 +208,24 @@ std::ostream& HttpResponse::dump(std::ostream& os) const {
         os << i.first << ": " << i.second << "\r\n";
     }
     os << "Connection: " << (m_close ? "close" : "keep-alive") << "\r\n";
-    if(!m_body.empty()) {
-        os << "Content-Length: " << m_body.size() << "\r\n\r\n" << m_body;
+    if(m_file) {
+        os << "Content-Length: " << m_fileLength << "\r\n\r\n";
+    } else if(!m_body.empty()) {
+        os << "Content-Length: " << m_body.size() << "\r\n\r\n";
     } else {
         os << "\r\n";
     }
     return os;
 }
 
+std::ostream& HttpResponse::dump(std::ostream& os) const {
+    dumpHead(os);
+    if(!m_file) {
+        os << m_body;
+    }
+    return os;
+}
+
 std::ostream& operator<<(std::ostream& os, const HttpRequest& req) {
     return req.dump(os);
 }
@@ -287,6 +287,13 @@ public:
     void setBody(const std::string& v) { m_body = v; }
     void setHeaders(const MapType& v) { m_headers = v; }
 
+    //用文件fd中从offset开始的length字节作为消息体，取代m_body。HttpSession::sendResponse用sendfile发送，
+    //不读入内存。fd由响应接管，最后一个副本析构时关闭
+    void setFile(int fd, uint64_t offset, uint64_t length);
+    int getFileFd() const { return m_file ? *m_file : -1; }
+    uint64_t getFileOffset() const { return m_fileOffset; }
+    uint64_t getFileLength() const { return m_fileLength; }
+
     std::string getHeader(const std::string& key, const std::string& def = "") const;
     void setHeader(const std::string& key, const std::string& val);
     void delHeader(const std::string& key);
@@ -301,7 +308,10 @@ public:
     }
 
     std::string toString() const;
+    //消息体是文件时只输出到首部为止
     std::ostream& dump(std::ostream& os) const;
+    //只输出状态行和首部（包括结尾的空行），消息体由调用者单独发送
+    std::ostream& dumpHead(std::ostream& os) const;
 private:
     HttpStatus m_status;
     uint8_t m_version;
@@ -310,6 +320,9 @@ private:
     std::string m_reason;   //响应原因
     std::string m_body;     //响应消息体
     MapType m_headers;      //响应首部
+    std::shared_ptr<int> m_file;    //作为消息体的文件fd
+    uint64_t m_fileOffset = 0;
+    uint64_t m_fileLength = 0;
 };
 
 std::ostream& operator<<(std::ostream& os, const HttpRequest& req);
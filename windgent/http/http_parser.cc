@@ -134,11 +134,15 @@ HttpRequestParser::HttpRequestParser():m_error(0) {
 }
 
 size_t HttpRequestParser::execute(char* data, size_t len) {
-    size_t offset = http_parser_execute(&m_parser, data, len, 0);
+    size_t offset = parse(data, len);
     memmove(data, data + offset, (len-offset));
     return offset;
 }
 
+size_t HttpRequestParser::parse(const char* data, size_t len) {
+    return http_parser_execute(&m_parser, data, len, 0);
+}
+
 int HttpRequestParser::isFinished() {
     return http_parser_is_finished(&m_parser);
 }
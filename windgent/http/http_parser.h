@@ -14,6 +14,8 @@ public:
     HttpRequestParser();
     //解析请求报文，返回已经解析的长度，并移除已经解析的数据
     size_t execute(char* data, size_t len);
+    //同execute，但不移动数据，由调用者丢弃已经解析的部分（比如BufferedStream::consume）
+    size_t parse(const char* data, size_t len);
     int isFinished();
     int hasError();
 
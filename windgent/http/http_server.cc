@@ -1,5 +1,6 @@
 #include "./http_server.h"
 #include "../log.h"
+#include <algorithm>
 
 namespace windgent {
 namespace http {
@@ -10,9 +11,25 @@ HttpServer::HttpServer(bool keep_alive, IOManager* worker, IOManager* accept_wor
     :TcpServer(worker, accept_worker), m_isKeepAlive(keep_alive), m_dispatcher(new ServletDispatcher) {
 }
 
+HttpServer::HttpServer(bool keep_alive, const std::vector<IOManager*>& workers)
+    :TcpServer(workers), m_isKeepAlive(keep_alive), m_dispatcher(new ServletDispatcher) {
+}
+
+size_t HttpServer::getStackSize() {
+    //TcpServer上没有设置栈大小时由servlet决定，设置了则两者取最大值
+    size_t size = TcpServer::getStackSize();
+    return std::max(size, m_dispatcher->getStackSize());
+}
+
 void HttpServer::handleClient(Socket::ptr client) {
     HttpSession::ptr session(new HttpSession(client));
+    //recvRequest遇到大请求体时会降低协程的优先级，每个请求开始时恢复
+    Fiber* fiber = Fiber::GetCurrent();
+    Fiber::Priority priority = fiber ? fiber->getPriority() : Fiber::PRIORITY_NORMAL;
     do {
+        if(fiber) {
+            fiber->setPriority(priority);
+        }
         HttpRequest::ptr req = session->recvRequest();
         if(!req) {
             LOG_INFO(g_logger) << "session recv http request error, errno = " << errno << ", errstr = " 
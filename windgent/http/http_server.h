@@ -15,9 +15,13 @@ public:
 
     HttpServer(bool keep_alive = false, IOManager* worker = IOManager::GetThis()
               ,IOManager* accept_worker = IOManager::GetThis());
+    //shared-nothing模式，见TcpServer
+    HttpServer(bool keep_alive, const std::vector<IOManager*>& workers);
     
     ServletDispatcher::ptr getDispatcher() const { return m_dispatcher; }
     void setDispatcher(ServletDispatcher::ptr v) { m_dispatcher = v; }
+    //连接协程的栈要能容纳任意一个servlet
+    virtual size_t getStackSize() override;
 protected:
     virtual void handleClient(Socket::ptr client) override;
 private:
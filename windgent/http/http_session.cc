@@ -1,60 +1,63 @@
 #include "./http_session.h"
 #include "./http_parser.h"
+#include "../config.h"
+#include "../fiber.h"
+#include <algorithm>
+#include <stdint.h>
 
 namespace windgent {
 namespace http {
 
+static windgent::ConfigVar<uint64_t>::ptr g_http_response_zerocopy_threshold
+    = windgent::ConfigMgr::Lookup<uint64_t>("http.response.zerocopy_threshold", 128 * 1024ull, "body size from which the response is sent with MSG_ZEROCOPY, 0 to disable");
+static windgent::ConfigVar<uint64_t>::ptr g_http_request_bulk_body_size
+    = windgent::ConfigMgr::Lookup<uint64_t>("http.request.bulk_body_size", 64 * 1024ull, "body size above which the request is handled at low priority, 0 to disable");
+
 HttpSession::HttpSession(Socket::ptr socket, bool owner)
     :SocketStream(socket, owner) {
+    m_input.reset(new BufferedStream(SocketStream::ptr(new SocketStream(socket, false))
+                                     , HttpRequestParser::getHttpRequestBufferSize()));
 }
 
 HttpRequest::ptr HttpSession::recvRequest() {
     HttpRequestParser::ptr parser(new HttpRequestParser);
-    uint64_t buffer_size = HttpRequestParser::getHttpRequestBufferSize();
-    std::shared_ptr<char> buffer(new char[buffer_size], [](char* ptr){ delete[] ptr; });
-    char* data = buffer.get();
-    uint64_t last_size = 0;      //data中剩余的未解析完的数据大小
-
-    do {
-        int len = read(data + last_size, buffer_size - last_size);      //SockStream::read
-        if(len <= 0) {              //error
+    //请求行和首部直接在预读缓冲区中解析，解析过的部分丢弃，未解析完的留在缓冲区等待更多数据。
+    //缓冲区跨请求保留，流水线发来的下一个请求不会丢失
+    while(true) {
+        if(m_input->size() == 0 && m_input->fill() <= 0) {
             close();
             return nullptr;
         }
-        len += last_size;
-        size_t nparse = parser->execute(data, len);     //解析数据并从data中移除
+        size_t len = m_input->size();
+        size_t nparse = parser->parse(m_input->peek(len), len);
+        m_input->consume(nparse);
         if(parser->hasError()) {
             close();
             return nullptr;
         }
-        last_size = len - nparse;
-        if(last_size == buffer_size) {
-            close();
-            return nullptr;
-        }
         if(parser->isFinished()) {
             break;
         }
-    }while(true);
+        //首部超过缓冲区大小
+        if(m_input->fill() <= 0) {
+            close();
+            return nullptr;
+        }
+    }
     //已经填充完请求行和首部，开始填充消息体
     uint64_t length = parser->getContentLength();
+    //大请求体的读取和处理降为低优先级，不让它们排在小请求前面占用调度线程
+    uint64_t bulk_size = g_http_request_bulk_body_size->getVal();
+    if(bulk_size && length > bulk_size && Fiber::GetCurrent()) {
+        Fiber::GetCurrent()->setPriority(Fiber::PRIORITY_LOW);
+    }
     if(length > 0) {
         std::string body;
         body.resize(length);
-        int len = 0;
-        if(length >= last_size) {
-            memcpy(&body[0], data, last_size);
-            len = last_size;
-        } else {
-            memcpy(&body[0], data, length);
-            len = length;
-        }
-        length -= last_size;
-        if(length > 0) {
-            if(readFixedSize(&body[len], length) <= 0) {
-                close();
-                return nullptr;
-            }
+        //先取缓冲区中已有的部分，剩下的大块读取直接从socket读进body
+        if(m_input->readFixedSize(&body[0], length) <= 0) {
+            close();
+            return nullptr;
         }
         parser->getData()->setBody(body);
     }
@@ -63,10 +66,34 @@ HttpRequest::ptr HttpSession::recvRequest() {
 }
 
 int HttpSession::sendResponse (HttpResponse::ptr rsp) {
+    //只序列化首部，消息体直接引用响应中的数据，和首部一起集中写出，不拼接
     std::stringstream ss;
-    ss << *rsp;
-    std::string data = ss.str();
-    return writeFixedSize(data.c_str(), data.size());
+    rsp->dumpHead(ss);
+    std::string head = ss.str();
+    if(rsp->getFileFd() >= 0) {
+        //MSG_MORE让首部和文件的第一段合并成一个报文；文件为空时后面没有数据，不能带，否则首部要等内核超时才发出
+        uint64_t length = rsp->getFileLength();
+        iovec iov = {(void*)head.c_str(), head.size()};
+        if(writevFixedSize(&iov, 1, false, length > 0 ? MSG_MORE : 0) < 0) {
+            return -1;
+        }
+        if(length == 0) {
+            return (int)head.size();
+        }
+        int64_t n = sendFile(rsp->getFileFd(), rsp->getFileOffset(), length);
+        if(n <= 0) {
+            //文件一个字节都没有发出，首部还在内核中等待
+            pushPending();
+        }
+        return n == (int64_t)length ? (int)head.size() : -1;
+    }
+    const std::string& body = rsp->getBody();
+    iovec iovs[2] = {{(void*)head.c_str(), head.size()}, {(void*)body.c_str(), body.size()}};
+    //大的消息体用MSG_ZEROCOPY，内核直接引用body的内存，返回前等待内核用完
+    uint64_t threshold = g_http_response_zerocopy_threshold->getVal();
+    bool zerocopy = threshold && body.size() >= threshold;
+    int64_t n = writevFixedSize(iovs, body.empty() ? 1 : 2, zerocopy);
+    return n < 0 ? -1 : (int)std::min<int64_t>(n, INT32_MAX);
 }
 
 }
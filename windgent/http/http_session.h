@@ -2,6 +2,7 @@
 #define __HTTP_SESSION_H__
 
 #include "../socket_stream.h"
+#include "../buffered_stream.h"
 #include "http.h"
 
 namespace windgent {
@@ -16,6 +17,11 @@ public:
     //流程：接收m_socket上发来的请求报文 --> 通过HttpRequestParser::execute执行解析请求报文的所有回调函数(on_request_http_field...)来填充m_data的所有内容(请求行、首部、消息体...)
     HttpRequest::ptr recvRequest();
     int sendResponse (HttpResponse::ptr rsp);
+
+    //请求的预读缓冲区，直接读取请求数据时（比如升级协议后）应从这里读，避免漏掉已经预读的数据
+    BufferedStream::ptr getInput() const { return m_input; }
+private:
+    BufferedStream::ptr m_input;
 };
 
 }
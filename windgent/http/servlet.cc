@@ -1,5 +1,11 @@
 #include "./servlet.h"
+#include "../fiber.h"
 #include <fnmatch.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <algorithm>
 
 namespace windgent {
 namespace http {
@@ -14,6 +20,7 @@ int32_t FunctionServlet::handle(HttpRequest::ptr request, HttpResponse::ptr resp
 
 ServletDispatcher::ServletDispatcher()
     :Servlet("ServletDispatcher"), m_default(new NotFoundServlet("nothing")) {
+    updateStackSize();
 }
 
 int32_t ServletDispatcher::handle(HttpRequest::ptr request, HttpResponse::ptr response, HttpSession::ptr session) {
@@ -27,11 +34,13 @@ int32_t ServletDispatcher::handle(HttpRequest::ptr request, HttpResponse::ptr re
 void ServletDispatcher::addServlet(const std::string& uri, Servlet::ptr slt) {
     RWMutexType::WrLock lock(m_mutex);
     m_datas[uri] = slt;
+    updateStackSize();
 }
 
 void ServletDispatcher::addServlet(const std::string& uri, FunctionServlet::callback cb) {
     RWMutexType::WrLock lock(m_mutex);
     m_datas[uri].reset(new FunctionServlet(cb));
+    updateStackSize();
 }
 
 void ServletDispatcher::addGlobServlet(const std::string& uri, Servlet::ptr slt) {
@@ -43,6 +52,7 @@ void ServletDispatcher::addGlobServlet(const std::string& uri, Servlet::ptr slt)
         }
     }
     m_globs.push_back(std::make_pair(uri, slt));
+    updateStackSize();
 }
 
 void ServletDispatcher::addGlobServlet(const std::string& uri, FunctionServlet::callback cb) {
@@ -53,6 +63,7 @@ void ServletDispatcher::addGlobServlet(const std::string& uri, FunctionServlet::
 void ServletDispatcher::delServlet(const std::string& uri) {
     RWMutexType::WrLock lock(m_mutex);
     m_datas.erase(uri);
+    updateStackSize();
 }
 
 void ServletDispatcher::delGlobServlet(const std::string& uri) {
@@ -63,6 +74,37 @@ void ServletDispatcher::delGlobServlet(const std::string& uri) {
             break;
         }
     }
+    updateStackSize();
+}
+
+void ServletDispatcher::setDefault(Servlet::ptr v) {
+    RWMutexType::WrLock lock(m_mutex);
+    m_default = v;
+    updateStackSize();
+}
+
+void ServletDispatcher::updateStackSize() {
+    //栈大小为0的servlet（包括内置的NotFoundServlet）对栈没有要求
+    size_t size = 0;
+    auto update = [&size](const Servlet::ptr& slt) {
+        size = std::max(size, slt->getStackSize());
+    };
+    for(auto& i : m_datas) {
+        update(i.second);
+    }
+    for(auto& i : m_globs) {
+        update(i.second);
+    }
+    if(m_default) {
+        update(m_default);
+    }
+    m_maxStackSize = size;
+}
+
+size_t ServletDispatcher::getStackSize() {
+    //没有servlet显式指定栈大小时使用fiber.stacksize
+    size_t size = std::max(Servlet::getStackSize(), m_maxStackSize.load());
+    return size ? size : Fiber::GetDefaultStackSize();
 }
 
 Servlet::ptr ServletDispatcher::getServlet(const std::string& uri) {
@@ -110,5 +152,70 @@ int32_t NotFoundServlet::handle(HttpRequest::ptr request, HttpResponse::ptr resp
     return 0;
 }
 
+StaticFileServlet::StaticFileServlet(const std::string& root, const std::string& prefix)
+    :Servlet("StaticFileServlet"), m_root(root), m_prefix(prefix) {
+    while(!m_root.empty() && m_root.back() == '/') {
+        m_root.pop_back();
+    }
+}
+
+//按扩展名返回Content-Type
+static const char* GetContentType(const std::string& path) {
+    static const char* s_types[][2] = {
+        {".html", "text/html"},
+        {".htm", "text/html"},
+        {".css", "text/css"},
+        {".js", "application/javascript"},
+        {".json", "application/json"},
+        {".txt", "text/plain"},
+        {".png", "image/png"},
+        {".jpg", "image/jpeg"},
+        {".jpeg", "image/jpeg"},
+        {".gif", "image/gif"},
+        {".svg", "image/svg+xml"},
+        {".ico", "image/x-icon"},
+    };
+    size_t pos = path.rfind('.');
+    if(pos != std::string::npos && path.find('/', pos) == std::string::npos) {
+        for(auto& i : s_types) {
+            if(strcasecmp(path.c_str() + pos, i[0]) == 0) {
+                return i[1];
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+int32_t StaticFileServlet::handle(HttpRequest::ptr request, HttpResponse::ptr response, HttpSession::ptr session) {
+    std::string path = request->getPath();
+    if(path.compare(0, m_prefix.size(), m_prefix) == 0) {
+        path = path.substr(m_prefix.size());
+    }
+    if(path.empty() || path[0] != '/') {
+        path = "/" + path;
+    }
+    if(path.find("/../") != std::string::npos || (path.size() >= 3 && path.compare(path.size() - 3, 3, "/..") == 0)) {
+        response->setStatus(HttpStatus::FORBIDDEN);
+        return 0;
+    }
+    if(path.back() == '/') {
+        path += "index.html";
+    }
+    int fd = open((m_root + path).c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        if(fd >= 0) {
+            close(fd);
+        }
+        response->setStatus(HttpStatus::NOT_FOUND);
+        response->setHeader("Content-Type", "text/html");
+        response->setBody("<html><head><title>404 Not Found</title></head><body><center><h1>404 Not Found</h1></center></body></html>");
+        return 0;
+    }
+    response->setHeader("Content-Type", GetContentType(path));
+    response->setFile(fd, 0, st.st_size);
+    return 0;
+}
+
 }
 }
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include "../mutex.h"
 
 #include <memory>
+#include <atomic>
 #include <functional>
 #include <string>
 #include <vector>
@@ -22,8 +23,13 @@ public:
 
     virtual int32_t handle(HttpRequest::ptr request, HttpResponse::ptr response, HttpSession::ptr session) = 0;
     const std::string& getName() const { return m_name; }
+
+    //执行该servlet的协程所需的栈大小，0表示使用fiber.stacksize
+    virtual size_t getStackSize() { return m_stacksize; }
+    void setStackSize(size_t v) { m_stacksize = v; }
 private:
     std::string m_name;
+    size_t m_stacksize = 0;
 };
 
 class FunctionServlet : public Servlet {
@@ -54,10 +60,18 @@ public:
     void delGlobServlet(const std::string& uri);
 
     Servlet::ptr getDefault() const { return m_default; }
-    void setDefault(Servlet::ptr v) { m_default = v; }
+    void setDefault(Servlet::ptr v);
     Servlet::ptr getServlet(const std::string& uri);
     Servlet::ptr getGlobServlet(const std::string& uri);
     Servlet::ptr getMatchedServlet(const std::string& uri);
+
+    //所有已注册servlet显式指定的栈大小的最大值，连接协程按它分配栈；栈大小为0的servlet（包括内置的默认servlet）
+    //不参与计算，都没有指定时使用fiber.stacksize。注册和删除servlet时更新，每次accept只读取缓存的结果；
+    //servlet注册之后再调用setStackSize不会生效
+    virtual size_t getStackSize() override;
+private:
+    //持有写锁时调用，重新计算已注册servlet的栈大小
+    void updateStackSize();
 private:
     RWMutexType m_mutex;
     //uri到servlet的映射，精准匹配
@@ -65,6 +79,7 @@ private:
     //模糊匹配
     std::vector<std::pair<std::string, Servlet::ptr> > m_globs;
     Servlet::ptr m_default;
+    std::atomic<size_t> m_maxStackSize{0};      //显式指定的栈大小的最大值
 };
 
 class NotFoundServlet : public Servlet {
@@ -78,6 +93,19 @@ private:
     std::string m_content;
 };
 
+//静态文件：把请求路径去掉prefix后拼在root后面，找到的普通文件用sendfile发送，不读入内存。
+//路径中含有..时返回403，文件不存在返回404，以/结尾的路径发送其中的index.html
+class StaticFileServlet : public Servlet {
+public:
+    typedef std::shared_ptr<StaticFileServlet> ptr;
+
+    StaticFileServlet(const std::string& root, const std::string& prefix = "");
+    virtual int32_t handle(HttpRequest::ptr request, HttpResponse::ptr response, HttpSession::ptr session) override;
+private:
+    std::string m_root;
+    std::string m_prefix;
+};
+
 }
 }
 
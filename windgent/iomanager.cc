@@ -1,8 +1,13 @@
 #include "./iomanager.h"
 #include "./macro.h"
 #include "./log.h"
+#include "./config.h"
+#include "./uring.h"
+#include "./fd_manager.h"
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
@@ -12,52 +17,79 @@ namespace windgent {
 
 static windgent::Logger::ptr g_logger = LOG_NAME("system");
 
-IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
-    :Scheduler(threads, use_caller, name) {
-    m_epfd = epoll_create(500);
-    ASSERT(m_epfd > 0);
+static windgent::ConfigVar<std::string>::ptr g_iomanager_backend = windgent::ConfigMgr::Lookup<std::string>("iomanager.backend", "epoll", "io backend of IOManager: epoll or io_uring, fall back to epoll if io_uring is unsupported");
+static windgent::ConfigVar<bool>::ptr g_epoll_persistent = windgent::ConfigMgr::Lookup<bool>("iomanager.epoll_persistent", true, "register hooked sockets once with EPOLLIN|EPOLLOUT|EPOLLET and track readiness in FdContext");
+static windgent::ConfigVar<uint32_t>::ptr g_epoll_max_events = windgent::ConfigMgr::Lookup<uint32_t>("iomanager.epoll_max_events", 4096, "max size of the epoll_wait event array, it starts at 64 and doubles when filled");
+static windgent::ConfigVar<uint32_t>::ptr g_uring_entries = windgent::ConfigMgr::Lookup<uint32_t>("iomanager.uring_entries", 256, "submission queue entries of each io_uring");
 
-    int ret = pipe(m_tickleFds);
-    ASSERT(ret == 0);
+static windgent::ConfigVar<uint32_t>::ptr g_timer_stacksize = windgent::ConfigMgr::Lookup<uint32_t>("iomanager.timer_stacksize", 0, "stack size of fibers running timer callbacks, 0 means fiber.stacksize");
 
-    epoll_event event;
-    memset(&event, 0, sizeof(event));
-    event.events = EPOLLIN | EPOLLET;
-    event.data.fd = m_tickleFds[0];
+//持久注册的fd在epoll中关注的事件，EPOLLRDHUP按读事件处理
+static const uint32_t PERSISTENT_EVENTS = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
 
-    ret = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);   //ET模式下要设为非阻塞
-    ASSERT(ret == 0);
-    //将m_tickleFds[0]添加到m_epfd的内部列表，监听m_tickleFds[0]上的读事件。
-    //如果m_tickleFds[0]上有读事件到来，epoll_wait就会返回
-    ret = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-    ASSERT(ret == 0);
+IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
+    :Scheduler(threads, use_caller, name), TimerManager(threads)
+    ,m_fdContexts(&IOManager::InitFdContext) {
+    //threads已经包括use_caller时的caller线程
+    size_t workers = threads;
+    //每个调度线程一个eventfd，tickle时只唤醒选中的线程
+    for(size_t i = 0; i < workers; ++i) {
+        int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        ASSERT(fd >= 0);
+        m_tickleFds.push_back(fd);
+    }
 
-    contextResize(32);
+    const std::string& backend = g_iomanager_backend->getVal();
+    if(backend == "io_uring") {
+        if(!initUring(workers)) {
+            LOG_WARN(g_logger) << "io_uring backend unavailable, fall back to epoll";
+        }
+    } else if(backend != "epoll") {
+        LOG_ERROR(g_logger) << "unknown iomanager.backend " << backend << ", use epoll";
+    }
+
+    if(!isUring()) {
+        m_ioEpfd = epoll_create(500);
+        ASSERT(m_ioEpfd > 0);
+        for(size_t i = 0; i < workers; ++i) {
+            int epfd = epoll_create(500);
+            ASSERT(epfd > 0);
+            m_epfds.push_back(epfd);
+
+            epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN | EPOLLET;
+            event.data.ptr = nullptr;
+            //将线程自己的eventfd添加到它的epoll，eventfd被写入时epoll_wait就会返回
+            int ret = epoll_ctl(epfd, EPOLL_CTL_ADD, m_tickleFds[i], &event);
+            ASSERT(ret == 0);
+        }
+        m_persistent = g_epoll_persistent->getVal();
+    }
 
     start();
 }
 
 IOManager::~IOManager() {
     stop();
-    close(m_epfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
-
-    for(size_t i = 0;i < m_fdContexts.size(); ++i) {
-        if(m_fdContexts[i]) {
-            delete m_fdContexts[i];
-        }
+    for(auto& i : m_epfds) {
+        close(i);
+    }
+    if(m_ioEpfd >= 0) {
+        close(m_ioEpfd);
+    }
+#ifdef WINDGENT_IO_URING
+    for(auto& i : m_rings) {
+        delete i;
+    }
+#endif
+    for(auto& i : m_tickleFds) {
+        close(i);
     }
 }
 
-void IOManager::contextResize(size_t size) {
-    m_fdContexts.resize(size);
-    for(size_t i = 0;i < m_fdContexts.size(); ++i) {
-        if(!m_fdContexts[i]) {
-            m_fdContexts[i] = new FdContext;
-            m_fdContexts[i]->fd = i;
-        }
-    }
+void IOManager::InitFdContext(FdContext& ctx, int fd) {
+    ctx.fd = fd;
 }
 
 IOManager::FdContext::EventContext& IOManager::FdContext::getContext(IOManager::Event event) {
@@ -77,11 +109,22 @@ void IOManager::FdContext::resetContext(IOManager::FdContext::EventContext& ctx)
     ctx.cb = nullptr;
 }
 
-void IOManager::FdContext::triggerEvent(IOManager::Event event) {
+void IOManager::FdContext::triggerEvent(IOManager::Event event, ReadyBatch* batch) {
     // std::cout << "--------- IOManager::FdContext::triggerEvent() ---------" << std::endl;
     ASSERT(events & event);
     events = (Event)(events & ~event);
     EventContext& ctx = getContext(event);
+    if(batch && ctx.scheduler == Scheduler::GetThis()) {
+        if(ctx.cb) {
+            batch->cbs.push_back(nullptr);
+            batch->cbs.back().swap(ctx.cb);
+        } else {
+            batch->fibers.push_back(nullptr);
+            batch->fibers.back().swap(ctx.fiber);
+        }
+        ctx.scheduler = nullptr;
+        return;
+    }
     //触发事件的执行
     if(ctx.cb) {
         ctx.scheduler->schedule(&ctx.cb);
@@ -92,18 +135,15 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
     return;
 }
 
+IOManager::FdContext* IOManager::getFdContext(int fd) {
+    return m_fdContexts.get(fd, true);
+}
+
 int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
     //先拿到fd对应的上下文对象
-    FdContext* fd_ctx = nullptr;
-    RWMutexType::RdLock lock(m_mutex);
-    if((int)m_fdContexts.size() > fd) {
-        fd_ctx = m_fdContexts[fd];
-        lock.unlock();
-    } else {
-        lock.unlock();
-        RWMutexType::WrLock lock2(m_mutex);
-        contextResize(fd * 1.5);
-        fd_ctx = m_fdContexts[fd];
+    FdContext* fd_ctx = getFdContext(fd);
+    if(!fd_ctx) {
+        return -1;
     }
     //修改事件上下文
     FdContext::MutexType::Lock lock3(fd_ctx->mutex);
@@ -113,18 +153,46 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
                             << ", fd_ctx.event= " << fd_ctx->events;
         ASSERT(!(fd_ctx->events & event));
     }
-    //若fd_ctx->events为0，表示添加新事件
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epevent;
-    epevent.events = EPOLLET | fd_ctx->events | event;
-    epevent.data.ptr = fd_ctx;
-    //为fd注册新事件
-    int ret = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(ret) {
-        LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << op << ", " << fd 
-                            << ", " << epevent.events << "): " << ret << " (" << errno << ")"
-                            << strerror(errno) << ")";
-        return -1;
+    //持久注册之后fd号被新的fd复用，旧的注册已经随旧的fd消失
+    if(fd_ctx->persistent) {
+        FdCtx::ptr ctx = FdMgr::GetInstance()->get(fd);
+        if(ctx && ctx->getGeneration() != fd_ctx->generation) {
+            fd_ctx->persistent = false;
+            fd_ctx->ready = NONE;
+        }
+    }
+    if(fd_ctx->persistent) {
+        //持久注册的fd上已经记录了就绪，用EPOLL_CTL_MOD重新装填，内核会按当前状态再报告一次
+        if(fd_ctx->ready & event) {
+            fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+            epoll_event epevent;
+            epevent.events = PERSISTENT_EVENTS;
+            epevent.data.ptr = fd_ctx;
+            int ret = epoll_ctl(m_ioEpfd, EPOLL_CTL_MOD, fd, &epevent);
+            //fd关闭时没有经过cancelAll，注册已经随之消失
+            if(ret && errno == ENOENT) {
+                ret = epoll_ctl(m_ioEpfd, EPOLL_CTL_ADD, fd, &epevent);
+            }
+            if(ret) {
+                LOG_ERROR(g_logger) << "epoll_ctl(" << m_ioEpfd << ", " << EPOLL_CTL_MOD << ", " << fd
+                                    << "): (" << errno << ")" << strerror(errno);
+                return -1;
+            }
+        }
+    } else if(!isUring()) {
+        //若fd_ctx->events为0，表示添加新事件
+        int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        epoll_event epevent;
+        epevent.events = EPOLLET | fd_ctx->events | event;
+        epevent.data.ptr = fd_ctx;
+        //为fd注册新事件
+        int ret = epoll_ctl(m_ioEpfd, op, fd, &epevent);
+        if(ret) {
+            LOG_ERROR(g_logger) << "epoll_ctl(" << m_ioEpfd << ", " << op << ", " << fd 
+                                << ", " << epevent.events << "): " << ret << " (" << errno << ")"
+                                << strerror(errno) << ")";
+            return -1;
+        }
     }
 
     ++m_pendingEventCount;
@@ -141,16 +209,77 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
         event_ctx.fiber = Fiber::GetThis();
         ASSERT(event_ctx.fiber->getState() == Fiber::EXEC);
     }
+    //io_uring后端：提交一次性的poll请求，和下一次等待一起进入内核
+    if(isUring()) {
+        armPoll(fd_ctx, event);
+    }
+    return 0;
+}
+
+int IOManager::waitEvent(int fd, Event event, uint64_t generation) {
+    if(!m_persistent) {
+        return addEvent(fd, event);
+    }
+    FdContext* fd_ctx = getFdContext(fd);
+    if(!fd_ctx) {
+        return -1;
+    }
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    //fd号被复用：旧的fd在其他IOManager的线程上或者没有经过hook关闭，这里的持久注册已经随旧的fd消失
+    if(fd_ctx->persistent && generation && fd_ctx->generation != generation) {
+        fd_ctx->persistent = false;
+        fd_ctx->ready = NONE;
+    }
+    if(!fd_ctx->persistent) {
+        //第一次等待，注册读写两个方向，之后不再修改
+        int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        epoll_event epevent;
+        epevent.events = PERSISTENT_EVENTS;
+        epevent.data.ptr = fd_ctx;
+        int ret = epoll_ctl(m_ioEpfd, op, fd, &epevent);
+        //fd被dup过时，关闭后原来的注册还在；反过来fd没有经过cancelAll就关闭时，注册已经不在了
+        if(ret && errno == EEXIST) {
+            op = EPOLL_CTL_MOD;
+            ret = epoll_ctl(m_ioEpfd, op, fd, &epevent);
+        } else if(ret && errno == ENOENT) {
+            op = EPOLL_CTL_ADD;
+            ret = epoll_ctl(m_ioEpfd, op, fd, &epevent);
+        }
+        if(ret) {
+            LOG_ERROR(g_logger) << "epoll_ctl(" << m_ioEpfd << ", " << op << ", " << fd
+                                << ", " << epevent.events << "): " << ret << " (" << errno << ")"
+                                << strerror(errno) << ")";
+            return -1;
+        }
+        fd_ctx->persistent = true;
+        fd_ctx->ready = NONE;
+        fd_ctx->generation = generation;
+    } else if(fd_ctx->ready & event) {
+        //上次等待之后fd又就绪过，不用挂起，由调用者重试
+        fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+        return 1;
+    }
+    if(fd_ctx->events & event) {
+        LOG_ERROR(g_logger) << "waitEvent assert fd= " << fd << ", event= " << event
+                            << ", fd_ctx.event= " << fd_ctx->events;
+        ASSERT(!(fd_ctx->events & event));
+    }
+
+    ++m_pendingEventCount;
+    fd_ctx->events = (Event)(fd_ctx->events | event);
+    FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
+    ASSERT(!event_ctx.scheduler && !event_ctx.fiber && !event_ctx.cb);
+    event_ctx.scheduler = Scheduler::GetThis();
+    event_ctx.fiber = Fiber::GetThis();
+    ASSERT(event_ctx.fiber->getState() == Fiber::EXEC);
     return 0;
 }
 
 bool IOManager::delEvent(int fd, Event event) {
-    RWMutexType::RdLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = m_fdContexts.get(fd);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     //fd上无此事件
@@ -160,17 +289,21 @@ bool IOManager::delEvent(int fd, Event event) {
 
     Event new_event = (Event)(fd_ctx->events & ~event); //从fd_ctx->events中减去event对应的事件
     // std::cout << "new_event = " << new_event << std::endl;
-    int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_event;
-    epevent.data.ptr = fd_ctx;
-
-    int ret = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(ret) {
-        LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << op << ", " << fd 
-                            << ", " << epevent.events << "): " << ret << " (" << errno << ")"
-                            <<strerror(errno) << ")";
-        return false;
+    if(isUring()) {
+        removePoll(fd_ctx, event);
+    } else if(!fd_ctx->persistent) {
+        int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = EPOLLET | new_event;
+        epevent.data.ptr = fd_ctx;
+
+        int ret = epoll_ctl(m_ioEpfd, op, fd, &epevent);
+        if(ret) {
+            LOG_ERROR(g_logger) << "epoll_ctl(" << m_ioEpfd << ", " << op << ", " << fd 
+                                << ", " << epevent.events << "): " << ret << " (" << errno << ")"
+                                <<strerror(errno) << ")";
+            return false;
+        }
     }
 
     --m_pendingEventCount;
@@ -182,12 +315,10 @@ bool IOManager::delEvent(int fd, Event event) {
 }
 
 bool IOManager::cancelEvent(int fd, Event event) {
-    RWMutexType::RdLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = m_fdContexts.get(fd);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     //fd上无此事件
@@ -196,17 +327,21 @@ bool IOManager::cancelEvent(int fd, Event event) {
     }
     //从events中删除这个事件，如果还有事件剩余，需要修改
     Event new_event = (Event)(fd_ctx->events & ~event); 
-    int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_event;
-    epevent.data.ptr = fd_ctx;
-
-    int ret = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(ret) {
-        LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << op << ", " << fd 
-                            << ", " << epevent.events << "): " << ret << " (" << errno << ")"
-                            <<strerror(errno) << ")";
-        return false;
+    if(isUring()) {
+        removePoll(fd_ctx, event);
+    } else if(!fd_ctx->persistent) {
+        int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = EPOLLET | new_event;
+        epevent.data.ptr = fd_ctx;
+
+        int ret = epoll_ctl(m_ioEpfd, op, fd, &epevent);
+        if(ret) {
+            LOG_ERROR(g_logger) << "epoll_ctl(" << m_ioEpfd << ", " << op << ", " << fd 
+                                << ", " << epevent.events << "): " << ret << " (" << errno << ")"
+                                <<strerror(errno) << ")";
+            return false;
+        }
     }
     //触发执行此事件
     fd_ctx->triggerEvent(event);
@@ -215,30 +350,54 @@ bool IOManager::cancelEvent(int fd, Event event) {
 }
 
 bool IOManager::cancelAll(int fd) {
-     RWMutexType::RdLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+     FdContext* fd_ctx = m_fdContexts.get(fd);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    //io_uring后端：取消fd上进行中的完成模式请求
+    bool has_waiters = fd_ctx->waiters;
+    if(has_waiters) {
+        cancelWaiters(fd_ctx);
+    }
+    //持久注册的fd不再监听，fd号被复用时重新注册
+    bool persistent = fd_ctx->persistent;
+    if(persistent) {
+        epoll_event epevent;
+        memset(&epevent, 0, sizeof(epevent));
+        if(epoll_ctl(m_ioEpfd, EPOLL_CTL_DEL, fd, &epevent)) {
+            LOG_ERROR(g_logger) << "epoll_ctl(" << m_ioEpfd << ", " << EPOLL_CTL_DEL << ", " << fd
+                                << "): (" << errno << ")" << strerror(errno);
+        }
+        fd_ctx->persistent = false;
+        fd_ctx->ready = NONE;
+    }
     //fd上无事件
     if(!fd_ctx->events) {
-        return false;
+        return has_waiters;
     }
 
-    int op = EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = 0;
-    epevent.data.ptr = fd_ctx;
-
-    int ret = epoll_ctl(m_epfd, op, fd, &epevent);      //不再监听fd
-    if(ret) {
-        LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << op << ", " << fd 
-                            << ", " << epevent.events << "): " << ret << " (" << errno << ")"
-                            <<strerror(errno) << ")";
-        return false;
+    if(isUring()) {
+        if(fd_ctx->events & READ) {
+            removePoll(fd_ctx, READ);
+        }
+        if(fd_ctx->events & WRITE) {
+            removePoll(fd_ctx, WRITE);
+        }
+    } else if(!persistent) {
+        int op = EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = 0;
+        epevent.data.ptr = fd_ctx;
+
+        int ret = epoll_ctl(m_ioEpfd, op, fd, &epevent);      //不再监听fd
+        if(ret) {
+            LOG_ERROR(g_logger) << "epoll_ctl(" << m_ioEpfd << ", " << op << ", " << fd 
+                                << ", " << epevent.events << "): " << ret << " (" << errno << ")"
+                                <<strerror(errno) << ")";
+            return false;
+        }
     }
     //触发全部已注册的事件
     if(fd_ctx->events & READ) {
@@ -252,19 +411,54 @@ bool IOManager::cancelAll(int fd) {
     return true;
 }
 
-IOManager* IOManager::GetThis() {
-    return dynamic_cast<IOManager*>(Scheduler::GetThis());
+void IOManager::setPoller(int idx) {
+    Mutex::Lock lock(m_pollerMutex);
+    int old = m_poller;
+    if(old == idx) {
+        return;
+    }
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = this;
+    if(old >= 0) {
+        int ret = epoll_ctl(m_epfds[old], EPOLL_CTL_DEL, m_ioEpfd, &event);
+        ASSERT(ret == 0);
+    }
+    //共享的IO epoll中已经有就绪的fd时，加入后新的poller马上会被唤醒
+    if(idx >= 0) {
+        int ret = epoll_ctl(m_epfds[idx], EPOLL_CTL_ADD, m_ioEpfd, &event);
+        ASSERT(ret == 0);
+    }
+    m_poller = idx;
 }
 
-void IOManager::tickle() {
-    //如果没有空闲的线程，不需要发通知
-    if(!hasIdleThreads()) {
+void IOManager::handOffPoller(int idx) {
+    if(m_poller != idx) {
         return;
     }
-    // std::cout << "---------- IOManager::tickle() -----------" << std::endl;
-    //如果有空闲线程，往m_tickleFds写端写入一个字符，epoll_wait就会被唤醒
-    int ret = write(m_tickleFds[1], "T", 1);
-    ASSERT(ret == 1);
+    for(size_t i = 1; i < m_epfds.size(); ++i) {
+        int next = (idx + i) % m_epfds.size();
+        if(isSleeping(next)) {
+            setPoller(next);
+            return;
+        }
+    }
+}
+
+IOManager* IOManager::GetThis() {
+    return dynamic_cast<IOManager*>(Scheduler::GetThis());
+}
+
+int IOManager::getLocalWorker() {
+    return Scheduler::GetThis() == this ? Scheduler::GetWorkerIndex() : -1;
+}
+
+void IOManager::wakeup(int idx) {
+    //往线程idx的eventfd写入，它的epoll_wait（或io_uring上的poll）就会返回
+    uint64_t one = 1;
+    int ret = write(m_tickleFds[idx], &one, sizeof(one));
+    ASSERT(ret == sizeof(one));
 }
 
 bool IOManager::stopping() {
@@ -274,7 +468,11 @@ bool IOManager::stopping() {
 
 bool IOManager::stopping(uint64_t& timeout) {
     timeout = getTimeOfNextTimer();
-    return timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
+    return !hasTimer() && m_pendingEventCount == 0 && Scheduler::stopping();
+}
+
+int IOManager::getTimerShard() {
+    return Scheduler::GetThis() == this ? Scheduler::GetWorkerIndex() : -1;
 }
 
 //IO调度器无任务时执行idle函数，阻塞在epoll_wait上等待着IO事件到来。idle退出的时机是epoll_wait返回，对应的操作是tickle或注册的IO事件就绪或超时
@@ -282,20 +480,37 @@ bool IOManager::stopping(uint64_t& timeout) {
 //⼆是关注当前注册的所有IO事件有没有触发，如果有触发，那么应该执⾏
 void IOManager::idle() {
     LOG_INFO(g_logger) << "IOManager::idle()";
-    const uint64_t MAX_EVENTS = 64;
-    epoll_event* events = new epoll_event[MAX_EVENTS]();
-    std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr) {
-        delete[] ptr;
-    });
+    if(isUring()) {
+        idleUring();
+        return;
+    }
+    int idx = getLocalWorker();
+    ASSERT(idx >= 0);
+    int epfd = m_epfds[idx];
+    //事件数组一次被填满说明还有就绪的事件没取到，下次扩大一倍
+    std::vector<epoll_event> events(64);
+    ReadyBatch batch;
+    std::vector<std::function<void()> > cbs;
+    //共享的IO epoll以EPOLLET嵌套，上次没有取完时不会再通知，直接再取一次
+    bool io_pending = false;
 
     while(true) {
         uint64_t next_timeout = 0;
         //next_timeout每次都会重置为：到下一定时器任务执行要等待的时间
         if(stopping(next_timeout)) {
             LOG_INFO(g_logger) << "name= " << getName() << ", idle stopping exit";
+            if(m_poller == idx) {
+                setPoller(-1);
+            }
             break;
         }
+        //没有线程负责等待IO，或者负责的线程已经离开idle去执行任务，由本线程接手
+        int poller = m_poller;
+        if(poller != idx && (poller < 0 || !isSleeping(poller))) {
+            setPoller(idx);
+        }
 
+        epoll_event wakes[2];
         int ret = 0;
         do {
             static const int MAX_TIMEOUT = 3000;
@@ -304,10 +519,13 @@ void IOManager::idle() {
             } else {
                 next_timeout = MAX_TIMEOUT;
             }
+            if(io_pending) {
+                next_timeout = 0;
+            }
             //next_timeout是到下一定时器执行要等待的时间，因此epoll_wait等待next_timeout后会立即返回，从而跳出do...while
             //去执行超时的定时器任务，而不需要等待MAX_TIMEOUT
-            //三种情况能唤醒epoll_wait：1：超时时间到了 2：socket上有数据到来  3：tickle往pipe中写入了1，通知有任务来了
-            ret = epoll_wait(m_epfd, events, 64, (int)next_timeout);
+            //三种情况能唤醒epoll_wait：1：超时时间到了 2：本线程是poller，共享的IO epoll上有fd就绪  3：tickle写了本线程的eventfd，通知有任务来了
+            ret = epoll_wait(epfd, wakes, 2, (int)next_timeout);
             // LOG_INFO(g_logger) << "epoll_wait ret = " << ret;
             if(ret < 0 && errno == EINTR) {
                 ;
@@ -315,27 +533,31 @@ void IOManager::idle() {
                 break;
             }
         }while(true);
+        bool tickled = false;
+        for(int i = 0; i < ret; ++i) {
+            if(wakes[i].data.ptr) {
+                io_pending = true;
+            } else {
+                //本线程的eventfd，读一次就清零
+                uint64_t dummy;
+                read(m_tickleFds[idx], &dummy, sizeof(dummy));
+                tickled = true;
+            }
+        }
+        //从共享的IO epoll取就绪的fd
+        ret = 0;
+        if(io_pending) {
+            ret = epoll_wait(m_ioEpfd, &events[0], events.size(), 0);
+            io_pending = ret == (int)events.size();
+            ret = std::max(ret, 0);
+        }
 
         //获取超时的定时器任务
-        std::vector<std::function<void()> > cbs;
         listExpiredCbs(cbs);
-        //如果有超时的定时器任务，全部加入任务队列中调度
-        if(!cbs.empty()) {
-            // std::cout << "--------- schedule(cbs.begin(), cbs.end()) ---------" << std::endl;
-            schedule(cbs.begin(), cbs.end());
-            cbs.clear();
-        }
         //遍历所有发⽣的事件，根据epoll_event的私有指针找到对应的FdContext，进⾏事件处理
+        size_t triggered = 0;
         for(int i = 0;i < ret; ++i) {
             epoll_event& event = events[i];
-            if(event.data.fd == m_tickleFds[0]) {
-                uint8_t dummy[256];
-                //若该fd是pipefd，将发来的1读取完
-                while(read(m_tickleFds[0], dummy, sizeof(dummy)) > 0);
-                // std::cout << "dummy[0] = " << dummy[0] << std::endl;
-                continue;
-            }
-
             FdContext* fd_ctx = (FdContext*)event.data.ptr;
             FdContext::MutexType::Lock lock(fd_ctx->mutex);
             if(event.events & (EPOLLERR | EPOLLHUP)) {
@@ -343,46 +565,76 @@ void IOManager::idle() {
             }
 
             int real_event = NONE;
-            if(event.events & EPOLLIN) {
+            if(event.events & (EPOLLIN | EPOLLRDHUP)) {
                 real_event |= READ;
             }
             if(event.events & EPOLLOUT) {
                 real_event |= WRITE;
             }
-            //fd_ctx->events是通过addEvent添加的事件，而real_event是从fd上监听到的事件
-            if((fd_ctx->events & real_event) == NONE) {
+            //持久注册的fd不需要epoll_ctl：没有等待者的就绪记录下来，留给下一次waitEvent
+            if(fd_ctx->persistent) {
+                fd_ctx->ready = (Event)(fd_ctx->ready | (real_event & ~fd_ctx->events));
+            }
+            //fd_ctx->events是通过addEvent添加的事件，而real_event是从fd上监听到的事件。
+            //EPOLLERR、EPOLLHUP总会上报，只处理添加过的事件
+            real_event &= fd_ctx->events;
+            if(real_event == NONE) {
                 continue;
             }
             //剔除已经发⽣的事件，将剩下的事件重新加⼊epoll_wait，如果剩下的事件为0，表示这个fd已经不需要关注了，直接从epoll中删除
-            int left_events = (fd_ctx->events & ~real_event);
-            int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-            event.events = EPOLLET | left_events;
-            int ret2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
-            if(ret2) {
-                LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << op << ", " << fd_ctx->fd 
-                            << ", " << event.events << "): " << ret2 << " (" << errno << ")"
-                            <<strerror(errno) << ")";
-                continue;  
+            if(!fd_ctx->persistent) {
+                int left_events = (fd_ctx->events & ~real_event);
+                int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+                event.events = EPOLLET | left_events;
+                int ret2 = epoll_ctl(m_ioEpfd, op, fd_ctx->fd, &event);
+                if(ret2) {
+                    LOG_ERROR(g_logger) << "epoll_ctl(" << m_ioEpfd << ", " << op << ", " << fd_ctx->fd 
+                                << ", " << event.events << "): " << ret2 << " (" << errno << ")"
+                                <<strerror(errno) << ")";
+                    continue;  
+                }
             }
             // 处理已经发⽣的事件，也就是让调度器调度指定的函数或协程
             if(real_event & READ) {
                 // std::cout << "--------- fd_ctx->triggerEvent(READ) ---------" << std::endl;
-                fd_ctx->triggerEvent(READ);
-                --m_pendingEventCount;
+                fd_ctx->triggerEvent(READ, &batch);
+                ++triggered;
             }
             if(real_event & WRITE) {
                 // std::cout << "--------- fd_ctx->triggerEvent(WRITE) ---------" << std::endl;
-                fd_ctx->triggerEvent(WRITE);
-                --m_pendingEventCount;
+                fd_ctx->triggerEvent(WRITE, &batch);
+                ++triggered;
             }
         }
+        m_pendingEventCount -= triggered;
+        //本线程要离开idle去执行任务，把等待IO交给另一个睡眠中的线程；都不在睡眠时保留，下一个进入idle的线程会接手
+        if(tickled || !cbs.empty() || !batch.fibers.empty() || !batch.cbs.empty()) {
+            handOffPoller(idx);
+        }
+        //如果有超时的定时器任务，全部以高优先级加入任务队列中调度
+        if(!cbs.empty()) {
+            scheduleLocal(cbs.begin(), cbs.end(), g_timer_stacksize->getVal(), Fiber::PRIORITY_HIGH);
+            cbs.clear();
+        }
+        scheduleBatch(batch);
+        if(ret == (int)events.size() && events.size() < g_epoll_max_events->getVal()) {
+            events.resize(std::min((size_t)g_epoll_max_events->getVal(), events.size() * 2));
+        }
 
         //一旦处理完所有的事件，idle协程yield，这样可以让调度协程(Scheduler::run)重新检查是否有新任务要调度
         //上⾯triggerEvent实际也只是把对应的fiber重新加⼊调度，要执⾏的话还要等idle协程退出
-        Fiber::ptr cur = Fiber::GetThis();
-        auto raw_ptr = cur.get();
-        cur.reset();
-        raw_ptr->swapOut();   //回到调度器的主协程
+        Fiber::GetCurrent()->swapOut();   //回到调度器的主协程
+    }
+}
+
+void IOManager::scheduleBatch(ReadyBatch& batch) {
+    if(!batch.fibers.empty()) {
+        scheduleLocal(batch.fibers.begin(), batch.fibers.end());
+        batch.fibers.clear();
+    }
+    if(!batch.cbs.empty()) {
+        scheduleLocal(batch.cbs.begin(), batch.cbs.end());
+        batch.cbs.clear();
     }
 }
 
@@ -391,4 +643,310 @@ void IOManager::onTimerInsertedAtFront() {
     tickle();
 }
 
-}
\ No newline at end of file
+void IOManager::onTimerMailed(int shard) {
+    tickleWorker(shard);
+}
+
+#ifdef WINDGENT_IO_URING
+
+//cqe的user_data：0表示不需要处理的结果，1表示本线程的eventfd可读，最高位为1表示fd就绪的poll请求，其余为IoWaiter的地址
+static const uint64_t URING_IGNORE = 0;
+static const uint64_t URING_TICKLE = 1;
+static const uint64_t URING_POLL = 1ull << 63;
+//本线程积攒的sqe超过这个数目时立即提交，否则等到idle时和等待一起提交
+static const uint32_t URING_SUBMIT_BATCH = 32;
+
+static uint64_t PollData(int fd, IOManager::Event event, uint32_t seq) {
+    return URING_POLL | ((uint64_t)fd << 32) | ((uint64_t)seq << 1) | (event == IOManager::WRITE ? 1 : 0);
+}
+
+struct IOManager::IoWaiter {
+    Fiber::ptr fiber;                   //等待完成的协程
+    FdContext* fdCtx = nullptr;
+    IoWaiter* next = nullptr;           //同一fd上的下一个请求
+    int ring = -1;                      //请求所在的io_uring
+    int res = 0;                        //cqe的结果
+    bool cancelled = false;             //是否被cancelAll取消
+    __kernel_timespec ts;               //链接的超时，提交时由内核读取
+};
+
+bool IOManager::initUring(size_t count) {
+    if(!IoUring::IsSupported()) {
+        return false;
+    }
+    for(size_t i = 0; i < count; ++i) {
+        IoUring* ring = new IoUring;
+        if(!ring->init(g_uring_entries->getVal())) {
+            delete ring;
+            for(auto& r : m_rings) {
+                delete r;
+            }
+            m_rings.clear();
+            return false;
+        }
+        m_rings.push_back(ring);
+        armTickle(i);
+    }
+    return true;
+}
+
+void IOManager::armTickle(int idx) {
+    IoUring* ring = m_rings[idx];
+    IoUring::MutexType::Lock lock(ring->getMutex());
+    io_uring_sqe* sqe = ring->getSqe();
+    ASSERT(sqe);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = m_tickleFds[idx];
+    sqe->poll32_events = POLLIN;
+    //multishot：触发后poll请求仍然有效，不需要每次重新提交
+    sqe->len = m_tickleMultishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = URING_TICKLE;
+    ring->publish();
+}
+
+void IOManager::armPoll(FdContext* fd_ctx, Event event) {
+    FdContext::EventContext& ctx = fd_ctx->getContext(event);
+    ctx.seq = (ctx.seq + 1) & 0x7fffffff;
+    int local = getLocalWorker();
+    ctx.ring = local >= 0 ? local : 0;
+    IoUring* ring = m_rings[ctx.ring];
+    {
+        IoUring::MutexType::Lock lock(ring->getMutex());
+        io_uring_sqe* sqe = ring->getSqe();
+        ASSERT(sqe);
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd_ctx->fd;
+        sqe->poll32_events = event == READ ? POLLIN : POLLOUT;
+        sqe->user_data = PollData(fd_ctx->fd, event, ctx.seq);
+        ring->publish();
+    }
+    //其他线程的io_uring可能正在等待，需要立即提交
+    if(local != ctx.ring || ring->pending() >= URING_SUBMIT_BATCH) {
+        ring->submit();
+    }
+}
+
+void IOManager::removePoll(FdContext* fd_ctx, Event event) {
+    FdContext::EventContext& ctx = fd_ctx->getContext(event);
+    if(ctx.ring < 0) {
+        return;
+    }
+    IoUring* ring = m_rings[ctx.ring];
+    {
+        IoUring::MutexType::Lock lock(ring->getMutex());
+        io_uring_sqe* sqe = ring->getSqe();
+        if(!sqe) {
+            return;
+        }
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = PollData(fd_ctx->fd, event, ctx.seq);
+        sqe->user_data = URING_IGNORE;
+        ring->publish();
+    }
+    if(getLocalWorker() != ctx.ring) {
+        ring->submit();
+    }
+    ctx.ring = -1;
+}
+
+void IOManager::cancelWaiters(FdContext* fd_ctx) {
+    int local = getLocalWorker();
+    for(IoWaiter* w = fd_ctx->waiters; w; w = w->next) {
+        if(w->cancelled) {
+            continue;
+        }
+        w->cancelled = true;
+        IoUring* ring = m_rings[w->ring];
+        {
+            IoUring::MutexType::Lock lock(ring->getMutex());
+            io_uring_sqe* sqe = ring->getSqe();
+            if(!sqe) {
+                continue;
+            }
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = (uint64_t)w;
+            sqe->user_data = URING_IGNORE;
+            ring->publish();
+        }
+        if(local != w->ring) {
+            ring->submit();
+        }
+    }
+}
+
+int IOManager::submitIo(int fd, const IoRequest& req, uint64_t timeout_ms) {
+    int idx = getLocalWorker();
+    if(idx < 0 || req.opcode < 0) {
+        return -EAGAIN;
+    }
+    IoUring* ring = m_rings[idx];
+    FdContext* fd_ctx = getFdContext(fd);
+    if(!fd_ctx) {
+        return -EBADF;
+    }
+
+    IoWaiter w;
+    w.fiber = Fiber::GetThis();
+    w.fdCtx = fd_ctx;
+    w.ring = idx;
+    {
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        w.next = fd_ctx->waiters;
+        fd_ctx->waiters = &w;
+    }
+    bool ok = false;
+    {
+        IoUring::MutexType::Lock lock(ring->getMutex());
+        //请求和链接的超时必须在同一批提交
+        if(ring->reserve(timeout_ms != (uint64_t)-1 ? 2 : 1)) {
+            io_uring_sqe* sqe = ring->getSqe();
+            sqe->opcode = req.opcode;
+            sqe->fd = fd;
+            sqe->addr = req.addr;
+            sqe->len = req.len;
+            sqe->off = req.off;
+            sqe->rw_flags = req.opFlags;
+            sqe->user_data = (uint64_t)&w;
+            if(timeout_ms != (uint64_t)-1) {
+                w.ts.tv_sec = timeout_ms / 1000;
+                w.ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+                sqe->flags |= IOSQE_IO_LINK;
+                io_uring_sqe* tsqe = ring->getSqe();
+                tsqe->opcode = IORING_OP_LINK_TIMEOUT;
+                tsqe->fd = -1;
+                tsqe->addr = (uint64_t)&w.ts;
+                tsqe->len = 1;
+                tsqe->user_data = URING_IGNORE;
+            }
+            ring->publish();
+            ok = true;
+        }
+    }
+    if(!ok) {
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        IoWaiter** pp = &fd_ctx->waiters;
+        while(*pp != &w) {
+            pp = &(*pp)->next;
+        }
+        *pp = w.next;
+        return -EAGAIN;
+    }
+    ++m_pendingEventCount;
+    if(ring->pending() >= URING_SUBMIT_BATCH) {
+        ring->submit();
+    }
+    //完成事件只由本线程的idle处理，此时协程一定已经切出
+    Fiber::YieldToHold();
+    if(w.res == -ECANCELED && !w.cancelled && timeout_ms != (uint64_t)-1) {
+        return -ETIMEDOUT;
+    }
+    return w.res;
+}
+
+void IOManager::idleUring() {
+    int idx = getLocalWorker();
+    ASSERT(idx >= 0);
+    IoUring* ring = m_rings[idx];
+    std::vector<std::function<void()> > cbs;
+    ReadyBatch batch;
+
+    auto handle = [this, idx, &batch](const io_uring_cqe& cqe) {
+        uint64_t data = cqe.user_data;
+        if(data == URING_IGNORE) {
+            return;
+        }
+        if(data == URING_TICKLE) {
+            uint64_t dummy;
+            read(m_tickleFds[idx], &dummy, sizeof(dummy));
+            //multishot失效（或内核不支持）时重新提交
+            if(!(cqe.flags & IORING_CQE_F_MORE)) {
+                if(cqe.res == -EINVAL) {
+                    m_tickleMultishot = false;
+                }
+                armTickle(idx);
+            }
+            return;
+        }
+        if(data & URING_POLL) {
+            int fd = (data >> 32) & 0x7fffffff;
+            Event event = (data & 1) ? WRITE : READ;
+            uint32_t seq = (data >> 1) & 0x7fffffff;
+            FdContext* fd_ctx = m_fdContexts.get(fd);
+            if(!fd_ctx) {
+                return;
+            }
+            FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+            FdContext::EventContext& ctx = fd_ctx->getContext(event);
+            //事件已被删除或者重新添加过，是过期的结果
+            if(!(fd_ctx->events & event) || ctx.seq != seq) {
+                return;
+            }
+            ctx.ring = -1;
+            fd_ctx->triggerEvent(event, &batch);
+            --m_pendingEventCount;
+            return;
+        }
+        IoWaiter* w = (IoWaiter*)data;
+        {
+            FdContext::MutexType::Lock lock(w->fdCtx->mutex);
+            IoWaiter** pp = &w->fdCtx->waiters;
+            while(*pp != w) {
+                pp = &(*pp)->next;
+            }
+            *pp = w->next;
+        }
+        w->res = cqe.res;
+        batch.fibers.push_back(nullptr);
+        batch.fibers.back().swap(w->fiber);
+        --m_pendingEventCount;
+        //调度之后协程随时可能返回，不能再访问w
+    };
+
+    while(true) {
+        uint64_t next_timeout = 0;
+        if(stopping(next_timeout)) {
+            LOG_INFO(g_logger) << "name= " << getName() << ", idle stopping exit";
+            break;
+        }
+        static const uint64_t MAX_TIMEOUT = 3000;
+        next_timeout = std::min(next_timeout, MAX_TIMEOUT);
+        //一次系统调用：提交积攒的sqe，并等待完成事件、tickle或者超时
+        int ret = ring->submitAndWait(next_timeout);
+        if(ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+            LOG_ERROR(g_logger) << "io_uring_enter errno=" << errno << " " << strerror(errno);
+        }
+
+        listExpiredCbs(cbs);
+        if(!cbs.empty()) {
+            scheduleLocal(cbs.begin(), cbs.end(), g_timer_stacksize->getVal(), Fiber::PRIORITY_HIGH);
+            cbs.clear();
+        }
+        ring->reap(handle);
+        scheduleBatch(batch);
+
+        Fiber::GetCurrent()->swapOut();
+    }
+}
+
+#else
+
+bool IOManager::initUring(size_t count) {
+    LOG_WARN(g_logger) << "io_uring backend is not compiled in";
+    return false;
+}
+
+void IOManager::armPoll(FdContext* fd_ctx, Event event) { }
+void IOManager::removePoll(FdContext* fd_ctx, Event event) { }
+void IOManager::cancelWaiters(FdContext* fd_ctx) { }
+void IOManager::armTickle(int idx) { }
+void IOManager::idleUring() { }
+
+int IOManager::submitIo(int fd, const IoRequest& req, uint64_t timeout_ms) {
+    return -EAGAIN;
+}
+
+#endif
+
+}
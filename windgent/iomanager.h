@@ -3,10 +3,13 @@
 
 #include "./scheduler.h"
 #include "./timer.h"
+#include "./fd_table.h"
 
 namespace windgent {
 
-//基于epoll的IO协程调度器
+class IoUring;
+
+//IO协程调度器，由配置iomanager.backend选择epoll（默认）或io_uring后端，内核不支持io_uring时回退到epoll
 class IOManager : public Scheduler, public TimerManager {
 public:
     typedef std::shared_ptr<IOManager> ptr;
@@ -17,7 +20,22 @@ public:
         READ = 0x1,     //EPOLLIN
         WRITE = 0x4,    //EPOLLOUT
     };
+    //io_uring后端完成模式的IO请求，字段含义与io_uring_sqe的同名字段相同
+    struct IoRequest {
+        int opcode = -1;            //-1表示该操作不支持完成模式
+        uint64_t addr = 0;
+        uint32_t len = 0;
+        uint64_t off = 0;           //文件偏移，accept时为地址长度的指针，connect时为地址长度
+        uint32_t opFlags = 0;       //msg_flags、accept_flags等
+    };
 private:
+    //io_uring后端进行中的完成模式请求，放在发起请求的协程栈上
+    struct IoWaiter;
+    //idle一次唤醒中就绪的协程和回调，处理完所有事件后再批量放入调度队列，只加一次锁
+    struct ReadyBatch {
+        std::vector<Fiber::ptr> fibers;
+        std::vector<std::function<void()> > cbs;
+    };
     //每个socket fd都对应⼀个FdContext，包括fd的值，fd上的事件，以及fd的读写事件上下⽂
     struct FdContext {
         typedef Mutex MutexType;
@@ -26,18 +44,24 @@ private:
             Scheduler* scheduler = nullptr;     //事件执行的scheduler
             Fiber::ptr fiber;                   //事件回调协程
             std::function<void()> cb;           //事件回调函数
+            uint32_t seq = 0;                   //io_uring后端：每次添加事件时递增，用于识别过期的poll完成事件
+            int ring = -1;                      //io_uring后端：poll请求所在的io_uring
         };
         //获取事件上下文
         EventContext& getContext(Event event);
         //重置事件上下文
         void resetContext(EventContext& ctx);
-        //触发事件的执行
-        void triggerEvent(Event event);
+        //触发事件的执行。batch不为空且事件属于当前线程的调度器时，先放入batch，由调用者批量调度
+        void triggerEvent(Event event, ReadyBatch* batch = nullptr);
 
         EventContext read;          //读事件上下文
         EventContext write;         //写事件上下文
         Event events = NONE;        //该fd添加了哪些事件的回调函数，或者说该fd关⼼哪些事件
+        Event ready = NONE;         //持久注册：已经就绪但还没有被等待的事件
+        bool persistent = false;    //持久注册：fd已经以EPOLLIN|EPOLLOUT|EPOLLET注册，不再需要epoll_ctl
+        uint64_t generation = 0;    //持久注册时fd的FdCtx的代数
         int fd = 0;                 //事件关联的句柄
+        IoWaiter* waiters = nullptr;    //io_uring后端：该fd上进行中的完成模式请求
         MutexType mutex;
     };
 
@@ -47,32 +71,72 @@ public:
 
     //添加事件
     int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
+    //当前协程等待fd上的事件，用于读写到EAGAIN之后的等待（hook）。开启iomanager.epoll_persistent时，fd第一次等待时注册一次
+    //EPOLLIN|EPOLLOUT|EPOLLET，之后就绪状态记录在FdContext中，不再调用epoll_ctl。generation为fd的FdCtx的代数，
+    //与注册时不同说明fd号已被新的fd复用（旧的fd可能在其他IOManager的线程上或者没有经过hook关闭），重新注册。
+    //返回0表示已添加，调用者需要YieldToHold；返回1表示事件在上次等待之后已经就绪，调用者直接重试；-1表示失败
+    int waitEvent(int fd, Event event, uint64_t generation = 0);
     //删除事件
     bool delEvent(int fd, Event event);
     //取消事件：强制触发执行该事件
     bool cancelEvent(int fd, Event event);
     //取消fd上的所有事件
     bool cancelAll(int fd);
+    //是否使用io_uring后端
+    bool isUring() const { return !m_rings.empty(); }
+    //io_uring后端的完成模式：提交请求并挂起当前协程，直到请求完成。timeout_ms不为-1时由内核在超时后取消请求。
+    //返回cqe的结果，负数为-errno，超时返回-ETIMEDOUT，被cancelAll取消返回-ECANCELED；无法提交时返回-EAGAIN，调用者应改为等待就绪
+    int submitIo(int fd, const IoRequest& req, uint64_t timeout_ms);
 
     static IOManager* GetThis();
 
 protected:
-    //往m_tickleFds写端写，用于主动通知线程有协程任务到来，此时epoll_wait会立即返回
-    void tickle() override;
+    //写调度线程idx的eventfd，它的epoll_wait会立即返回
+    void wakeup(int idx) override;
     bool stopping() override;
     void idle() override;
     void onTimerInsertedAtFront() override;
+    //只唤醒定时器分片所属的线程
+    void onTimerMailed(int shard) override;
+    //每个调度线程使用自己的定时器分片
+    int getTimerShard() override;
 
-    //初始化事件列表
-    void contextResize(size_t size);
+    //获取fd对应的上下文，所在的块还没有分配时分配，fd超出范围返回nullptr
+    FdContext* getFdContext(int fd);
     bool stopping(uint64_t& timeout);
 private:
-    int m_epfd = 0;        //epoll fd
-    int m_tickleFds[2];    //管道通信
+    //io_uring后端，每个调度线程一个io_uring
+    bool initUring(size_t count);
+    //当前线程的调度线程编号（epoll和io_uring的下标），不是本调度器的线程时返回-1
+    int getLocalWorker();
+    //提交poll请求等待事件就绪/移除poll请求，调用者需持有fd_ctx->mutex
+    void armPoll(FdContext* fd_ctx, Event event);
+    void removePoll(FdContext* fd_ctx, Event event);
+    //取消fd上所有进行中的完成模式请求，调用者需持有fd_ctx->mutex
+    void cancelWaiters(FdContext* fd_ctx);
+    //监听调度线程idx的eventfd
+    void armTickle(int idx);
+    void idleUring();
+    //FdTable新分配的块中每个FdContext的初始化
+    static void InitFdContext(FdContext& ctx, int fd);
+    //把batch中的协程和回调放入当前线程的调度队列并清空batch，多于一个时唤醒一个其他线程
+    void scheduleBatch(ReadyBatch& batch);
+    //epoll后端：把共享的IO epoll嵌套进调度线程idx的epoll，由它等待IO就绪，-1表示没有线程等待
+    void setPoller(int idx);
+    //poller idx离开idle前，把等待IO交给另一个睡眠中的线程
+    void handOffPoller(int idx);
+private:
+    std::vector<int> m_epfds;       //epoll后端，每个调度线程一个epoll，放线程自己的eventfd，poller的还有m_ioEpfd
+    int m_ioEpfd = -1;              //epoll后端，所有fd注册在这个共享的epoll上，同一时刻只嵌套在一个空闲线程（poller）的epoll里
+    std::atomic<int> m_poller = {-1};   //epoll后端，等待m_ioEpfd的调度线程，没有时为-1
+    Mutex m_pollerMutex;            //修改poller时的锁
+    std::vector<int> m_tickleFds;   //每个调度线程一个eventfd，用于定向唤醒
 
     std::atomic<size_t> m_pendingEventCount = {0};  //等待执行的事件数
-    RWMutexType m_mutex;
-    std::vector<FdContext*> m_fdContexts;           //socket事件上下⽂的容器
+    FdTable<FdContext> m_fdContexts;                //socket事件上下⽂的容器，按fd分块分配，查找不加锁
+    std::vector<IoUring*> m_rings;                  //io_uring后端，下标为调度线程的编号；为空表示使用epoll
+    bool m_tickleMultishot = true;                  //内核是否支持multishot poll
+    bool m_persistent = false;                      //epoll后端是否持久注册waitEvent等待的fd
 };
 
 }
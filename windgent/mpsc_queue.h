@@ -0,0 +1,126 @@
+#ifndef __MPSC_QUEUE_H__
+#define __MPSC_QUEUE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+#include "./noncopyable.h"
+
+namespace windgent {
+
+//有界无锁多生产者单消费者队列（Vyukov环形队列）。
+//每个槽位带一个序号：生产者通过CAS抢占m_tail上的位置，写入数据后发布序号；消费者按序号判断槽位是否可读。
+//槽位在构造时一次分配，入队出队都不会申请堆内存，也不会加锁。
+//同一时刻只能有一个消费者，多个线程都可能消费时，先用tryLockConsumer()取得消费权。
+template<class T>
+class MPSCQueue : NonCopyable {
+public:
+    //capacity会向上取整为2的幂
+    MPSCQueue(size_t capacity) {
+        size_t cap = 2;
+        while(cap < capacity) {
+            cap <<= 1;
+        }
+        m_mask = cap - 1;
+        m_cells = std::vector<Cell>(cap);
+        for(size_t i = 0; i < cap; ++i) {
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+        m_consumer.clear();
+    }
+
+    //入队，成功时v被移走；队列已满返回false，v保持不变
+    bool push(T& v) {
+        Cell* cell = nullptr;
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        while(true) {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if(diff == 0) {
+                if(m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if(diff < 0) {
+                return false;
+            } else {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(v);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    //出队一个元素，队列为空（或队首的生产者还未写完）返回false。调用者需持有消费权
+    bool pop(T& v) {
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        Cell& cell = m_cells[pos & m_mask];
+        if(cell.seq.load(std::memory_order_acquire) != pos + 1) {
+            return false;
+        }
+        v = std::move(cell.data);
+        cell.data = T();
+        cell.seq.store(pos + m_mask + 1, std::memory_order_release);
+        m_head.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    //批量出队，每个元素调用一次cb(T&)，最多max个，返回出队的个数。调用者需持有消费权
+    template<class Func>
+    size_t popBatch(Func cb, size_t max = ~(size_t)0) {
+        size_t n = 0;
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        while(n < max) {
+            Cell& cell = m_cells[pos & m_mask];
+            if(cell.seq.load(std::memory_order_acquire) != pos + 1) {
+                break;
+            }
+            cb(cell.data);
+            cell.data = T();
+            cell.seq.store(pos + m_mask + 1, std::memory_order_release);
+            ++pos;
+            ++n;
+        }
+        m_head.store(pos, std::memory_order_relaxed);
+        return n;
+    }
+
+    //获取/释放消费权
+    bool tryLockConsumer() {
+        return !m_consumer.test_and_set(std::memory_order_acquire);
+    }
+    void unlockConsumer() {
+        m_consumer.clear(std::memory_order_release);
+    }
+
+    //近似的元素个数，仅用于判断是否值得去消费
+    size_t size() const {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t head = m_head.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+    bool empty() const { return size() == 0; }
+    size_t capacity() const { return m_mask + 1; }
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+private:
+    std::vector<Cell> m_cells;
+    size_t m_mask = 0;
+    //生产者和消费者的位置分处不同的cache line，避免伪共享
+    char m_pad0[64];
+    std::atomic<size_t> m_tail = {0};
+    char m_pad1[64];
+    std::atomic<size_t> m_head = {0};
+    std::atomic_flag m_consumer;
+    char m_pad2[64];
+};
+
+}
+
+#endif
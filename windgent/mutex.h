@@ -31,6 +31,8 @@ public:
     ~Semaphore();
 
     void wait();  //P操作
+    //最多等待timeout_ms毫秒，超时返回false
+    bool waitFor(uint64_t timeout_ms);
     void notify();  //V操作
 private:
     Semaphore& operator=(const Semaphore&) = delete;
@@ -2,17 +2,62 @@
 #include "log.h"
 #include "macro.h"
 #include "hook.h"
+#include "config.h"
 
 namespace windgent {
 
 windgent::Logger::ptr g_logger = LOG_NAME("system");
+static windgent::ConfigVar<uint32_t>::ptr g_scheduler_inbox_size = 
+        windgent::ConfigMgr::Lookup<uint32_t>("scheduler.inbox_size", 1024, "scheduler per thread inbox size");
+static windgent::ConfigVar<std::string>::ptr g_scheduler_affinity = 
+        windgent::ConfigMgr::Lookup<std::string>("scheduler.affinity", "", "cpu affinity of scheduler threads: empty for none, "
+                                                 "core (one cpu per thread), numa (one numa node per thread) or a cpu list like 0-3,8");
+static windgent::ConfigVar<uint32_t>::ptr g_scheduler_starvation_interval = 
+        windgent::ConfigMgr::Lookup<uint32_t>("scheduler.starvation_interval", 16, "every n-th task is taken from lower priorities first, 0 for strict priority");
+
+//所有调度器共用的分配位置，多个调度器（比如每个核一个单线程的IOManager）依次使用后面的cpu或节点
+static std::atomic<size_t> s_next_affinity = {0};
+
+//按scheduler.affinity为下一个调度线程选择cpu，返回空表示不绑定
+static std::vector<int> NextAffinity() {
+    const std::string& policy = g_scheduler_affinity->getVal();
+    if(policy.empty()) {
+        return std::vector<int>();
+    }
+    if(policy == "numa") {
+        //节点号可能不连续，只有内存没有cpu的节点也在列表里，轮转时只用有cpu的节点
+        static std::vector<std::vector<int> > s_nodes = []() {
+            std::vector<std::vector<int> > nodes;
+            for(auto& i : Thread::GetNumaNodes()) {
+                if(!i.empty()) {
+                    nodes.push_back(i);
+                }
+            }
+            return nodes;
+        }();
+        if(s_nodes.empty()) {
+            LOG_ERROR(g_logger) << "scheduler.affinity=numa: no NUMA node has cpus, thread not bound";
+            return std::vector<int>();
+        }
+        return s_nodes[s_next_affinity++ % s_nodes.size()];
+    }
+    std::vector<int> cpus = policy == "core" ? Thread::GetOnlineCpus() : Thread::ParseCpuList(policy);
+    if(cpus.empty()) {
+        LOG_ERROR(g_logger) << "invalid scheduler.affinity " << policy;
+        return cpus;
+    }
+    return std::vector<int>(1, cpus[s_next_affinity++ % cpus.size()]);
+}
 
 //当前线程的协程调度器，同⼀个调度器下的所有线程指同同⼀个调度器实例
 static thread_local Scheduler* t_scheduler = nullptr;               
 //当前线程的调度协程，每个线程都独有⼀份，包括caller线程，这个加上前⾯协程模块的t_fiber和t_thread_fiber，每个线程总共可以记录三个协程的上下⽂信息。
 static thread_local Fiber* t_scheduler_fiber = nullptr;
+//当前线程的本地任务队列在Scheduler::m_workQueues中的下标
+static thread_local int t_worker_index = -1;
 
-Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name) :m_name(name) {
+Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
+    :m_globalQueue(0), m_name(name) {
     ASSERT(threads > 0);
 
     //是否把创建Scheduler的线程纳入Schuduler监管，如果是，则
@@ -35,6 +80,17 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name) :
         m_rootThread = -1;
     }
     m_threadCount = threads;
+
+    //每个调度线程一个本地队列，caller线程固定使用下标0
+    size_t workers = m_threadCount + (use_caller ? 1 : 0);
+    for(size_t i = 0; i < workers; ++i) {
+        m_workQueues.push_back(new WorkQueue(g_scheduler_inbox_size->getVal()));
+        m_workQueues[i]->index = i;
+    }
+    if(use_caller) {
+        m_workQueues[0]->threadId = m_rootThread;
+        m_nextWorker = 1;
+    }
 }
 
 Scheduler::~Scheduler() {
@@ -42,6 +98,9 @@ Scheduler::~Scheduler() {
     if(GetThis() == this) {
         t_scheduler = nullptr;
     }
+    for(size_t i = 0; i < m_workQueues.size(); ++i) {
+        delete m_workQueues[i];
+    }
 }
 
 Scheduler* Scheduler::GetThis() {
@@ -52,6 +111,10 @@ void Scheduler::setThis() {
     t_scheduler = this;
 }
 
+int Scheduler::GetWorkerIndex() {
+    return t_worker_index;
+}
+
 Fiber* Scheduler::GetMainFiber() {
     return t_scheduler_fiber;
 }
@@ -67,7 +130,7 @@ void Scheduler::start() {
     m_threads.resize(m_threadCount);
     for(size_t i = 0;i < m_threadCount; ++i) {
         //而对于新的线程，直接将run作为其执行函数，线程立即开始执行run
-        m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(i)));
+        m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(i), NextAffinity()));
         m_threadIds.push_back(m_threads[i]->getId());
     }
     lock.unlock();
@@ -97,12 +160,9 @@ void Scheduler::stop() {
     }
 
     m_stopping = true;
-    for(size_t i = 0; i < m_threadCount; ++i) {
-        tickle();
-    }
-    //如果使用了use_caller，需要多tickle一下
-    if(m_rootFiber) {
-        tickle();
+    //唤醒所有调度线程（包括use_caller线程）检查停止条件
+    for(size_t i = 0; i < m_workQueues.size(); ++i) {
+        wakeup(i);
     }
     //使用use_caller，只要没达到停止条件，让线程主协程去执行run。因为use_caller线程不像其他线程一开始就绑定run并执行，
     //而必须通过它自己的主协程来执行
@@ -125,48 +185,233 @@ void Scheduler::stop() {
     }
 }
 
+bool Scheduler::enqueue(FiberAndThread& ft) {
+    WorkQueue* local = getLocalQueue();
+    WorkQueue* wq = nullptr;
+    if(ft.threadId != -1) {
+        //指定了线程的任务放入该线程的队列
+        for(auto& i : m_workQueues) {
+            if(i->threadId == ft.threadId) {
+                wq = i;
+                break;
+            }
+        }
+    } else if(local) {
+        wq = local;
+    } else {
+        //非调度线程提交的任务轮流分给各个调度线程
+        wq = m_workQueues[m_nextInbox++ % m_workQueues.size()];
+    }
+
+    //投递给其他线程的任务走无锁的inbox，不加锁也不申请内存
+    if(wq && wq != local) {
+        bool pinned = ft.threadId != -1;
+        ++m_taskCount;
+        if(wq->inbox.push(ft)) {
+            //与run()中进入idle前的检查配对
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            //指定了线程的任务只能由目标线程执行，直接唤醒它；其他任务按tickle()的策略唤醒一个线程，由它从各个inbox中窃取
+            if(pinned) {
+                tickleWorker(wq->index);
+                return false;
+            }
+            return true;
+        }
+        --m_taskCount;
+        LOG_DEBUG(g_logger) << "inbox of thread " << wq->threadId << " is full";
+        if(ft.threadId == -1) {
+            wq = nullptr;
+        }
+    }
+    if(!wq) {
+        wq = &m_globalQueue;
+    }
+
+    MutexType::Lock lock(wq->mutex);
+    bool need_tickle = wq->empty();
+    wq->push(std::move(ft));
+    ++m_taskCount;
+    //inbox满了，指定线程的任务放进了目标线程的tasks，只有它能执行，同样直接唤醒它
+    if(wq != local && wq != &m_globalQueue) {
+        lock.unlock();
+        tickleWorker(wq->index);
+        return false;
+    }
+    return need_tickle;
+}
+
+size_t Scheduler::drainInbox(WorkQueue* wq) {
+    if(wq->inbox.empty() || !wq->inbox.tryLockConsumer()) {
+        return 0;
+    }
+    size_t n = 0;
+    {
+        MutexType::Lock lock(wq->mutex);
+        n = wq->inbox.popBatch([wq](FiberAndThread& ft) {
+            wq->push(std::move(ft));
+        });
+    }
+    wq->inbox.unlockConsumer();
+    return n;
+}
+
+Scheduler::WorkQueue* Scheduler::getLocalQueue() {
+    if(t_scheduler != this || t_worker_index < 0) {
+        return nullptr;
+    }
+    return m_workQueues[t_worker_index];
+}
+
+bool Scheduler::dequeue(WorkQueue* wq, FiberAndThread& ft, bool& tickle_me, bool& skipped) {
+    if(wq->size == 0) {
+        return false;
+    }
+    MutexType::Lock lock(wq->mutex);
+    //平时从高到低依次检查各优先级；每interval个任务中的最后一个从较低的优先级开始（低、普通轮流），
+    //高优先级任务源源不断时低优先级任务仍能以至少1/interval的比例得到执行
+    uint32_t interval = g_scheduler_starvation_interval->getVal();
+    int first = Fiber::PRIORITY_HIGH;
+    if(interval && wq->picks % interval == interval - 1) {
+        first = Fiber::PRIORITY_COUNT - 1 - (wq->picks / interval) % (Fiber::PRIORITY_COUNT - 1);
+    }
+    for(int n = 0; n < Fiber::PRIORITY_COUNT; ++n) {
+        int p = (first + n) % Fiber::PRIORITY_COUNT;
+        std::deque<FiberAndThread>& tasks = wq->tasks[p];
+        auto it = tasks.begin();
+        while(it != tasks.end()) {
+            //指定了调度线程，但不是在当前线程上调度，通知指定的那个线程进⾏调度，然后跳过这个任务，继续下⼀个
+            if(it->threadId != -1 && it->threadId != windgent::GetThreadId()) {
+                for(auto& i : m_workQueues) {
+                    if(i->threadId == it->threadId) {
+                        tickleWorker(i->index);
+                        break;
+                    }
+                }
+                ++it;
+                continue;
+            }
+            ASSERT(it->fiber || it->cb);
+            //协程还未从其他线程上切出，稍后再取
+            if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
+                ++it;
+                skipped = true;
+                continue;
+            }
+            // 当前调度线程找到⼀个任务，准备开始调度，将其从任务队列中剔除，活跃线程数加1
+            ft = std::move(*it);
+            tasks.erase(it);
+            --wq->size;
+            --wq->depth[p];
+            ++wq->dequeued[p];
+            ++wq->picks;
+            for(int q = 0; q < p; ++q) {
+                if(!wq->tasks[q].empty()) {
+                    ++wq->rescued;
+                    break;
+                }
+            }
+            ++m_activeThreadCount;
+            --m_taskCount;
+            // 当前线程拿完⼀个任务后，发现任务队列还有剩余，那么tickle⼀下其他线程
+            tickle_me |= !wq->empty();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Scheduler::steal(size_t self, FiberAndThread& ft, bool& tickle_me) {
+    std::vector<FiberAndThread> stolen;
+    size_t n = m_workQueues.size();
+    for(size_t i = 1; i < n && stolen.empty(); ++i) {
+        WorkQueue* victim = m_workQueues[(self + i) % n];
+        //victim可能正忙于执行任务，帮它把inbox中的任务搬出来
+        drainInbox(victim);
+        if(victim->size == 0) {
+            continue;
+        }
+        MutexType::Lock lock(victim->mutex);
+        //从高优先级开始，每个优先级从队尾开始取，最多取走一半，指定了线程的任务和还未切出的协程不能窃取
+        size_t want = (victim->size + 1) / 2;
+        for(int p = 0; p < Fiber::PRIORITY_COUNT && stolen.size() < want; ++p) {
+            std::deque<FiberAndThread>& tasks = victim->tasks[p];
+            auto it = tasks.end();
+            while(it != tasks.begin() && stolen.size() < want) {
+                --it;
+                if(it->threadId != -1 || (it->fiber && it->fiber->getState() == Fiber::EXEC)) {
+                    continue;
+                }
+                stolen.push_back(std::move(*it));
+                it = tasks.erase(it);
+                --victim->depth[p];
+                --victim->size;
+            }
+        }
+        if(stolen.empty()) {
+            //剩下的都是指定给该线程的任务，通知一下
+            tickleWorker(victim->index);
+        }
+    }
+    if(stolen.empty()) {
+        return false;
+    }
+
+    //同一优先级中越靠后的任务越早入队，倒序放回本地队列以保持原来的顺序，再按优先级取出一个执行
+    WorkQueue* wq = m_workQueues[self];
+    {
+        MutexType::Lock lock(wq->mutex);
+        for(auto it = stolen.rbegin(); it != stolen.rend(); ++it) {
+            wq->push(std::move(*it));
+        }
+    }
+    bool skipped = false;
+    return dequeue(wq, ft, tickle_me, skipped);
+}
+
 void Scheduler::run() {
     LOG_INFO(g_logger) << "run";
     set_hook_enable(true);
     setThis();
     //若当前执行run的线程不是user_caller线程（一般调度线程），设置该线程的主协程为调度协程
     if(windgent::GetThreadId() != m_rootThread) {
-        t_scheduler_fiber = Fiber::GetThis().get();
+        t_scheduler_fiber = Fiber::GetCurrent();
+        t_worker_index = m_nextWorker++;
+    } else {
+        t_worker_index = 0;
     }
+    ASSERT(t_worker_index < (int)m_workQueues.size());
+    WorkQueue* local = m_workQueues[t_worker_index];
+    local->threadId = windgent::GetThreadId();
+
     //空闲协程，当队列中无任务时，线程执行此协程
     Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
     Fiber::ptr cb_fiber;
+    size_t cb_stacksize = 0;        //cb_fiber创建时指定的栈大小
 
     FiberAndThread ft;
+    bool woken = false;             //是否刚从idle返回
     while(true) {
         ft.reset();
         bool tickle_me = false;     //是否tickle其他线程进⾏任务调度
-        bool is_active = false;
-        {
-            MutexType::Lock locK(m_mtx);
-            auto it = m_fibers.begin();
-            while(it != m_fibers.end()) {
-                //指定了调度线程，但不是在当前线程上调度，标记⼀下需要通知其他线程（指定的那个线程）进⾏调度，然后跳过这个任务，继续下⼀个
-                if(it->threadId != -1 && it->threadId != windgent::GetThreadId()) {
-                    ++it;
-                    tickle_me = true;
-                    continue;
-                }
-                ASSERT(it->fiber || it->cb);
-                //协程已经处于执行态
-                if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
-                    ++it;
-                    continue;
-                }
-                // 当前调度线程找到⼀个任务，准备开始调度，将其从任务队列中剔除，活跃线程数加1
-                ft = *it;
-                m_fibers.erase(it++);
-                ++m_activeThreadCount;
-                is_active = true;
-                break;
+        bool skipped = false;       //是否有还未切出的协程被跳过
+        //先把其他线程投递来的任务搬进本地队列，再依次从本地队列、全局队列取任务，都没有时再从其他线程窃取
+        drainInbox(local);
+        bool is_active = dequeue(local, ft, tickle_me, skipped)
+                      || dequeue(&m_globalQueue, ft, tickle_me, skipped)
+                      || steal(t_worker_index, ft, tickle_me);
+        //被tickle唤醒来找任务的线程，结束寻找状态。没找到时再找一次：唤醒者可能因为看到有线程在找任务而省掉了唤醒
+        if(local->searching && local->searching.exchange(false)) {
+            --m_searching;
+            if(!is_active) {
+                is_active = dequeue(&m_globalQueue, ft, tickle_me, skipped)
+                         || steal(t_worker_index, ft, tickle_me);
+            }
+        }
+        if(woken) {
+            woken = false;
+            if(is_active) {
+                ++local->useful;
             }
-            // 当前线程拿完⼀个任务后，发现任务队列还有剩余，那么tickle⼀下其他线程
-            tickle_me |= it != m_fibers.end();          
         }
 
         if(tickle_me) {
@@ -187,11 +432,15 @@ void Scheduler::run() {
             }
             ft.reset();
         } else if(ft.cb) {      //一般任务
-            if(cb_fiber) {
+            //栈大小相同时复用上一个执行完的协程
+            if(cb_fiber && cb_stacksize == ft.stacksize) {
                 cb_fiber->reset(ft.cb);
             } else {
-                cb_fiber.reset(new Fiber(ft.cb));
+                cb_fiber.reset(new Fiber(ft.cb, ft.stacksize));
+                cb_stacksize = ft.stacksize;
             }
+            //函数任务挂起后重新调度时保持提交时的优先级
+            cb_fiber->setPriority((Fiber::Priority)ft.priority);
 
             ft.reset();
             cb_fiber->swapIn();
@@ -207,19 +456,39 @@ void Scheduler::run() {
                 cb_fiber.reset();
             }
         } else {        //空闲时
-             if(is_active) {
+            if(is_active) {
                 --m_activeThreadCount;
                 continue;
             }
+            //被跳过的协程马上就会切出，不进入idle
+            if(skipped) {
+                continue;
+            }
             // 如果调度器没有调度任务，那么idle协程会不停地swapIn/swapOut，不会结束，如果idle协程结束了，那⼀定是调度器停⽌了
             if(idle_fiber->getState() == Fiber::TERM) {
                 LOG_INFO(g_logger) << "idle fiber term";
+                //本线程已经满足停止条件，其他睡眠的线程可能还在等待超时，唤醒它们重新检查
+                for(auto& i : m_workQueues) {
+                    if(i != local) {
+                        tickleWorker(i->index);
+                    }
+                }
                 break;
             }
 
             ++m_idleThreadCount;
+            local->idle = true;
+            //先声明自己在睡眠再检查一次本地队列和inbox：投递者在入队后检查睡眠标志，两边至少有一方能看到对方，任务不会因为漏掉tickle而滞留
+            local->sleeping = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(local->size || !local->inbox.empty() || m_globalQueue.size) {
+                leaveIdle();
+                continue;
+            }
             idle_fiber->swapIn();
-            --m_idleThreadCount;
+            leaveIdle();
+            ++local->wakeups;
+            woken = true;
             if(idle_fiber->getState() != Fiber::TERM && idle_fiber->getState() != Fiber::EXCEPT) {
                 idle_fiber->m_state = Fiber::HOLD;
             }
@@ -227,13 +496,85 @@ void Scheduler::run() {
     }
 }
 
+void Scheduler::leaveIdle() {
+    WorkQueue* wq = getLocalQueue();
+    if(!wq) {
+        return;
+    }
+    wq->sleeping = false;
+    if(wq->idle) {
+        wq->idle = false;
+        --m_idleThreadCount;
+    }
+}
+
 void Scheduler::tickle() {
+    //已经有线程被唤醒去找任务了，由它取到任务后再决定是否继续唤醒
+    if(m_searching > 0 || m_idleThreadCount == 0) {
+        ++m_suppressed;
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for(auto& wq : m_workQueues) {
+        bool expected = true;
+        if(wq->sleeping && wq->sleeping.compare_exchange_strong(expected, false)) {
+            wq->searching = true;
+            ++m_searching;
+            ++m_tickles;
+            wakeup(wq->index);
+            return;
+        }
+    }
+    ++m_suppressed;
+}
+
+void Scheduler::tickleWorker(int idx) {
+    if(idx < 0 || idx >= (int)m_workQueues.size()) {
+        return;
+    }
+    //与run()中进入idle前的检查配对
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    WorkQueue* wq = m_workQueues[idx];
+    bool expected = true;
+    if(wq->sleeping && wq->sleeping.compare_exchange_strong(expected, false)) {
+        ++m_tickles;
+        wakeup(idx);
+    } else {
+        ++m_suppressed;
+    }
+}
+
+void Scheduler::wakeup(int idx) {
     LOG_DEBUG(g_logger) << "tickle";
 }
 
+Scheduler::WakeupStats Scheduler::getWakeupStats() const {
+    WakeupStats stats;
+    stats.tickles = m_tickles;
+    stats.suppressed = m_suppressed;
+    for(auto& i : m_workQueues) {
+        stats.wakeups += i->wakeups;
+        stats.useful += i->useful;
+    }
+    return stats;
+}
+
+Scheduler::QueueStats Scheduler::getQueueStats() const {
+    QueueStats stats;
+    std::vector<const WorkQueue*> queues(m_workQueues.begin(), m_workQueues.end());
+    queues.push_back(&m_globalQueue);
+    for(auto& i : queues) {
+        for(int p = 0; p < Fiber::PRIORITY_COUNT; ++p) {
+            stats.depth[p] += i->depth[p];
+            stats.dequeued[p] += i->dequeued[p];
+        }
+        stats.rescued += i->rescued;
+    }
+    return stats;
+}
+
 bool Scheduler::stopping() {
-    MutexType::Lock lock(m_mtx);
-    return m_stopping && m_autostop && m_fibers.empty() && m_activeThreadCount == 0;
+    return m_stopping && m_autostop && m_taskCount == 0 && m_activeThreadCount == 0;
 }
 
 void Scheduler::idle() {
@@ -261,6 +602,7 @@ std::ostream& Scheduler::dump(std::ostream& os) {
        << " active_count=" << m_activeThreadCount
        << " idle_count=" << m_idleThreadCount
        << " stopping=" << m_stopping
+       << " global_tasks=" << m_globalQueue.size
        << " ]" << std::endl << "    ";
 
     for(size_t i = 0; i < m_threadIds.size(); ++i) {
@@ -269,6 +611,33 @@ std::ostream& Scheduler::dump(std::ostream& os) {
         }
         os << m_threadIds[i];
     }
+    os << std::endl << "    queues:";
+    for(size_t i = 0; i < m_workQueues.size(); ++i) {
+        os << " [" << m_workQueues[i]->threadId << "]=" << m_workQueues[i]->size
+           << "+" << m_workQueues[i]->inbox.size();
+    }
+    {
+        MutexType::Lock lock(m_mtx);
+        os << std::endl << "    affinity:";
+        for(auto& i : m_threads) {
+            os << " [" << i->getId() << "]=";
+            if(i->getCpus().empty()) {
+                os << "-";
+            } else {
+                os << "cpu" << Thread::FormatCpuList(i->getCpus()) << "/node" << i->getNumaNode();
+            }
+        }
+    }
+    WakeupStats stats = getWakeupStats();
+    os << std::endl << "    wakeup: tickles=" << stats.tickles << " suppressed=" << stats.suppressed
+       << " wakeups=" << stats.wakeups << " useful=" << stats.useful;
+    static const char* s_priority_names[Fiber::PRIORITY_COUNT] = {"high", "normal", "low"};
+    QueueStats qstats = getQueueStats();
+    os << std::endl << "    priority:";
+    for(int p = 0; p < Fiber::PRIORITY_COUNT; ++p) {
+        os << " " << s_priority_names[p] << "=" << qstats.depth[p] << "/" << qstats.dequeued[p];
+    }
+    os << " rescued=" << qstats.rescued;
     return os;
 }
 
@@ -6,10 +6,11 @@
 #include <atomic>
 #include <vector>
 #include <string>
-#include <list>
+#include <deque>
 #include "fiber.h"
 #include "thread.h"
 #include "mutex.h"
+#include "mpsc_queue.h"
 
 
 namespace windgent {
@@ -27,32 +28,42 @@ public:
 
     static Scheduler* GetThis();
     static Fiber* GetMainFiber();
+    //当前线程在所属调度器中的编号，不是调度线程或还未开始调度时返回-1
+    static int GetWorkerIndex();
 
     void start();
     void stop();
 
-    //协程调度:可以指定协程在某个线程中执行
+    //协程调度:可以指定协程在某个线程中执行。调度线程提交的任务放入自己的本地队列，指定了其他线程的任务放入该线程的无锁收件箱，
+    //非调度线程提交的任务轮流放入各调度线程的收件箱。stacksize为执行函数任务的协程栈大小，0表示使用fiber.stacksize。
+    //priority为Fiber::Priority，-1表示协程使用自己的优先级、函数任务使用PRIORITY_NORMAL；给协程指定优先级会同时修改协程的优先级
     template<class FiberOrcb>
-    void schedule(FiberOrcb fc, int thd = -1) {
+    void schedule(FiberOrcb fc, int thd = -1, size_t stacksize = 0, int priority = -1) {
         // std::cout << "--------- Scheduler::schedule() ---------" << std::endl;
         bool need_tickle = false;
-        {
-            MutexType::Lock lock(m_mtx);
-            need_tickle = scheduleNoLock(fc, thd);
+        FiberAndThread ft(fc, thd);
+        ft.stacksize = stacksize;
+        ft.setPriority(priority);
+        if(ft.fiber || ft.cb) {
+            need_tickle = enqueue(ft);
         }
         if(need_tickle) {
             // std::cout << "--------- need_tickle ---------" << std::endl;
             tickle();
         }
     }
-    //批量协程调度
+    //批量协程调度，只加一次锁
     template<class InputIterator>
-    void schedule(InputIterator begin, InputIterator end) {
+    void schedule(InputIterator begin, InputIterator end, size_t stacksize = 0, int priority = -1) {
         bool need_tickle = false;
+        WorkQueue* wq = getLocalQueue();
+        if(!wq) {
+            wq = &m_globalQueue;
+        }
         {
-            MutexType::Lock lock(m_mtx);
+            MutexType::Lock lock(wq->mutex);
             while(begin != end) {
-                need_tickle = scheduleNoLock(&*begin, -1) || need_tickle;
+                need_tickle = scheduleNoLock(wq, &*begin, -1, stacksize, priority) || need_tickle;
                 ++begin;
             }
         }
@@ -61,11 +72,32 @@ public:
         }
     }
 
+    //唤醒统计，用来判断唤醒是否有效
+    struct WakeupStats {
+        uint64_t tickles = 0;       //实际发出的唤醒次数
+        uint64_t suppressed = 0;    //没有睡眠的线程、目标线程已醒或已有线程在找任务而省掉的唤醒
+        uint64_t wakeups = 0;       //调度线程从idle返回的次数
+        uint64_t useful = 0;        //从idle返回后取到了任务的次数
+    };
+    WakeupStats getWakeupStats() const;
+
+    //各优先级的队列统计，不包括还在inbox中的任务
+    struct QueueStats {
+        size_t depth[Fiber::PRIORITY_COUNT] = {0};      //排队中的任务数
+        uint64_t dequeued[Fiber::PRIORITY_COUNT] = {0}; //已取出执行的任务数
+        uint64_t rescued = 0;       //防饥饿：低优先级任务先于排队中的高优先级任务执行的次数
+    };
+    QueueStats getQueueStats() const;
+
     void switchTo(int thread);
     std::ostream& dump(std::ostream& os);
 protected:
-    //通知协程调度器有任务到来
+    //通知协程调度器有任务到来：唤醒编号最小的睡眠线程。已经有被唤醒还没取到任务的线程时不再唤醒，由它取到任务后按需继续唤醒
     virtual void tickle();
+    //唤醒指定的调度线程，它没有睡眠时什么也不做
+    void tickleWorker(int idx);
+    //让编号为idx的调度线程从idle中返回，由子类实现
+    virtual void wakeup(int idx);
     //协程调度函数
     void run();
     virtual bool stopping();
@@ -73,16 +105,31 @@ protected:
 
     void setThis();
     bool hasIdleThreads() { return m_idleThreadCount > 0; }
-private:
-    //将任务加入到队列中
-    template<class FiberOrcb>
-    bool scheduleNoLock(FiberOrcb fc, int thd) {
-        bool need_tickle = m_fibers.empty();
-        FiberAndThread ft(fc, thd);
-        if(ft.fiber || ft.cb) {
-            m_fibers.push_back(ft);
+    //调度线程idx是否在idle中睡眠，已经被唤醒的不算
+    bool isSleeping(int idx) const { return m_workQueues[idx]->sleeping; }
+    //当前线程结束睡眠状态，不再计入空闲线程。idle中取到了要由本线程执行的任务时提前调用，调度这些任务时不会再把本线程当作可唤醒的线程
+    void leaveIdle();
+    //idle中把取到的任务批量放入本线程的本地队列。本线程从idle返回后马上会取走一个，只有多出来的任务才唤醒一个其他线程
+    template<class InputIterator>
+    void scheduleLocal(InputIterator begin, InputIterator end, size_t stacksize = 0, int priority = -1) {
+        WorkQueue* wq = getLocalQueue();
+        if(!wq) {
+            schedule(begin, end, stacksize, priority);
+            return;
+        }
+        leaveIdle();
+        size_t size = 0;
+        {
+            MutexType::Lock lock(wq->mutex);
+            while(begin != end) {
+                scheduleNoLock(wq, &*begin, -1, stacksize, priority);
+                ++begin;
+            }
+            size = wq->size;
+        }
+        if(size > 1) {
+            tickle();
         }
-        return need_tickle;
     }
 private:
     //线程要执行的任务：可以是一个协程或者一个std::function
@@ -90,13 +137,20 @@ private:
         Fiber::ptr fiber;           //协程
         std::function<void()> cb;   //协程执行的函数
         int threadId;               //协程所在的线程id
+        size_t stacksize = 0;       //执行cb的协程的栈大小，0表示默认大小
+        int priority = Fiber::PRIORITY_NORMAL;  //所在的优先级队列
 
         //协程在确定的线程上执行
         FiberAndThread(Fiber::ptr f, int thr):fiber(f), threadId(thr) {
-
+            if(fiber) {
+                priority = fiber->getPriority();
+            }
         }
         FiberAndThread(Fiber::ptr* f, int thr) :threadId(thr) {
             fiber.swap(*f);
+            if(fiber) {
+                priority = fiber->getPriority();
+            }
         }
 
         //一般任务
@@ -110,16 +164,96 @@ private:
         FiberAndThread() :threadId(-1) {
         }
 
+        //指定优先级，-1（或不合法的值）表示保持默认
+        void setPriority(int p) {
+            if(p < 0 || p >= Fiber::PRIORITY_COUNT) {
+                return;
+            }
+            priority = p;
+            if(fiber) {
+                fiber->setPriority((Fiber::Priority)p);
+            }
+        }
+
         void reset() {
             fiber = nullptr;
             cb = nullptr;
             threadId = -1;
+            stacksize = 0;
+            priority = Fiber::PRIORITY_NORMAL;
         }
     };
+
+    //每个调度线程的本地任务队列，每个优先级一个双端队列，本线程按优先级从队首取任务，其他线程空闲时从队尾窃取未指定线程的任务。
+    //其他线程投递给本线程的任务先进入无锁的inbox，再由本线程（或前来窃取的线程）批量搬进tasks
+    struct WorkQueue {
+        WorkQueue(size_t inbox_size) :inbox(inbox_size) {
+            for(int i = 0; i < Fiber::PRIORITY_COUNT; ++i) {
+                depth[i] = 0;
+                dequeued[i] = 0;
+            }
+        }
+
+        //调用者需持有mutex
+        bool empty() const { return size == 0; }
+        void push(FiberAndThread&& ft) {
+            tasks[ft.priority].push_back(std::move(ft));
+            ++depth[ft.priority];
+            ++size;
+        }
+
+        MutexType mutex;
+        std::deque<FiberAndThread> tasks[Fiber::PRIORITY_COUNT];
+        std::atomic<size_t> size = {0};     //tasks中的任务数，供其他线程不加锁地判断队列是否为空
+        std::atomic<size_t> depth[Fiber::PRIORITY_COUNT];       //各优先级的任务数
+        std::atomic<uint64_t> dequeued[Fiber::PRIORITY_COUNT];  //各优先级取出执行的任务数
+        std::atomic<uint64_t> rescued = {0};    //防饥饿生效的次数
+        uint64_t picks = 0;                 //取出的任务总数，用于防饥饿的轮转，受mutex保护
+        std::atomic<int> threadId = {-1};   //队列所属线程的id，线程开始执行run后才设置
+        MPSCQueue<FiberAndThread> inbox;    //跨线程投递的任务
+        int index = -1;                     //队列在m_workQueues中的下标，全局队列为-1
+        std::atomic<bool> sleeping = {false};   //所属线程是否在idle中（或即将进入），唤醒者把它置为false后再唤醒，避免重复唤醒
+        std::atomic<bool> searching = {false};  //所属线程被tickle唤醒，还没有取过任务
+        bool idle = false;                      //所属线程计入了m_idleThreadCount，只由所属线程访问
+        std::atomic<uint64_t> wakeups = {0};    //从idle返回的次数
+        std::atomic<uint64_t> useful = {0};     //从idle返回后取到了任务的次数
+    };
+
+    //将任务加入到队列中，调用者需持有队列对应的锁
+    template<class FiberOrcb>
+    bool scheduleNoLock(WorkQueue* wq, FiberOrcb fc, int thd, size_t stacksize = 0, int priority = -1) {
+        bool need_tickle = wq->empty();
+        FiberAndThread ft(fc, thd);
+        ft.stacksize = stacksize;
+        ft.setPriority(priority);
+        if(ft.fiber || ft.cb) {
+            wq->push(std::move(ft));
+            ++m_taskCount;
+        }
+        return need_tickle;
+    }
+
+    //将任务放入合适的队列，返回是否需要tickle。投递给其他线程时直接唤醒该线程
+    bool enqueue(FiberAndThread& ft);
+    //返回当前线程在本调度器中的本地队列，非调度线程返回nullptr
+    WorkQueue* getLocalQueue();
+    //把inbox中的任务批量搬进tasks，返回搬运的个数
+    size_t drainInbox(WorkQueue* wq);
+    //按优先级从队列中取出一个当前线程可执行的任务，每scheduler.starvation_interval个任务让低优先级先取一次。tickle_me表示队列中还有其他线程可执行的任务，skipped表示跳过了还未切出的协程
+    bool dequeue(WorkQueue* wq, FiberAndThread& ft, bool& tickle_me, bool& skipped);
+    //本地队列和全局队列都为空时，从其他线程的本地队列尾部窃取一半未指定线程的任务（高优先级优先），放入自己的队列
+    bool steal(size_t self, FiberAndThread& ft, bool& tickle_me);
 private:
     MutexType m_mtx;
     std::vector<Thread::ptr> m_threads;     //工作线程
-    std::list<FiberAndThread> m_fibers;     //待执行的协程（任务）队列
+    WorkQueue m_globalQueue;                //全局任务队列，只存放指定了未知线程的任务和inbox满时溢出的任务
+    std::vector<WorkQueue*> m_workQueues;   //每个调度线程的本地任务队列，use_caller时下标0属于caller线程
+    std::atomic<size_t> m_nextWorker = {0}; //下一个开始run的线程所使用的队列下标
+    std::atomic<size_t> m_nextInbox = {0};  //非调度线程提交任务时轮询的inbox下标
+    std::atomic<size_t> m_taskCount = {0};  //所有队列中的任务总数
+    std::atomic<int> m_searching = {0};     //被tickle唤醒还没取过任务的线程数
+    std::atomic<uint64_t> m_tickles = {0};
+    std::atomic<uint64_t> m_suppressed = {0};
     std::string m_name;
     Fiber::ptr m_rootFiber;                 //use_caller为true时有效, 调度器所在线程的调度协程
 protected:
@@ -110,7 +110,7 @@ bool Socket::setSockOpt(int level, int optname, const void* optval, socklen_t op
 }
 
 //socket
-bool Socket::bind(const Address::ptr addr) {
+bool Socket::bind(const Address::ptr addr, bool reuse_port) {
     if(WINDGENT_UNLIKELY(!isValid())) {
         newSocket();
         if(WINDGENT_UNLIKELY(!isValid())) {
@@ -124,6 +124,13 @@ bool Socket::bind(const Address::ptr addr) {
         return false;
     }
 
+    if(reuse_port) {
+        int val = 1;
+        if(!setSockOpt(SOL_SOCKET, SO_REUSEPORT, val)) {
+            return false;
+        }
+    }
+
     if(::bind(m_sockfd, addr->getAddr(), addr->getAddrLen())) {
         LOG_ERROR(g_logger) << "Socket::bind error, errno = " << errno << ", errstr = " << strerror(errno);
         return false;
@@ -60,7 +60,8 @@ public:
     }
 
     //socket
-    bool bind(const Address::ptr addr);
+    //reuse_port为true时在bind之前设置SO_REUSEPORT，多个socket可以绑定同一个地址，由内核分配新连接
+    bool bind(const Address::ptr addr, bool reuse_port = false);
     bool listen(int backlog = SOMAXCONN);
     bool connect(const Address::ptr addr, uint64_t timeout = -1);
     Socket::ptr accept();
@@ -1,5 +1,18 @@
 #include "./socket_stream.h"
+#include "./hook.h"
+#include "./iomanager.h"
+#include "./fiber.h"
+#include "./fd_manager.h"
 #include <vector>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 namespace windgent {
 
@@ -8,6 +21,9 @@ SocketStream::SocketStream(Socket::ptr socket, bool owner)
 }
 
 SocketStream::~SocketStream() {
+    if(m_zcEpfd >= 0) {
+        ::close(m_zcEpfd);
+    }
     if(m_owner && m_socket) {
         m_socket->close();
     }
@@ -37,6 +53,13 @@ int SocketStream::read(ByteArray::ptr ba, size_t length) {
     return ret;
 }
 
+int SocketStream::readv(struct iovec* buffers, size_t count) {
+    if(!isConnected()) {
+        return -1;
+    }
+    return m_socket->recv(buffers, count);
+}
+
 int SocketStream::write(const void* buffer, size_t length) {
     if(!isConnected()) {
         return -1;
@@ -57,6 +80,208 @@ int SocketStream::write(ByteArray::ptr ba, size_t length) {
     return ret;
 }
 
+int64_t SocketStream::sendFile(int fd, uint64_t offset, uint64_t length) {
+    if(!isConnected()) {
+        return -1;
+    }
+    int sock = m_socket->getSocket();
+    off_t off = offset;
+    uint64_t sent = 0;
+    while(sent < length) {
+        //sendfile一次最多发送0x7ffff000字节
+        ssize_t n = sendfile(sock, fd, &off, std::min<uint64_t>(length - sent, 0x7ffff000));
+        if(n > 0) {
+            sent += n;
+        } else if(n == 0) {
+            break;
+        } else if(sent == 0 && (errno == EINVAL || errno == ENOSYS)) {
+            return spliceFrom(fd, offset, length);
+        } else if(sent == 0 && errno == ESPIPE) {
+            //管道等不可定位的fd，从当前位置读
+            return spliceFrom(fd, -1, length);
+        } else {
+            return -1;
+        }
+    }
+    return sent;
+}
+
+int64_t SocketStream::spliceFrom(int fd, int64_t offset, uint64_t length) {
+    if(!isConnected()) {
+        return -1;
+    }
+    int pipefd[2];
+    if(pipe2(pipefd, O_CLOEXEC)) {
+        return -1;
+    }
+    //管道越大每轮搬运的数据越多，扩大失败时使用默认大小
+    fcntl(pipefd[1], F_SETPIPE_SZ, 1024 * 1024);
+    int pipe_size = fcntl(pipefd[1], F_GETPIPE_SZ);
+    if(pipe_size <= 0) {
+        pipe_size = 64 * 1024;
+    }
+
+    int sock = m_socket->getSocket();
+    loff_t off = offset;
+    loff_t* poff = offset < 0 ? nullptr : &off;
+    uint64_t sent = 0;
+    bool error = false;
+    while(!error && sent < length) {
+        //每轮把不超过管道容量的数据搬进管道，再全部搬到socket，管道不会写满而阻塞
+        ssize_t n = splice(fd, poff, pipefd[1], nullptr, std::min<uint64_t>(length - sent, pipe_size), SPLICE_F_MOVE);
+        if(n <= 0) {
+            error = n < 0;
+            break;
+        }
+        while(n > 0) {
+            //SPLICE_F_MORE让socket等待后续数据（MSG_MORE），最后一段不能带，否则会被延迟发送
+            unsigned int flags = SPLICE_F_MOVE | (sent + n < length ? SPLICE_F_MORE : 0);
+            ssize_t m = splice(pipefd[0], nullptr, sock, nullptr, n, flags);
+            if(m <= 0) {
+                error = true;
+                break;
+            }
+            n -= m;
+            sent += m;
+        }
+    }
+    int err = errno;
+    ::close(pipefd[0]);
+    ::close(pipefd[1]);
+    errno = err;
+    return error ? -1 : sent;
+}
+
+int64_t SocketStream::writevFixedSize(iovec* buffers, size_t count, bool zerocopy, int flags) {
+    if(!isConnected()) {
+        return -1;
+    }
+    if(zerocopy && enableZeroCopy()) {
+        flags |= MSG_ZEROCOPY;
+    }
+    uint64_t sent = 0;
+    while(count > 0) {
+        int n = m_socket->send(buffers, count, flags);
+        if(n < 0 && errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+            //锁定的页超过了optmem限制，剩下的数据普通发送
+            flags &= ~MSG_ZEROCOPY;
+            continue;
+        }
+        if(n <= 0) {
+            return -1;
+        }
+        if(flags & MSG_ZEROCOPY) {
+            ++m_zcNext;
+        }
+        sent += n;
+        //跳过已经发送完的iovec，调整部分发送的那一个
+        while(count > 0 && (size_t)n >= buffers->iov_len) {
+            n -= buffers->iov_len;
+            ++buffers;
+            --count;
+        }
+        if(count > 0) {
+            buffers->iov_base = (char*)buffers->iov_base + n;
+            buffers->iov_len -= n;
+        }
+    }
+    if(m_zcDone != m_zcNext && !waitZeroCopy()) {
+        return -1;
+    }
+    return sent;
+}
+
+bool SocketStream::pushPending() {
+    if(!isConnected()) {
+        return false;
+    }
+    //清除TCP_CORK时内核会推送等待合并的数据，没有设置过TCP_CORK时不改变其他行为
+    int off = 0;
+    return m_socket->setSockOpt(IPPROTO_TCP, TCP_CORK, off);
+}
+
+bool SocketStream::enableZeroCopy() {
+    if(m_zerocopy == 0) {
+        int on = 1;
+        m_zerocopy = m_socket->setSockOpt(SOL_SOCKET, SO_ZEROCOPY, on) ? 1 : -1;
+    }
+    return m_zerocopy > 0;
+}
+
+bool SocketStream::waitZeroCopy() {
+    int fd = m_socket->getSocket();
+    //m_zcDone在m_zcNext之前（考虑回绕）时还有未完成的发送
+    while((int32_t)(m_zcNext - m_zcDone) > 0) {
+        char control[128];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        //hook的fd在内核中是非阻塞的，错误队列为空时立即返回EAGAIN
+        int ret = recvmsg_f(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if(ret >= 0) {
+            for(cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+                if(!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                        || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                    continue;
+                }
+                sock_extended_err* err = (sock_extended_err*)CMSG_DATA(cm);
+                if(err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                    continue;
+                }
+                //一条通知确认序号[ee_info, ee_data]的发送都已完成
+                if((int32_t)(err->ee_data + 1 - m_zcDone) > 0) {
+                    m_zcDone = err->ee_data + 1;
+                }
+                if(err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    m_zcCopied += err->ee_data - err->ee_info + 1;
+                }
+            }
+            continue;
+        }
+        if(errno == EINTR) {
+            continue;
+        }
+        if(errno != EAGAIN || !isConnected()) {
+            return false;
+        }
+        IOManager* iom = IOManager::GetThis();
+        if(!iom || !is_hook_enable()) {
+            pollfd pfd = {fd, 0, 0};
+            poll(&pfd, 1, 10);
+            continue;
+        }
+        //完成通知只让socket进入错误状态。直接等socket的读事件时，已经到达的下一个请求会让它立即触发而空转，
+        //也会消耗掉读事件；改为等私有epoll可读，它只在错误队列非空时可读
+        if(m_zcEpfd < 0 && !initZeroCopyWait()) {
+            return false;
+        }
+        if(iom->addEvent(m_zcEpfd, IOManager::READ)) {
+            return false;
+        }
+        Fiber::YieldToHold();
+    }
+    return true;
+}
+
+bool SocketStream::initZeroCopyWait() {
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(epfd < 0) {
+        return false;
+    }
+    //事件集为空，EPOLLERR总会上报
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, m_socket->getSocket(), &event)) {
+        ::close(epfd);
+        return false;
+    }
+    //和hook的socket()一样登记新的fd，关闭时由hook的close取消事件
+    FdMgr::GetInstance()->create(epfd);
+    m_zcEpfd = epfd;
+    return true;
+}
+
 void SocketStream::close() {
     if(m_socket) {
         m_socket->close();
@@ -15,15 +15,45 @@ public:
 
     virtual int read(void* buffer, size_t length) override;
     virtual int read(ByteArray::ptr ba, size_t length) override;
+    virtual int readv(struct iovec* buffers, size_t count) override;
     virtual int write(const void* buffer, size_t length) override;
     virtual int write(ByteArray::ptr ba, size_t length) override;
     virtual void close() override;
 
+    //把文件fd中从offset开始的length字节直接发送到socket，数据不经过用户空间。优先用sendfile，
+    //fd不支持sendfile时改用spliceFrom，fd是管道等不可定位的fd时忽略offset。socket不可写时挂起协程。
+    //返回发送的字节数，文件提前结束时小于length，出错返回-1
+    int64_t sendFile(int fd, uint64_t offset, uint64_t length);
+    //经过一个管道用splice把fd中的数据搬到socket，fd是文件或管道。offset为-1时从fd的当前位置读。返回值同sendFile
+    int64_t spliceFrom(int fd, int64_t offset, uint64_t length);
+    //集中写：发送buffers中的全部数据，不需要先拼接到一块内存，部分发送时调整buffers（会被修改）后继续。
+    //zerocopy为true时带MSG_ZEROCOPY发送，返回前挂起协程等待内核的完成通知，返回后buffers中的数据才可以修改或释放；
+    //socket不支持时退回普通发送。返回发送的字节数，出错返回-1
+    int64_t writevFixedSize(iovec* buffers, size_t count, bool zerocopy = false, int flags = 0);
+    //立即发出带MSG_MORE发送、还暂存在内核中的数据，后续数据没有发出时调用，否则要等内核约200ms的超时。非TCP socket返回false
+    bool pushPending();
+
+    //零拷贝统计：带MSG_ZEROCOPY的发送次数，以及其中被内核退化为拷贝的次数（比如回环地址）
+    uint64_t getZeroCopySends() const { return m_zcNext; }
+    uint64_t getZeroCopyCopied() const { return m_zcCopied; }
+
     Socket::ptr getSocket() const { return m_socket; }
     bool isConnected() const;
+private:
+    //第一次使用时在socket上开启SO_ZEROCOPY，不支持返回false
+    bool enableZeroCopy();
+    //读取错误队列中的完成通知，直到所有带MSG_ZEROCOPY的发送都已完成
+    bool waitZeroCopy();
+    //创建等待完成通知用的私有epoll，socket以空的事件集注册在上面
+    bool initZeroCopyWait();
 protected:
     Socket::ptr m_socket;
     bool m_owner;           //SocketStream是否有对m_socket的主导权
+    int m_zerocopy = 0;     //SO_ZEROCOPY的状态：0未设置，1已开启，-1不支持
+    uint32_t m_zcNext = 0;  //下一次零拷贝发送的序号，内核从0开始为每次发送编号
+    uint32_t m_zcDone = 0;  //已经完成的序号上界（不含）
+    uint64_t m_zcCopied = 0;
+    int m_zcEpfd = -1;      //私有epoll，只在socket的错误队列非空时可读
 };
 
 }
@@ -28,6 +28,15 @@ int Stream::readFixedSize(ByteArray::ptr ba, size_t length) {
     return length;
 }
 
+int Stream::readv(struct iovec* buffers, size_t count) {
+    for(size_t i = 0; i < count; ++i) {
+        if(buffers[i].iov_len > 0) {
+            return read(buffers[i].iov_base, buffers[i].iov_len);
+        }
+    }
+    return 0;
+}
+
 int Stream::writeFixedSize(const void* buffer, size_t length) {
     uint64_t left = length;
     size_t offset = 0;
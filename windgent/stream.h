@@ -16,6 +16,8 @@ public:
     virtual int read(ByteArray::ptr ba, size_t length) = 0;
     virtual int readFixedSize(void* buffer, size_t length);
     virtual int readFixedSize(ByteArray::ptr ba, size_t length);
+    //分散读：一次读取依次填充多块内存。默认实现只读进第一块非空的内存
+    virtual int readv(struct iovec* buffers, size_t count);
     //往流中写数据
     virtual int write(const void* buffer, size_t length) = 0;
     virtual int write(ByteArray::ptr ba, size_t length) = 0;
@@ -12,6 +12,11 @@ TcpServer::TcpServer(IOManager* worker, IOManager* accept_worker)
     ,m_name("windgent/1.0.0"), m_isStop(true) {
 }
 
+TcpServer::TcpServer(const std::vector<IOManager*>& workers)
+    :m_worker(workers.empty() ? IOManager::GetThis() : workers[0]), m_acceptWorker(m_worker), m_workers(workers)
+    ,m_recvTimeout(g_tcp_server_read_timeout->getVal()), m_name("windgent/1.0.0"), m_isStop(true) {
+}
+
 TcpServer::~TcpServer() {
     for(auto& sock : m_socks) {
         sock->close();
@@ -26,21 +31,29 @@ bool TcpServer::bind(Address::ptr addr) {
 }
 
 bool TcpServer::bind(const std::vector<Address::ptr> addrs, std::vector<Address::ptr> fails) {
-    for(auto& addr : addrs) {
-        Socket::ptr sock = Socket::createTCP(addr);
-        if(!sock->bind(addr)) {
-            LOG_ERROR(g_logger) << "bind errno = " << errno << ", errstr = " << strerror(errno)
-                                << ", addr = [" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue; 
-        }
-        if(!sock->listen()) {
-            LOG_ERROR(g_logger) << "listen errno = " << errno << ", errstr = " << strerror(errno)
-                                << ", addr = [" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue; 
+    //shared-nothing模式下每个地址绑定m_workers.size()次，第i个socket由m_workers[i % size]负责accept
+    size_t count = isReusePort() ? m_workers.size() : 1;
+    for(auto addr : addrs) {
+        for(size_t i = 0; i < count; ++i) {
+            Socket::ptr sock = Socket::createTCP(addr);
+            if(!sock->bind(addr, isReusePort())) {
+                LOG_ERROR(g_logger) << "bind errno = " << errno << ", errstr = " << strerror(errno)
+                                    << ", addr = [" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if(!sock->listen()) {
+                LOG_ERROR(g_logger) << "listen errno = " << errno << ", errstr = " << strerror(errno)
+                                    << ", addr = [" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            m_socks.push_back(sock);
+            //端口为0时，其余的socket绑定第一个socket分配到的端口
+            if(i == 0 && count > 1) {
+                addr = sock->getLocalAddress();
+            }
         }
-        m_socks.push_back(sock);
     }
 
     if(!fails.empty()) {
@@ -59,8 +72,8 @@ bool TcpServer::start() {
         return true;
     }
     m_isStop = false;
-    for(auto& sock : m_socks) {
-        m_acceptWorker->schedule(std::bind(&TcpServer::handleAccept, shared_from_this(), sock));
+    for(size_t i = 0; i < m_socks.size(); ++i) {
+        getAcceptWorker(i)->schedule(std::bind(&TcpServer::handleAccept, shared_from_this(), m_socks[i]));
     }
     return true;
 }
@@ -68,6 +81,18 @@ bool TcpServer::start() {
 void TcpServer::stop() {
     m_isStop = true;
     auto self = shared_from_this();
+    if(isReusePort()) {
+        //监听socket只能在accept它的IOManager上取消
+        for(size_t i = 0; i < m_socks.size(); ++i) {
+            Socket::ptr sock = m_socks[i];
+            getAcceptWorker(i)->schedule([sock, self]() {
+                sock->cancelAll();
+                sock->close();
+            });
+        }
+        m_socks.clear();
+        return;
+    }
     m_acceptWorker->schedule([this, self](){
         for(auto& sock : m_socks) {
             sock->cancelAll();
@@ -86,11 +111,22 @@ void TcpServer::handleAccept(Socket::ptr sock) {
         Socket::ptr client = sock->accept();
         if(client) {
             client->setRecvTimeout(m_recvTimeout);
-            m_worker->schedule(std::bind(&TcpServer::handleClient, shared_from_this(), client));
-        } else {
+            if(isReusePort()) {
+                //连接留在accept它的线程上
+                IOManager::GetThis()->schedule(std::bind(&TcpServer::handleClient, shared_from_this(), client)
+                                               , GetThreadId(), getStackSize());
+            } else {
+                m_worker->schedule(std::bind(&TcpServer::handleClient, shared_from_this(), client), -1, getStackSize());
+            }
+        } else if(!m_isStop) {
+            //stop()关闭监听socket后accept失败是正常的
             LOG_ERROR(g_logger) << "handleAccept errno = " << errno << ", errstr = " << strerror(errno);
         }
     }
 }
 
-}
\ No newline at end of file
+IOManager* TcpServer::getAcceptWorker(size_t idx) {
+    return isReusePort() ? m_workers[idx % m_workers.size()] : m_acceptWorker;
+}
+
+}
@@ -16,6 +16,9 @@ public:
     typedef std::shared_ptr<TcpServer> ptr;
 
     TcpServer(IOManager* worker = IOManager::GetThis(), IOManager* accept_worker = IOManager::GetThis());
+    //shared-nothing模式：bind时为workers中的每个IOManager各创建一个SO_REUSEPORT的监听socket，由内核把新连接分给它们，
+    //连接在accept它的线程上处理直到关闭。每个IOManager应当只有一个线程，这样连接的协程不会被其他线程窃取
+    TcpServer(const std::vector<IOManager*>& workers);
     virtual ~TcpServer();
 
     //为m_socks绑定地址
@@ -25,22 +28,31 @@ public:
     virtual void stop();
 
     bool isStop() const { return m_isStop; }
+    bool isReusePort() const { return !m_workers.empty(); }
     uint64_t getReadTimeout() const { return m_recvTimeout; }
     std::string getName() const { return m_name; }
     void setReadTimeout(uint64_t v) { m_recvTimeout = v; }
     void setName(const std::string& v) { m_name = v; }
+    //处理连接的协程的栈大小，0表示使用fiber.stacksize
+    virtual size_t getStackSize() { return m_stacksize; }
+    void setStackSize(size_t v) { m_stacksize = v; }
 protected:
     //处理连接成功的client上的事件
     virtual void handleClient(Socket::ptr client);
     //只用于接受监听的socket上的客户端连接
     virtual void handleAccept(Socket::ptr sock);
+private:
+    //第idx个监听socket在哪个IOManager上accept
+    IOManager* getAcceptWorker(size_t idx);
 private:
     std::vector<Socket::ptr> m_socks;   //监听的socket组
     IOManager* m_worker;                //线程池，处理accept后的sock
     IOManager* m_acceptWorker;          //只用来accept m_socks上的连接
+    std::vector<IOManager*> m_workers;  //shared-nothing模式：每个IOManager一个监听socket，同时处理自己accept的连接
     uint64_t m_recvTimeout;             //接收超时时间
     std::string m_name;                 //服务器名称
     bool m_isStop;                      //停止运行标志
+    size_t m_stacksize = 0;             //连接协程的栈大小
 };
 
 }
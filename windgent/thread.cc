@@ -2,11 +2,21 @@
 #include "log.h"
 #include "util.h"
 
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
 namespace windgent {
 
 //线程局部变量，每个线程都有自己的一份拷贝
 static thread_local Thread* t_thread = nullptr;
 static thread_local std::string t_thread_name = "UNKNOWN";
+static thread_local int t_numa_node = -1;
 
 static windgent::Logger::ptr g_logger = LOG_NAME("system");
 
@@ -25,12 +35,45 @@ void Thread::SetName(const std::string& name) {
     t_thread_name = name;
 }
 
+int Thread::GetNumaNode() {
+    return t_numa_node;
+}
+
+//把当前线程绑定到cpus上，cpus都在同一个节点时返回节点号，否则返回-1
+static int SetAffinity(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    int node = -2;
+    for(auto cpu : cpus) {
+        CPU_SET(cpu, &set);
+        int n = Thread::GetCpuNode(cpu);
+        node = (node == -2 || node == n) ? n : -1;
+    }
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(ret) {
+        LOG_ERROR(g_logger) << "pthread_setaffinity_np(" << Thread::FormatCpuList(cpus) << ") failed, ret=" << ret;
+        return -1;
+    }
+    if(node < 0) {
+        return -1;
+    }
+    //之后这个线程第一次写到的页（协程栈、FdContext等）优先从本节点分配
+    unsigned long mask = 1ul << node;
+    if(node >= (int)sizeof(mask) * 8 || syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1)) {
+        LOG_WARN(g_logger) << "set_mempolicy(MPOL_PREFERRED, " << node << ") failed, errno=" << errno;
+    }
+    return node;
+}
+
 void* Thread::run(void* arg) {
     Thread* thd = (Thread*)arg;
     t_thread = thd;
     t_thread_name = thd->m_name;
     thd->m_id = windgent::GetThreadId();
     pthread_setname_np(pthread_self(), thd->m_name.substr(0,15).c_str());
+    if(!thd->m_cpus.empty()) {
+        thd->m_numaNode = t_numa_node = SetAffinity(thd->m_cpus);
+    }
 
     std::function<void()> cb;
     cb.swap(thd->m_cb);
@@ -42,8 +85,8 @@ void* Thread::run(void* arg) {
     return 0;
 }
 
-Thread::Thread(std::function<void()> cb, std::string name)
-    :m_cb(cb), m_name(name) {
+Thread::Thread(std::function<void()> cb, std::string name, const std::vector<int>& cpus)
+    :m_cb(cb), m_name(name), m_cpus(cpus) {
     if(name.empty()) {
         m_name = "UNKNOWN";
     }
@@ -74,4 +117,127 @@ void Thread::join() {
     m_threadId = 0;
 }
 
-}
\ No newline at end of file
+const std::vector<int>& Thread::GetOnlineCpus() {
+    static std::vector<int> s_cpus = [](){
+        std::ifstream ifs("/sys/devices/system/cpu/online");
+        std::string str;
+        std::vector<int> cpus;
+        if(std::getline(ifs, str)) {
+            cpus = ParseCpuList(str);
+        }
+        if(cpus.empty()) {
+            long n = sysconf(_SC_NPROCESSORS_ONLN);
+            for(long i = 0; i < n; ++i) {
+                cpus.push_back(i);
+            }
+        }
+        return cpus;
+    }();
+    return s_cpus;
+}
+
+const std::vector<std::vector<int> >& Thread::GetNumaNodes() {
+    static std::vector<std::vector<int> > s_nodes = [](){
+        std::vector<std::vector<int> > nodes;
+        const char* path = "/sys/devices/system/node";
+        DIR* dir = opendir(path);
+        if(dir) {
+            struct dirent* ent = nullptr;
+            while((ent = readdir(dir)) != nullptr) {
+                int id = 0;
+                if(sscanf(ent->d_name, "node%d", &id) != 1) {
+                    continue;
+                }
+                std::ifstream ifs(std::string(path) + "/" + ent->d_name + "/cpulist");
+                std::string str;
+                if(!std::getline(ifs, str)) {
+                    continue;
+                }
+                if((int)nodes.size() <= id) {
+                    nodes.resize(id + 1);
+                }
+                nodes[id] = ParseCpuList(str);
+            }
+            closedir(dir);
+        }
+        if(nodes.empty()) {
+            nodes.push_back(GetOnlineCpus());
+        }
+        return nodes;
+    }();
+    return s_nodes;
+}
+
+int Thread::GetCpuNode(int cpu) {
+    const std::vector<std::vector<int> >& nodes = GetNumaNodes();
+    for(size_t i = 0; i < nodes.size(); ++i) {
+        if(std::find(nodes[i].begin(), nodes[i].end(), cpu) != nodes[i].end()) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+std::vector<int> Thread::ParseCpuList(const std::string& str) {
+    std::vector<int> cpus;
+    std::stringstream ss(str);
+    std::string item;
+    while(std::getline(ss, item, ',')) {
+        item.erase(std::remove_if(item.begin(), item.end(), ::isspace), item.end());
+        if(item.empty()) {
+            continue;
+        }
+        int first = 0, last = 0;
+        char dash = 0;
+        std::stringstream is(item);
+        if(!(is >> first) || first < 0) {
+            return std::vector<int>();
+        }
+        last = first;
+        if(is >> dash) {
+            if(dash != '-' || !(is >> last) || last < first) {
+                return std::vector<int>();
+            }
+        }
+        if(!is.eof() && is.peek() != EOF) {
+            return std::vector<int>();
+        }
+        for(int i = first; i <= last; ++i) {
+            cpus.push_back(i);
+        }
+    }
+    return cpus;
+}
+
+std::string Thread::FormatCpuList(const std::vector<int>& cpus) {
+    std::stringstream ss;
+    for(size_t i = 0; i < cpus.size(); ++i) {
+        size_t j = i;
+        while(j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+            ++j;
+        }
+        if(i) {
+            ss << ",";
+        }
+        ss << cpus[i];
+        if(j > i) {
+            ss << "-" << cpus[j];
+        }
+        i = j;
+    }
+    return ss.str();
+}
+
+bool Thread::BindMemory(void* addr, size_t len, int node) {
+    if(node < 0) {
+        return true;
+    }
+    unsigned long mask = 1ul << node;
+    if(node >= (int)sizeof(mask) * 8 || syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1, 0)) {
+        LOG_DEBUG(g_logger) << "mbind(" << addr << ", " << len << ", " << node << ") failed, errno=" << errno;
+        return false;
+    }
+    return true;
+}
+
+}
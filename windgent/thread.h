@@ -4,6 +4,8 @@
 #include <thread>
 #include <functional>
 #include <memory>
+#include <vector>
+#include <string>
 #include "mutex.h"
 
 namespace windgent {
@@ -12,17 +14,36 @@ namespace windgent {
 class Thread : NonCopyable {
 public:
     typedef std::shared_ptr<Thread> ptr;
-    Thread(std::function<void()> cb, std::string name);
+    //cpus不为空时，线程在执行cb之前绑定到这些cpu上；它们都属于同一个NUMA节点时，线程的内存分配优先使用该节点
+    Thread(std::function<void()> cb, std::string name, const std::vector<int>& cpus = std::vector<int>());
     ~Thread();
 
     pid_t getId() const { return m_id; }
     const std::string& getName() const { return m_name; }
+    const std::vector<int>& getCpus() const { return m_cpus; }
+    int getNumaNode() const { return m_numaNode; }
 
     void join();
 
     static Thread* GetThis();
     static const std::string& GetName();
     static void SetName(const std::string& name);
+    //当前线程绑定的NUMA节点，没有绑定时返回-1
+    static int GetNumaNode();
+
+    //在线的cpu
+    static const std::vector<int>& GetOnlineCpus();
+    //每个NUMA节点的cpu，下标是节点号，没有NUMA信息时只有一个节点，包含所有在线的cpu。
+    //节点号不连续时中间的节点、只有内存的节点，cpu列表为空
+    static const std::vector<std::vector<int> >& GetNumaNodes();
+    //cpu所在的NUMA节点，未知时返回-1
+    static int GetCpuNode(int cpu);
+    //解析"0-3,8,10-11"格式的cpu列表，格式错误时返回空
+    static std::vector<int> ParseCpuList(const std::string& str);
+    //把cpu列表格式化为"0-3,8"的形式
+    static std::string FormatCpuList(const std::vector<int>& cpus);
+    //让[addr, addr + len)的内存优先从node节点分配，node为-1时什么也不做
+    static bool BindMemory(void* addr, size_t len, int node);
 private:
     Thread(const Thread&) = delete;
     Thread(const Thread&&) = delete;
@@ -34,6 +55,8 @@ private:
     pthread_t m_threadId = 0;   //pthreda库的线程id
     std::function<void()> m_cb;
     std::string m_name;
+    std::vector<int> m_cpus;    //绑定的cpu，为空表示不绑定
+    int m_numaNode = -1;        //cpus所在的NUMA节点，跨节点或不绑定时为-1
 
     Semaphore m_sem;
     // Cond m_cond;
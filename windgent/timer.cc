@@ -1,41 +1,317 @@
 #include "./timer.h"
 #include "./util.h"
+#include "./config.h"
+#include "./log.h"
+
+#include <set>
+#include <string.h>
+#include <algorithm>
 
 namespace windgent {
 
+static windgent::Logger::ptr g_logger = LOG_NAME("system");
+
+static windgent::ConfigVar<std::string>::ptr g_timer_backend = windgent::ConfigMgr::Lookup<std::string>("timer.backend", "wheel", "timer container: wheel or set");
+
 bool Timer::Comparator::operator()(const Timer::ptr& lhs, const Timer::ptr& rhs){
     if(!lhs && !rhs) return false;
     if(!lhs) return true;
     if(!rhs) return false;
-    if(lhs->m_next < rhs->m_next) return true;
-    if(lhs->m_next > rhs->m_next) return false;
+    if(lhs->m_queuedNext < rhs->m_queuedNext) return true;
+    if(lhs->m_queuedNext > rhs->m_queuedNext) return false;
     return lhs.get() < rhs.get();
 }
 
+//定时器容器的接口，按定时器的m_queuedNext排序，只由独占分片的线程访问
+class TimerQueue {
+public:
+    virtual ~TimerQueue() { }
+    virtual void insert(const Timer::ptr& timer) = 0;
+    //删除定时器，不在容器中返回false
+    virtual bool erase(const Timer::ptr& timer) = 0;
+    virtual bool empty() const = 0;
+    //最早的执行时刻，可以返回一个下界，到时再取一次即可；没有定时器时返回~0ull
+    virtual uint64_t nextTime() = 0;
+    //取出所有执行时刻<=now_ms的定时器，rollover时取出全部
+    virtual void popExpired(uint64_t now_ms, bool rollover, std::vector<Timer::ptr>& expired) = 0;
+};
+
+//按执行时刻排序的std::set，插入删除O(log n)
+class TimerSet : public TimerQueue {
+public:
+    virtual void insert(const Timer::ptr& timer) override {
+        m_timers.insert(timer);
+    }
+    virtual bool erase(const Timer::ptr& timer) override {
+        return m_timers.erase(timer) > 0;
+    }
+    virtual bool empty() const override {
+        return m_timers.empty();
+    }
+    virtual uint64_t nextTime() override {
+        return m_timers.empty() ? ~0ull : (*m_timers.begin())->m_queuedNext;
+    }
+    virtual void popExpired(uint64_t now_ms, bool rollover, std::vector<Timer::ptr>& expired) override {
+        auto it = m_timers.begin();
+        //找到执行时刻<=now_ms的所有定时器
+        while(it != m_timers.end() && (rollover || (*it)->m_queuedNext <= now_ms)) {
+            ++it;
+        }
+        expired.insert(expired.end(), m_timers.begin(), it);
+        m_timers.erase(m_timers.begin(), it);
+    }
+private:
+    std::set<Timer::ptr, Timer::Comparator> m_timers;
+};
+
+//分层时间轮，精度1ms。第0层256个槽，每槽1ms；之后4层各64个槽，每层一个槽覆盖下一层一整圈，共可表示2^32ms(约49天)，
+//更远的定时器先放在最高层的最后一个槽里。每当低一层转完一圈，就把高一层当前槽里的定时器重新分配到低层（级联）。
+//每个槽是一条侵入式双向链表，插入和删除都是O(1)；推进时按槽整条取出到期的定时器
+class TimerWheel : public TimerQueue {
+public:
+    TimerWheel(uint64_t now_ms) :m_current(now_ms) {
+        memset(m_slots0, 0, sizeof(m_slots0));
+        memset(m_slots, 0, sizeof(m_slots));
+    }
+    ~TimerWheel() {
+        std::vector<Timer::ptr> all;
+        popExpired(m_current, true, all);
+    }
+
+    virtual void insert(const Timer::ptr& timer) override {
+        //执行时刻早于m_current：定时器已经到期，或者时钟被往回调了
+        if(timer->m_queuedNext < m_current) {
+            uint64_t now_ms = GetCurrentMS();
+            if(now_ms < m_current) {
+                rebase(now_ms);
+            }
+        }
+        timer->m_wheelRef = timer;
+        place(timer.get());
+        ++m_count;
+    }
+    virtual bool erase(const Timer::ptr& timer) override {
+        if(!timer->m_wheelPprev) {
+            return false;
+        }
+        unlink(timer.get());
+        --m_count;
+        timer->m_wheelRef.reset();
+        return true;
+    }
+    virtual bool empty() const override {
+        return m_count == 0;
+    }
+    //第0层的槽对应精确的执行时刻；高层的槽只能给出槽的起始时刻，作为下界
+    virtual uint64_t nextTime() override {
+        if(m_count == 0) {
+            return ~0ull;
+        }
+        if(m_pending) {
+            return m_current;
+        }
+        return nextSlotTime();
+    }
+    virtual void popExpired(uint64_t now_ms, bool rollover, std::vector<Timer::ptr>& expired) override {
+        if(rollover) {
+            take(&m_pending, expired);
+            for(size_t i = 0; i < SLOTS0; ++i) {
+                take(&m_slots0[i], expired);
+            }
+            for(size_t l = 0; l < LEVELS; ++l) {
+                for(size_t i = 0; i < SLOTS; ++i) {
+                    take(&m_slots[l][i], expired);
+                }
+            }
+            m_current = now_ms;
+            return;
+        }
+        if(now_ms < m_current) {
+            rebase(now_ms);
+        }
+        while(m_current < now_ms && m_count > 0) {
+            //下一毫秒的槽为空时，直接跳到下一个有定时器的槽或者需要级联的时刻，中间的空档不逐毫秒推进
+            if(!m_slots0[(m_current + 1) & (SLOTS0 - 1)]) {
+                uint64_t next = nextSlotTime();
+                if(next > now_ms) {
+                    break;
+                }
+                m_current = next - 1;
+            }
+            ++m_current;
+            size_t idx = m_current & (SLOTS0 - 1);
+            //第0层转完一圈，依次级联高层当前槽
+            if(idx == 0) {
+                for(size_t l = 0; l < LEVELS; ++l) {
+                    size_t i = (m_current >> Shift(l)) & (SLOTS - 1);
+                    cascade(&m_slots[l][i]);
+                    if(i != 0) {
+                        break;
+                    }
+                }
+            }
+            take(&m_slots0[idx], expired);
+        }
+        if(m_current < now_ms) {
+            m_current = now_ms;
+        }
+        take(&m_pending, expired);
+    }
+private:
+    static const size_t SLOTS0 = 256;
+    static const size_t SLOTS = 64;
+    static const size_t LEVELS = 4;
+    static const uint64_t MAX_DELTA = 1ull << 32;
+
+    //第l层（不含第0层）一个槽对应的时间位移
+    static size_t Shift(size_t l) { return 8 + 6 * l; }
+
+    //各层槽中最早的时刻：第0层是精确的执行时刻，高层是槽的起始时刻，也就是它需要级联的时刻。没有时返回~0ull
+    uint64_t nextSlotTime() const {
+        uint64_t next = ~0ull;
+        for(size_t i = 1; i <= SLOTS0; ++i) {
+            if(m_slots0[(m_current + i) & (SLOTS0 - 1)]) {
+                next = m_current + i;
+                break;
+            }
+        }
+        for(size_t l = 0; l < LEVELS; ++l) {
+            uint64_t base = m_current >> Shift(l);
+            //这一层及更高层最早的槽也不会比next早
+            if(((base + 1) << Shift(l)) >= next) {
+                break;
+            }
+            for(size_t i = 1; i <= SLOTS; ++i) {
+                if(m_slots[l][(base + i) & (SLOTS - 1)]) {
+                    next = std::min(next, (base + i) << Shift(l));
+                    break;
+                }
+            }
+        }
+        return next;
+    }
+
+    static void link(Timer** head, Timer* t) {
+        t->m_wheelNext = *head;
+        if(*head) {
+            (*head)->m_wheelPprev = &t->m_wheelNext;
+        }
+        *head = t;
+        t->m_wheelPprev = head;
+    }
+    static void unlink(Timer* t) {
+        *t->m_wheelPprev = t->m_wheelNext;
+        if(t->m_wheelNext) {
+            t->m_wheelNext->m_wheelPprev = t->m_wheelPprev;
+        }
+        t->m_wheelNext = nullptr;
+        t->m_wheelPprev = nullptr;
+    }
+
+    //根据执行时刻与当前时刻的距离选择层和槽
+    void place(Timer* t) {
+        uint64_t expires = t->m_queuedNext;
+        if(expires <= m_current) {
+            link(&m_pending, t);
+            return;
+        }
+        uint64_t delta = expires - m_current;
+        if(delta < SLOTS0) {
+            link(&m_slots0[expires & (SLOTS0 - 1)], t);
+            return;
+        }
+        if(delta >= MAX_DELTA) {
+            delta = MAX_DELTA - 1;
+            expires = m_current + delta;
+        }
+        for(size_t l = 0; l < LEVELS; ++l) {
+            if(delta < (1ull << Shift(l + 1)) || l == LEVELS - 1) {
+                link(&m_slots[l][(expires >> Shift(l)) & (SLOTS - 1)], t);
+                return;
+            }
+        }
+    }
+    //把槽内的定时器按当前时刻重新分配
+    void cascade(Timer** head) {
+        Timer* t = *head;
+        *head = nullptr;
+        while(t) {
+            Timer* next = t->m_wheelNext;
+            place(t);
+            t = next;
+        }
+    }
+    //时钟往回调了不到rollover的阈值时，m_current停在now_ms之后，新的定时器都会当作已到期放进m_pending，
+    //要等时钟追上m_current才取出。把时间轮退回now_ms，所有定时器按新的当前时刻重新分配
+    void rebase(uint64_t now_ms) {
+        Timer* all = nullptr;
+        gather(&m_pending, &all);
+        for(size_t i = 0; i < SLOTS0; ++i) {
+            gather(&m_slots0[i], &all);
+        }
+        for(size_t l = 0; l < LEVELS; ++l) {
+            for(size_t i = 0; i < SLOTS; ++i) {
+                gather(&m_slots[l][i], &all);
+            }
+        }
+        m_current = now_ms;
+        cascade(&all);
+    }
+    //把槽内的定时器移到list上
+    static void gather(Timer** head, Timer** list) {
+        Timer* t = *head;
+        *head = nullptr;
+        while(t) {
+            Timer* next = t->m_wheelNext;
+            link(list, t);
+            t = next;
+        }
+    }
+    //取出整个槽，交出时间轮对定时器的引用
+    void take(Timer** head, std::vector<Timer::ptr>& expired) {
+        Timer* t = *head;
+        *head = nullptr;
+        while(t) {
+            Timer* next = t->m_wheelNext;
+            t->m_wheelNext = nullptr;
+            t->m_wheelPprev = nullptr;
+            expired.push_back(std::move(t->m_wheelRef));
+            --m_count;
+            t = next;
+        }
+    }
+private:
+    uint64_t m_current;                     //已经推进到的时刻，执行时刻<=它的定时器都已取出
+    size_t m_count = 0;                     //定时器总数
+    Timer* m_pending = nullptr;             //插入时就已经到期的定时器
+    Timer* m_slots0[SLOTS0];
+    Timer* m_slots[LEVELS][SLOTS];
+};
+
+
 bool Timer::cancel() {
-    TimerManager::RWMutexType::WrLock lock(m_manager->m_mutex);
-    if(m_cb) {
+    {
+        SpinLock::Lock lock(m_mutex);
+        if(!m_cb) {
+            return false;
+        }
         m_cb = nullptr;
-        auto it = m_manager->m_timers.find(shared_from_this());
-        m_manager->m_timers.erase(it);
-        return true;
     }
-    return false;
+    --m_manager->m_timerCount;
+    m_manager->commit(shared_from_this());
+    return true;
 }
 
 bool Timer::refresh() {
-    TimerManager::RWMutexType::WrLock lock(m_manager->m_mutex);
-    if(!m_cb) {
-        return false;
-    }
-
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it == m_manager->m_timers.end()) {
-        return false;
+    {
+        SpinLock::Lock lock(m_mutex);
+        if(!m_cb) {
+            return false;
+        }
+        m_next = windgent::GetCurrentMS() + m_ms;       //刷新执行时间
     }
-    m_manager->m_timers.erase(it);
-    m_next = windgent::GetCurrentMS() + m_ms;       //刷新执行时间
-    m_manager->m_timers.insert(shared_from_this());
+    //执行时刻只会推后，即使所属线程还没处理邮箱，到期时也会发现时间未到而重新放回容器
+    m_manager->commit(shared_from_this());
     return true;
 }
 
@@ -43,26 +319,52 @@ bool Timer::reset(uint64_t ms, bool from_now) {
     if(ms == m_ms && !from_now) {
         return true;
     }
-    TimerManager::RWMutexType::WrLock lock(m_manager->m_mutex);
-    if(!m_cb) {
-        return false;
+    uint64_t old_next = 0;
+    uint64_t new_next = 0;
+    {
+        SpinLock::Lock lock(m_mutex);
+        if(!m_cb) {
+            return false;
+        }
+        uint64_t start = 0;
+        if(from_now) {
+            start = windgent::GetCurrentMS();
+        } else {
+            start = m_next - m_ms;
+        }
+        //重置时间间隔和执行时刻
+        old_next = m_next;
+        m_ms = ms;
+        m_next = start + m_ms;
+        new_next = m_next;
     }
+    //执行时刻提前了而定时器又在其他线程上，需要唤醒所属线程来调整
+    if(!m_manager->commit(shared_from_this()) && new_next < old_next) {
+        m_manager->onTimerMailed(m_shard);
+    }
+    return true;
+}
 
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it == m_manager->m_timers.end()) {
-        return false;
+bool Timer::rearm(uint64_t ms, std::function<void()> cb) {
+    {
+        SpinLock::Lock lock(m_mutex);
+        if(m_cb) {
+            return false;
+        }
+        //不在任何容器和邮箱中时，把定时器迁移到当前线程的分片，之后的取消也能直接在本线程完成
+        if(!m_queued && !m_inMail) {
+            m_shard = m_manager->getShardIndex(m_manager->getTimerShard());
+        }
+        m_isRecur = false;
+        m_ms = ms;
+        m_next = windgent::GetCurrentMS() + m_ms;
+        m_cb.swap(cb);
     }
-    m_manager->m_timers.erase(it);
-    uint64_t start = 0;
-    if(from_now) {
-        start = windgent::GetCurrentMS();
-    } else {
-        start = m_next - m_ms;
+    ++m_manager->m_timerCount;
+    //还留在其他线程的分片上，所属线程可能正按更晚的时刻睡眠
+    if(!m_manager->commit(shared_from_this())) {
+        m_manager->onTimerMailed(m_shard);
     }
-    //重置时间间隔和执行时刻
-    m_ms = ms;
-    m_next = start + m_ms;
-    m_manager->addTimer(shared_from_this(), lock);
     return true;
 }
 
@@ -71,33 +373,107 @@ Timer::Timer(uint64_t ms, std::function<void()> cb, bool isRecur, TimerManager*
     m_next = windgent::GetCurrentMS() + m_ms;
 }
 
-Timer::Timer(uint64_t next):m_next(next) { }
+TimerManager::Shard::Shard(TimerQueue* q, uint64_t now_ms)
+    :timers(q), next(~0ull), previousTime(now_ms) {
+}
+
+TimerManager::Shard::~Shard() {
+    delete timers;
+}
+
+TimerManager::TimerManager(size_t shards) {
+    uint64_t now_ms = windgent::GetCurrentMS();
+    const std::string& backend = g_timer_backend->getVal();
+    if(backend != "set" && backend != "wheel") {
+        LOG_ERROR(g_logger) << "unknown timer.backend " << backend << ", use wheel";
+    }
+    for(size_t i = 0; i <= shards; ++i) {
+        TimerQueue* q = nullptr;
+        if(backend == "set") {
+            q = new TimerSet;
+        } else {
+            q = new TimerWheel(now_ms);
+        }
+        m_shards.push_back(new Shard(q, now_ms));
+    }
+}
 
-TimerManager::TimerManager() {
-    m_previouseTime = windgent::GetCurrentMS();
+TimerManager::~TimerManager() {
+    for(auto& i : m_shards) {
+        drainMailbox(i);
+        delete i;
+    }
 }
 
-TimerManager::~TimerManager() { }
+void TimerManager::requeue(Shard* shard, const Timer::ptr& timer) {
+    if(timer->m_queued) {
+        shard->timers->erase(timer);
+        timer->m_queued = false;
+    }
+    if(timer->m_cb) {
+        timer->m_queuedNext = timer->m_next;
+        shard->timers->insert(timer);
+        timer->m_queued = true;
+        if(timer->m_queuedNext < shard->next) {
+            shard->next = timer->m_queuedNext;
+        }
+    }
+}
 
-void TimerManager::addTimer(Timer::ptr timer, RWMutexType::WrLock& lock) {
-    // std::cout << "-------- TimerManager::addTimer() -----------" << std::endl;
-    auto it = m_timers.insert(timer).first;
-    bool at_front = (it == m_timers.begin()) && !m_tickled;
-    if(at_front) {
-        m_tickled = true;
+bool TimerManager::commit(const Timer::ptr& timer) {
+    Shard* shard = m_shards[timer->m_shard];
+    if(shard == m_shards.back()) {
+        bool at_front = false;
+        {
+            Mutex::Lock lock(shard->mutex);
+            SpinLock::Lock lock2(timer->m_mutex);
+            at_front = timer->m_cb && timer->m_next < shard->next;
+            requeue(shard, timer);
+        }
+        //共享分片可能有线程按旧的超时时间睡着
+        if(at_front) {
+            onTimerInsertedAtFront();
+        }
+        return true;
     }
-    lock.unlock();
-    //如果插在首部，主动唤醒epoll_wait来执行此定时器
-    if(at_front) {
-        // std::cout << "-------- trigger onTimerInsertedAtFront() -----------" << std::endl;
-        onTimerInsertedAtFront();
+    if(timer->m_shard == getTimerShard()) {
+        SpinLock::Lock lock(timer->m_mutex);
+        requeue(shard, timer);
+        return true;
+    }
+    //已经在邮箱里的定时器不需要重复投递，所属线程处理时会读取最新的状态
+    bool expected = false;
+    if(!timer->m_inMail.compare_exchange_strong(expected, true)) {
+        return false;
+    }
+    timer->m_mailRef = timer;
+    Timer* head = shard->mailbox.load(std::memory_order_relaxed);
+    do {
+        timer->m_mailNext = head;
+    } while(!shard->mailbox.compare_exchange_weak(head, timer.get()
+                , std::memory_order_release, std::memory_order_relaxed));
+    return false;
+}
+
+void TimerManager::drainMailbox(Shard* shard) {
+    Timer* t = shard->mailbox.exchange(nullptr, std::memory_order_acquire);
+    while(t) {
+        Timer* next = t->m_mailNext;
+        Timer::ptr timer = std::move(t->m_mailRef);
+        t->m_mailNext = nullptr;
+        t->m_inMail = false;
+        SpinLock::Lock lock(timer->m_mutex);
+        requeue(shard, timer);
+        t = next;
     }
 }
 
 Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool isRecur) {
     Timer::ptr timer(new Timer(ms, cb, isRecur, this));
-    RWMutexType::WrLock lock(m_mutex);
-    addTimer(timer, lock);
+    ++m_timerCount;
+    timer->m_shard = getShardIndex(getTimerShard());
+    //本线程的分片直接插入，所属线程正在运行，睡眠前会重新计算超时时间；共享分片插在最前面时会唤醒
+    commit(timer);
     return timer;
 }
 
@@ -114,72 +490,87 @@ Timer::ptr TimerManager::addCondTimer(uint64_t ms, std::function<void()> cb
 }
 
 uint64_t TimerManager::getTimeOfNextTimer() {
-    RWMutexType::RdLock lock(m_mutex);
-    if(m_timers.empty()) {
+    uint64_t next = m_shards.back()->next;
+    int idx = getTimerShard();
+    if(idx >= 0 && idx < (int)m_shards.size() - 1) {
+        //邮箱里有其他线程的修改，需要马上处理
+        if(m_shards[idx]->mailbox.load(std::memory_order_acquire)) {
+            return 0;
+        }
+        next = std::min(next, m_shards[idx]->next.load());
+    }
+    if(next == ~0ull) {
         return ~0ull;
     }
-    m_tickled = false;
-    const Timer::ptr& next = *m_timers.begin();
     uint64_t now_ms = windgent::GetCurrentMS();
-    if(now_ms >= next->m_next) {
+    if(now_ms >= next) {
         return 0;
     } else {
-        return next->m_next - now_ms;
+        return next - now_ms;
     }
 }
 
-bool TimerManager::detectClockRollover(uint64_t now_ms) {
+bool TimerManager::detectClockRollover(Shard* shard, uint64_t now_ms) {
     bool rollover = false;
-    if(now_ms < m_previouseTime && now_ms < (m_previouseTime - 60 * 60 * 1000)) {
+    if(now_ms < shard->previousTime && now_ms < (shard->previousTime - 60 * 60 * 1000)) {
         rollover = true;
     }
-    m_previouseTime = now_ms;
+    shard->previousTime = now_ms;
     return rollover;
 }
 
 void TimerManager::listExpiredCbs(std::vector<std::function<void()> >& cbs) {
     // std::cout << "-------- TimerManager::listExpiredCbs() -----------" << std::endl;
     uint64_t now_ms = windgent::GetCurrentMS();
-    std::vector<Timer::ptr> expired;
-    {
-        RWMutexType::RdLock locK(m_mutex);
-        if(m_timers.empty()) {
-            return;
-        }
+    int idx = getTimerShard();
+    if(idx >= 0 && idx < (int)m_shards.size() - 1) {
+        Shard* shard = m_shards[idx];
+        drainMailbox(shard);
+        listExpiredCbs(shard, now_ms, cbs);
     }
-    RWMutexType::WrLock lock(m_mutex);
-    if(m_timers.empty()) {
-            return;
+    //共享分片只在有到期的定时器时才加锁
+    Shard* shared = m_shards.back();
+    if(shared->next <= now_ms || now_ms + 60 * 60 * 1000 < shared->previousTime) {
+        Mutex::Lock lock(shared->mutex);
+        listExpiredCbs(shared, now_ms, cbs);
     }
+}
+
+void TimerManager::listExpiredCbs(Shard* shard, uint64_t now_ms, std::vector<std::function<void()> >& cbs) {
     //如果服务器时间延后，则当前所有的定时器都已超时
-    bool rollover = detectClockRollover(now_ms);
-    if(!rollover && ((*m_timers.begin())->m_next > now_ms)) {
+    bool rollover = detectClockRollover(shard, now_ms);
+    if(!rollover && shard->next > now_ms) {
         return;
     }
-    Timer::ptr now_timer(new Timer(now_ms));
-    auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-    //找到执行时刻<=now_ms的所有定时器，这些定时器已经超时，需要手动触发执行它们
-    while(it != m_timers.end() && (*it)->m_next == now_ms) {
-        ++it;
-    }
-    expired.insert(expired.begin(), m_timers.begin(), it);
-    m_timers.erase(m_timers.begin(), it);   //删除超时的定时器
-    cbs.reserve(expired.size());
+    //一次取出所有执行时刻<=now_ms的定时器，这些定时器已经超时，需要手动触发执行它们
+    std::vector<Timer::ptr>& expired = shard->expired;
+    shard->timers->popExpired(now_ms, rollover, expired);
+    cbs.reserve(cbs.size() + expired.size());
 
     for(auto& timer : expired) {
-        cbs.push_back(timer->m_cb);
-        if(timer->m_isRecur) {
+        SpinLock::Lock lock(timer->m_mutex);
+        timer->m_queued = false;
+        if(!timer->m_cb) {
+            //已被其他线程取消，邮箱里的消息处理时什么也不用做
+        } else if(!rollover && timer->m_next > now_ms) {
+            //已被其他线程推后
+            requeue(shard, timer);
+        } else if(timer->m_isRecur) {
+            cbs.push_back(timer->m_cb);
             timer->m_next = now_ms + timer->m_ms;
-            m_timers.insert(timer);
+            requeue(shard, timer);
         } else {
+            cbs.push_back(std::move(timer->m_cb));
             timer->m_cb = nullptr;
+            --m_timerCount;
         }
     }
+    expired.clear();
+    shard->next = shard->timers->nextTime();
 }
 
 bool TimerManager::hasTimer() {
-    RWMutexType::RdLock lock(m_mutex);
-    return !m_timers.empty();
+    return m_timerCount > 0;
 }
 
-}   
\ No newline at end of file
+}
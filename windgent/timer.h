@@ -6,15 +6,20 @@
 #include <iostream>
 #include <memory>
 #include <functional>
-#include <set>
 #include <vector>
+#include <atomic>
 
 namespace windgent {
 
 class TimerManager;
+class TimerQueue;
+class TimerSet;
+class TimerWheel;
 //定时器类
 class Timer : public std::enable_shared_from_this<Timer> {
     friend class TimerManager;
+    friend class TimerSet;
+    friend class TimerWheel;
 public:
     typedef std::shared_ptr<Timer> ptr;
     //取消定时器
@@ -23,28 +28,50 @@ public:
     bool refresh();
     //重置定时器
     bool reset(uint64_t ms, bool from_now);
+    //重新启用已执行完或已取消的一次性定时器，复用定时器对象，用于频繁设置超时的场景。定时器仍有效时返回false
+    //cb应足够小（如只捕获几个指针或整数），这样std::function不会在堆上分配内存
+    bool rearm(uint64_t ms, std::function<void()> cb);
+    TimerManager* getManager() const { return m_manager; }
 private:
     Timer(uint64_t ms, std::function<void()> cb, bool isRecur, TimerManager* manager);
-    Timer(uint64_t next);   //为了便于根据m_next查找
 private:
     bool m_isRecur = false;             //是否是循环定时器
     uint64_t m_ms = 0;                  //执行周期
     uint64_t m_next = 0;                //精确的执行时间，用于什么时候超时
     std::function<void()> m_cb;         //回调函数
     TimerManager* m_manager = nullptr;  //定时器所属的TimeManager
+    SpinLock m_mutex;                   //保护m_ms、m_next、m_cb，任意线程都可能修改它们
+
+    //以下只由定时器所属分片的线程访问
+    int m_shard = 0;                    //定时器所属的分片
+    bool m_queued = false;              //是否在分片的容器中
+    uint64_t m_queuedNext = 0;          //放入容器时的执行时刻，容器按它排序
+    //时间轮的侵入式链表，插入和删除都是O(1)。定时器挂在时间轮上时，由m_wheelRef保持自身不被释放
+    Timer* m_wheelNext = nullptr;
+    Timer** m_wheelPprev = nullptr;
+    Timer::ptr m_wheelRef;
+
+    //其他线程修改定时器后，把它投递到所属分片的邮箱里，由分片的线程调整容器
+    Timer* m_mailNext = nullptr;
+    Timer::ptr m_mailRef;
+    std::atomic<bool> m_inMail = {false};
 private:
     struct Comparator {
         bool operator()(const Timer::ptr& lhs, const Timer::ptr& rhs);
     };
 };
 
-//定时器管理类，使用set来管理
+//定时器管理类。定时器容器由配置timer.backend选择：wheel为分层时间轮（默认），插入和取消都是O(1)；set为按执行时刻排序的std::set。
+//定时器按线程分片：每个工作线程（由getTimerShard()给出编号）独占一个分片，在本线程添加、取消定时器以及取出到期的定时器都不加锁；
+//其他线程对定时器的取消、刷新、重置通过分片的无锁邮箱交给所属线程处理。非工作线程添加的定时器放在一个共享分片里，由互斥锁保护，
+//只有它有到期的定时器时，工作线程才会去加锁
 class TimerManager {
     friend class Timer;
 public:
     typedef RWMutex RWMutexType;
 
-    TimerManager();
+    //shards为工作线程的分片数，另外还有一个共享分片
+    TimerManager(size_t shards = 0);
     virtual ~TimerManager();
 
     Timer::ptr addTimer(uint64_t ms, std::function<void()> cb, bool isRecur = false);
@@ -52,9 +79,9 @@ public:
     Timer::ptr addCondTimer(uint64_t ms, std::function<void()> cb
                             , std::weak_ptr<void> weak_cond, bool isRecur = false);
 
-    //获取到下一定时器执行要等待的时间
+    //获取当前线程到下一定时器执行要等待的时间，只读原子变量，不加锁
     uint64_t getTimeOfNextTimer();
-    //获取所有超时的定时器的回调函数，从而创建出协程来schedule
+    //获取当前线程的分片和共享分片中所有超时的定时器的回调函数，从而创建出协程来schedule
     void listExpiredCbs(std::vector<std::function<void()> >& cbs);
     //是否有定时器任务
     bool hasTimer();
@@ -62,17 +89,37 @@ protected:
     //如果有新的定时器插入到首部时，表示这个定时器任务很快就会执行，此时应主动将IOManager从epoll_wait中唤醒来执行此任务
     //因为epoll_wait等待的时间TIMEOUT可能太长
     virtual void onTimerInsertedAtFront() = 0;
-    //添加定时器，供上层调用
-    void addTimer(Timer::ptr timer, RWMutexType::WrLock& lock);
+    //定时器的修改投递到了分片shard的邮箱，所属线程可能正按更晚的时刻睡眠，默认按onTimerInsertedAtFront处理
+    virtual void onTimerMailed(int shard) { onTimerInsertedAtFront(); }
+    //当前线程对应的分片编号，不是工作线程时返回-1
+    virtual int getTimerShard() { return -1; }
 private:
+    struct Shard {
+        Shard(TimerQueue* q, uint64_t now_ms);
+        ~Shard();
+
+        TimerQueue* timers;                     //定时器容器
+        std::atomic<uint64_t> next;             //最早执行时刻的下界，~0ull表示没有定时器
+        std::atomic<Timer*> mailbox = {nullptr};//其他线程投递来的定时器
+        std::atomic<uint64_t> previousTime;     //上次取到期定时器的时刻，用于检测时间回拨
+        std::vector<Timer::ptr> expired;        //复用的到期定时器列表
+        Mutex mutex;                            //只有共享分片使用
+    };
+    //在所属分片上使定时器的修改生效，能直接操作分片时返回true，否则投递到邮箱并返回false
+    bool commit(const Timer::ptr& timer);
+    //按定时器的当前状态调整它在容器中的位置，调用者需能独占分片并持有定时器的锁
+    void requeue(Shard* shard, const Timer::ptr& timer);
+    //处理邮箱中的定时器
+    void drainMailbox(Shard* shard);
+    //取出分片中到期的定时器
+    void listExpiredCbs(Shard* shard, uint64_t now_ms, std::vector<std::function<void()> >& cbs);
     //检测服务器时间是否延后
-    bool detectClockRollover(uint64_t now_ms);
+    bool detectClockRollover(Shard* shard, uint64_t now_ms);
+    //getTimerShard()的结果对应的分片下标，非工作线程对应共享分片
+    int getShardIndex(int idx) const { return idx >= 0 && idx < (int)m_shards.size() - 1 ? idx : m_shards.size() - 1; }
 private:
-    RWMutexType m_mutex;
-    std::set<Timer::ptr, Timer::Comparator> m_timers;
-    //是否触发onTimerInsertedAtFront,因为可能发生频繁修改
-    bool m_tickled = false;
-    uint64_t m_previouseTime = 0;
+    std::vector<Shard*> m_shards;               //工作线程的分片，最后一个为共享分片
+    std::atomic<size_t> m_timerCount = {0};     //还未取消也未执行完的定时器总数
 };
 
 }
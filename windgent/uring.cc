@@ -0,0 +1,197 @@
+#include "./uring.h"
+
+#ifdef WINDGENT_IO_URING
+
+#include "./log.h"
+
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <algorithm>
+
+namespace windgent {
+
+static windgent::Logger::ptr g_logger = LOG_NAME("system");
+
+static int io_uring_setup(uint32_t entries, io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags
+                          , const void* arg, size_t argsz) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int io_uring_register(int fd, uint32_t opcode, void* arg, uint32_t nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+IoUring::IoUring() {
+}
+
+IoUring::~IoUring() {
+    if(m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if(m_cqRing && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if(m_sqRing) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if(m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool IoUring::init(uint32_t entries) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    m_fd = io_uring_setup(entries, &p);
+    if(m_fd < 0) {
+        LOG_ERROR(g_logger) << "io_uring_setup(" << entries << ") errno=" << errno << " " << strerror(errno);
+        return false;
+    }
+
+    m_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    m_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    //新内核中提交队列和完成队列在同一块映射里
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single) {
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE
+                    , MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if(m_sqRing == MAP_FAILED) {
+        m_sqRing = nullptr;
+        return false;
+    }
+    if(single) {
+        m_cqRing = m_sqRing;
+    } else {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE
+                        , MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if(m_cqRing == MAP_FAILED) {
+            m_cqRing = nullptr;
+            return false;
+        }
+    }
+    m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe*)mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE
+                                 , MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if(m_sqes == MAP_FAILED) {
+        m_sqes = nullptr;
+        return false;
+    }
+
+    char* sq = (char*)m_sqRing;
+    m_sqHead = (uint32_t*)(sq + p.sq_off.head);
+    m_sqTail = (uint32_t*)(sq + p.sq_off.tail);
+    m_sqMask = *(uint32_t*)(sq + p.sq_off.ring_mask);
+    m_sqEntries = *(uint32_t*)(sq + p.sq_off.ring_entries);
+    m_sqeTail = *m_sqTail;
+    //sqe总是按顺序使用，下标数组固定为恒等映射
+    uint32_t* array = (uint32_t*)(sq + p.sq_off.array);
+    for(uint32_t i = 0; i < m_sqEntries; ++i) {
+        array[i] = i;
+    }
+
+    char* cq = (char*)m_cqRing;
+    m_cqHead = (uint32_t*)(cq + p.cq_off.head);
+    m_cqTail = (uint32_t*)(cq + p.cq_off.tail);
+    m_cqMask = *(uint32_t*)(cq + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+bool IoUring::reserve(uint32_t n) {
+    while(m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) + n > m_sqEntries) {
+        publish();
+        if(submit() < 0 && errno != EBUSY && errno != EAGAIN && errno != EINTR) {
+            LOG_ERROR(g_logger) << "io_uring submit errno=" << errno << " " << strerror(errno);
+            return false;
+        }
+    }
+    return true;
+}
+
+io_uring_sqe* IoUring::getSqe() {
+    if(!reserve(1)) {
+        return nullptr;
+    }
+    io_uring_sqe* sqe = &m_sqes[m_sqeTail & m_sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    ++m_sqeTail;
+    return sqe;
+}
+
+void IoUring::publish() {
+    __atomic_store_n(m_sqTail, m_sqeTail, __ATOMIC_RELEASE);
+}
+
+int IoUring::submit() {
+    //内核只会取到已发布的sqe，to_submit给上限即可
+    int ret = 0;
+    do {
+        ret = io_uring_enter(m_fd, m_sqEntries, 0, 0, nullptr, 0);
+    } while(ret < 0 && errno == EINTR);
+    return ret;
+}
+
+int IoUring::submitAndWait(uint64_t timeout_ms) {
+    //提交的个数少于to_submit时内核不会等待，必须给出准确的已发布个数
+    uint32_t to_submit = __atomic_load_n(m_sqTail, __ATOMIC_ACQUIRE) - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)&ts;
+    return io_uring_enter(m_fd, to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG
+                          , &arg, sizeof(arg));
+}
+
+bool IoUring::IsSupported() {
+    static int s_supported = -1;
+    if(s_supported >= 0) {
+        return s_supported;
+    }
+    s_supported = 0;
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = io_uring_setup(4, &p);
+    if(fd < 0) {
+        LOG_WARN(g_logger) << "io_uring not available, errno=" << errno << " " << strerror(errno);
+        return false;
+    }
+    //带超时的等待需要EXT_ARG，完成事件不丢失需要NODROP
+    if(!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP)) {
+        LOG_WARN(g_logger) << "io_uring lacks required features, features=" << p.features;
+        close(fd);
+        return false;
+    }
+    const int ops[] = {IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE, IORING_OP_ASYNC_CANCEL
+                       , IORING_OP_LINK_TIMEOUT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READV
+                       , IORING_OP_WRITEV, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_RECVMSG
+                       , IORING_OP_SENDMSG, IORING_OP_ACCEPT, IORING_OP_CONNECT};
+    size_t len = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+    io_uring_probe* probe = (io_uring_probe*)calloc(1, len);
+    bool ok = io_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for(size_t i = 0; ok && i < sizeof(ops) / sizeof(ops[0]); ++i) {
+        if(ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+            LOG_WARN(g_logger) << "io_uring op " << ops[i] << " not supported";
+            ok = false;
+        }
+    }
+    free(probe);
+    close(fd);
+    s_supported = ok;
+    return ok;
+}
+
+}
+
+#endif
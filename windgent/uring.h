@@ -0,0 +1,99 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include "./mutex.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+//内核头文件足够新时才编译io_uring后端，定义WINDGENT_NO_IO_URING可以关闭
+#if !defined(WINDGENT_NO_IO_URING) && defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_FEAT_EXT_ARG) && defined(IORING_POLL_ADD_MULTI)
+#define WINDGENT_IO_URING 1
+#endif
+#endif
+#endif
+
+#ifdef WINDGENT_IO_URING
+
+namespace windgent {
+
+//不依赖liburing，直接用系统调用和共享内存操作一个io_uring实例。
+//提交队列可以被多个线程写入，由m_mutex保护；完成队列只由所属的线程读取
+class IoUring : NonCopyable {
+public:
+    typedef SpinLock MutexType;
+
+    IoUring();
+    ~IoUring();
+
+    //创建io_uring实例并映射队列，失败返回false
+    bool init(uint32_t entries);
+
+    //保证提交队列中至少有n个空闲的sqe，不够时先把已发布的提交给内核，调用者需持有getMutex()
+    bool reserve(uint32_t n);
+    //取一个空闲的sqe并清零，调用者需持有getMutex()。提交队列满时先提交给内核
+    io_uring_sqe* getSqe();
+    //让已填写的sqe对内核可见，调用者需持有getMutex()
+    void publish();
+    //把已发布的sqe提交给内核
+    int submit();
+    //提交已发布的sqe，并等待至少一个完成事件，最多等待timeout_ms毫秒
+    int submitAndWait(uint64_t timeout_ms);
+
+    //依次处理完成队列中的事件，返回处理的个数
+    template<class F>
+    size_t reap(F f) {
+        uint32_t head = *m_cqHead;
+        uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        size_t n = 0;
+        while(head != tail) {
+            f(m_cqes[head & m_cqMask]);
+            ++head;
+            ++n;
+            //处理过程中可能有新的完成事件
+            if(head == tail) {
+                __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+                tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+            }
+        }
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    //已发布还未提交给内核的sqe个数
+    uint32_t pending() const { return m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE); }
+    MutexType& getMutex() { return m_mutex; }
+
+    //内核是否支持IOManager用到的io_uring特性，只检测一次
+    static bool IsSupported();
+private:
+    int m_fd = -1;
+    MutexType m_mutex;
+
+    void* m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    void* m_cqRing = nullptr;
+    size_t m_cqRingSize = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    uint32_t* m_sqHead = nullptr;
+    uint32_t* m_sqTail = nullptr;
+    uint32_t m_sqMask = 0;
+    uint32_t m_sqEntries = 0;
+    uint32_t m_sqeTail = 0;         //已取出的sqe的尾部，publish后对内核可见
+
+    uint32_t* m_cqHead = nullptr;
+    uint32_t* m_cqTail = nullptr;
+    uint32_t m_cqMask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+};
+
+}
+
+#endif
+
+#endif